@@ -0,0 +1,135 @@
+/*
+ * admission_controller.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_ADMISSION_CONTROLLER_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_ADMISSION_CONTROLLER_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The key in a job's metadata that is added when a search wasn't
+ * run in full because the service was overloaded.
+ */
+#define AC_ADMISSION_S "admission"
+
+/**
+ * The value for AC_ADMISSION_S when only Lucene was searched.
+ */
+#define AC_LOCAL_ONLY_S "local_only"
+
+/**
+ * The value for AC_ADMISSION_S when the search wasn't run at all.
+ */
+#define AC_REJECTED_S "rejected"
+
+
+typedef enum
+{
+	/** Run the search as normal. */
+	AD_ADMITTED,
+
+	/** Run the search against Lucene but not CKAN or Zenodo. */
+	AD_LOCAL_ONLY,
+
+	/** Don't run the search. */
+	AD_REJECTED
+} AdmissionDecision;
+
+
+/**
+ * A limit on the number of searches that run at once.
+ *
+ * The limit adapts to the observed latency: it grows by one for each
+ * limit's worth of searches that finish within the target latency while
+ * the limit is in use and shrinks by a tenth, at most once per target
+ * latency, when they don't. Searches that arrive when the limit is
+ * reached wait in a bounded queue for a slot.
+ *
+ * The slots are shared between users with start-time fair queuing.
+ * Each user has a weight and each search costs the inverse of its
+ * user's weight in virtual time, so when searches are waiting, the
+ * slots go to the users that have had the smallest share of them for
+ * their weight rather than to whoever sent the most searches. Users
+ * can also be limited in the number of searches that they can have
+ * running and waiting at once.
+ */
+typedef struct AdmissionController AdmissionController;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create an AdmissionController.
+ *
+ * @param min_limit The lowest that the limit can shrink to.
+ * @param max_limit The highest that the limit can grow to. The limit starts here.
+ * @param max_queue The maximum number of searches that can wait for a slot.
+ * @param queue_timeout The number of milliseconds that a search can wait for a slot.
+ * @param target_latency The number of milliseconds that a search should take.
+ * @param local_only_flag If this is <code>true</code> then searches that can't
+ * get a slot are run against Lucene only. If it is <code>false</code> they are
+ * rejected.
+ * @param default_weight The weight of the users that aren't in users_p.
+ * @param max_running_per_user The maximum number of searches that each user
+ * can have running at once or 0 for no limit.
+ * @param max_waiting_per_user The maximum number of searches that each user
+ * can have waiting for a slot at once or 0 for no limit.
+ * @param users_p An optional object keyed by user with objects that have
+ * "weight" and "max_concurrent" keys to override the defaults for that user.
+ * This is copied. This can be <code>NULL</code>.
+ * @return The new AdmissionController or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL AdmissionController *AllocateAdmissionController (const uint32 min_limit, const uint32 max_limit, const uint32 max_queue, const uint32 queue_timeout, const uint32 target_latency, const bool local_only_flag, const uint32 default_weight, const uint32 max_running_per_user, const uint32 max_waiting_per_user, const json_t *users_p);
+
+
+SEARCH_SERVICE_LOCAL void FreeAdmissionController (AdmissionController *controller_p);
+
+
+/**
+ * Decide whether to run a search, waiting for a slot if needed.
+ *
+ * @param controller_p The AdmissionController.
+ * @param user_s The user or API key that the search is for. If this is
+ * <code>NULL</code> then the search is counted with the other anonymous ones.
+ * @return The decision. If this is AD_ADMITTED then FinishSearch () must be
+ * called once the search has finished.
+ */
+SEARCH_SERVICE_LOCAL AdmissionDecision AdmitSearch (AdmissionController *controller_p, const char *user_s);
+
+
+/**
+ * Free the slot of an admitted search and adapt the limit.
+ *
+ * @param controller_p The AdmissionController.
+ * @param user_s The same user that was passed to AdmitSearch ().
+ * @param latency The number of milliseconds that the search took.
+ */
+SEARCH_SERVICE_LOCAL void FinishSearch (AdmissionController *controller_p, const char *user_s, const uint64 latency);
+
+
+/**
+ * Get the current time in milliseconds for measuring latencies.
+ *
+ * @return The time on a clock that only goes forwards.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetAdmissionTime (void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_ADMISSION_CONTROLLER_H_ */
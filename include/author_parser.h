@@ -0,0 +1,73 @@
+/*
+ * author_parser.h
+ *
+ *  Created on: 12 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_AUTHOR_PARSER_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_AUTHOR_PARSER_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+
+
+/**
+ * The key for the "; "-separated author names in a search result.
+ */
+#define AP_AUTHOR_S "author"
+
+
+/**
+ * The key for the optional array of individual author names in a search result.
+ */
+#define AP_AUTHORS_LIST_S "authors"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Set the author details for a search result from a string value.
+ *
+ * Some CKAN plugins store the authors as a serialised JSON array of
+ * objects each with a "name" key, whereas others just store a plain string.
+ * The value is scanned once without building a JSON tree and if it is
+ * an array, the names are written as a single "; "-separated string.
+ * Anything else is set verbatim.
+ *
+ * @param result_p The search result to add the authors to.
+ * @param authors_s The raw author value.
+ * @param list_flag If <code>true</code> then the individual names will also
+ * be added to the result as an array. A plain string is added as an array
+ * with just that string, or an empty array if the string is empty.
+ * @return <code>true</code> if the authors were added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool AddAuthorsFromString (json_t *result_p, const char *authors_s, const bool list_flag);
+
+
+/**
+ * Set the author details for a search result from a JSON array of
+ * objects each with a "name" key.
+ *
+ * @param result_p The search result to add the authors to.
+ * @param authors_p The JSON array of authors.
+ * @param list_flag If <code>true</code> then the individual names will also
+ * be added to the result as an array.
+ * @return <code>true</code> if the authors were added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool AddAuthorsFromJSON (json_t *result_p, const json_t *authors_p, const bool list_flag);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_AUTHOR_PARSER_H_ */
@@ -0,0 +1,155 @@
+/*
+ * cache_invalidator.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_CACHE_INVALIDATOR_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_CACHE_INVALIDATOR_H_
+
+#include "search_service_library.h"
+#include "lucene_result_cache.h"
+#include "negative_query_cache.h"
+#include "typedefs.h"
+
+
+/**
+ * The ways that the documents in the Lucene index can change.
+ */
+typedef enum
+{
+	/** New documents were added. */
+	IC_INDEXED,
+
+	/** Existing documents were changed. */
+	IC_UPDATED,
+
+	/** Documents were removed. */
+	IC_DELETED
+} IndexChange;
+
+
+/**
+ * Receives the changes that the Grassroots indexing pipeline makes to
+ * the Lucene index and removes only the cached results that they affect.
+ *
+ * The changes arrive as JSON datagrams on a local socket such as
+ *
+ * <code>{ "change": "update", "types": [ "Field Trial", "Study" ] }</code>
+ *
+ * where "change" is one of "index", "update" or "delete" and "types" are
+ * the facets of the documents that changed. Without "types", every type
+ * is treated as changed.
+ *
+ * Rather than reading the generation from the index directory, the caches
+ * then use the generations kept here. The Lucene result pages for the
+ * changed types are removed straight away. The empty Lucene queries are
+ * only forgotten when documents are indexed or updated, since deleting
+ * documents can't give an empty query any hits.
+ *
+ * Each process has a single listener on the socket which passes every
+ * change on to all of the CacheInvalidators, so any number of them can
+ * share the same path. If the socket is later removed or replaced, the
+ * CacheInvalidators stop listening, the Lucene result pages and empty
+ * Lucene queries are forgotten and the caches go back to being cleared
+ * whenever the index generation changes.
+ */
+typedef struct CacheInvalidator CacheInvalidator;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a CacheInvalidator and register it with this process's listener,
+ * starting the listener if this is the first one.
+ *
+ * @param socket_path_s The path of the local socket to listen on. If the
+ * listener is already running, this must be the path that it uses. A file
+ * left at this path by a previous run is replaced, but if another process
+ * is already listening on it this fails.
+ * @param lucene_cache_p The LuceneResultCache to remove pages from. This must
+ * stay valid until FreeCacheInvalidator () is called. This can be <code>NULL</code>.
+ * @param negative_cache_p The NegativeQueryCache whose Lucene queries are
+ * forgotten if the socket is lost. This must stay valid until
+ * FreeCacheInvalidator () is called. This can be <code>NULL</code>.
+ * @return The new CacheInvalidator or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL CacheInvalidator *AllocateCacheInvalidator (const char *socket_path_s, LuceneResultCache *lucene_cache_p, NegativeQueryCache *negative_cache_p);
+
+
+/**
+ * Unregister and free the CacheInvalidator. Once the last one has been
+ * freed, the listener stops and the socket is removed if it is still the
+ * one that the listener bound.
+ *
+ * @param invalidator_p The CacheInvalidator to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeCacheInvalidator (CacheInvalidator *invalidator_p);
+
+
+/**
+ * Apply a change to the caches. This is what each notification on the
+ * socket is turned into and it can also be called directly from within
+ * the server.
+ *
+ * @param invalidator_p The CacheInvalidator.
+ * @param change The way that the documents changed.
+ * @param type_s The facet of the documents that changed or <code>NULL</code>
+ * if any type could have changed.
+ */
+SEARCH_SERVICE_LOCAL void NotifyIndexChange (CacheInvalidator *invalidator_p, const IndexChange change, const char *type_s);
+
+
+/**
+ * Check whether the changes are still being received.
+ *
+ * @param invalidator_p The CacheInvalidator.
+ * @return <code>true</code> if they are, <code>false</code> if the socket
+ * has been lost and the index generation should be used instead.
+ */
+SEARCH_SERVICE_LOCAL bool IsCacheInvalidatorListening (const CacheInvalidator *invalidator_p);
+
+
+/**
+ * Once the socket has been lost, turn a generation read from the index
+ * directory into one that the caches can use. The generations that the
+ * caches have already seen are notified ones, so these start after them.
+ *
+ * @param invalidator_p The CacheInvalidator.
+ * @param index_generation The generation from the index directory.
+ * @return The generation for the caches or 0 if index_generation is 0.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetFallbackIndexGeneration (const CacheInvalidator *invalidator_p, const uint64 index_generation);
+
+
+/**
+ * Get the generation to use for the Lucene result pages. This changes with
+ * every notification.
+ *
+ * @param invalidator_p The CacheInvalidator.
+ * @return The generation.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetNotifiedResultsGeneration (const CacheInvalidator *invalidator_p);
+
+
+/**
+ * Get the generation to use for the empty Lucene queries. This only
+ * changes when documents are indexed or updated.
+ *
+ * @param invalidator_p The CacheInvalidator.
+ * @return The generation.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetNotifiedEmptyQueriesGeneration (const CacheInvalidator *invalidator_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_CACHE_INVALIDATOR_H_ */
@@ -0,0 +1,89 @@
+/*
+ * disk_result_cache.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_DISK_RESULT_CACHE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_DISK_RESULT_CACHE_H_
+
+#include <time.h>
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "external_fetch.h"
+#include "typedefs.h"
+
+
+/**
+ * An append-only file of CKAN and Zenodo responses keyed by their
+ * request addresses, used as a second tier behind an ExternalResultCache.
+ *
+ * Only the index of the file is kept in memory, so it can hold far more
+ * responses than the memory cache and they survive a restart. Each write
+ * is appended in a single call, so the file can be shared by several
+ * processes. The responses written by the others are picked up when a
+ * lookup misses. Once the file grows beyond its maximum size, it is
+ * rewritten with just the most recent responses.
+ */
+typedef struct DiskResultCache DiskResultCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Open a DiskResultCache and read the index of any responses already in it.
+ *
+ * @param filename_s The file to use. This is created if needed.
+ * @param max_size The number of bytes that the file can grow to before
+ * it is compacted.
+ * @param max_age The number of seconds after being fetched that a response
+ * is no use to anyone and can be dropped.
+ * @return The new DiskResultCache or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL DiskResultCache *AllocateDiskResultCache (const char *filename_s, const uint64 max_size, const uint32 max_age);
+
+
+SEARCH_SERVICE_LOCAL void FreeDiskResultCache (DiskResultCache *cache_p);
+
+
+/**
+ * Get a response from a DiskResultCache.
+ *
+ * @param cache_p The DiskResultCache.
+ * @param url_s The address of the request.
+ * @param fetched_time_p If the response is found, this is set to the time that
+ * it was fetched from the portal.
+ * @param validators_p If the response is found, this is set to its validators.
+ * @return The response or <code>NULL</code> if it isn't in the cache.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetDiskResult (DiskResultCache *cache_p, const char *url_s, time_t *fetched_time_p, FetchValidators *validators_p);
+
+
+/**
+ * Append a response to a DiskResultCache.
+ *
+ * @param cache_p The DiskResultCache.
+ * @param url_s The address of the request.
+ * @param response_p The response.
+ * @param validators_p The response's validators.
+ * @param fetched_time The time that the response was fetched from, or last
+ * confirmed as current by, the portal.
+ * @return <code>true</code> if the response was added successfully, <code>false</code>
+ * otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool PutDiskResult (DiskResultCache *cache_p, const char *url_s, const json_t *response_p, const FetchValidators *validators_p, const time_t fetched_time);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_DISK_RESULT_CACHE_H_ */
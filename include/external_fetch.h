@@ -0,0 +1,119 @@
+/*
+ * external_fetch.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_EXTERNAL_FETCH_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_EXTERNAL_FETCH_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "search_trace.h"
+#include "typedefs.h"
+
+
+/**
+ * The settings and latency history for sending hedged requests to
+ * CKAN and Zenodo.
+ *
+ * The latencies of the recent requests to each portal are kept. If a
+ * request hasn't been answered by a given percentile of these, a
+ * duplicate is sent and whichever answers first is used while the
+ * other is cancelled. The number of duplicates is limited to a share
+ * of all requests so that the portals' load stays bounded.
+ */
+typedef struct HedgePolicy HedgePolicy;
+
+
+/**
+ * The validators of a portal's response. These are sent back to the
+ * portal to ask whether a cached copy of the response is still current,
+ * which saves downloading and parsing it again if it is.
+ */
+typedef struct FetchValidators
+{
+	/** The response's ETag header or <code>NULL</code>. */
+	char *fv_etag_s;
+
+	/** The response's Last-Modified header or <code>NULL</code>. */
+	char *fv_last_modified_s;
+} FetchValidators;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a HedgePolicy.
+ *
+ * @param percentile The percentile of a portal's recent latencies to wait for
+ * before sending a duplicate request.
+ * @param max_percent The maximum number of duplicate requests for each 100 requests.
+ * @param min_delay The minimum number of milliseconds to wait before sending
+ * a duplicate request.
+ * @return The new HedgePolicy or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL HedgePolicy *AllocateHedgePolicy (const uint32 percentile, const uint32 max_percent, const uint32 min_delay);
+
+
+/**
+ * Free a HedgePolicy. This waits for any requests that are still
+ * running, including the duplicates that lost, to finish first.
+ *
+ * @param policy_p The HedgePolicy to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeHedgePolicy (HedgePolicy *policy_p);
+
+
+/**
+ * Send a request to CKAN or Zenodo and parse its JSON response.
+ *
+ * @param policy_p The HedgePolicy to use. If this is <code>NULL</code>,
+ * a single request is sent.
+ * @param url_s The address of the request.
+ * @param validators_p If this is not <code>NULL</code>, any validators in it
+ * make the request conditional and afterwards it holds the validators of
+ * the response.
+ * @param not_modified_flag_p If this is not <code>NULL</code>, it is set to
+ * <code>true</code> if the portal said that the response matching the
+ * validators is still current, in which case <code>NULL</code> is returned,
+ * and <code>false</code> otherwise.
+ * @param trace_p The SearchTrace to add the phases of the request that was
+ * used to. This can be <code>NULL</code>.
+ * @return The response or <code>NULL</code> upon error or if the response
+ * has not been modified.
+ */
+SEARCH_SERVICE_LOCAL json_t *FetchExternalResponse (HedgePolicy *policy_p, const char *url_s, FetchValidators *validators_p, bool *not_modified_flag_p, SearchTrace *trace_p);
+
+
+/**
+ * Copy a set of validators.
+ *
+ * @param dest_p The FetchValidators to copy to. Any existing values are freed.
+ * @param src_p The FetchValidators to copy from.
+ * @return <code>true</code> if the validators were copied successfully,
+ * <code>false</code> otherwise in which case dest_p is left empty.
+ */
+SEARCH_SERVICE_LOCAL bool CopyFetchValidators (FetchValidators *dest_p, const FetchValidators *src_p);
+
+
+/**
+ * Free the values of a set of validators and reset them to <code>NULL</code>.
+ *
+ * @param validators_p The FetchValidators to clear.
+ */
+SEARCH_SERVICE_LOCAL void ClearFetchValidators (FetchValidators *validators_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_EXTERNAL_FETCH_H_ */
@@ -0,0 +1,90 @@
+/*
+ * external_result_cache.h
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_EXTERNAL_RESULT_CACHE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_EXTERNAL_RESULT_CACHE_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "disk_result_cache.h"
+#include "external_fetch.h"
+#include "typedefs.h"
+
+
+/**
+ * A cache of the raw responses from CKAN and Zenodo keyed by their
+ * request addresses.
+ *
+ * An entry is fresh for its time to live. After that it is stale
+ * but, for a grace period, it is still returned straight away while a
+ * background thread gets a new copy. If the portal can't be reached,
+ * a stale entry is returned rather than nothing for as long as the
+ * stale-if-error period allows.
+ *
+ * An optional DiskResultCache can sit behind the memory cache. Responses
+ * that aren't in memory are looked for there before asking the portal
+ * and every response fetched from a portal is added to it.
+ */
+typedef struct ExternalResultCache ExternalResultCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create an ExternalResultCache and start its refresh thread.
+ *
+ * @param max_entries The maximum number of responses to keep. Once this is
+ * reached, the least recently used response is removed.
+ * @param ttl The number of seconds that a response is fresh for.
+ * @param grace The number of seconds after a response has become stale that
+ * it can still be returned while it is refreshed in the background.
+ * @param stale_if_error The number of seconds after a response has become stale
+ * that it can still be returned if the portal can't be reached.
+ * @param disk_p The optional DiskResultCache to use as the second tier. If
+ * this is not <code>NULL</code>, the new ExternalResultCache takes ownership
+ * of it, but only once it has been created successfully.
+ * @return The new ExternalResultCache or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL ExternalResultCache *AllocateExternalResultCache (const uint32 max_entries, const uint32 ttl, const uint32 grace, const uint32 stale_if_error, DiskResultCache *disk_p);
+
+
+/**
+ * Stop the refresh thread of an ExternalResultCache and free it
+ * along with its DiskResultCache.
+ *
+ * @param cache_p The ExternalResultCache to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeExternalResultCache (ExternalResultCache *cache_p);
+
+
+/**
+ * Get the JSON response for a CKAN or Zenodo request.
+ *
+ * @param cache_p The ExternalResultCache to use. If this is <code>NULL</code>
+ * then the request is always sent to the portal.
+ * @param hedge_p The HedgePolicy for any request that is sent to the portal.
+ * This can be <code>NULL</code>.
+ * @param url_s The address of the request.
+ * @param trace_p The SearchTrace to record the lookup and any request in.
+ * This can be <code>NULL</code>.
+ * @return A new reference to the response which must not be altered
+ * or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetExternalResults (ExternalResultCache *cache_p, HedgePolicy *hedge_p, const char *url_s, SearchTrace *trace_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_EXTERNAL_RESULT_CACHE_H_ */
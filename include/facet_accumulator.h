@@ -0,0 +1,118 @@
+/*
+ * facet_accumulator.h
+ *
+ *  Created on: 13 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_FACET_ACCUMULATOR_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_FACET_ACCUMULATOR_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "lucene_tool.h"
+
+
+/**
+ * The set of facet names known from the service configuration. Each
+ * name is given a fixed index so that counts for it can be kept in
+ * a plain array. The names are not copied and belong to the
+ * configuration that they were taken from.
+ */
+typedef struct FacetKeys
+{
+	const char **fk_names_ss;
+	uint32 fk_num_names;
+	uint32 fk_capacity;
+} FacetKeys;
+
+
+/**
+ * The facet counts for a single search. Any number of threads can
+ * increment the counts for the interned facet keys at the same time
+ * without taking a lock. Counts for names that aren't in the FacetKeys
+ * are kept in a separate list that is guarded by a mutex.
+ */
+typedef struct FacetAccumulator FacetAccumulator;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+SEARCH_SERVICE_LOCAL FacetKeys *AllocateFacetKeys (void);
+
+SEARCH_SERVICE_LOCAL void FreeFacetKeys (FacetKeys *keys_p);
+
+
+/**
+ * Add a facet name to a FacetKeys if it isn't already there.
+ *
+ * @param keys_p The FacetKeys to add the name to.
+ * @param name_s The facet name. This is not copied.
+ * @return <code>true</code> if the name is in the FacetKeys upon return,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool InternFacetKey (FacetKeys *keys_p, const char *name_s);
+
+
+/**
+ * Add the descriptions of each of the values in a mappings object
+ * from the CKAN or Zenodo configuration to a FacetKeys.
+ *
+ * @param keys_p The FacetKeys to add the names to.
+ * @param mappings_p The mappings object.
+ * @return <code>true</code> if all of the names were added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool InternFacetKeysFromMappings (FacetKeys *keys_p, const json_t *mappings_p);
+
+
+/**
+ * Allocate a FacetAccumulator for a search.
+ *
+ * @param keys_p The interned facet names. This must remain valid for
+ * the lifetime of the FacetAccumulator.
+ * @return The new FacetAccumulator or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL FacetAccumulator *AllocateFacetAccumulator (const FacetKeys *keys_p);
+
+SEARCH_SERVICE_LOCAL void FreeFacetAccumulator (FacetAccumulator *accumulator_p);
+
+
+/**
+ * Increase the count for a facet. This is safe to call from
+ * several threads at once.
+ *
+ * @param accumulator_p The FacetAccumulator to update. If this is
+ * <code>NULL</code> then nothing is counted.
+ * @param name_s The facet name.
+ * @param count The amount to add.
+ * @return <code>true</code> if the count was updated successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool IncrementFacetAccumulator (FacetAccumulator *accumulator_p, const char *name_s, const uint32 count);
+
+
+/**
+ * Add all of the non-zero facet counts to a LuceneTool. This should be
+ * called once, after all of the producers have finished, and before
+ * AddLuceneFacetResultsToJSON ().
+ *
+ * @param accumulator_p The FacetAccumulator to get the counts from.
+ * @param lucene_p The LuceneTool to add the counts to.
+ * @return <code>true</code> if all of the counts were added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool FlushFacetAccumulatorToLucene (const FacetAccumulator *accumulator_p, LuceneTool *lucene_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_FACET_ACCUMULATOR_H_ */
@@ -0,0 +1,88 @@
+/*
+ * hit_converter.h
+ *
+ *  Created on: 12 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_HIT_CONVERTER_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_HIT_CONVERTER_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "facet_accumulator.h"
+#include "result_projection.h"
+
+
+struct SearchConfig;
+
+
+/**
+ * A function to convert a single hit from an external search
+ * engine into a Grassroots search result.
+ *
+ * @param hit_p The external hit.
+ * @param facets_p The facet counts to increment for the hit. This may
+ * be shared with other threads converting hits at the same time.
+ * @param projection_p The fields to include in the result.
+ * @param config_p The configuration snapshot for the search.
+ * @return The newly-allocated Grassroots result or <code>NULL</code>
+ * upon error.
+ */
+typedef json_t *(*ConvertHitFn) (const json_t *hit_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const struct SearchConfig *config_p);
+
+
+/**
+ * A pool of worker threads for converting large arrays of hits.
+ */
+typedef struct ConversionPool ConversionPool;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a pool of threads for converting hits.
+ *
+ * @param num_threads The number of worker threads.
+ * @return The new ConversionPool or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL ConversionPool *AllocateConversionPool (const uint32 num_threads);
+
+
+/**
+ * Stop the threads of a ConversionPool and free it.
+ *
+ * @param pool_p The ConversionPool to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeConversionPool (ConversionPool *pool_p);
+
+
+/**
+ * Convert an array of external hits into Grassroots results.
+ *
+ * If the service has a ConversionPool and there are enough hits, they are
+ * split into chunks that are converted in parallel. The results are returned
+ * in the same order as the hits.
+ *
+ * @param hits_p The JSON array of external hits.
+ * @param convert_fn The function used to convert each hit.
+ * @param facets_p The FacetAccumulator to add the facet counts to.
+ * @param projection_p The fields to include in each result.
+ * @param config_p The configuration snapshot for the search.
+ * @return The newly-allocated JSON array of results or <code>NULL</code>
+ * upon error.
+ */
+SEARCH_SERVICE_LOCAL json_t *ConvertHits (const json_t *hits_p, ConvertHitFn convert_fn, FacetAccumulator *facets_p, const ResultProjection *projection_p, const struct SearchConfig *config_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_HIT_CONVERTER_H_ */
@@ -0,0 +1,37 @@
+/*
+ * lucene_index_generation.h
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_INDEX_GENERATION_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_INDEX_GENERATION_H_
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the generation of a Lucene index. Every commit to the index
+ * writes a new segments_N file, where N is the generation in base 36,
+ * so anything worked out from the index can be kept until this changes.
+ *
+ * @param index_dir_s The Lucene index directory.
+ * @return The generation or 0 if it could not be found.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetLuceneIndexGeneration (const char *index_dir_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_INDEX_GENERATION_H_ */
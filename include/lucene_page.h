@@ -0,0 +1,114 @@
+/*
+ * lucene_page.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_PAGE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_PAGE_H_
+
+#include "jansson.h"
+
+#include "lucene_result_cache.h"
+#include "operation.h"
+#include "search_cursor.h"
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The functions that ServeLucenePage () calls to add a page of Lucene
+ * hits to the results of a search.
+ */
+typedef struct LucenePageSource
+{
+	/**
+	 * Add the hits from a page that was in the cache.
+	 *
+	 * @param page_p The page from GetCachedLucenePage ().
+	 * @param from The index of the first hit on the page.
+	 * @param data_p The LucenePageSource's data.
+	 * @return The status of adding the hits.
+	 */
+	OperationStatus (*lps_add_cached_hits_fn) (const json_t *page_p, const uint32 from, void *data_p);
+
+	/**
+	 * Add the hits for the page from the index, which has already been
+	 * searched.
+	 *
+	 * @param from The index of the first hit on the page.
+	 * @param to The index of the last hit on the page.
+	 * @param page_pp If this is not <code>NULL</code>, the page can be cached
+	 * and this should be set to a new page in the same form as
+	 * GetCachedLucenePage () returns, or left as <code>NULL</code> if the
+	 * page is incomplete.
+	 * @param data_p The LucenePageSource's data.
+	 * @return The status of adding the hits.
+	 */
+	OperationStatus (*lps_add_searched_hits_fn) (const uint32 from, const uint32 to, json_t **page_pp, void *data_p);
+
+	/**
+	 * Get the total number of hits for the query, either from the search
+	 * or as restored from a cached page.
+	 *
+	 * @param data_p The LucenePageSource's data.
+	 * @return The total number of hits.
+	 */
+	uint32 (*lps_get_num_total_hits_fn) (void *data_p);
+
+	/** The data passed to each of the functions. */
+	void *lps_data_p;
+} LucenePageSource;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the page of Lucene hits that a SearchCursor is on from the cache.
+ *
+ * @param cache_p The LuceneResultCache. This can be <code>NULL</code>.
+ * @param query_s The query.
+ * @param facet_s The facet that the query is restricted to. This can be
+ * <code>NULL</code>.
+ * @param cursor_p The SearchCursor.
+ * @param generation The generation of the results, or 0 if it is unknown
+ * in which case nothing is cached.
+ * @return A new copy of the page which the caller must json_decref () or
+ * <code>NULL</code> if it isn't in the cache or if the cursor has run out
+ * of Lucene hits.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetCachedLucenePage (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, const SearchCursor *cursor_p, const uint64 generation);
+
+
+/**
+ * Add the page of Lucene hits that a SearchCursor is on to the results,
+ * from the cached page if there is one or else from the search which is
+ * then cached, and move the cursor on to the next page.
+ *
+ * @param cache_p The LuceneResultCache. This can be <code>NULL</code>.
+ * @param query_s The query.
+ * @param facet_s The facet that the query is restricted to. This can be
+ * <code>NULL</code>.
+ * @param cursor_p The SearchCursor. If it has already run out of Lucene
+ * hits, nothing is added and it is left as it is.
+ * @param generation The generation of the results, or 0 if it is unknown
+ * in which case nothing is cached.
+ * @param cached_page_p The page from GetCachedLucenePage (). This can be
+ * <code>NULL</code>.
+ * @param source_p The LucenePageSource to add the hits with.
+ * @return The status of adding the hits.
+ */
+SEARCH_SERVICE_LOCAL OperationStatus ServeLucenePage (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, SearchCursor *cursor_p, const uint64 generation, const json_t *cached_page_p, const LucenePageSource *source_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_PAGE_H_ */
@@ -0,0 +1,122 @@
+/*
+ * lucene_result_cache.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_RESULT_CACHE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_RESULT_CACHE_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * A cache of the pages of Lucene hits for recent queries.
+ *
+ * Each page is keyed on its query, with the white space in it collapsed,
+ * its facet, page number and page size. The pages are stored as compact
+ * serialised JSON rather than as parsed trees to keep them small, and the
+ * least recently used ones are evicted once either the number of pages or
+ * their total size reaches its limit.
+ *
+ * The whole cache belongs to a single generation of the Lucene index and
+ * is cleared as soon as a newer generation is seen, so a page is never
+ * served after the index has changed. If the indexing pipeline sends
+ * notifications of its changes instead, only the pages for the types of
+ * data that changed are removed.
+ */
+typedef struct LuceneResultCache LuceneResultCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a LuceneResultCache.
+ *
+ * @param max_entries The maximum number of pages to keep.
+ * @param max_size The maximum number of bytes of pages to keep.
+ * @param notified_flag If this is <code>true</code>, a newer generation
+ * doesn't clear the cache since the pages that it affects are removed with
+ * InvalidateLuceneResults () instead.
+ * @return The new LuceneResultCache or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL LuceneResultCache *AllocateLuceneResultCache (const uint32 max_entries, const uint64 max_size, const bool notified_flag);
+
+
+SEARCH_SERVICE_LOCAL void FreeLuceneResultCache (LuceneResultCache *cache_p);
+
+
+/**
+ * Get a cached page of Lucene hits.
+ *
+ * @param cache_p The LuceneResultCache.
+ * @param query_s The query.
+ * @param facet_s The facet or <code>NULL</code> for any.
+ * @param page The page number.
+ * @param page_size The number of hits on each page.
+ * @param generation The current generation of the Lucene index.
+ * @return A new copy of the page which the caller must json_decref () or
+ * <code>NULL</code> if it isn't cached for this generation.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetCachedLuceneResults (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const uint64 generation);
+
+
+/**
+ * Add a page of Lucene hits to the cache. If the generation is older than
+ * the cache's, the page came from a search that started before the index
+ * changed and is ignored.
+ *
+ * @param cache_p The LuceneResultCache.
+ * @param query_s The query.
+ * @param facet_s The facet or <code>NULL</code> for any.
+ * @param page The page number.
+ * @param page_size The number of hits on each page.
+ * @param generation The generation of the Lucene index that was searched.
+ * @param results_p The page to store. This is serialised so the caller
+ * keeps ownership of it.
+ * @return <code>true</code> if the page was stored successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool AddCachedLuceneResults (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const uint64 generation, const json_t *results_p);
+
+
+/**
+ * Remove the pages that a change to the documents of a given type
+ * affects. These are the pages for that facet and the pages for any
+ * facet.
+ *
+ * @param cache_p The LuceneResultCache.
+ * @param facet_s The facet of the documents that changed or <code>NULL</code>
+ * to remove every page.
+ * @param generation The generation that the change created. Any pages
+ * from searches of an earlier generation are no longer added.
+ * @return The number of pages that were removed.
+ */
+SEARCH_SERVICE_LOCAL uint32 InvalidateLuceneResults (LuceneResultCache *cache_p, const char *facet_s, const uint64 generation);
+
+
+/**
+ * Remove every page and, from now on, empty the cache whenever the
+ * generation changes rather than waiting for InvalidateLuceneResults ().
+ * This is for when the notifications of the changes stop arriving. The
+ * generations must carry on increasing from the notified ones.
+ *
+ * @param cache_p The LuceneResultCache.
+ */
+SEARCH_SERVICE_LOCAL void UseLuceneIndexGenerations (LuceneResultCache *cache_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_LUCENE_RESULT_CACHE_H_ */
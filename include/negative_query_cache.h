@@ -0,0 +1,93 @@
+/*
+ * negative_query_cache.h
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_NEGATIVE_QUERY_CACHE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_NEGATIVE_QUERY_CACHE_H_
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * A compact record of the queries that are known to have no hits in
+ * each of Lucene, CKAN and Zenodo, so that they don't need running again.
+ *
+ * Each source has a Bloom filter of its normalised queries so the memory
+ * used doesn't depend on the number of queries. A false positive would
+ * wrongly report a query as empty, so the filters should be sized so that
+ * this is rare. Each filter is cleared when the given generation of its
+ * source changes. The filters for CKAN and Zenodo also expire their
+ * queries after a time to live since their contents change without us
+ * knowing.
+ */
+typedef struct NegativeQueryCache NegativeQueryCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a NegativeQueryCache.
+ *
+ * @param num_bits The number of bits in each source's Bloom filter.
+ * @param ttl The number of seconds that the CKAN and Zenodo entries last for.
+ * @return The new NegativeQueryCache or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL NegativeQueryCache *AllocateNegativeQueryCache (const uint32 num_bits, const uint32 ttl);
+
+
+SEARCH_SERVICE_LOCAL void FreeNegativeQueryCache (NegativeQueryCache *cache_p);
+
+
+/**
+ * Check whether a query is known to have no hits.
+ *
+ * @param cache_p The NegativeQueryCache.
+ * @param source_flag The source to check. This is one of SC_LUCENE_EXHAUSTED,
+ * SC_CKAN_EXHAUSTED or SC_ZENODO_EXHAUSTED.
+ * @param query_s The query.
+ * @param facet_s The facet that the query is restricted to. This can be <code>NULL</code>.
+ * @param generation The current generation of the source.
+ * @return <code>true</code> if the query is known to have no hits,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool IsKnownEmptyQuery (NegativeQueryCache *cache_p, const uint32 source_flag, const char *query_s, const char *facet_s, const uint64 generation);
+
+
+/**
+ * Record that a query has no hits.
+ *
+ * @param cache_p The NegativeQueryCache.
+ * @param source_flag The source that the query has no hits in. This is one
+ * of SC_LUCENE_EXHAUSTED, SC_CKAN_EXHAUSTED or SC_ZENODO_EXHAUSTED.
+ * @param query_s The query.
+ * @param facet_s The facet that the query is restricted to. This can be <code>NULL</code>.
+ * @param generation The generation of the source that the query was run against.
+ */
+SEARCH_SERVICE_LOCAL void AddEmptyQuery (NegativeQueryCache *cache_p, const uint32 source_flag, const char *query_s, const char *facet_s, const uint64 generation);
+
+
+/**
+ * Forget every query that is known to have no hits in a source,
+ * whatever its generation.
+ *
+ * @param cache_p The NegativeQueryCache.
+ * @param source_flag The source to forget the queries for. This is one
+ * of SC_LUCENE_EXHAUSTED, SC_CKAN_EXHAUSTED or SC_ZENODO_EXHAUSTED.
+ */
+SEARCH_SERVICE_LOCAL void ForgetEmptyQueries (NegativeQueryCache *cache_p, const uint32 source_flag);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_NEGATIVE_QUERY_CACHE_H_ */
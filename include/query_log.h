@@ -0,0 +1,98 @@
+/*
+ * query_log.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_QUERY_LOG_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_QUERY_LOG_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The key for the query in each of the entries from GetTopQueries ().
+ */
+#define QL_QUERY_S "query"
+
+/**
+ * The key for the facet in each of the entries from GetTopQueries ().
+ */
+#define QL_FACET_S "facet"
+
+/**
+ * The key for the number of times that a query has been run.
+ */
+#define QL_COUNT_S "count"
+
+
+/**
+ * A file that every search's query is appended to, so that the most
+ * frequent queries survive a restart.
+ *
+ * Each line is a JSON object. Appending keeps the file safe to share
+ * between any number of service instances and processes. Once the file
+ * grows past its maximum size, it is rewritten with a single line per
+ * query and every process sharing it switches to the new file the next
+ * time that it records a query.
+ */
+typedef struct QueryLog QueryLog;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Open a QueryLog.
+ *
+ * @param filename_s The file to append to. This is created if needed.
+ * @param max_size The size in bytes that the file can grow to before
+ * it is compacted. If this is 0, it is only compacted by GetTopQueries ().
+ * @return The new QueryLog or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL QueryLog *AllocateQueryLog (const char *filename_s, const uint64 max_size);
+
+
+SEARCH_SERVICE_LOCAL void FreeQueryLog (QueryLog *log_p);
+
+
+/**
+ * Add a query to a QueryLog. If this takes the file past its maximum
+ * size, the calling thread then compacts it.
+ *
+ * @param log_p The QueryLog.
+ * @param query_s The query.
+ * @param facet_s The facet that the query was restricted to. This can be <code>NULL</code>.
+ * @return <code>true</code> if the query was added successfully, <code>false</code>
+ * otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool RecordQuery (QueryLog *log_p, const char *query_s, const char *facet_s);
+
+
+/**
+ * Get the most frequent queries from a QueryLog.
+ *
+ * If the file has grown well beyond its number of different queries,
+ * it is rewritten with a single line per query.
+ *
+ * @param log_p The QueryLog.
+ * @param max_queries The maximum number of queries to get.
+ * @return An array of objects with the QL_QUERY_S, QL_FACET_S and QL_COUNT_S
+ * keys ordered from most to least frequent or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetTopQueries (QueryLog *log_p, const uint32 max_queries);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_QUERY_LOG_H_ */
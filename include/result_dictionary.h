@@ -0,0 +1,87 @@
+/*
+ * result_dictionary.h
+ *
+ *  Created on: 14 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_RESULT_DICTIONARY_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_RESULT_DICTIONARY_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The key in the search metadata for the shared values
+ * of the compacted results.
+ */
+#define RD_DICTIONARY_S "dictionary"
+
+
+/**
+ * A dictionary of the values that are repeated across a page of
+ * search results, such as the providers and type descriptions.
+ * Each compacted result stores the index of its value in the
+ * dictionary rather than the value itself.
+ */
+typedef struct ResultDictionary ResultDictionary;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate an empty ResultDictionary.
+ *
+ * @return The new ResultDictionary or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL ResultDictionary *AllocateResultDictionary (void);
+
+
+/**
+ * Free a ResultDictionary.
+ *
+ * @param dictionary_p The ResultDictionary to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeResultDictionary (ResultDictionary *dictionary_p);
+
+
+/**
+ * Replace any of the shared values in a search result with their
+ * indexes in the dictionary, adding any values that are not already
+ * there.
+ *
+ * @param dictionary_p The ResultDictionary to use.
+ * @param result_p The search result to compact.
+ * @return <code>true</code> if the result was compacted successfully,
+ * <code>false</code> otherwise in which case the result is left with any
+ * values that couldn't be replaced.
+ */
+SEARCH_SERVICE_LOCAL bool CompactResult (ResultDictionary *dictionary_p, json_t *result_p);
+
+
+/**
+ * Add the dictionary to the metadata for a page of search results so that
+ * clients can look up the indexes in the compacted results. Each key
+ * of the compacted values maps to the array of its distinct values.
+ *
+ * @param dictionary_p The ResultDictionary to add.
+ * @param metadata_p The metadata to add the dictionary to.
+ * @return <code>true</code> if the dictionary was added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool AddResultDictionaryToJSON (const ResultDictionary *dictionary_p, json_t *metadata_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_RESULT_DICTIONARY_H_ */
@@ -0,0 +1,118 @@
+/*
+ * result_projection.h
+ *
+ *  Created on: 13 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_RESULT_PROJECTION_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_RESULT_PROJECTION_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The projection value to return every field of each result.
+ */
+#define RP_FULL_S "full"
+
+
+/**
+ * The projection value to return just the fields that are needed
+ * to list the results: the id, name, type, icon and url.
+ */
+#define RP_SUMMARY_S "summary"
+
+
+/**
+ * The set of fields to include in each search result.
+ */
+typedef struct ResultProjection
+{
+	/** If this is <code>true</code>, all fields are included. */
+	bool rp_full_flag;
+
+	/**
+	 * The keys of the fields to include if rp_full_flag is <code>false</code>.
+	 */
+	const char **rp_fields_ss;
+
+	/** The number of entries in rp_fields_ss. */
+	uint32 rp_num_fields;
+
+	/** The copied list of fields that rp_fields_ss points into. */
+	char *rp_buffer_s;
+} ResultProjection;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Set up a ResultProjection from a parameter value.
+ *
+ * @param projection_p The ResultProjection to set up.
+ * @param fields_s Either RP_FULL_S, RP_SUMMARY_S or a comma-separated list
+ * of the keys of the fields to include. If this is <code>NULL</code> or empty
+ * then all fields are included.
+ * @return <code>true</code> if the ResultProjection was set up successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool InitResultProjection (ResultProjection *projection_p, const char *fields_s);
+
+
+/**
+ * Free any memory used by a ResultProjection.
+ *
+ * @param projection_p The ResultProjection to clear.
+ */
+SEARCH_SERVICE_LOCAL void ClearResultProjection (ResultProjection *projection_p);
+
+
+/**
+ * Check whether a field should be included in the results.
+ *
+ * @param projection_p The ResultProjection to check.
+ * @param key_s The key of the field.
+ * @return <code>true</code> if the field should be included,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool IsFieldInResultProjection (const ResultProjection *projection_p, const char *key_s);
+
+
+/**
+ * Check whether the array of individual author names should be
+ * included in the results.
+ *
+ * @param projection_p The ResultProjection to check.
+ * @param default_flag The value to use when all fields are being returned.
+ * @return <code>true</code> if the author names should be included,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool IsAuthorsListInResultProjection (const ResultProjection *projection_p, const bool default_flag);
+
+
+/**
+ * Create a result containing just the projected fields of a document.
+ * The result will always have the document's name, if it has one,
+ * since that is needed to make the returned resource.
+ *
+ * @param document_p The document to copy the fields from.
+ * @param projection_p The fields to copy.
+ * @return The newly-allocated result or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetProjectedResult (const json_t *document_p, const ResultProjection *projection_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_RESULT_PROJECTION_H_ */
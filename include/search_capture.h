@@ -0,0 +1,76 @@
+/*
+ * search_capture.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CAPTURE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CAPTURE_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The key for the number of milliseconds since the epoch at which
+ * a captured search arrived.
+ */
+#define SCP_TIME_S "time"
+
+/**
+ * The key for the parameters of a captured search, keyed by
+ * parameter name.
+ */
+#define SCP_PARAMS_S "params"
+
+
+/**
+ * A file that the parameters of every incoming search are appended to,
+ * along with when they arrived, so that the real mix of searches can be
+ * replayed against the service later.
+ *
+ * Each line is a JSON object such as
+ *
+ * <code>{ "time": 1792322400123, "params": { "SS Keyword Search": "wheat", "SS Results Page Size": 20 } }</code>
+ */
+typedef struct SearchCapture SearchCapture;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Open a SearchCapture.
+ *
+ * @param filename_s The file to append to. This is created if needed.
+ * @return The new SearchCapture or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL SearchCapture *AllocateSearchCapture (const char *filename_s);
+
+
+SEARCH_SERVICE_LOCAL void FreeSearchCapture (SearchCapture *capture_p);
+
+
+/**
+ * Add a search to a SearchCapture, timestamped with the current time.
+ *
+ * @param capture_p The SearchCapture.
+ * @param params_p The search's parameter values keyed by parameter name.
+ * @return <code>true</code> if the search was added successfully, <code>false</code>
+ * otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool CaptureSearch (SearchCapture *capture_p, const json_t *params_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CAPTURE_H_ */
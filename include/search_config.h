@@ -0,0 +1,165 @@
+/*
+ * search_config.h
+ *
+ *  Created on: 15 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CONFIG_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CONFIG_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "facet_accumulator.h"
+#include "typedefs.h"
+
+
+struct ConversionPool;
+struct ExternalResultCache;
+struct HedgePolicy;
+
+
+/**
+ * An immutable snapshot of the search service's configuration.
+ *
+ * Each search takes a reference to the current snapshot and uses it
+ * throughout, so a reload never changes the configuration part of the
+ * way through a search. The snapshot is freed when the last search
+ * using it releases it.
+ */
+typedef struct SearchConfig
+{
+	/** The configuration that the snapshot was made from. */
+	json_t *sc_config_p;
+
+	const char *sc_ckan_url_s;
+	const json_t *sc_ckan_filters_p;
+	const json_t *sc_ckan_resource_mappings_p;
+	const char *sc_ckan_result_icon_s;
+	const json_t *sc_ckan_provider_p;
+
+	const char *sc_zenodo_url_s;
+	const char *sc_zenodo_community_s;
+	const char *sc_zenodo_api_token_s;
+	const json_t *sc_zenodo_resource_mappings_p;
+	const json_t *sc_zenodo_provider_p;
+
+	/**
+	 * If this is <code>true</code> then the CKAN and Zenodo results
+	 * will have an array of the individual author names as well as
+	 * the joined author string.
+	 */
+	bool sc_author_list_flag;
+
+	/**
+	 * The service's pool of threads used to convert large numbers of
+	 * CKAN and Zenodo hits in parallel. This is shared by every snapshot.
+	 */
+	struct ConversionPool *sc_conversion_pool_p;
+
+	/**
+	 * The minimum number of hits before the ConversionPool is used.
+	 */
+	uint32 sc_parallel_conversion_min_hits;
+
+	/**
+	 * The service's cache of CKAN and Zenodo responses. This is shared
+	 * by every snapshot and can be <code>NULL</code>.
+	 */
+	struct ExternalResultCache *sc_external_cache_p;
+
+	/**
+	 * The service's policy for sending duplicate requests to slow CKAN
+	 * and Zenodo portals. This is shared by every snapshot and can be
+	 * <code>NULL</code>.
+	 */
+	struct HedgePolicy *sc_hedge_p;
+
+	/**
+	 * The facet names from the configuration that each search's
+	 * FacetAccumulator keeps lock-free counters for.
+	 */
+	FacetKeys *sc_facet_keys_p;
+
+	/**
+	 * The number of hits to request from each of CKAN and Zenodo
+	 * for each page of results.
+	 */
+	uint32 sc_external_page_size;
+
+	/**
+	 * The directory to write exported results to. If this is
+	 * <code>NULL</code> then exports are disabled.
+	 */
+	const char *sc_export_directory_s;
+
+	/**
+	 * The optional web address that the export directory is served from.
+	 */
+	const char *sc_export_url_s;
+
+	/**
+	 * The maximum number of hits to write to each export.
+	 */
+	uint32 sc_export_max_hits;
+
+	/**
+	 * These only change when a reload changes the configuration of
+	 * the given backend, so anything cached for a backend can be
+	 * kept for as long as its generation stays the same.
+	 */
+	uint32 sc_ckan_generation;
+	uint32 sc_zenodo_generation;
+
+	/** The number of searches using this snapshot. */
+	uint32 sc_num_refs;
+} SearchConfig;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a snapshot of the search service's configuration.
+ *
+ * @param config_p The configuration to use. The snapshot takes a
+ * reference to this.
+ * @param previous_p The snapshot that this one is replacing, used to
+ * work out which backends have changed. This can be <code>NULL</code>.
+ * @param pool_p The service's ConversionPool. This can be <code>NULL</code>.
+ * @param cache_p The service's ExternalResultCache. This can be <code>NULL</code>.
+ * @param hedge_p The service's HedgePolicy. This can be <code>NULL</code>.
+ * @return The new SearchConfig with a single reference or <code>NULL</code>
+ * upon error.
+ */
+SEARCH_SERVICE_LOCAL SearchConfig *AllocateSearchConfig (json_t *config_p, const SearchConfig *previous_p, struct ConversionPool *pool_p, struct ExternalResultCache *cache_p, struct HedgePolicy *hedge_p);
+
+
+/**
+ * Take a reference to a SearchConfig.
+ *
+ * @param config_p The SearchConfig.
+ * @return The SearchConfig.
+ */
+SEARCH_SERVICE_LOCAL SearchConfig *RetainSearchConfig (SearchConfig *config_p);
+
+
+/**
+ * Release a reference to a SearchConfig, freeing it if this was
+ * the last one.
+ *
+ * @param config_p The SearchConfig to release.
+ */
+SEARCH_SERVICE_LOCAL void ReleaseSearchConfig (SearchConfig *config_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CONFIG_H_ */
@@ -0,0 +1,192 @@
+/*
+ * search_cursor.h
+ *
+ *  Created on: 14 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CURSOR_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CURSOR_H_
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The key in the search metadata for the cursor to get the next page
+ * of results. This is omitted once every source has been exhausted.
+ */
+#define SC_NEXT_CURSOR_S "next_cursor"
+
+
+/**
+ * The flag set in a SearchCursor once there are no more Lucene hits.
+ */
+#define SC_LUCENE_EXHAUSTED (1 << 0)
+
+/**
+ * The flag set in a SearchCursor once there are no more CKAN hits.
+ */
+#define SC_CKAN_EXHAUSTED (1 << 1)
+
+/**
+ * The flag set in a SearchCursor once there are no more Zenodo hits.
+ */
+#define SC_ZENODO_EXHAUSTED (1 << 2)
+
+
+/**
+ * The largest number of Lucene hits that can be asked for on each page.
+ */
+#define SC_MAX_PAGE_SIZE (10000)
+
+
+/**
+ * The position reached in each of the sources being searched.
+ *
+ * This is passed between the client and the service as an opaque
+ * string so that each page can resume every source from where the
+ * previous page stopped.
+ */
+typedef struct SearchCursor
+{
+	/** The page of Lucene hits to get. */
+	uint32 sc_lucene_page;
+
+	/** The number of Lucene hits on each page. */
+	uint32 sc_page_size;
+
+	/** The index of the next CKAN hit to get. */
+	uint32 sc_ckan_from;
+
+	/** The index of the next Zenodo hit to get. */
+	uint32 sc_zenodo_from;
+
+	/**
+	 * The number of hits to get from each external source. This always
+	 * comes from the service's configuration rather than the client.
+	 */
+	uint32 sc_external_page_size;
+
+	/** The SC_*_EXHAUSTED flags for the sources with no more hits. */
+	uint32 sc_exhausted_flags;
+} SearchCursor;
+
+
+/**
+ * The range of hits to get from an external source and the number
+ * that it actually returned.
+ */
+typedef struct SourcePage
+{
+	/** The index of the first hit to get. */
+	uint32 sp_from;
+
+	/**
+	 * The maximum number of hits to get. A source that can only fetch
+	 * whole pages reduces this when sp_from is partway through one of
+	 * them, as it then only has the rest of that page to return.
+	 */
+	uint32 sp_size;
+
+	/** The number of hits that the source returned. */
+	uint32 sp_num_hits;
+} SourcePage;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Set up a SearchCursor for a given page of results.
+ *
+ * @param cursor_p The SearchCursor to set up.
+ * @param page_number The page of results.
+ * @param page_size The number of Lucene hits on each page.
+ * @param external_page_size The number of hits to get from each external source.
+ * @return <code>true</code> if the page size is between 1 and SC_MAX_PAGE_SIZE
+ * and the positions of the page's hits fit in the cursor, <code>false</code>
+ * otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool InitSearchCursor (SearchCursor *cursor_p, const uint32 page_number, const uint32 page_size, const uint32 external_page_size);
+
+
+/**
+ * Set up a SearchCursor from a string generated by GetSearchCursorAsString().
+ *
+ * The cursor comes from the client, so it is checked in the same way as
+ * InitSearchCursor() and the external page size in it is replaced by the
+ * configured one.
+ *
+ * @param cursor_p The SearchCursor to set up.
+ * @param cursor_s The cursor string.
+ * @param external_page_size The number of hits to get from each external source.
+ * @return <code>true</code> if the cursor was parsed successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool ParseSearchCursor (SearchCursor *cursor_p, const char *cursor_s, const uint32 external_page_size);
+
+
+/**
+ * Get the string to send to the client for a SearchCursor.
+ *
+ * @param cursor_p The SearchCursor.
+ * @return The newly-allocated string which should be freed with FreeCopiedString()
+ * or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL char *GetSearchCursorAsString (const SearchCursor *cursor_p);
+
+
+/**
+ * Get the range of hits to request from an external source.
+ *
+ * @param cursor_p The SearchCursor.
+ * @param source_flag The SC_*_EXHAUSTED flag for the source.
+ * @param page_p The SourcePage to set.
+ */
+SEARCH_SERVICE_LOCAL void GetSearchCursorSourcePage (const SearchCursor *cursor_p, const uint32 source_flag, SourcePage *page_p);
+
+
+/**
+ * Move a SearchCursor on to the position after the hits that have
+ * been returned from an external source. If the source returned fewer
+ * hits than were asked for, it is marked as exhausted.
+ *
+ * @param cursor_p The SearchCursor.
+ * @param source_flag The SC_*_EXHAUSTED flag for the source.
+ * @param page_p The range of hits that the source was asked for and returned.
+ */
+SEARCH_SERVICE_LOCAL void AdvanceSearchCursorSource (SearchCursor *cursor_p, const uint32 source_flag, const SourcePage *page_p);
+
+
+/**
+ * Move a SearchCursor on to the next page of Lucene hits, or mark
+ * Lucene as exhausted if the current page is the last one. This is
+ * the same whether the page came from Lucene or from the cache.
+ *
+ * @param cursor_p The SearchCursor.
+ * @param num_total_hits The total number of Lucene hits for the query.
+ */
+SEARCH_SERVICE_LOCAL void AdvanceSearchCursorLucene (SearchCursor *cursor_p, const uint32 num_total_hits);
+
+
+/**
+ * Check whether there are any more results for a SearchCursor.
+ *
+ * @param cursor_p The SearchCursor.
+ * @param sources_flags The SC_*_EXHAUSTED flags of the sources being searched.
+ * @return <code>true</code> if any of the sources may have more results,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool HasMoreSearchCursorResults (const SearchCursor *cursor_p, const uint32 sources_flags);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_CURSOR_H_ */
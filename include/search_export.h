@@ -0,0 +1,75 @@
+/*
+ * search_export.h
+ *
+ *  Created on: 15 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_EXPORT_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_EXPORT_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "search_config.h"
+#include "result_projection.h"
+#include "lucene_tool.h"
+#include "linked_list.h"
+#include "operation.h"
+
+
+/**
+ * The file extension used for exported results.
+ */
+#define SE_EXPORT_FILE_EXTENSION_S ".ndjson"
+
+
+/**
+ * A function to convert a Lucene document into a search result.
+ *
+ * @param document_p The Lucene document.
+ * @param data_p The custom data for the function.
+ * @return The newly-allocated search result or <code>NULL</code>
+ * upon error.
+ */
+typedef json_t *(*LuceneDocumentConverter) (const json_t *document_p, void *data_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Write every hit for a search to a newline-delimited JSON file in the
+ * configured export directory and add the file as the job's result.
+ *
+ * The Lucene query is run once so that every hit comes from the same
+ * snapshot of the index. Each hit is written out as soon as it has been
+ * converted, so the number of hits doesn't affect the memory used. The
+ * file is only moved into place once it is complete.
+ *
+ * @param lucene_p The LuceneTool to search with.
+ * @param keyword_s The query.
+ * @param facets_p The facets to restrict the search to, or <code>NULL</code>.
+ * @param sources_flags The SC_CKAN_EXHAUSTED and SC_ZENODO_EXHAUSTED flags for
+ * the external sources to export from too.
+ * @param convert_fn The function to convert each Lucene document.
+ * @param convert_data_p The custom data for convert_fn.
+ * @param projection_p The fields to export for each hit.
+ * @param job_p The ServiceJob to add the exported file to.
+ * @param config_p The configuration snapshot for the search.
+ * @return The status of the export.
+ */
+SEARCH_SERVICE_LOCAL OperationStatus RunSearchExport (LuceneTool *lucene_p, const char *keyword_s, LinkedList *facets_p, const uint32 sources_flags,
+																											LuceneDocumentConverter convert_fn, void *convert_data_p, const ResultProjection *projection_p,
+																											ServiceJob *job_p, const SearchConfig *config_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_EXPORT_H_ */
@@ -0,0 +1,110 @@
+/*
+ * search_flight.h
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_FLIGHT_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_FLIGHT_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "service_job.h"
+
+
+/**
+ * A search that is currently being run. Any identical searches that
+ * arrive while it is running wait for it to finish and then share
+ * its results rather than running the search again themselves.
+ */
+typedef struct SearchFlight SearchFlight;
+
+
+/**
+ * The set of SearchFlights that are currently running, looked up
+ * by a key made from the search's parameters.
+ */
+typedef struct SearchFlightTable SearchFlightTable;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+SEARCH_SERVICE_LOCAL SearchFlightTable *AllocateSearchFlightTable (void);
+
+
+/**
+ * Free a SearchFlightTable. There must not be any SearchFlights still
+ * using it.
+ *
+ * @param table_p The SearchFlightTable to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeSearchFlightTable (SearchFlightTable *table_p);
+
+
+/**
+ * Join the running search for the given key, or start a new one if
+ * there isn't one.
+ *
+ * @param table_p The SearchFlightTable.
+ * @param key_s The key for the search's parameters. This is copied.
+ * @param leader_flag_p Upon return, this will be <code>true</code> if
+ * a new SearchFlight was started and so the caller needs to run the search
+ * and then call CompleteSearchFlight (). If this is <code>false</code>, the
+ * caller should call CopySearchFlightResults () to get the results.
+ * @return The SearchFlight or <code>NULL</code> upon error in which case
+ * the caller should just run the search itself. This must be released with
+ * LeaveSearchFlight ().
+ */
+SEARCH_SERVICE_LOCAL SearchFlight *JoinSearchFlight (SearchFlightTable *table_p, const char *key_s, bool *leader_flag_p);
+
+
+/**
+ * Store the results of a search so that any waiting identical searches
+ * can use them. The SearchFlight is removed from the table so any later
+ * searches will start a new one.
+ *
+ * @param table_p The SearchFlightTable.
+ * @param flight_p The SearchFlight that was started by the caller.
+ * @param job_p The ServiceJob with the search's results.
+ */
+SEARCH_SERVICE_LOCAL void CompleteSearchFlight (SearchFlightTable *table_p, SearchFlight *flight_p, const ServiceJob *job_p);
+
+
+/**
+ * Wait for a SearchFlight to complete and add its results to a ServiceJob.
+ *
+ * The results themselves are shared between the ServiceJobs rather than
+ * copied, so they must not be altered. Each ServiceJob gets its own copy
+ * of the metadata.
+ *
+ * @param table_p The SearchFlightTable.
+ * @param flight_p The SearchFlight that was joined.
+ * @param job_p The ServiceJob to add the results to.
+ * @return <code>true</code> if all of the results were added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool CopySearchFlightResults (SearchFlightTable *table_p, SearchFlight *flight_p, ServiceJob *job_p);
+
+
+/**
+ * Release a SearchFlight from JoinSearchFlight (), freeing it if this was
+ * the last search using it.
+ *
+ * @param table_p The SearchFlightTable.
+ * @param flight_p The SearchFlight to release.
+ */
+SEARCH_SERVICE_LOCAL void LeaveSearchFlight (SearchFlightTable *table_p, SearchFlight *flight_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_FLIGHT_H_ */
@@ -0,0 +1,61 @@
+/*
+ * search_job_sets.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_JOB_SETS_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_JOB_SETS_H_
+
+#include "search_service_library.h"
+#include "service_job.h"
+
+
+/**
+ * The ServiceJobSets of the searches that have finished but whose results
+ * may still be being sent by the server.
+ *
+ * Each server thread handles one request at a time, so once a thread
+ * starts another search the server has finished with its previous
+ * ServiceJobSet. Only the latest set for each thread is kept and the one
+ * before it is freed, so a single instance of the service can run any
+ * number of searches without its job sets building up.
+ */
+typedef struct SearchJobSets SearchJobSets;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+SEARCH_SERVICE_LOCAL SearchJobSets *AllocateSearchJobSets (void);
+
+
+/**
+ * Free a SearchJobSets along with every ServiceJobSet that it still has.
+ *
+ * @param sets_p The SearchJobSets to free.
+ */
+SEARCH_SERVICE_LOCAL void FreeSearchJobSets (SearchJobSets *sets_p);
+
+
+/**
+ * Keep the ServiceJobSet of a search that the calling thread has just
+ * run and free the one that the thread kept for its previous search.
+ *
+ * @param sets_p The SearchJobSets.
+ * @param jobs_p The ServiceJobSet to keep. This will be freed by the next
+ * call from the same thread or by FreeSearchJobSets ().
+ */
+SEARCH_SERVICE_LOCAL void KeepSearchJobSet (SearchJobSets *sets_p, ServiceJobSet *jobs_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_JOB_SETS_H_ */
@@ -23,27 +23,171 @@
 #ifndef SEARCH_SERVICE_DATA_H
 #define SEARCH_SERVICE_DATA_H
 
+#include <pthread.h>
+#include <time.h>
 
 
 #include "service.h"
 #include "search_service_library.h"
+#include "hit_converter.h"
+#include "search_config.h"
+#include "search_flight.h"
+#include "external_result_cache.h"
+#include "external_fetch.h"
+#include "negative_query_cache.h"
+#include "lucene_result_cache.h"
+#include "cache_invalidator.h"
+#include "query_log.h"
+#include "search_warm_up.h"
+#include "admission_controller.h"
+#include "search_trace.h"
+#include "slow_query_log.h"
+#include "search_capture.h"
+#include "search_job_sets.h"
 
 
 
 typedef struct SearchServiceData
 {
 	ServiceData ssd_base_data;
-	const char *ssd_ckan_url_s;
-	const json_t *ssd_ckan_filters_p;
-	const json_t *ssd_ckan_resource_mappings_p;
-	const char *ssd_ckan_result_icon_s;
-	const json_t *ssd_ckan_provider_p;
-
-	const char *ssd_zenodo_url_s;
-	const char *ssd_zenodo_community_s;
-	const char *ssd_zenodo_api_token_s;
-	const json_t *ssd_zenodo_resource_mappings_p;
-	const json_t *ssd_zenodo_provider_p;
+
+	/**
+	 * The optional pool of threads used to convert large
+	 * numbers of CKAN and Zenodo hits in parallel. This is
+	 * shared by every configuration snapshot.
+	 */
+	ConversionPool *ssd_conversion_pool_p;
+
+	/**
+	 * The current configuration snapshot. Use AcquireSearchConfig ()
+	 * to get it rather than accessing this directly.
+	 */
+	SearchConfig *ssd_config_p;
+
+	/**
+	 * The optional cache of CKAN and Zenodo responses. This is
+	 * shared by every configuration snapshot.
+	 */
+	ExternalResultCache *ssd_external_cache_p;
+
+	/**
+	 * The optional policy for sending duplicate requests to slow
+	 * CKAN and Zenodo portals. This is shared by every configuration
+	 * snapshot.
+	 */
+	HedgePolicy *ssd_hedge_p;
+
+	/**
+	 * The optional record of the queries that have no hits in
+	 * each source.
+	 */
+	NegativeQueryCache *ssd_negative_cache_p;
+
+	/**
+	 * The optional cache of the pages of Lucene hits for the
+	 * current generation of the index.
+	 */
+	LuceneResultCache *ssd_lucene_cache_p;
+
+	/**
+	 * The optional listener for changes to the Lucene index. If this
+	 * is set, it decides when the Lucene caches are out of date.
+	 */
+	CacheInvalidator *ssd_invalidator_p;
+
+	/** The lock for swapping ssd_config_p. */
+	pthread_mutex_t ssd_config_lock;
+
+	/**
+	 * The configuration file to watch for changes. If this is
+	 * <code>NULL</code> then hot reloading is disabled.
+	 */
+	const char *ssd_reload_filename_s;
+
+	/** The number of seconds between checks of the configuration file. */
+	uint32 ssd_reload_interval;
+
+	/** The modification time of the configuration file when it was last loaded. */
+	time_t ssd_reload_mtime;
+
+	pthread_t ssd_reload_thread;
+
+	bool ssd_reload_thread_flag;
+
+	/** Set to <code>true</code> to stop the reload thread. */
+	bool ssd_reload_stop_flag;
+
+	pthread_mutex_t ssd_reload_lock;
+
+	pthread_cond_t ssd_reload_cond;
+
+	/**
+	 * The searches that are currently running so that identical
+	 * searches that arrive at the same time can share their results.
+	 * If this is <code>NULL</code> then each search is run separately.
+	 */
+	SearchFlightTable *ssd_flights_p;
+
+	/**
+	 * The optional log of every search's query. If this is
+	 * <code>NULL</code> then queries aren't recorded.
+	 */
+	QueryLog *ssd_query_log_p;
+
+	/** The number of the most frequent queries to run when the service starts. */
+	uint32 ssd_warm_up_num_queries;
+
+	/** The warm up that is running, if any. */
+	SearchWarmUp *ssd_warm_up_p;
+
+	/**
+	 * The optional limit on the number of searches that run at once.
+	 * If this is <code>NULL</code> then every search is run straight away.
+	 */
+	AdmissionController *ssd_admission_p;
+
+	/**
+	 * The recent average number of milliseconds that a CKAN request
+	 * has taken, or 0 if none has been made yet. This is used to decide
+	 * whether CKAN can be searched within a latency budget.
+	 */
+	uint32 ssd_ckan_latency;
+
+	/** The same as ssd_ckan_latency but for Zenodo. */
+	uint32 ssd_zenodo_latency;
+
+	/**
+	 * When ssd_ckan_latency was last updated, from GetAdmissionTime (),
+	 * so that an estimate which is no longer being refreshed can decay.
+	 */
+	uint64 ssd_ckan_latency_time;
+
+	/** The same as ssd_ckan_latency_time but for Zenodo. */
+	uint64 ssd_zenodo_latency_time;
+
+	/**
+	 * The optional writer of each search's trace. If this is
+	 * <code>NULL</code> then searches aren't traced.
+	 */
+	SearchTracer *ssd_tracer_p;
+
+	/**
+	 * The optional log of the searches that take longer than its
+	 * threshold. If this is <code>NULL</code> then they aren't recorded.
+	 */
+	SlowQueryLog *ssd_slow_query_log_p;
+
+	/**
+	 * The optional record of every incoming search's parameters for
+	 * replaying later. If this is <code>NULL</code> then they aren't recorded.
+	 */
+	SearchCapture *ssd_capture_p;
+
+	/**
+	 * The ServiceJobSets of the finished searches that the server
+	 * may still be using.
+	 */
+	SearchJobSets *ssd_job_sets_p;
 
 } SearchServiceData;
 
@@ -62,6 +206,33 @@ SEARCH_SERVICE_LOCAL void FreeSearchServiceData (SearchServiceData *data_p);
 SEARCH_SERVICE_LOCAL bool ConfigureSearchServiceData (SearchServiceData *data_p);
 
 
+/**
+ * Get a reference to the search service's current configuration
+ * snapshot. This must be released with ReleaseSearchConfig ()
+ * once the search has finished with it.
+ *
+ * @param data_p The configuration data for the search service.
+ * @return The current SearchConfig or <code>NULL</code> if the
+ * service has not been configured.
+ */
+SEARCH_SERVICE_LOCAL SearchConfig *AcquireSearchConfig (SearchServiceData *data_p);
+
+
+/**
+ * Start running the most frequent queries from the query log in the
+ * background to fill the caches. This only happens once for each process
+ * as the caches of later instances of the service start from the same
+ * backends that the first instance has already warmed up.
+ *
+ * @param data_p The configuration data for the search service.
+ * @param warm_up_fn The function to run each query. This is passed data_p.
+ * @return <code>true</code> if the warm up was started, <code>false</code>
+ * if there is no query log, another instance has already warmed up or
+ * there was an error.
+ */
+SEARCH_SERVICE_LOCAL bool WarmUpSearchServiceData (SearchServiceData *data_p, WarmUpQueryFn warm_up_fn);
+
+
 #ifdef __cplusplus
 }
 #endif
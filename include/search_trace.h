@@ -0,0 +1,200 @@
+/*
+ * search_trace.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_TRACE_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_TRACE_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "typedefs.h"
+
+
+/**
+ * The key in a job's metadata for the id of its trace.
+ */
+#define ST_TRACE_ID_S "trace_id"
+
+
+/**
+ * Writes the traces of searches to a local file in the Chrome trace
+ * event format, which can be opened with chrome://tracing or Perfetto.
+ *
+ * Each search is shown as its own row of nested spans and its root span
+ * has the trace id in its arguments. The file is rotated once it reaches
+ * its maximum size, keeping a given number of older files.
+ */
+typedef struct SearchTracer SearchTracer;
+
+
+/**
+ * The spans of a single search. These are only written out once the
+ * search has finished. A SearchTrace must only be used by the thread
+ * that is running its search.
+ *
+ * Every function that takes a SearchTrace does nothing if it is
+ * <code>NULL</code>, so searches that aren't traced needn't check.
+ */
+typedef struct SearchTrace SearchTrace;
+
+
+/**
+ * The value returned for a span that isn't being recorded.
+ */
+#define ST_NO_SPAN (-1)
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a SearchTracer.
+ *
+ * @param filename_s The file to write the traces to.
+ * @param max_size The number of bytes that the file can grow to before it is rotated.
+ * @param max_files The number of rotated files to keep.
+ * @param sample_percent The percentage of searches without a trace id of their
+ * own that are traced. Searches that come with a trace id are always traced.
+ * @return The new SearchTracer or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL SearchTracer *AllocateSearchTracer (const char *filename_s, const uint64 max_size, const uint32 max_files, const uint32 sample_percent);
+
+
+SEARCH_SERVICE_LOCAL void FreeSearchTracer (SearchTracer *tracer_p);
+
+
+/**
+ * Start tracing a search.
+ *
+ * @param tracer_p The SearchTracer to write the trace to. This can be
+ * <code>NULL</code> if the trace is only needed by the caller.
+ * @param trace_id_s The trace id that came with the search. This can be 32
+ * hexadecimal digits or a W3C traceparent header. If this is <code>NULL</code>
+ * or not valid, default_id_s is used instead and the search is sampled.
+ * @param default_id_s The trace id to use if the search didn't come with one.
+ * @param always_flag If this is <code>true</code>, the spans are recorded
+ * even if the search isn't sampled, so that they can be looked at with
+ * GetSearchTraceStages (). They are still only written out if it is sampled.
+ * @return The new SearchTrace or <code>NULL</code> if the search isn't sampled
+ * or upon error.
+ */
+SEARCH_SERVICE_LOCAL SearchTrace *StartSearchTrace (SearchTracer *tracer_p, const char *trace_id_s, const char *default_id_s, const bool always_flag);
+
+
+/**
+ * Write a search's spans out and free its SearchTrace. Any spans that
+ * are still open are ended.
+ *
+ * @param trace_p The SearchTrace.
+ */
+SEARCH_SERVICE_LOCAL void FinishSearchTrace (SearchTrace *trace_p);
+
+
+/**
+ * Get the id of a trace.
+ *
+ * @param trace_p The SearchTrace.
+ * @return The 32 hexadecimal digit id or <code>NULL</code> if trace_p is.
+ */
+SEARCH_SERVICE_LOCAL const char *GetSearchTraceId (const SearchTrace *trace_p);
+
+
+/**
+ * Get the number of microseconds that a trace's first span took, or has
+ * taken so far if it is still open.
+ *
+ * @param trace_p The SearchTrace.
+ * @return The duration or 0 if trace_p is <code>NULL</code> or has no spans.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetSearchTraceDuration (const SearchTrace *trace_p);
+
+
+/**
+ * Get a trace's spans as JSON. Each one is an object with its "name",
+ * its "depth" of nesting, its "start" after the first span and how long
+ * it took, in milliseconds as "ms", along with any arguments that were
+ * added to it.
+ *
+ * @param trace_p The SearchTrace.
+ * @return A new array of the spans in the order that they started or
+ * <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL json_t *GetSearchTraceStages (const SearchTrace *trace_p);
+
+
+/**
+ * Start a span. Spans that start while another is open are shown
+ * nested inside of it.
+ *
+ * @param trace_p The SearchTrace.
+ * @param name_s The name of the span. This must be a string literal.
+ * @return The span to pass to EndTraceSpan () or ST_NO_SPAN.
+ */
+SEARCH_SERVICE_LOCAL int32 BeginTraceSpan (SearchTrace *trace_p, const char *name_s);
+
+
+/**
+ * End a span.
+ *
+ * @param trace_p The SearchTrace.
+ * @param span The value returned by BeginTraceSpan ().
+ */
+SEARCH_SERVICE_LOCAL void EndTraceSpan (SearchTrace *trace_p, const int32 span);
+
+
+/**
+ * Add a span whose times were measured elsewhere, such as the phases
+ * of an HTTP request.
+ *
+ * @param trace_p The SearchTrace.
+ * @param name_s The name of the span. This must be a string literal.
+ * @param start The start of the span from GetTraceTime ().
+ * @param end The end of the span from GetTraceTime ().
+ * @return The span, to add arguments to, or ST_NO_SPAN.
+ */
+SEARCH_SERVICE_LOCAL int32 AddTraceSpan (SearchTrace *trace_p, const char *name_s, const uint64 start, const uint64 end);
+
+
+/**
+ * Add a string argument to a span.
+ *
+ * @param trace_p The SearchTrace.
+ * @param span The span.
+ * @param key_s The argument's name.
+ * @param value_s The argument's value. If this is <code>NULL</code>, nothing is added.
+ */
+SEARCH_SERVICE_LOCAL void SetTraceSpanString (SearchTrace *trace_p, const int32 span, const char *key_s, const char *value_s);
+
+
+/**
+ * Add an integer argument to a span.
+ *
+ * @param trace_p The SearchTrace.
+ * @param span The span.
+ * @param key_s The argument's name.
+ * @param value The argument's value.
+ */
+SEARCH_SERVICE_LOCAL void SetTraceSpanInteger (SearchTrace *trace_p, const int32 span, const char *key_s, const int64 value);
+
+
+/**
+ * Get the current time in microseconds for the spans.
+ *
+ * @return The time on a clock that only goes forwards.
+ */
+SEARCH_SERVICE_LOCAL uint64 GetTraceTime (void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_TRACE_H_ */
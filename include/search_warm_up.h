@@ -0,0 +1,69 @@
+/*
+ * search_warm_up.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_WARM_UP_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_WARM_UP_H_
+
+#include "search_service_library.h"
+#include "query_log.h"
+#include "typedefs.h"
+
+
+/**
+ * A background thread that replays the most frequent queries from a
+ * QueryLog when the service starts, so that the caches are already
+ * filled when the first real searches arrive.
+ */
+typedef struct SearchWarmUp SearchWarmUp;
+
+
+/**
+ * The function called to run each of the queries.
+ *
+ * @param query_s The query.
+ * @param facet_s The facet that the query was restricted to. This can be <code>NULL</code>.
+ * @param data_p The custom data given to StartSearchWarmUp ().
+ */
+typedef void (*WarmUpQueryFn) (const char *query_s, const char *facet_s, void *data_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start a SearchWarmUp.
+ *
+ * @param log_p The QueryLog to get the queries from. This must stay valid
+ * until StopSearchWarmUp () is called.
+ * @param num_queries The number of the most frequent queries to run.
+ * @param warm_up_fn The function to run each query.
+ * @param data_p The custom data to pass to warm_up_fn.
+ * @return The running SearchWarmUp or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL SearchWarmUp *StartSearchWarmUp (QueryLog *log_p, const uint32 num_queries, WarmUpQueryFn warm_up_fn, void *data_p);
+
+
+/**
+ * Stop a SearchWarmUp and free it. If a query is being run, this waits
+ * for it to finish.
+ *
+ * @param warm_up_p The SearchWarmUp to stop.
+ * @return <code>true</code> if every query had been run before the
+ * SearchWarmUp was stopped, <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool StopSearchWarmUp (SearchWarmUp *warm_up_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SEARCH_WARM_UP_H_ */
@@ -0,0 +1,75 @@
+/*
+ * slow_query_log.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_INCLUDE_SLOW_QUERY_LOG_H_
+#define SERVICES_SEARCH_SERVICE_INCLUDE_SLOW_QUERY_LOG_H_
+
+#include "jansson.h"
+
+#include "search_service_library.h"
+#include "search_trace.h"
+#include "service_job.h"
+#include "typedefs.h"
+
+
+/**
+ * A file that each search which takes longer than a threshold is
+ * appended to, so that slow searches can be found and explained without
+ * wading through the rest of the service's output.
+ *
+ * Each line is a JSON object with the search's normalised query, facet,
+ * page, outcome and the time it took, a summary of each source with its
+ * time, hits, cache status and bytes downloaded, and every stage from
+ * the search's SearchTrace.
+ */
+typedef struct SlowQueryLog SlowQueryLog;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Open a SlowQueryLog.
+ *
+ * @param filename_s The file to append to. This is created if needed.
+ * @param threshold The number of milliseconds that a search must take
+ * to be logged.
+ * @return The new SlowQueryLog or <code>NULL</code> upon error.
+ */
+SEARCH_SERVICE_LOCAL SlowQueryLog *AllocateSlowQueryLog (const char *filename_s, const uint32 threshold);
+
+
+SEARCH_SERVICE_LOCAL void FreeSlowQueryLog (SlowQueryLog *log_p);
+
+
+/**
+ * Add a search to a SlowQueryLog if it took longer than the threshold.
+ *
+ * @param log_p The SlowQueryLog.
+ * @param trace_p The search's SearchTrace. The search's time is taken
+ * from its first span, which must have ended.
+ * @param query_s The query.
+ * @param facet_s The facet that the query was restricted to. This can be <code>NULL</code>.
+ * @param page The Lucene page that the search started from.
+ * @param page_size The number of results on each page.
+ * @param cursor_flag <code>true</code> if the page came from a cursor.
+ * @param job_p The search's ServiceJob with its results and metadata.
+ * @return <code>true</code> if the search wasn't slow or was added successfully,
+ * <code>false</code> otherwise.
+ */
+SEARCH_SERVICE_LOCAL bool LogSlowQuery (SlowQueryLog *log_p, const SearchTrace *trace_p, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const bool cursor_flag, const ServiceJob *job_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_INCLUDE_SLOW_QUERY_LOG_H_ */
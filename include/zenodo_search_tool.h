@@ -8,10 +8,13 @@
 #ifndef SERVICES_SEARCH_SERVICE_INCLUDE_ZENODO_SEARCH_TOOL_H_
 #define SERVICES_SEARCH_SERVICE_INCLUDE_ZENODO_SEARCH_TOOL_H_
 
-#include "search_service_data.h"
+#include "search_config.h"
 #include "search_service_library.h"
 
-#include "lucene_tool.h"
+#include "facet_accumulator.h"
+#include "result_projection.h"
+#include "search_cursor.h"
+#include "search_trace.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -19,7 +22,7 @@ extern "C"
 #endif
 
 
-SEARCH_SERVICE_LOCAL json_t *SearchZenodo (const char *query_s, LuceneTool *lucene_p, const SearchServiceData *data_p);
+SEARCH_SERVICE_LOCAL json_t *SearchZenodo (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p);
 
 
 #ifdef __cplusplus
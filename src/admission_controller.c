@@ -0,0 +1,591 @@
+/*
+ * admission_controller.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "admission_controller.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+/* How much of the limit is kept when searches are too slow */
+static const double S_DECREASE_FACTOR = 0.9;
+
+
+/*
+ * The searches of a single user or API key. Each search costs the
+ * inverse of the user's weight in virtual time, so a user with twice
+ * the weight gets twice the share of the slots when they are contended.
+ */
+typedef struct UserFlow
+{
+	char *uf_user_s;
+
+	uint32 uf_weight;
+
+	/** The most searches that the user can run at once, or 0 for no limit. */
+	uint32 uf_max_running;
+
+	uint32 uf_num_running;
+
+	uint32 uf_num_waiting;
+
+	/** The virtual time at which the user's last search finishes. */
+	double uf_finish_tag;
+
+	struct UserFlow *uf_next_p;
+} UserFlow;
+
+
+/*
+ * A search waiting for a slot. These live on the waiting threads' stacks.
+ */
+typedef struct Waiter
+{
+	UserFlow *wa_flow_p;
+
+	/** The virtual time at which the search should start. */
+	double wa_start_tag;
+
+	bool wa_granted_flag;
+
+	struct Waiter *wa_next_p;
+} Waiter;
+
+
+struct AdmissionController
+{
+	/** The limit is fractional so that it can grow by less than one at a time. */
+	double ac_limit;
+
+	uint32 ac_min_limit;
+
+	uint32 ac_max_limit;
+
+	uint32 ac_num_running;
+
+	uint32 ac_num_waiting;
+
+	uint32 ac_max_queue;
+
+	uint32 ac_queue_timeout;
+
+	uint32 ac_target_latency;
+
+	/** When the limit was last decreased, from GetAdmissionTime (). */
+	uint64 ac_decrease_time;
+
+	bool ac_local_only_flag;
+
+	uint32 ac_default_weight;
+
+	uint32 ac_max_running_per_user;
+
+	uint32 ac_max_waiting_per_user;
+
+	/** The weights and limits for individual users, keyed by user. */
+	json_t *ac_users_p;
+
+	/** The start tag of the most recently admitted search. */
+	double ac_virtual_time;
+
+	/** The users that have searches running or waiting or that have used more than their share. */
+	UserFlow *ac_flows_p;
+
+	/** The searches waiting for a slot in the order that they arrived. */
+	Waiter *ac_waiters_p;
+
+	pthread_mutex_t ac_lock;
+
+	pthread_cond_t ac_slot_cond;
+};
+
+
+static bool HasFreeSlot (const AdmissionController *controller_p);
+
+static UserFlow *GetUserFlow (AdmissionController *controller_p, const char *user_s);
+
+static UserFlow *FindUserFlow (AdmissionController *controller_p, const char *user_s);
+
+static void RemoveIdleUserFlow (AdmissionController *controller_p, UserFlow *flow_p);
+
+static bool CanUserRun (const UserFlow *flow_p);
+
+static void StartUserSearch (AdmissionController *controller_p, UserFlow *flow_p, const double start_tag);
+
+static void GrantWaitingSearches (AdmissionController *controller_p);
+
+static void RemoveWaiter (AdmissionController *controller_p, Waiter *waiter_p);
+
+static void RefundUserSearch (AdmissionController *controller_p, UserFlow *flow_p, const double previous_tag, const double start_tag, const double finish_tag);
+
+
+
+AdmissionController *AllocateAdmissionController (const uint32 min_limit, const uint32 max_limit, const uint32 max_queue, const uint32 queue_timeout, const uint32 target_latency, const bool local_only_flag, const uint32 default_weight, const uint32 max_running_per_user, const uint32 max_waiting_per_user, const json_t *users_p)
+{
+	AdmissionController *controller_p = (AdmissionController *) AllocMemory (sizeof (AdmissionController));
+
+	if (controller_p)
+		{
+			controller_p -> ac_min_limit = (min_limit > 0) ? min_limit : 1;
+			controller_p -> ac_max_limit = (max_limit > controller_p -> ac_min_limit) ? max_limit : controller_p -> ac_min_limit;
+			controller_p -> ac_limit = (double) (controller_p -> ac_max_limit);
+			controller_p -> ac_num_running = 0;
+			controller_p -> ac_num_waiting = 0;
+			controller_p -> ac_max_queue = max_queue;
+			controller_p -> ac_queue_timeout = queue_timeout;
+			controller_p -> ac_target_latency = target_latency;
+			controller_p -> ac_decrease_time = 0;
+			controller_p -> ac_local_only_flag = local_only_flag;
+			controller_p -> ac_default_weight = (default_weight > 0) ? default_weight : 1;
+			controller_p -> ac_max_running_per_user = max_running_per_user;
+			controller_p -> ac_max_waiting_per_user = max_waiting_per_user;
+			controller_p -> ac_users_p = users_p ? json_deep_copy (users_p) : NULL;
+			controller_p -> ac_virtual_time = 0.0;
+			controller_p -> ac_flows_p = NULL;
+			controller_p -> ac_waiters_p = NULL;
+
+			if ((controller_p -> ac_users_p) || (!users_p))
+				{
+					if (pthread_mutex_init (& (controller_p -> ac_lock), NULL) == 0)
+						{
+							if (pthread_cond_init (& (controller_p -> ac_slot_cond), NULL) == 0)
+								{
+									return controller_p;
+								}
+
+							pthread_mutex_destroy (& (controller_p -> ac_lock));
+						}
+
+					if (controller_p -> ac_users_p)
+						{
+							json_decref (controller_p -> ac_users_p);
+						}
+				}
+
+			FreeMemory (controller_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate AdmissionController");
+
+	return NULL;
+}
+
+
+void FreeAdmissionController (AdmissionController *controller_p)
+{
+	/* Nothing can be waiting by now so only the flows that are owed time are left */
+	UserFlow *flow_p = controller_p -> ac_flows_p;
+
+	while (flow_p)
+		{
+			UserFlow *next_p = flow_p -> uf_next_p;
+
+			FreeCopiedString (flow_p -> uf_user_s);
+			FreeMemory (flow_p);
+
+			flow_p = next_p;
+		}
+
+	if (controller_p -> ac_users_p)
+		{
+			json_decref (controller_p -> ac_users_p);
+		}
+
+	pthread_cond_destroy (& (controller_p -> ac_slot_cond));
+	pthread_mutex_destroy (& (controller_p -> ac_lock));
+	FreeMemory (controller_p);
+}
+
+
+AdmissionDecision AdmitSearch (AdmissionController *controller_p, const char *user_s)
+{
+	AdmissionDecision decision = AD_ADMITTED;
+	UserFlow *flow_p;
+
+	pthread_mutex_lock (& (controller_p -> ac_lock));
+
+	flow_p = GetUserFlow (controller_p, user_s ? user_s : "");
+
+	if (flow_p)
+		{
+			/* A user that has been idle starts from now rather than from where it left off */
+			const double previous_tag = flow_p -> uf_finish_tag;
+			const double start_tag = (previous_tag > controller_p -> ac_virtual_time) ? previous_tag : controller_p -> ac_virtual_time;
+			const double finish_tag = start_tag + 1.0 / ((double) (flow_p -> uf_weight));
+
+			flow_p -> uf_finish_tag = finish_tag;
+
+			if (HasFreeSlot (controller_p) && CanUserRun (flow_p))
+				{
+					StartUserSearch (controller_p, flow_p, start_tag);
+				}
+			else if ((controller_p -> ac_num_waiting < controller_p -> ac_max_queue) && ((controller_p -> ac_max_waiting_per_user == 0) || (flow_p -> uf_num_waiting < controller_p -> ac_max_waiting_per_user)))
+				{
+					Waiter waiter;
+					Waiter **link_pp = & (controller_p -> ac_waiters_p);
+					struct timespec wake_time;
+					int res = 0;
+
+					clock_gettime (CLOCK_REALTIME, &wake_time);
+					wake_time.tv_sec += (controller_p -> ac_queue_timeout) / 1000;
+					wake_time.tv_nsec += ((controller_p -> ac_queue_timeout) % 1000) * 1000000L;
+
+					if (wake_time.tv_nsec >= 1000000000L)
+						{
+							++ wake_time.tv_sec;
+							wake_time.tv_nsec -= 1000000000L;
+						}
+
+					waiter.wa_flow_p = flow_p;
+					waiter.wa_start_tag = start_tag;
+					waiter.wa_granted_flag = false;
+					waiter.wa_next_p = NULL;
+
+					while (*link_pp)
+						{
+							link_pp = & ((*link_pp) -> wa_next_p);
+						}
+
+					*link_pp = &waiter;
+
+					++ (controller_p -> ac_num_waiting);
+					++ (flow_p -> uf_num_waiting);
+
+					/* FinishSearch () hands the slots out and marks us as granted */
+					while ((! (waiter.wa_granted_flag)) && (res != ETIMEDOUT))
+						{
+							res = pthread_cond_timedwait (& (controller_p -> ac_slot_cond), & (controller_p -> ac_lock), &wake_time);
+						}
+
+					if (! (waiter.wa_granted_flag))
+						{
+							RemoveWaiter (controller_p, &waiter);
+							decision = (controller_p -> ac_local_only_flag) ? AD_LOCAL_ONLY : AD_REJECTED;
+						}
+				}
+			else
+				{
+					decision = (controller_p -> ac_local_only_flag) ? AD_LOCAL_ONLY : AD_REJECTED;
+				}
+
+			if (decision != AD_ADMITTED)
+				{
+					RefundUserSearch (controller_p, flow_p, previous_tag, start_tag, finish_tag);
+					RemoveIdleUserFlow (controller_p, flow_p);
+				}
+		}
+	else
+		{
+			decision = (controller_p -> ac_local_only_flag) ? AD_LOCAL_ONLY : AD_REJECTED;
+		}
+
+	pthread_mutex_unlock (& (controller_p -> ac_lock));
+
+	if (decision != AD_ADMITTED)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Search service is saturated, %s search for \"%s\"", (decision == AD_LOCAL_ONLY) ? "running local-only" : "rejecting", user_s ? user_s : "");
+		}
+
+	return decision;
+}
+
+
+void FinishSearch (AdmissionController *controller_p, const char *user_s, const uint64 latency)
+{
+	UserFlow *flow_p;
+
+	pthread_mutex_lock (& (controller_p -> ac_lock));
+
+	-- (controller_p -> ac_num_running);
+
+	flow_p = FindUserFlow (controller_p, user_s ? user_s : "");
+
+	if (flow_p)
+		{
+			-- (flow_p -> uf_num_running);
+		}
+
+	if (latency > controller_p -> ac_target_latency)
+		{
+			const uint64 now = GetAdmissionTime ();
+
+			/*
+			 * The searches that were running alongside this one will have
+			 * been slow for the same reason, so only count them once.
+			 */
+			if (now - (controller_p -> ac_decrease_time) >= controller_p -> ac_target_latency)
+				{
+					controller_p -> ac_limit *= S_DECREASE_FACTOR;
+
+					if (controller_p -> ac_limit < (double) (controller_p -> ac_min_limit))
+						{
+							controller_p -> ac_limit = (double) (controller_p -> ac_min_limit);
+						}
+
+					controller_p -> ac_decrease_time = now;
+
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Search took " UINT64_FMT " ms, reducing concurrency limit to " UINT32_FMT, latency, (uint32) (controller_p -> ac_limit));
+				}
+		}
+	else if ((controller_p -> ac_num_running + 1) >= (uint32) (controller_p -> ac_limit))
+		{
+			/* Only grow the limit if it is actually being used */
+			controller_p -> ac_limit += 1.0 / (controller_p -> ac_limit);
+
+			if (controller_p -> ac_limit > (double) (controller_p -> ac_max_limit))
+				{
+					controller_p -> ac_limit = (double) (controller_p -> ac_max_limit);
+				}
+		}
+
+	/* The limit may have grown by more than one slot */
+	GrantWaitingSearches (controller_p);
+
+	if (flow_p)
+		{
+			RemoveIdleUserFlow (controller_p, flow_p);
+		}
+
+	pthread_mutex_unlock (& (controller_p -> ac_lock));
+}
+
+
+uint64 GetAdmissionTime (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return ((uint64) now.tv_sec) * 1000 + ((uint64) now.tv_nsec) / 1000000;
+}
+
+
+/*
+ * This must be called with the controller's lock held.
+ */
+static bool HasFreeSlot (const AdmissionController *controller_p)
+{
+	return (controller_p -> ac_num_running < (uint32) (controller_p -> ac_limit));
+}
+
+
+/*
+ * This must be called with the controller's lock held.
+ */
+static UserFlow *GetUserFlow (AdmissionController *controller_p, const char *user_s)
+{
+	UserFlow *flow_p = FindUserFlow (controller_p, user_s);
+
+	if (!flow_p)
+		{
+			flow_p = (UserFlow *) AllocMemory (sizeof (UserFlow));
+
+			if (flow_p)
+				{
+					flow_p -> uf_user_s = EasyCopyToNewString (user_s);
+
+					if (flow_p -> uf_user_s)
+						{
+							const json_t *user_config_p = (controller_p -> ac_users_p) ? json_object_get (controller_p -> ac_users_p, user_s) : NULL;
+
+							flow_p -> uf_weight = controller_p -> ac_default_weight;
+							flow_p -> uf_max_running = controller_p -> ac_max_running_per_user;
+							flow_p -> uf_num_running = 0;
+							flow_p -> uf_num_waiting = 0;
+							flow_p -> uf_finish_tag = controller_p -> ac_virtual_time;
+
+							if (user_config_p)
+								{
+									GetJSONUnsignedInteger (user_config_p, "weight", & (flow_p -> uf_weight));
+									GetJSONUnsignedInteger (user_config_p, "max_concurrent", & (flow_p -> uf_max_running));
+
+									if (flow_p -> uf_weight == 0)
+										{
+											flow_p -> uf_weight = 1;
+										}
+								}
+
+							flow_p -> uf_next_p = controller_p -> ac_flows_p;
+							controller_p -> ac_flows_p = flow_p;
+						}
+					else
+						{
+							FreeMemory (flow_p);
+							flow_p = NULL;
+						}
+				}
+		}
+
+	return flow_p;
+}
+
+
+static UserFlow *FindUserFlow (AdmissionController *controller_p, const char *user_s)
+{
+	UserFlow *flow_p = controller_p -> ac_flows_p;
+
+	while (flow_p)
+		{
+			if (strcmp (flow_p -> uf_user_s, user_s) == 0)
+				{
+					return flow_p;
+				}
+
+			flow_p = flow_p -> uf_next_p;
+		}
+
+	return NULL;
+}
+
+
+/*
+ * This must be called with the controller's lock held. A flow is only
+ * needed while it has searches or is still paying for its earlier ones,
+ * as otherwise a new one would start from the current virtual time anyway.
+ */
+static void RemoveIdleUserFlow (AdmissionController *controller_p, UserFlow *flow_p)
+{
+	if ((flow_p -> uf_num_running == 0) && (flow_p -> uf_num_waiting == 0) && (flow_p -> uf_finish_tag <= controller_p -> ac_virtual_time))
+		{
+			UserFlow **link_pp = & (controller_p -> ac_flows_p);
+
+			while (*link_pp != flow_p)
+				{
+					link_pp = & ((*link_pp) -> uf_next_p);
+				}
+
+			*link_pp = flow_p -> uf_next_p;
+
+			FreeCopiedString (flow_p -> uf_user_s);
+			FreeMemory (flow_p);
+		}
+}
+
+
+static bool CanUserRun (const UserFlow *flow_p)
+{
+	return ((flow_p -> uf_max_running == 0) || (flow_p -> uf_num_running < flow_p -> uf_max_running));
+}
+
+
+/*
+ * This must be called with the controller's lock held.
+ */
+static void StartUserSearch (AdmissionController *controller_p, UserFlow *flow_p, const double start_tag)
+{
+	++ (controller_p -> ac_num_running);
+	++ (flow_p -> uf_num_running);
+
+	if (start_tag > controller_p -> ac_virtual_time)
+		{
+			controller_p -> ac_virtual_time = start_tag;
+		}
+}
+
+
+/*
+ * This must be called with the controller's lock held. The free slots
+ * go to the waiting searches with the earliest start tags whose users
+ * are below their own limits.
+ */
+static void GrantWaitingSearches (AdmissionController *controller_p)
+{
+	bool granted_flag = false;
+
+	while (HasFreeSlot (controller_p))
+		{
+			Waiter *waiter_p = controller_p -> ac_waiters_p;
+			Waiter *next_waiter_p = NULL;
+
+			while (waiter_p)
+				{
+					if (CanUserRun (waiter_p -> wa_flow_p))
+						{
+							if ((!next_waiter_p) || (waiter_p -> wa_start_tag < next_waiter_p -> wa_start_tag))
+								{
+									next_waiter_p = waiter_p;
+								}
+						}
+
+					waiter_p = waiter_p -> wa_next_p;
+				}
+
+			if (next_waiter_p)
+				{
+					RemoveWaiter (controller_p, next_waiter_p);
+					StartUserSearch (controller_p, next_waiter_p -> wa_flow_p, next_waiter_p -> wa_start_tag);
+					next_waiter_p -> wa_granted_flag = true;
+					granted_flag = true;
+				}
+			else
+				{
+					break;
+				}
+		}
+
+	if (granted_flag)
+		{
+			pthread_cond_broadcast (& (controller_p -> ac_slot_cond));
+		}
+}
+
+
+/*
+ * This must be called with the controller's lock held.
+ */
+static void RemoveWaiter (AdmissionController *controller_p, Waiter *waiter_p)
+{
+	Waiter **link_pp = & (controller_p -> ac_waiters_p);
+
+	while (*link_pp != waiter_p)
+		{
+			link_pp = & ((*link_pp) -> wa_next_p);
+		}
+
+	*link_pp = waiter_p -> wa_next_p;
+
+	-- (controller_p -> ac_num_waiting);
+	-- (waiter_p -> wa_flow_p -> uf_num_waiting);
+}
+
+
+/*
+ * This must be called with the controller's lock held. A search that
+ * isn't admitted gives back the virtual time that it was charged so that
+ * its user doesn't fall behind everyone else.
+ */
+static void RefundUserSearch (AdmissionController *controller_p, UserFlow *flow_p, const double previous_tag, const double start_tag, const double finish_tag)
+{
+	if (flow_p -> uf_finish_tag == finish_tag)
+		{
+			/* Nothing else has been charged to the user since */
+			flow_p -> uf_finish_tag = previous_tag;
+		}
+	else
+		{
+			/* The user's later searches were queued behind this one, so move them up */
+			const double cost = finish_tag - start_tag;
+			Waiter *waiter_p;
+
+			for (waiter_p = controller_p -> ac_waiters_p; waiter_p; waiter_p = waiter_p -> wa_next_p)
+				{
+					if ((waiter_p -> wa_flow_p == flow_p) && (waiter_p -> wa_start_tag >= finish_tag))
+						{
+							waiter_p -> wa_start_tag -= cost;
+						}
+				}
+
+			flow_p -> uf_finish_tag -= cost;
+		}
+}
@@ -0,0 +1,763 @@
+/*
+ * author_parser.c
+ *
+ *  Created on: 12 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "author_parser.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "json_util.h"
+#include "string_utils.h"
+
+
+static const char * const S_AUTHOR_NAME_KEY_S = "name";
+
+static const char * const S_AUTHOR_SEPARATOR_S = "; ";
+
+
+/*
+ * Below this length, the joined names are written into a buffer
+ * on the stack rather than one from the heap.
+ */
+#define S_AUTHORS_STACK_BUFFER_SIZE (256)
+
+
+typedef struct AuthorsWriter
+{
+	char *aw_start_s;
+	char *aw_current_s;
+	json_t *aw_names_p;
+} AuthorsWriter;
+
+
+static bool ScanAuthorsArray (const char *value_s, AuthorsWriter *writer_p);
+
+static bool ScanAuthorObject (const char **value_ss, AuthorsWriter *writer_p);
+
+static bool ScanString (const char **value_ss, char *dest_s, size_t *length_p);
+
+static bool SkipValue (const char **value_ss);
+
+static bool AddAuthorName (AuthorsWriter *writer_p, const char *name_s, const size_t length);
+
+static bool SetAuthors (json_t *result_p, AuthorsWriter *writer_p);
+
+static bool SetPlainAuthorList (json_t *result_p, const char *authors_s);
+
+static const char *SkipWhitespace (const char *value_s);
+
+static bool ParseHexCodePoint (const char *value_s, uint32 *code_point_p);
+
+static size_t WriteUTF8 (uint32 code_point, char *dest_s);
+
+
+
+bool AddAuthorsFromString (json_t *result_p, const char *authors_s, const bool list_flag)
+{
+	bool success_flag = false;
+	const char *start_s = SkipWhitespace (authors_s);
+
+	if (*start_s == '[')
+		{
+			/*
+			 * The joined names can never be longer than the serialised
+			 * array that they came from, since every separator between
+			 * two names in the source is longer than "; " and decoding
+			 * escape sequences only ever shrinks the text.
+			 */
+			char buffer_s [S_AUTHORS_STACK_BUFFER_SIZE];
+			const size_t l = strlen (start_s) + 1;
+			char *output_s = (l <= S_AUTHORS_STACK_BUFFER_SIZE) ? buffer_s : (char *) AllocMemory (l);
+
+			if (output_s)
+				{
+					AuthorsWriter writer;
+
+					writer.aw_start_s = output_s;
+					writer.aw_current_s = output_s;
+					writer.aw_names_p = NULL;
+
+					if (list_flag)
+						{
+							writer.aw_names_p = json_array ();
+
+							if (!writer.aw_names_p)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate authors list");
+								}
+						}
+
+					if ((!list_flag) || (writer.aw_names_p))
+						{
+							if (ScanAuthorsArray (start_s, &writer))
+								{
+									success_flag = SetAuthors (result_p, &writer);
+								}
+						}
+
+					if (writer.aw_names_p)
+						{
+							json_decref (writer.aw_names_p);
+						}
+
+					if (output_s != buffer_s)
+						{
+							FreeMemory (output_s);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes for authors", l);
+				}
+		}		/* if (*start_s == '[') */
+
+
+	/*
+	 * If it wasn't a JSON array of authors, just set
+	 * it as a string
+	 */
+	if (!success_flag)
+		{
+			if (SetJSONString (result_p, AP_AUTHOR_S, authors_s))
+				{
+					/*
+					 * Results have the same shape whichever way the portal
+					 * stored the authors, so a plain string is a list of one.
+					 */
+					if (list_flag)
+						{
+							success_flag = SetPlainAuthorList (result_p, authors_s);
+						}
+					else
+						{
+							success_flag = true;
+						}
+				}
+			else
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, result_p, "Failed to set \"%s\": \"%s\"", AP_AUTHOR_S, authors_s);
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool AddAuthorsFromJSON (json_t *result_p, const json_t *authors_p, const bool list_flag)
+{
+	bool success_flag = false;
+
+	if (json_is_array (authors_p))
+		{
+			const size_t num_authors = json_array_size (authors_p);
+			size_t l = 1;
+			size_t i;
+			char *output_s = NULL;
+			char buffer_s [S_AUTHORS_STACK_BUFFER_SIZE];
+
+			/* Work out how much space we need so that we only allocate once */
+			for (i = 0; i < num_authors; ++ i)
+				{
+					const char *name_s = GetJSONString (json_array_get (authors_p, i), S_AUTHOR_NAME_KEY_S);
+
+					if (name_s)
+						{
+							l += strlen (name_s) + strlen (S_AUTHOR_SEPARATOR_S);
+						}
+				}
+
+			output_s = (l <= S_AUTHORS_STACK_BUFFER_SIZE) ? buffer_s : (char *) AllocMemory (l);
+
+			if (output_s)
+				{
+					AuthorsWriter writer;
+
+					writer.aw_start_s = output_s;
+					writer.aw_current_s = output_s;
+					writer.aw_names_p = list_flag ? json_array () : NULL;
+
+					if ((!list_flag) || (writer.aw_names_p))
+						{
+							success_flag = true;
+
+							for (i = 0; (i < num_authors) && success_flag; ++ i)
+								{
+									const json_t *entry_p = json_array_get (authors_p, i);
+
+									if (json_is_object (entry_p))
+										{
+											const char *name_s = GetJSONString (entry_p, S_AUTHOR_NAME_KEY_S);
+
+											if (name_s)
+												{
+													success_flag = AddAuthorName (&writer, name_s, strlen (name_s));
+												}
+										}
+								}
+
+							if (success_flag)
+								{
+									success_flag = SetAuthors (result_p, &writer);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate authors list");
+						}
+
+					if (writer.aw_names_p)
+						{
+							json_decref (writer.aw_names_p);
+						}
+
+					if (output_s != buffer_s)
+						{
+							FreeMemory (output_s);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes for authors", l);
+				}
+
+		}		/* if (json_is_array (authors_p)) */
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, authors_p, "Authors is not a JSON array");
+		}
+
+	return success_flag;
+}
+
+
+
+static bool SetAuthors (json_t *result_p, AuthorsWriter *writer_p)
+{
+	bool success_flag = false;
+
+	*(writer_p -> aw_current_s) = '\0';
+
+	if (SetJSONString (result_p, AP_AUTHOR_S, writer_p -> aw_start_s))
+		{
+			if (writer_p -> aw_names_p)
+				{
+					if (json_object_set (result_p, AP_AUTHORS_LIST_S, writer_p -> aw_names_p) == 0)
+						{
+							success_flag = true;
+						}
+					else
+						{
+							PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, writer_p -> aw_names_p, "Failed to set \"%s\"", AP_AUTHORS_LIST_S);
+						}
+				}
+			else
+				{
+					success_flag = true;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set authors to \"%s\"", writer_p -> aw_start_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Append a name to the joined authors string. If the name is
+ * already in place, i.e. it was decoded directly into the output
+ * buffer, it is shifted along to make space for the separator.
+ */
+static bool AddAuthorName (AuthorsWriter *writer_p, const char *name_s, const size_t length)
+{
+	bool success_flag = true;
+
+	if (writer_p -> aw_current_s != writer_p -> aw_start_s)
+		{
+			const size_t sep_length = strlen (S_AUTHOR_SEPARATOR_S);
+
+			memmove (writer_p -> aw_current_s + sep_length, name_s, length);
+			memcpy (writer_p -> aw_current_s, S_AUTHOR_SEPARATOR_S, sep_length);
+			writer_p -> aw_current_s += sep_length;
+		}
+	else if (name_s != writer_p -> aw_current_s)
+		{
+			memmove (writer_p -> aw_current_s, name_s, length);
+		}
+
+	if (writer_p -> aw_names_p)
+		{
+			json_t *name_p = json_stringn (writer_p -> aw_current_s, length);
+
+			if (name_p)
+				{
+					if (json_array_append_new (writer_p -> aw_names_p, name_p) != 0)
+						{
+							json_decref (name_p);
+							success_flag = false;
+						}
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%.*s\" to authors list", (int) length, writer_p -> aw_current_s);
+				}
+		}
+
+	writer_p -> aw_current_s += length;
+
+	return success_flag;
+}
+
+
+static bool ScanAuthorsArray (const char *value_s, AuthorsWriter *writer_p)
+{
+	const char *current_s = SkipWhitespace (value_s + 1);
+	bool loop_flag = (*current_s != ']');
+
+	while (loop_flag)
+		{
+			if (*current_s == '{')
+				{
+					if (!ScanAuthorObject (&current_s, writer_p))
+						{
+							return false;
+						}
+				}
+			else if (!SkipValue (&current_s))
+				{
+					return false;
+				}
+
+			current_s = SkipWhitespace (current_s);
+
+			if (*current_s == ',')
+				{
+					current_s = SkipWhitespace (current_s + 1);
+				}
+			else if (*current_s == ']')
+				{
+					loop_flag = false;
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	/* Make sure that there is nothing after the end of the array */
+	current_s = SkipWhitespace (current_s + 1);
+
+	return (*current_s == '\0');
+}
+
+
+static bool ScanAuthorObject (const char **value_ss, AuthorsWriter *writer_p)
+{
+	const char *current_s = SkipWhitespace (*value_ss + 1);
+	bool loop_flag = (*current_s != '}');
+
+	while (loop_flag)
+		{
+			const char *key_s = current_s + 1;
+			size_t key_length = 0;
+
+			if ((*current_s != '"') || (!ScanString (&current_s, NULL, &key_length)))
+				{
+					return false;
+				}
+
+			current_s = SkipWhitespace (current_s);
+
+			if (*current_s != ':')
+				{
+					return false;
+				}
+
+			current_s = SkipWhitespace (current_s + 1);
+
+			/*
+			 * The key can't contain escape sequences if it is "name" so a
+			 * straight comparison of the raw characters is fine.
+			 */
+			if ((*current_s == '"') && (key_length == strlen (S_AUTHOR_NAME_KEY_S)) && (strncmp (key_s, S_AUTHOR_NAME_KEY_S, key_length) == 0))
+				{
+					size_t name_length = 0;
+
+					/* Decode the name straight into its final position */
+					char *dest_s = writer_p -> aw_current_s;
+
+					if (!ScanString (&current_s, dest_s, &name_length))
+						{
+							return false;
+						}
+
+					if (!AddAuthorName (writer_p, dest_s, name_length))
+						{
+							return false;
+						}
+				}
+			else if (!SkipValue (&current_s))
+				{
+					return false;
+				}
+
+			current_s = SkipWhitespace (current_s);
+
+			if (*current_s == ',')
+				{
+					current_s = SkipWhitespace (current_s + 1);
+				}
+			else if (*current_s == '}')
+				{
+					loop_flag = false;
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	*value_ss = current_s + 1;
+	return true;
+}
+
+
+/*
+ * Scan a JSON string starting at the opening quote. If dest_s is not NULL,
+ * the decoded value is written to it. On success, *value_ss points
+ * to the character after the closing quote and *length_p holds the
+ * number of bytes that the decoded string takes.
+ */
+static bool ScanString (const char **value_ss, char *dest_s, size_t *length_p)
+{
+	const char *current_s = *value_ss + 1;
+	size_t length = 0;
+
+	while (*current_s != '"')
+		{
+			const unsigned char c = (unsigned char) *current_s;
+
+			if (c < 0x20)
+				{
+					/* Control characters, including the terminator, are not allowed */
+					return false;
+				}
+			else if (c == '\\')
+				{
+					char decoded = '\0';
+
+					++ current_s;
+
+					switch (*current_s)
+						{
+							case '"':
+							case '\\':
+							case '/':
+								decoded = *current_s;
+								break;
+
+							case 'b':
+								decoded = '\b';
+								break;
+
+							case 'f':
+								decoded = '\f';
+								break;
+
+							case 'n':
+								decoded = '\n';
+								break;
+
+							case 'r':
+								decoded = '\r';
+								break;
+
+							case 't':
+								decoded = '\t';
+								break;
+
+							case 'u':
+								{
+									uint32 code_point;
+
+									if (!ParseHexCodePoint (current_s + 1, &code_point))
+										{
+											return false;
+										}
+
+									current_s += 4;
+
+									if ((code_point >= 0xD800) && (code_point <= 0xDBFF))
+										{
+											uint32 low;
+
+											if ((current_s [1] != '\\') || (current_s [2] != 'u') || (!ParseHexCodePoint (current_s + 3, &low)) || (low < 0xDC00) || (low > 0xDFFF))
+												{
+													return false;
+												}
+
+											code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+											current_s += 6;
+										}
+									else if (((code_point >= 0xDC00) && (code_point <= 0xDFFF)) || (code_point == 0))
+										{
+											return false;
+										}
+
+									if (dest_s)
+										{
+											length += WriteUTF8 (code_point, dest_s + length);
+										}
+									else
+										{
+											char temp_s [4];
+											length += WriteUTF8 (code_point, temp_s);
+										}
+								}
+								break;
+
+							default:
+								return false;
+						}
+
+					if (decoded != '\0')
+						{
+							if (dest_s)
+								{
+									dest_s [length] = decoded;
+								}
+
+							++ length;
+						}
+				}
+			else
+				{
+					if (dest_s)
+						{
+							dest_s [length] = (char) c;
+						}
+
+					++ length;
+				}
+
+			++ current_s;
+		}
+
+	*value_ss = current_s + 1;
+	*length_p = length;
+
+	return true;
+}
+
+
+static bool SkipValue (const char **value_ss)
+{
+	const char *current_s = *value_ss;
+	size_t l;
+
+	switch (*current_s)
+		{
+			case '"':
+				if (!ScanString (&current_s, NULL, &l))
+					{
+						return false;
+					}
+				break;
+
+			case '{':
+			case '[':
+				{
+					const char close_c = (*current_s == '{') ? '}' : ']';
+
+					current_s = SkipWhitespace (current_s + 1);
+
+					if (*current_s != close_c)
+						{
+							bool loop_flag = true;
+
+							while (loop_flag)
+								{
+									if (close_c == '}')
+										{
+											if ((*current_s != '"') || (!ScanString (&current_s, NULL, &l)))
+												{
+													return false;
+												}
+
+											current_s = SkipWhitespace (current_s);
+
+											if (*current_s != ':')
+												{
+													return false;
+												}
+
+											current_s = SkipWhitespace (current_s + 1);
+										}
+
+									if (!SkipValue (&current_s))
+										{
+											return false;
+										}
+
+									current_s = SkipWhitespace (current_s);
+
+									if (*current_s == ',')
+										{
+											current_s = SkipWhitespace (current_s + 1);
+										}
+									else if (*current_s == close_c)
+										{
+											loop_flag = false;
+										}
+									else
+										{
+											return false;
+										}
+								}
+						}
+
+					++ current_s;
+				}
+				break;
+
+			default:
+				{
+					/* numbers, true, false and null */
+					const char *start_s = current_s;
+
+					while ((*current_s != '\0') && (strchr (",]} \t\r\n", *current_s) == NULL))
+						{
+							++ current_s;
+						}
+
+					if (current_s == start_s)
+						{
+							return false;
+						}
+				}
+				break;
+		}
+
+	*value_ss = current_s;
+	return true;
+}
+
+
+static bool SetPlainAuthorList (json_t *result_p, const char *authors_s)
+{
+	json_t *names_p = json_array ();
+
+	if (names_p)
+		{
+			/* An empty value has no authors rather than one with no name */
+			if ((IsStringEmpty (authors_s)) || (json_array_append_new (names_p, json_string (authors_s)) == 0))
+				{
+					if (json_object_set_new (result_p, AP_AUTHORS_LIST_S, names_p) == 0)
+						{
+							return true;
+						}
+
+					names_p = NULL;
+				}
+
+			if (names_p)
+				{
+					json_decref (names_p);
+				}
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set \"%s\" to \"%s\"", AP_AUTHORS_LIST_S, authors_s);
+
+	return false;
+}
+
+
+static const char *SkipWhitespace (const char *value_s)
+{
+	while ((*value_s == ' ') || (*value_s == '\t') || (*value_s == '\n') || (*value_s == '\r'))
+		{
+			++ value_s;
+		}
+
+	return value_s;
+}
+
+
+static bool ParseHexCodePoint (const char *value_s, uint32 *code_point_p)
+{
+	uint32 code_point = 0;
+	int i;
+
+	for (i = 0; i < 4; ++ i)
+		{
+			const char c = value_s [i];
+
+			code_point <<= 4;
+
+			if ((c >= '0') && (c <= '9'))
+				{
+					code_point |= (uint32) (c - '0');
+				}
+			else if ((c >= 'a') && (c <= 'f'))
+				{
+					code_point |= (uint32) (c - 'a' + 10);
+				}
+			else if ((c >= 'A') && (c <= 'F'))
+				{
+					code_point |= (uint32) (c - 'A' + 10);
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	*code_point_p = code_point;
+	return true;
+}
+
+
+static size_t WriteUTF8 (uint32 code_point, char *dest_s)
+{
+	size_t l;
+
+	if (code_point < 0x80)
+		{
+			dest_s [0] = (char) code_point;
+			l = 1;
+		}
+	else if (code_point < 0x800)
+		{
+			dest_s [0] = (char) (0xC0 | (code_point >> 6));
+			dest_s [1] = (char) (0x80 | (code_point & 0x3F));
+			l = 2;
+		}
+	else if (code_point < 0x10000)
+		{
+			dest_s [0] = (char) (0xE0 | (code_point >> 12));
+			dest_s [1] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+			dest_s [2] = (char) (0x80 | (code_point & 0x3F));
+			l = 3;
+		}
+	else
+		{
+			dest_s [0] = (char) (0xF0 | (code_point >> 18));
+			dest_s [1] = (char) (0x80 | ((code_point >> 12) & 0x3F));
+			dest_s [2] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+			dest_s [3] = (char) (0x80 | (code_point & 0x3F));
+			l = 4;
+		}
+
+	return l;
+}
@@ -0,0 +1,631 @@
+/*
+ * cache_invalidator.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache_invalidator.h"
+#include "search_cursor.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+/* Notifications are small so anything bigger than this is truncated and ignored */
+#define S_MAX_MESSAGE_SIZE (65536)
+
+/* How often, in milliseconds, the listener checks whether it should stop and that it still has its socket */
+#define S_POLL_INTERVAL (1000)
+
+
+/*
+ * The socket that the notifications arrive on. There is only one of these
+ * per process, shared by every CacheInvalidator, since each instance of
+ * the service would otherwise take the socket from the one before it.
+ */
+typedef struct IndexChangeListener
+{
+	char *icl_socket_path_s;
+
+	int icl_socket_fd;
+
+	/** The file that we bound, so that we can tell if something else replaces it. */
+	dev_t icl_socket_device;
+	ino_t icl_socket_inode;
+
+	pthread_t icl_thread;
+
+	/** Set to <code>true</code> to stop the listener. */
+	bool icl_stop_flag;
+
+	/** Set once the socket has been removed or replaced. */
+	bool icl_lost_flag;
+} IndexChangeListener;
+
+
+struct CacheInvalidator
+{
+	LuceneResultCache *ci_lucene_cache_p;
+
+	NegativeQueryCache *ci_negative_cache_p;
+
+	/** Changes with every notification. */
+	uint64 ci_results_generation;
+
+	/** Only changes when documents are indexed or updated. */
+	uint64 ci_empty_queries_generation;
+
+	/** Makes sure that each notification's generation and removals go together. */
+	pthread_mutex_t ci_lock;
+
+	/** Cleared if the listener loses its socket. */
+	bool ci_listening_flag;
+
+	/**
+	 * Once the socket has been lost, this is added to the index
+	 * generations so that they carry on after the notified ones.
+	 */
+	uint64 ci_fallback_base;
+
+	/** The next CacheInvalidator registered with the listener. */
+	struct CacheInvalidator *ci_next_p;
+};
+
+
+/*
+ * This covers the listener and the list of CacheInvalidators that it
+ * sends the changes to. It is always taken before any CacheInvalidator's
+ * own lock.
+ */
+static pthread_mutex_t s_listener_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static IndexChangeListener *s_listener_p = NULL;
+
+static CacheInvalidator *s_invalidators_p = NULL;
+
+static uint32 s_num_invalidators = 0;
+
+
+static IndexChangeListener *AllocateIndexChangeListener (const char *socket_path_s);
+
+static void StopIndexChangeListener (IndexChangeListener *listener_p);
+
+static int OpenNotificationSocket (const char *socket_path_s);
+
+static bool IsSocketInUse (const struct sockaddr_un *address_p);
+
+static bool HasLostSocket (const IndexChangeListener *listener_p);
+
+static void *RunNotificationListener (void *data_p);
+
+static void ProcessNotification (const char *message_s);
+
+static void NotifyAllCacheInvalidators (const IndexChange change, const char *type_s);
+
+static void StopListeningForAllCacheInvalidators (void);
+
+static bool GetIndexChange (const char *change_s, IndexChange *change_p);
+
+
+
+CacheInvalidator *AllocateCacheInvalidator (const char *socket_path_s, LuceneResultCache *lucene_cache_p, NegativeQueryCache *negative_cache_p)
+{
+	CacheInvalidator *invalidator_p = (CacheInvalidator *) AllocMemory (sizeof (CacheInvalidator));
+
+	if (invalidator_p)
+		{
+			memset (invalidator_p, 0, sizeof (CacheInvalidator));
+
+			invalidator_p -> ci_lucene_cache_p = lucene_cache_p;
+			invalidator_p -> ci_negative_cache_p = negative_cache_p;
+			invalidator_p -> ci_listening_flag = true;
+
+			/* 0 means that the generation is unknown, which turns the caches off */
+			invalidator_p -> ci_results_generation = 1;
+			invalidator_p -> ci_empty_queries_generation = 1;
+
+			if (pthread_mutex_init (& (invalidator_p -> ci_lock), NULL) == 0)
+				{
+					bool registered_flag = false;
+
+					pthread_mutex_lock (&s_listener_lock);
+
+					if (!s_listener_p)
+						{
+							s_listener_p = AllocateIndexChangeListener (socket_path_s);
+						}
+
+					if (s_listener_p)
+						{
+							if (strcmp (s_listener_p -> icl_socket_path_s, socket_path_s) != 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Already listening for index changes on \"%s\" so can't listen on \"%s\"", s_listener_p -> icl_socket_path_s, socket_path_s);
+								}
+							else if (__atomic_load_n (& (s_listener_p -> icl_lost_flag), __ATOMIC_ACQUIRE))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The index change socket \"%s\" has been removed or replaced", socket_path_s);
+								}
+							else
+								{
+									invalidator_p -> ci_next_p = s_invalidators_p;
+									s_invalidators_p = invalidator_p;
+									++ s_num_invalidators;
+
+									registered_flag = true;
+								}
+						}
+
+					pthread_mutex_unlock (&s_listener_lock);
+
+					if (registered_flag)
+						{
+							return invalidator_p;
+						}
+
+					pthread_mutex_destroy (& (invalidator_p -> ci_lock));
+				}
+
+			FreeMemory (invalidator_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeCacheInvalidator (CacheInvalidator *invalidator_p)
+{
+	IndexChangeListener *listener_p = NULL;
+	CacheInvalidator **link_pp;
+
+	pthread_mutex_lock (&s_listener_lock);
+
+	link_pp = &s_invalidators_p;
+
+	while (*link_pp != invalidator_p)
+		{
+			link_pp = & ((*link_pp) -> ci_next_p);
+		}
+
+	*link_pp = invalidator_p -> ci_next_p;
+
+	-- s_num_invalidators;
+
+	if (s_num_invalidators == 0)
+		{
+			listener_p = s_listener_p;
+			s_listener_p = NULL;
+
+			/* Stop before the socket goes so that the listener doesn't think that it has been lost */
+			__atomic_store_n (& (listener_p -> icl_stop_flag), true, __ATOMIC_RELEASE);
+
+			/*
+			 * Only remove the socket if it is still the one that we bound and
+			 * do it before anyone else can bind a new one at the same path.
+			 */
+			if (!HasLostSocket (listener_p))
+				{
+					unlink (listener_p -> icl_socket_path_s);
+				}
+		}
+
+	pthread_mutex_unlock (&s_listener_lock);
+
+	/* The listener takes s_listener_lock so it must be stopped without it */
+	if (listener_p)
+		{
+			StopIndexChangeListener (listener_p);
+		}
+
+	pthread_mutex_destroy (& (invalidator_p -> ci_lock));
+	FreeMemory (invalidator_p);
+}
+
+
+void NotifyIndexChange (CacheInvalidator *invalidator_p, const IndexChange change, const char *type_s)
+{
+	uint64 generation;
+	uint32 num_removed = 0;
+
+	pthread_mutex_lock (& (invalidator_p -> ci_lock));
+
+	/*
+	 * The generations move on before anything is removed so that a search
+	 * which read the index before the change can't add its results back.
+	 */
+	generation = __atomic_add_fetch (& (invalidator_p -> ci_results_generation), 1, __ATOMIC_ACQ_REL);
+
+	if (change != IC_DELETED)
+		{
+			__atomic_add_fetch (& (invalidator_p -> ci_empty_queries_generation), 1, __ATOMIC_ACQ_REL);
+		}
+
+	if (invalidator_p -> ci_lucene_cache_p)
+		{
+			num_removed = InvalidateLuceneResults (invalidator_p -> ci_lucene_cache_p, type_s, generation);
+		}
+
+	pthread_mutex_unlock (& (invalidator_p -> ci_lock));
+
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Index change to \"%s\" removed " UINT32_FMT " cached Lucene pages", type_s ? type_s : "all types", num_removed);
+}
+
+
+bool IsCacheInvalidatorListening (const CacheInvalidator *invalidator_p)
+{
+	return __atomic_load_n (& (invalidator_p -> ci_listening_flag), __ATOMIC_ACQUIRE);
+}
+
+
+uint64 GetFallbackIndexGeneration (const CacheInvalidator *invalidator_p, const uint64 index_generation)
+{
+	if (index_generation > 0)
+		{
+			return index_generation + __atomic_load_n (& (invalidator_p -> ci_fallback_base), __ATOMIC_ACQUIRE);
+		}
+
+	return 0;
+}
+
+
+uint64 GetNotifiedResultsGeneration (const CacheInvalidator *invalidator_p)
+{
+	return __atomic_load_n (& (invalidator_p -> ci_results_generation), __ATOMIC_ACQUIRE);
+}
+
+
+uint64 GetNotifiedEmptyQueriesGeneration (const CacheInvalidator *invalidator_p)
+{
+	return __atomic_load_n (& (invalidator_p -> ci_empty_queries_generation), __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * This must be called with s_listener_lock held.
+ */
+static IndexChangeListener *AllocateIndexChangeListener (const char *socket_path_s)
+{
+	IndexChangeListener *listener_p = (IndexChangeListener *) AllocMemory (sizeof (IndexChangeListener));
+
+	if (listener_p)
+		{
+			memset (listener_p, 0, sizeof (IndexChangeListener));
+
+			listener_p -> icl_socket_path_s = EasyCopyToNewString (socket_path_s);
+
+			if (listener_p -> icl_socket_path_s)
+				{
+					listener_p -> icl_socket_fd = OpenNotificationSocket (socket_path_s);
+
+					if (listener_p -> icl_socket_fd >= 0)
+						{
+							struct stat socket_stat;
+
+							if (stat (socket_path_s, &socket_stat) == 0)
+								{
+									listener_p -> icl_socket_device = socket_stat.st_dev;
+									listener_p -> icl_socket_inode = socket_stat.st_ino;
+
+									if (pthread_create (& (listener_p -> icl_thread), NULL, RunNotificationListener, listener_p) == 0)
+										{
+											PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Listening for index changes on \"%s\"", socket_path_s);
+											return listener_p;
+										}
+
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start the index change listener");
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get the details of index change socket \"%s\": %s", socket_path_s, strerror (errno));
+								}
+
+							close (listener_p -> icl_socket_fd);
+							unlink (socket_path_s);
+						}
+
+					FreeCopiedString (listener_p -> icl_socket_path_s);
+				}
+
+			FreeMemory (listener_p);
+		}
+
+	return NULL;
+}
+
+
+static void StopIndexChangeListener (IndexChangeListener *listener_p)
+{
+	pthread_join (listener_p -> icl_thread, NULL);
+
+	close (listener_p -> icl_socket_fd);
+
+	FreeCopiedString (listener_p -> icl_socket_path_s);
+	FreeMemory (listener_p);
+}
+
+
+static int OpenNotificationSocket (const char *socket_path_s)
+{
+	struct sockaddr_un address;
+
+	if (strlen (socket_path_s) < sizeof (address.sun_path))
+		{
+			memset (&address, 0, sizeof (address));
+			address.sun_family = AF_UNIX;
+			strcpy (address.sun_path, socket_path_s);
+
+			/* Another process, such as another server worker, could already be listening */
+			if (!IsSocketInUse (&address))
+				{
+					int fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+
+					if (fd >= 0)
+						{
+							/* A socket left behind by a previous run would stop us binding */
+							unlink (socket_path_s);
+
+							if (bind (fd, (struct sockaddr *) &address, sizeof (address)) == 0)
+								{
+									return fd;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to bind index change socket \"%s\": %s", socket_path_s, strerror (errno));
+								}
+
+							close (fd);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create index change socket: %s", strerror (errno));
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Index change socket \"%s\" is already being listened on", socket_path_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Index change socket path \"%s\" is too long", socket_path_s);
+		}
+
+	return -1;
+}
+
+
+/*
+ * Connecting to a socket that nothing is bound to any more is refused,
+ * so only a live socket is reported as in use.
+ */
+static bool IsSocketInUse (const struct sockaddr_un *address_p)
+{
+	bool in_use_flag = false;
+	int fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+
+	if (fd >= 0)
+		{
+			if (connect (fd, (const struct sockaddr *) address_p, sizeof (struct sockaddr_un)) == 0)
+				{
+					in_use_flag = true;
+				}
+
+			close (fd);
+		}
+
+	return in_use_flag;
+}
+
+
+/*
+ * If the socket file has been removed or something else has been bound
+ * at its path, the notifications will no longer reach us.
+ */
+static bool HasLostSocket (const IndexChangeListener *listener_p)
+{
+	struct stat socket_stat;
+
+	if (stat (listener_p -> icl_socket_path_s, &socket_stat) == 0)
+		{
+			return ((socket_stat.st_dev != listener_p -> icl_socket_device) || (socket_stat.st_ino != listener_p -> icl_socket_inode));
+		}
+
+	return true;
+}
+
+
+static void *RunNotificationListener (void *data_p)
+{
+	IndexChangeListener *listener_p = (IndexChangeListener *) data_p;
+	char *message_s = (char *) AllocMemory (S_MAX_MESSAGE_SIZE + 1);
+
+	if (message_s)
+		{
+			struct pollfd poll_fd;
+
+			poll_fd.fd = listener_p -> icl_socket_fd;
+			poll_fd.events = POLLIN;
+
+			while (!__atomic_load_n (& (listener_p -> icl_stop_flag), __ATOMIC_ACQUIRE))
+				{
+					const int res = poll (&poll_fd, 1, S_POLL_INTERVAL);
+
+					if (res > 0)
+						{
+							const ssize_t size = recv (listener_p -> icl_socket_fd, message_s, S_MAX_MESSAGE_SIZE + 1, 0);
+
+							if (size > S_MAX_MESSAGE_SIZE)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Ignoring index change notification larger than %d bytes", S_MAX_MESSAGE_SIZE);
+								}
+							else if (size > 0)
+								{
+									* (message_s + size) = '\0';
+									ProcessNotification (message_s);
+								}
+						}
+					else if ((res == 0) && (HasLostSocket (listener_p)) && (!__atomic_load_n (& (listener_p -> icl_stop_flag), __ATOMIC_ACQUIRE)))
+						{
+							/*
+							 * Changes sent from now on won't reach us, so the caches
+							 * have to go back to using the index generation.
+							 */
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Index change socket \"%s\" has been removed or replaced, using the index generation instead", listener_p -> icl_socket_path_s);
+
+							__atomic_store_n (& (listener_p -> icl_lost_flag), true, __ATOMIC_RELEASE);
+							StopListeningForAllCacheInvalidators ();
+							break;
+						}
+				}
+
+			FreeMemory (message_s);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate index change buffer");
+		}
+
+	return NULL;
+}
+
+
+static void ProcessNotification (const char *message_s)
+{
+	json_error_t error;
+	json_t *message_p = json_loads (message_s, 0, &error);
+
+	if (message_p)
+		{
+			IndexChange change;
+
+			if (GetIndexChange (GetJSONString (message_p, "change"), &change))
+				{
+					const json_t *types_p = json_object_get (message_p, "types");
+
+					if (json_is_array (types_p) && (json_array_size (types_p) > 0))
+						{
+							size_t i;
+							json_t *type_p;
+
+							json_array_foreach (types_p, i, type_p)
+								{
+									if (json_is_string (type_p))
+										{
+											NotifyAllCacheInvalidators (change, json_string_value (type_p));
+										}
+									else
+										{
+											/* We can't tell which type changed so treat them all as changed */
+											PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, type_p, "Unknown type in index change notification");
+											NotifyAllCacheInvalidators (change, NULL);
+										}
+								}
+						}
+					else
+						{
+							NotifyAllCacheInvalidators (change, NULL);
+						}
+				}
+			else
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, message_p, "Unknown change in index change notification");
+				}
+
+			json_decref (message_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to parse index change notification \"%s\": %s", message_s, error.text);
+		}
+}
+
+
+static void NotifyAllCacheInvalidators (const IndexChange change, const char *type_s)
+{
+	CacheInvalidator *invalidator_p;
+
+	pthread_mutex_lock (&s_listener_lock);
+
+	for (invalidator_p = s_invalidators_p; invalidator_p; invalidator_p = invalidator_p -> ci_next_p)
+		{
+			NotifyIndexChange (invalidator_p, change, type_s);
+		}
+
+	pthread_mutex_unlock (&s_listener_lock);
+}
+
+
+static void StopListeningForAllCacheInvalidators (void)
+{
+	CacheInvalidator *invalidator_p;
+
+	pthread_mutex_lock (&s_listener_lock);
+
+	for (invalidator_p = s_invalidators_p; invalidator_p; invalidator_p = invalidator_p -> ci_next_p)
+		{
+			pthread_mutex_lock (& (invalidator_p -> ci_lock));
+
+			/*
+			 * The index generations count from a different place to the notified
+			 * ones, so they are moved past them. Then a search that read a notified
+			 * generation before this can't add to the caches for the index ones.
+			 */
+			__atomic_store_n (& (invalidator_p -> ci_fallback_base), __atomic_load_n (& (invalidator_p -> ci_results_generation), __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+			/*
+			 * The searches stop reading our generations before the caches are
+			 * emptied so that none of the entries from before can be kept.
+			 */
+			__atomic_store_n (& (invalidator_p -> ci_listening_flag), false, __ATOMIC_RELEASE);
+
+			if (invalidator_p -> ci_lucene_cache_p)
+				{
+					UseLuceneIndexGenerations (invalidator_p -> ci_lucene_cache_p);
+				}
+
+			if (invalidator_p -> ci_negative_cache_p)
+				{
+					ForgetEmptyQueries (invalidator_p -> ci_negative_cache_p, SC_LUCENE_EXHAUSTED);
+				}
+
+			pthread_mutex_unlock (& (invalidator_p -> ci_lock));
+		}
+
+	pthread_mutex_unlock (&s_listener_lock);
+}
+
+
+static bool GetIndexChange (const char *change_s, IndexChange *change_p)
+{
+	if (change_s)
+		{
+			if (strcmp (change_s, "index") == 0)
+				{
+					*change_p = IC_INDEXED;
+					return true;
+				}
+			else if (strcmp (change_s, "update") == 0)
+				{
+					*change_p = IC_UPDATED;
+					return true;
+				}
+			else if (strcmp (change_s, "delete") == 0)
+				{
+					*change_p = IC_DELETED;
+					return true;
+				}
+		}
+
+	return false;
+}
@@ -6,22 +6,26 @@
  */
 
 
+#include <stdio.h>
+
 #include "ckan_search_tool.h"
+#include "author_parser.h"
+#include "hit_converter.h"
+#include "external_result_cache.h"
 
 #include "curl_tools.h"
 #include "streams.h"
 #include "byte_buffer.h"
 #include "string_utils.h"
 #include "key_value_pair.h"
-#include "lucene_tool.h"
 
 
-static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, const SearchServiceData *data_p);
+static json_t *GetResult (const json_t *ckan_result_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
 
-static json_t *ParseCKANResults (const json_t *ckan_results_p, LuceneTool *lucene_p, const SearchServiceData *data_p);
+static json_t *ParseCKANResults (const json_t *ckan_results_p, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
 
 
-static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups_p, LuceneTool *lucene_p, const SearchServiceData *data_p);
+static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups_p, FacetAccumulator *facets_p, const SearchConfig *config_p);
 
 
 /*
@@ -29,7 +33,7 @@ static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups
  */
 
 
-json_t *SearchCKAN (const char *query_s, LuceneTool *lucene_p, const SearchServiceData *data_p)
+json_t *SearchCKAN (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p)
 {
 	json_t *grassroots_results_p = NULL;
 	CurlTool *curl_p = AllocateMemoryCurlTool (0);
@@ -44,19 +48,29 @@ json_t *SearchCKAN (const char *query_s, LuceneTool *lucene_p, const SearchServi
 
 					if (escaped_query_s)
 						{
-							if (AppendStringsToByteBuffer (buffer_p, data_p -> ssd_ckan_url_s, "/api/3/action/package_search?q=", escaped_query_s, NULL))
+							if (AppendStringsToByteBuffer (buffer_p, config_p -> sc_ckan_url_s, "/api/3/action/package_search?q=", escaped_query_s, NULL))
 								{
 									bool success_flag = true;
+									char range_s [64];
 
 									/* we no longer need the escaped query so let's delete it */
 									FreeURLEscapedString (escaped_query_s);
 
-									if (data_p -> ssd_ckan_filters_p)
+									/* Only get the hits for this page */
+									snprintf (range_s, sizeof (range_s), "&start=" UINT32_FMT "&rows=" UINT32_FMT, page_p -> sp_from, page_p -> sp_size);
+
+									if (!AppendStringsToByteBuffer (buffer_p, range_s, NULL))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\" to byte buffer", range_s);
+											success_flag = false;
+										}
+
+									if (config_p -> sc_ckan_filters_p)
 										{
 											size_t i;
 											json_t *filter_p;
 
-											json_array_foreach (data_p -> ssd_ckan_filters_p, i, filter_p)
+											json_array_foreach (config_p -> sc_ckan_filters_p, i, filter_p)
 												{
 													const char *key_s = GetJSONString (filter_p, "key");
 
@@ -92,46 +106,17 @@ json_t *SearchCKAN (const char *query_s, LuceneTool *lucene_p, const SearchServi
 									if (success_flag)
 										{
 											const char *url_s = GetByteBufferData (buffer_p);
+											json_t *ckan_results_p = GetExternalResults (config_p -> sc_external_cache_p, config_p -> sc_hedge_p, url_s, trace_p);
 
-											if (SetUriForCurlTool (curl_p, url_s))
+											if (ckan_results_p)
 												{
-													CURLcode res = RunCurlTool (curl_p);
-
-													if (res == CURLE_OK)
-														{
-															const char *result_s = GetCurlToolData (curl_p);
-
-															if (result_s)
-																{
-																	json_error_t err;
-																	json_t *ckan_results_p = json_loads (result_s, 0, &err);
-
-																	if (ckan_results_p)
-																		{
-																			grassroots_results_p = ParseCKANResults (ckan_results_p, lucene_p, data_p);
-																			json_decref (ckan_results_p);
-																		}
-																	else
-																		{
-																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "json_loads () failed for url \"%s\" with error at %d,%d\n\"%s\"\n", url_s, err.line, err.column, err.text, result_s);
-																		}
-
-																}		/* if (result_s) */
-															else
-																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetCurlToolData () failed for \"%s\"", url_s);
-																}
+													const int32 span = BeginTraceSpan (trace_p, "ParseCKANResults");
 
-														}		/* if (res == CURLE_OK) */
-													else
-														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "RunCurlTool () Failed for \"%s\" with error code %d", url_s, res);
-														}
+													grassroots_results_p = ParseCKANResults (ckan_results_p, page_p, facets_p, projection_p, config_p);
 
-												}		/* if (SetUriForCurlTool (curl_p, url_s)) */
-											else
-												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\", \"/api/3/action/package_search?q=\" and \"%s\"", data_p -> ssd_ckan_url_s, query_s);
+													SetTraceSpanInteger (trace_p, span, "hits", page_p -> sp_num_hits);
+													EndTraceSpan (trace_p, span);
+													json_decref (ckan_results_p);
 												}
 
 										}		/* if (success_flag) */
@@ -140,7 +125,7 @@ json_t *SearchCKAN (const char *query_s, LuceneTool *lucene_p, const SearchServi
 								}		/* if (AppendStringsToByteBuffer (buffer_p, ckan_search_url_s, "?q=", query_s, NULL)) */
 							else
 								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\", \"/api/3/action/package_search?q=\" and \"%s\"", data_p -> ssd_ckan_url_s, query_s);
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\", \"/api/3/action/package_search?q=\" and \"%s\"", config_p -> sc_ckan_url_s, query_s);
 								}
 
 						}		/* if (escaped_query_s) */
@@ -168,7 +153,7 @@ json_t *SearchCKAN (const char *query_s, LuceneTool *lucene_p, const SearchServi
 }
 
 
-static json_t *ParseCKANResults (const json_t *ckan_results_p, LuceneTool *lucene_p, const SearchServiceData *data_p)
+static json_t *ParseCKANResults (const json_t *ckan_results_p, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
 {
 	const json_t *ckan_result_p = json_object_get (ckan_results_p, "result");
 
@@ -183,48 +168,9 @@ static json_t *ParseCKANResults (const json_t *ckan_results_p, LuceneTool *lucen
 				{
 					if (json_is_array (results_p))
 						{
-							json_t *res_p = json_object ();
-
-							if (res_p)
-								{
-									json_t *grassroots_results_p = json_array ();
-
-									if (grassroots_results_p)
-										{
-
-											size_t i;
-
-											json_array_foreach (results_p, i, ckan_result_p)
-												{
-													json_t *grassroots_result_p = GetResult (ckan_result_p, lucene_p, data_p);
-
-													if (grassroots_result_p)
-														{
-															if (json_array_append_new (grassroots_results_p, grassroots_result_p) != 0)
-																{
-																	PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, grassroots_result_p, "Failed to add grassroots result");
-																	json_decref (grassroots_result_p);
-																}
-														}
-													else
-														{
-															PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, ckan_result_p, "Failed to create grassroots result");
-														}
-												}
-
-											return grassroots_results_p;
-										}
-									else
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create grassroots results array");
-										}
-
-								}		/* if (res_p) */
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create json object ()");
-								}
+							page_p -> sp_num_hits = (uint32) json_array_size (results_p);
 
+							return ConvertHits (results_p, GetResult, facets_p, projection_p, config_p);
 						}
 					else
 						{
@@ -248,14 +194,14 @@ static json_t *ParseCKANResults (const json_t *ckan_results_p, LuceneTool *lucen
 
 
 
-static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, const SearchServiceData *data_p)
+static json_t *GetResult (const json_t *ckan_result_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
 {
 	json_t *grassroots_result_p = NULL;
 	const char *id_s = GetJSONString (ckan_result_p, "id");
 
 	if (id_s)
 		{
-			char *url_s = ConcatenateVarargsStrings (data_p -> ssd_ckan_url_s, "/dataset/", id_s, NULL);
+			char *url_s = ConcatenateVarargsStrings (config_p -> sc_ckan_url_s, "/dataset/", id_s, NULL);
 
 			if (url_s)
 				{
@@ -277,8 +223,9 @@ static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, con
 														{
 															json_t *groups_p = json_object_get (ckan_result_p, "groups");
 															const char *value_s = GetJSONString (ckan_result_p, "notes");
+															const bool author_list_flag = IsAuthorsListInResultProjection (projection_p, config_p -> sc_author_list_flag);
 
-															if (value_s)
+															if ((value_s) && (IsFieldInResultProjection (projection_p, INDEXING_DESCRIPTION_S)))
 																{
 																	if (!SetJSONString (grassroots_result_p, INDEXING_DESCRIPTION_S, value_s))
 																		{
@@ -286,122 +233,37 @@ static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, con
 																		}
 																}
 
-															value_s = GetJSONString (ckan_result_p, "author");
-															if (value_s)
+															if ((author_list_flag) || (IsFieldInResultProjection (projection_p, AP_AUTHOR_S)))
 																{
-																	/*
-																	 * Is it a json object as some ckan plugins
-																	 * can return json.
-																	 */
-																	json_error_t err;
-																	json_t *authors_p = json_loads (value_s, 0, &err);
-																	bool set_authors_flag = false;
-																	const char * const AUTHORS_KEY_S = "author";
-
-																	if (authors_p)
+																	value_s = GetJSONString (ckan_result_p, "author");
+																	if (value_s)
 																		{
-																			if (json_is_array (authors_p))
+																			/*
+																			 * Is it a json object as some ckan plugins
+																			 * can return json.
+																			 */
+																			if (!AddAuthorsFromString (grassroots_result_p, value_s, author_list_flag))
 																				{
-																					ByteBuffer *buffer_p = AllocateByteBuffer (1024);
-
-																					if (buffer_p)
-																						{
-																							size_t num_authors = json_array_size (authors_p);
-																							size_t i = 0;
-																							bool loop_flag = true;
-																							bool authors_success_flag = true;
-																							bool first_entry_flag = true;
-
-																							while (loop_flag && authors_success_flag)
-																								{
-																									json_t *entry_p = json_array_get (authors_p, i);
-
-																									if (json_is_object (entry_p))
-																										{
-																											const char *name_s = GetJSONString (entry_p, "name");
-
-																											if (name_s)
-																												{
-																													if (first_entry_flag)
-																														{
-																															authors_success_flag = AppendStringToByteBuffer (buffer_p, name_s);
-																															first_entry_flag = false;
-																														}
-																													else
-																														{
-																															authors_success_flag = AppendStringsToByteBuffer (buffer_p, "; ", name_s, NULL);
-																														}
-
-																													if (!authors_success_flag)
-																														{
-																															PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to append \"%s\" to authors", name_s);
-																														}
-																												}
-																										}
-
-																									if (authors_success_flag)
-																										{
-																											++ i;
-
-																											if (i == num_authors)
-																												{
-																													loop_flag = false;
-																												}
-																										}
-																								}		/* while (loop_flag && success_flag */
-
-																							if (authors_success_flag)
-																								{
-																									const char *authors_s = GetByteBufferData (buffer_p);
-
-																									set_authors_flag = SetJSONString (grassroots_result_p, AUTHORS_KEY_S, authors_s);
-
-																									if (!set_authors_flag)
-																										{
-																											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set authors to \"%s\"", authors_s);
-																										}
-																								}
-
-																							FreeByteBuffer (buffer_p);
-																						}
-
-																				}		/* if (json_is_array (authors_p)) */
-																			else
-																				{
-																					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, authors_p, "Authors is not a JSON array");
+																					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set authors from \"%s\"", value_s);
 																				}
-
-																			json_decref (authors_p);
-																		}		/* if (authors_p) */
-
-																	/*
-																	 * If we didn't manage to set it from a json object
-																	 * just set it as a string
-																	 */
-																	if (!set_authors_flag)
+																		}
+																	else
 																		{
-																			if (!SetJSONString (grassroots_result_p, AUTHORS_KEY_S, value_s))
-																				{
-																					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\": \"%s\"", AUTHORS_KEY_S, value_s);
-																				}
+																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "No authors specified");
 																		}
 																}
-															else
-																{
-																	PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "No authors specified");
-																}
 
-															if (data_p -> ssd_ckan_result_icon_s)
+															if ((config_p -> sc_ckan_result_icon_s) && (IsFieldInResultProjection (projection_p, INDEXING_ICON_URI_S)))
 																{
-																	if (!SetJSONString (grassroots_result_p, INDEXING_ICON_URI_S, data_p -> ssd_ckan_result_icon_s))
+																	if (!SetJSONString (grassroots_result_p, INDEXING_ICON_URI_S, config_p -> sc_ckan_result_icon_s))
 																		{
-																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\": \"%s\"", INDEXING_ICON_URI_S, data_p -> ssd_ckan_result_icon_s);
+																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\": \"%s\"", INDEXING_ICON_URI_S, config_p -> sc_ckan_result_icon_s);
 																		}
 																}
 
-															if (data_p -> ssd_ckan_provider_p)
+															if ((config_p -> sc_ckan_provider_p) && (IsFieldInResultProjection (projection_p, SERVER_PROVIDER_S)))
 																{
-																	if (json_object_set (grassroots_result_p, SERVER_PROVIDER_S, data_p -> ssd_ckan_provider_p) != 0)
+																	if (json_object_set (grassroots_result_p, SERVER_PROVIDER_S, config_p -> sc_ckan_provider_p) != 0)
 																		{
 																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\" object", SERVER_PROVIDER_S);
 																		}
@@ -410,7 +272,7 @@ static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, con
 
 															if (groups_p)
 																{
-																	if (ParseResultGroups (grassroots_result_p, groups_p, lucene_p, data_p))
+																	if (!ParseResultGroups (grassroots_result_p, groups_p, facets_p, config_p))
 																		{
 																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, groups_p, "ParseResultGroups () failed");
 																		}
@@ -454,7 +316,7 @@ static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, con
 				}
 			else
 				{
-					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "ConcatenateVarargsStrings failed for \"%s\", \"/dataset/\", \"%s\"", data_p -> ssd_ckan_url_s, id_s);
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "ConcatenateVarargsStrings failed for \"%s\", \"/dataset/\", \"%s\"", config_p -> sc_ckan_url_s, id_s);
 				}
 
 		}
@@ -467,7 +329,7 @@ static json_t *GetResult (const json_t *ckan_result_p, LuceneTool *lucene_p, con
 }
 
 
-static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups_p, LuceneTool *lucene_p, const SearchServiceData *data_p)
+static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups_p, FacetAccumulator *facets_p, const SearchConfig *config_p)
 {
 	size_t i;
 	const json_t *group_p;
@@ -477,9 +339,9 @@ static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups
 		{
 			const char *type_s = GetJSONString (group_p, "title");
 
-			if (data_p -> ssd_ckan_resource_mappings_p)
+			if (config_p -> sc_ckan_resource_mappings_p)
 				{
-					const json_t *resource_p = json_object_get (data_p -> ssd_ckan_resource_mappings_p, type_s);
+					const json_t *resource_p = json_object_get (config_p -> sc_ckan_resource_mappings_p, type_s);
 
 					if (resource_p)
 						{
@@ -492,11 +354,9 @@ static bool ParseResultGroups (json_t *grassroots_result_p, const json_t *groups
 								{
 									if (SetJSONString (grassroots_result_p, INDEXING_TYPE_DESCRIPTION_S, datatype_description_s))
 										{
-											if (!AddFacetResultToLucene (lucene_p, datatype_description_s, 1))
+											if (!IncrementFacetAccumulator (facets_p, datatype_description_s, 1))
 												{
-													const uint32 count = 1;
-
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\": " UINT32_FMT " as lucene facet", indexing_type_s, count);
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\" facet count", indexing_type_s);
 												}
 
 										}
@@ -0,0 +1,789 @@
+/*
+ * disk_result_cache.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "disk_result_cache.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+/*
+ * Each record is a line of JSON with these keys followed by a line
+ * with the response. The address key is unusual enough that a response
+ * line can't be mistaken for the start of a record.
+ */
+static const char * const S_URL_S = "erc_url";
+
+static const char * const S_TIME_S = "erc_time";
+
+static const char * const S_LENGTH_S = "erc_length";
+
+static const char * const S_ETAG_S = "erc_etag";
+
+static const char * const S_LAST_MODIFIED_S = "erc_last_modified";
+
+
+typedef struct DiskEntry
+{
+	char *de_url_s;
+
+	uint32 de_hash;
+
+	/** Where the response starts in the file. */
+	off_t de_offset;
+
+	/** The length of the response, not including its newline. */
+	uint32 de_length;
+
+	time_t de_fetched_time;
+
+	FetchValidators de_validators;
+
+	struct DiskEntry *de_next_p;
+} DiskEntry;
+
+
+/*
+ * A single lock covers the index and the file. Lookups only read
+ * from the page cache in the usual case, so it is held throughout.
+ */
+struct DiskResultCache
+{
+	char *drc_filename_s;
+
+	int drc_fd;
+
+	/** Used to spot when another process has compacted the file. */
+	ino_t drc_inode;
+
+	/** How far through the file the index has got to. */
+	off_t drc_scanned_size;
+
+	off_t drc_max_size;
+
+	uint32 drc_max_age;
+
+	DiskEntry **drc_buckets_pp;
+	uint32 drc_num_buckets;
+	uint32 drc_num_entries;
+
+	pthread_mutex_t drc_lock;
+};
+
+
+static bool OpenDiskCacheFile (DiskResultCache *cache_p);
+
+static void RefreshDiskCache (DiskResultCache *cache_p);
+
+static void ScanDiskCacheFile (DiskResultCache *cache_p);
+
+static bool AddDiskEntry (DiskResultCache *cache_p, const char *url_s, const off_t offset, const uint32 length, const time_t fetched_time, const FetchValidators *validators_p);
+
+static DiskEntry *FindDiskEntry (DiskResultCache *cache_p, const char *url_s, const uint32 hash);
+
+static void ResizeDiskBuckets (DiskResultCache *cache_p);
+
+static void ClearDiskEntries (DiskResultCache *cache_p);
+
+static char *ReadDiskBody (DiskResultCache *cache_p, const DiskEntry *entry_p);
+
+static char *GetDiskRecord (const char *url_s, const time_t fetched_time, const FetchValidators *validators_p, const char *body_s);
+
+static bool WriteDiskRecord (const int fd, const char *record_s);
+
+static bool CompactDiskCache (DiskResultCache *cache_p);
+
+static int CompareDiskEntryTimes (const void *v0_p, const void *v1_p);
+
+static uint32 GetDiskURLHash (const char *url_s);
+
+
+
+DiskResultCache *AllocateDiskResultCache (const char *filename_s, const uint64 max_size, const uint32 max_age)
+{
+	DiskResultCache *cache_p = (DiskResultCache *) AllocMemory (sizeof (DiskResultCache));
+
+	if (cache_p)
+		{
+			memset (cache_p, 0, sizeof (DiskResultCache));
+
+			cache_p -> drc_fd = -1;
+			cache_p -> drc_max_size = (off_t) max_size;
+			cache_p -> drc_max_age = max_age;
+			cache_p -> drc_num_buckets = 1024;
+			cache_p -> drc_buckets_pp = (DiskEntry **) AllocMemoryArray (cache_p -> drc_num_buckets, sizeof (DiskEntry *));
+
+			if (cache_p -> drc_buckets_pp)
+				{
+					cache_p -> drc_filename_s = EasyCopyToNewString (filename_s);
+
+					if (cache_p -> drc_filename_s)
+						{
+							if (OpenDiskCacheFile (cache_p))
+								{
+									if (pthread_mutex_init (& (cache_p -> drc_lock), NULL) == 0)
+										{
+											PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Opened disk result cache \"%s\" with " UINT32_FMT " responses", filename_s, cache_p -> drc_num_entries);
+
+											return cache_p;
+										}
+
+									close (cache_p -> drc_fd);
+								}
+
+							ClearDiskEntries (cache_p);
+							FreeCopiedString (cache_p -> drc_filename_s);
+						}
+
+					FreeMemory (cache_p -> drc_buckets_pp);
+				}
+
+			FreeMemory (cache_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open disk result cache \"%s\"", filename_s);
+
+	return NULL;
+}
+
+
+void FreeDiskResultCache (DiskResultCache *cache_p)
+{
+	if (cache_p -> drc_fd >= 0)
+		{
+			close (cache_p -> drc_fd);
+		}
+
+	ClearDiskEntries (cache_p);
+
+	pthread_mutex_destroy (& (cache_p -> drc_lock));
+
+	FreeMemory (cache_p -> drc_buckets_pp);
+	FreeCopiedString (cache_p -> drc_filename_s);
+	FreeMemory (cache_p);
+}
+
+
+json_t *GetDiskResult (DiskResultCache *cache_p, const char *url_s, time_t *fetched_time_p, FetchValidators *validators_p)
+{
+	json_t *response_p = NULL;
+	const uint32 hash = GetDiskURLHash (url_s);
+	DiskEntry *entry_p = NULL;
+
+	pthread_mutex_lock (& (cache_p -> drc_lock));
+
+	entry_p = FindDiskEntry (cache_p, url_s, hash);
+
+	if (!entry_p)
+		{
+			/* Another process may have added it */
+			RefreshDiskCache (cache_p);
+			entry_p = FindDiskEntry (cache_p, url_s, hash);
+		}
+
+	if (entry_p)
+		{
+			if (time (NULL) - (entry_p -> de_fetched_time) <= (time_t) (cache_p -> drc_max_age))
+				{
+					char *body_s = ReadDiskBody (cache_p, entry_p);
+
+					if (body_s)
+						{
+							json_error_t err;
+
+							response_p = json_loadb (body_s, entry_p -> de_length, 0, &err);
+
+							if (response_p)
+								{
+									*fetched_time_p = entry_p -> de_fetched_time;
+
+									/* Without them, the response is just fetched in full when it expires */
+									CopyFetchValidators (validators_p, & (entry_p -> de_validators));
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid response for \"%s\" in disk result cache \"%s\": %s", url_s, cache_p -> drc_filename_s, err.text);
+								}
+
+							FreeMemory (body_s);
+						}
+				}
+		}
+
+	pthread_mutex_unlock (& (cache_p -> drc_lock));
+
+	return response_p;
+}
+
+
+bool PutDiskResult (DiskResultCache *cache_p, const char *url_s, const json_t *response_p, const FetchValidators *validators_p, const time_t fetched_time)
+{
+	bool success_flag = false;
+	char *body_s = json_dumps (response_p, JSON_COMPACT);
+
+	if (body_s)
+		{
+			char *record_s = GetDiskRecord (url_s, fetched_time, validators_p, body_s);
+
+			if (record_s)
+				{
+					pthread_mutex_lock (& (cache_p -> drc_lock));
+
+					/* Make sure that we append to the current file */
+					RefreshDiskCache (cache_p);
+
+					if (cache_p -> drc_fd >= 0)
+						{
+							success_flag = WriteDiskRecord (cache_p -> drc_fd, record_s);
+
+							/*
+							 * Rather than work out where our record went, which other
+							 * processes may have appended before or after, just index
+							 * everything new.
+							 */
+							ScanDiskCacheFile (cache_p);
+
+							if ((cache_p -> drc_max_size > 0) && (cache_p -> drc_scanned_size > cache_p -> drc_max_size))
+								{
+									if (!CompactDiskCache (cache_p))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to compact disk result cache \"%s\"", cache_p -> drc_filename_s);
+										}
+								}
+						}
+
+					pthread_mutex_unlock (& (cache_p -> drc_lock));
+
+					FreeCopiedString (record_s);
+				}
+
+			free (body_s);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%s\" to disk result cache \"%s\"", url_s, cache_p -> drc_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * (Re)open the file and index it from the start.
+ */
+static bool OpenDiskCacheFile (DiskResultCache *cache_p)
+{
+	struct stat info;
+
+	if (cache_p -> drc_fd >= 0)
+		{
+			close (cache_p -> drc_fd);
+		}
+
+	ClearDiskEntries (cache_p);
+	cache_p -> drc_scanned_size = 0;
+
+	cache_p -> drc_fd = open (cache_p -> drc_filename_s, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+	if (cache_p -> drc_fd >= 0)
+		{
+			if (fstat (cache_p -> drc_fd, &info) == 0)
+				{
+					cache_p -> drc_inode = info.st_ino;
+					ScanDiskCacheFile (cache_p);
+
+					return true;
+				}
+
+			close (cache_p -> drc_fd);
+			cache_p -> drc_fd = -1;
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open \"%s\"", cache_p -> drc_filename_s);
+
+	return false;
+}
+
+
+/*
+ * This must be called with the cache's lock held.
+ */
+static void RefreshDiskCache (DiskResultCache *cache_p)
+{
+	struct stat info;
+
+	if ((cache_p -> drc_fd >= 0) && (stat (cache_p -> drc_filename_s, &info) == 0) && (info.st_ino == cache_p -> drc_inode))
+		{
+			if (info.st_size > cache_p -> drc_scanned_size)
+				{
+					ScanDiskCacheFile (cache_p);
+				}
+		}
+	else
+		{
+			/* The file has been compacted or removed */
+			OpenDiskCacheFile (cache_p);
+		}
+}
+
+
+/*
+ * Index the records from where the last scan got to. This stops at a
+ * record that is still being written so it can be picked up next time.
+ */
+static void ScanDiskCacheFile (DiskResultCache *cache_p)
+{
+	/* Read through a copy of the descriptor so that the file isn't reopened */
+	const int scan_fd = dup (cache_p -> drc_fd);
+	FILE *in_f = (scan_fd >= 0) ? fdopen (scan_fd, "r") : NULL;
+
+	if (in_f)
+		{
+			struct stat info;
+
+			if ((fstat (fileno (in_f), &info) == 0) && (fseeko (in_f, cache_p -> drc_scanned_size, SEEK_SET) == 0))
+				{
+					const time_t now = time (NULL);
+					char *line_s = NULL;
+					size_t line_size = 0;
+					ssize_t line_length;
+					bool loop_flag = true;
+
+					while (loop_flag && ((line_length = getline (&line_s, &line_size, in_f)) > 0))
+						{
+							const off_t body_offset = cache_p -> drc_scanned_size + line_length;
+
+							loop_flag = false;
+
+							if (line_s [line_length - 1] == '\n')
+								{
+									json_error_t err;
+									json_t *header_p = json_loads (line_s, 0, &err);
+									const char *url_s = header_p ? GetJSONString (header_p, S_URL_S) : NULL;
+
+									if (url_s)
+										{
+											FetchValidators validators;
+											json_int_t fetched_time = 0;
+											json_int_t length = -1;
+
+											/* These only live as long as the header */
+											validators.fv_etag_s = (char *) GetJSONString (header_p, S_ETAG_S);
+											validators.fv_last_modified_s = (char *) GetJSONString (header_p, S_LAST_MODIFIED_S);
+
+											GetJSONInteger (header_p, S_TIME_S, &fetched_time);
+											GetJSONInteger (header_p, S_LENGTH_S, &length);
+
+											if (length >= 0)
+												{
+													const off_t next_offset = body_offset + length + 1;
+
+													if (next_offset <= info.st_size)
+														{
+															if (now - (time_t) fetched_time <= (time_t) (cache_p -> drc_max_age))
+																{
+																	AddDiskEntry (cache_p, url_s, body_offset, (uint32) length, (time_t) fetched_time, &validators);
+																}
+
+															if (fseeko (in_f, next_offset, SEEK_SET) == 0)
+																{
+																	cache_p -> drc_scanned_size = next_offset;
+																	loop_flag = true;
+																}
+														}
+												}
+											else
+												{
+													/* Without its length the record's body can't be found, so skip the header */
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Skipping cached record for \"%s\" with no length in \"%s\"", url_s, cache_p -> drc_filename_s);
+													cache_p -> drc_scanned_size = body_offset;
+													loop_flag = true;
+												}
+										}
+									else
+										{
+											/* Skip anything that isn't the start of a record */
+											cache_p -> drc_scanned_size = body_offset;
+											loop_flag = true;
+										}
+
+									if (header_p)
+										{
+											json_decref (header_p);
+										}
+								}
+						}
+
+					free (line_s);
+				}
+
+			fclose (in_f);
+		}
+	else if (scan_fd >= 0)
+		{
+			close (scan_fd);
+		}
+}
+
+
+/*
+ * A later record for the same address replaces the earlier one.
+ */
+static bool AddDiskEntry (DiskResultCache *cache_p, const char *url_s, const off_t offset, const uint32 length, const time_t fetched_time, const FetchValidators *validators_p)
+{
+	const uint32 hash = GetDiskURLHash (url_s);
+	DiskEntry *entry_p = FindDiskEntry (cache_p, url_s, hash);
+
+	if (!entry_p)
+		{
+			entry_p = (DiskEntry *) AllocMemory (sizeof (DiskEntry));
+
+			if (entry_p)
+				{
+					memset (entry_p, 0, sizeof (DiskEntry));
+
+					entry_p -> de_url_s = EasyCopyToNewString (url_s);
+
+					if (entry_p -> de_url_s)
+						{
+							const uint32 bucket = hash & (cache_p -> drc_num_buckets - 1);
+
+							entry_p -> de_hash = hash;
+							entry_p -> de_next_p = cache_p -> drc_buckets_pp [bucket];
+							cache_p -> drc_buckets_pp [bucket] = entry_p;
+
+							++ (cache_p -> drc_num_entries);
+
+							if (cache_p -> drc_num_entries > (cache_p -> drc_num_buckets << 1))
+								{
+									ResizeDiskBuckets (cache_p);
+								}
+						}
+					else
+						{
+							FreeMemory (entry_p);
+							entry_p = NULL;
+						}
+				}
+		}
+
+	if (entry_p)
+		{
+			entry_p -> de_offset = offset;
+			entry_p -> de_length = length;
+			entry_p -> de_fetched_time = fetched_time;
+
+			/* If this fails, the response just can't be revalidated */
+			CopyFetchValidators (& (entry_p -> de_validators), validators_p);
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to index \"%s\" in disk result cache", url_s);
+
+	return false;
+}
+
+
+static DiskEntry *FindDiskEntry (DiskResultCache *cache_p, const char *url_s, const uint32 hash)
+{
+	DiskEntry *entry_p = cache_p -> drc_buckets_pp [hash & (cache_p -> drc_num_buckets - 1)];
+
+	while (entry_p)
+		{
+			if ((entry_p -> de_hash == hash) && (strcmp (entry_p -> de_url_s, url_s) == 0))
+				{
+					return entry_p;
+				}
+
+			entry_p = entry_p -> de_next_p;
+		}
+
+	return NULL;
+}
+
+
+/*
+ * If we can't get the bigger table, the chains just get longer.
+ */
+static void ResizeDiskBuckets (DiskResultCache *cache_p)
+{
+	const uint32 num_buckets = (cache_p -> drc_num_buckets) << 1;
+	DiskEntry **buckets_pp = (DiskEntry **) AllocMemoryArray (num_buckets, sizeof (DiskEntry *));
+
+	if (buckets_pp)
+		{
+			uint32 i;
+
+			for (i = 0; i < cache_p -> drc_num_buckets; ++ i)
+				{
+					DiskEntry *entry_p = cache_p -> drc_buckets_pp [i];
+
+					while (entry_p)
+						{
+							DiskEntry *next_p = entry_p -> de_next_p;
+							const uint32 bucket = (entry_p -> de_hash) & (num_buckets - 1);
+
+							entry_p -> de_next_p = buckets_pp [bucket];
+							buckets_pp [bucket] = entry_p;
+
+							entry_p = next_p;
+						}
+				}
+
+			FreeMemory (cache_p -> drc_buckets_pp);
+			cache_p -> drc_buckets_pp = buckets_pp;
+			cache_p -> drc_num_buckets = num_buckets;
+		}
+}
+
+
+static void ClearDiskEntries (DiskResultCache *cache_p)
+{
+	uint32 i;
+
+	for (i = 0; i < cache_p -> drc_num_buckets; ++ i)
+		{
+			DiskEntry *entry_p = cache_p -> drc_buckets_pp [i];
+
+			while (entry_p)
+				{
+					DiskEntry *next_p = entry_p -> de_next_p;
+
+					ClearFetchValidators (& (entry_p -> de_validators));
+					FreeCopiedString (entry_p -> de_url_s);
+					FreeMemory (entry_p);
+
+					entry_p = next_p;
+				}
+
+			cache_p -> drc_buckets_pp [i] = NULL;
+		}
+
+	cache_p -> drc_num_entries = 0;
+}
+
+
+static char *ReadDiskBody (DiskResultCache *cache_p, const DiskEntry *entry_p)
+{
+	char *body_s = (char *) AllocMemory ((entry_p -> de_length) + 1);
+
+	if (body_s)
+		{
+			if (pread (cache_p -> drc_fd, body_s, entry_p -> de_length, entry_p -> de_offset) == (ssize_t) (entry_p -> de_length))
+				{
+					* (body_s + (entry_p -> de_length)) = '\0';
+					return body_s;
+				}
+
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to read \"%s\" from disk result cache \"%s\"", entry_p -> de_url_s, cache_p -> drc_filename_s);
+			FreeMemory (body_s);
+		}
+
+	return NULL;
+}
+
+
+static char *GetDiskRecord (const char *url_s, const time_t fetched_time, const FetchValidators *validators_p, const char *body_s)
+{
+	char *record_s = NULL;
+	json_t *header_p = json_pack ("{s:s,s:I,s:I}", S_URL_S, url_s, S_TIME_S, (json_int_t) fetched_time, S_LENGTH_S, (json_int_t) strlen (body_s));
+
+	if (header_p)
+		{
+			bool success_flag = true;
+
+			if (validators_p -> fv_etag_s)
+				{
+					success_flag = SetJSONString (header_p, S_ETAG_S, validators_p -> fv_etag_s);
+				}
+
+			if (success_flag && (validators_p -> fv_last_modified_s))
+				{
+					success_flag = SetJSONString (header_p, S_LAST_MODIFIED_S, validators_p -> fv_last_modified_s);
+				}
+
+			if (success_flag)
+				{
+					char *header_s = json_dumps (header_p, JSON_COMPACT);
+
+					if (header_s)
+						{
+							record_s = ConcatenateVarargsStrings (header_s, "\n", body_s, "\n", NULL);
+							free (header_s);
+						}
+				}
+
+			json_decref (header_p);
+		}
+
+	return record_s;
+}
+
+
+/*
+ * The whole record goes in one call so that records appended by
+ * other processes can't end up in the middle of it.
+ */
+static bool WriteDiskRecord (const int fd, const char *record_s)
+{
+	const size_t length = strlen (record_s);
+
+	return (write (fd, record_s, length) == (ssize_t) length);
+}
+
+
+/*
+ * This must be called with the cache's lock held. The most recent
+ * responses are copied to a new file until it is half of the maximum
+ * size and then it replaces the current one.
+ */
+static bool CompactDiskCache (DiskResultCache *cache_p)
+{
+	bool success_flag = false;
+	DiskEntry **entries_pp = (DiskEntry **) AllocMemoryArray (cache_p -> drc_num_entries, sizeof (DiskEntry *));
+
+	if (entries_pp || (cache_p -> drc_num_entries == 0))
+		{
+			char *temp_filename_s = ConcatenateVarargsStrings (cache_p -> drc_filename_s, ".XXXXXX", NULL);
+
+			if (temp_filename_s)
+				{
+					int out_fd = mkstemp (temp_filename_s);
+
+					if (out_fd >= 0)
+						{
+							const off_t budget = (cache_p -> drc_max_size) >> 1;
+							off_t written = 0;
+							uint32 num_entries = 0;
+							uint32 i;
+
+							for (i = 0; i < cache_p -> drc_num_buckets; ++ i)
+								{
+									DiskEntry *entry_p = cache_p -> drc_buckets_pp [i];
+
+									while (entry_p)
+										{
+											* (entries_pp + num_entries) = entry_p;
+											++ num_entries;
+											entry_p = entry_p -> de_next_p;
+										}
+								}
+
+							qsort (entries_pp, num_entries, sizeof (DiskEntry *), CompareDiskEntryTimes);
+
+							success_flag = true;
+
+							for (i = 0; (i < num_entries) && (written < budget) && success_flag; ++ i)
+								{
+									char *body_s = ReadDiskBody (cache_p, * (entries_pp + i));
+
+									if (body_s)
+										{
+											char *record_s = GetDiskRecord ((* (entries_pp + i)) -> de_url_s, (* (entries_pp + i)) -> de_fetched_time, & ((* (entries_pp + i)) -> de_validators), body_s);
+
+											if (record_s)
+												{
+													if (WriteDiskRecord (out_fd, record_s))
+														{
+															written += strlen (record_s);
+														}
+													else
+														{
+															success_flag = false;
+														}
+
+													FreeCopiedString (record_s);
+												}
+
+											FreeMemory (body_s);
+										}
+								}
+
+							fchmod (out_fd, 0644);
+
+							if (close (out_fd) != 0)
+								{
+									success_flag = false;
+								}
+
+							if (success_flag)
+								{
+									if (rename (temp_filename_s, cache_p -> drc_filename_s) == 0)
+										{
+											success_flag = OpenDiskCacheFile (cache_p);
+										}
+									else
+										{
+											success_flag = false;
+										}
+								}
+
+							if (!success_flag)
+								{
+									remove (temp_filename_s);
+								}
+						}
+
+					FreeCopiedString (temp_filename_s);
+				}
+
+			if (entries_pp)
+				{
+					FreeMemory (entries_pp);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/* Most recent first */
+static int CompareDiskEntryTimes (const void *v0_p, const void *v1_p)
+{
+	const DiskEntry *entry_0_p = * ((const DiskEntry * const *) v0_p);
+	const DiskEntry *entry_1_p = * ((const DiskEntry * const *) v1_p);
+
+	if (entry_0_p -> de_fetched_time > entry_1_p -> de_fetched_time)
+		{
+			return -1;
+		}
+	else if (entry_0_p -> de_fetched_time < entry_1_p -> de_fetched_time)
+		{
+			return 1;
+		}
+
+	return 0;
+}
+
+
+/* FNV-1a */
+static uint32 GetDiskURLHash (const char *url_s)
+{
+	uint32 hash = 2166136261u;
+	const unsigned char *c_p = (const unsigned char *) url_s;
+
+	while (*c_p)
+		{
+			hash ^= *c_p;
+			hash *= 16777619u;
+			++ c_p;
+		}
+
+	return hash;
+}
@@ -0,0 +1,1049 @@
+/*
+ * external_fetch.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "external_fetch.h"
+
+#include "curl_tools.h"
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+/* The number of recent latencies kept for each portal */
+#define S_NUM_SAMPLES (256)
+
+/* Don't hedge until we have some idea of a portal's latencies */
+static const uint32 S_MIN_SAMPLES = 20;
+
+/* The most duplicate requests that can be saved up for a burst */
+static const double S_MAX_HEDGE_TOKENS = 10.0;
+
+static const long S_NOT_MODIFIED_CODE = 304;
+
+
+/*
+ * The phases of a request as reported by curl. The times are in
+ * microseconds from the start of the request.
+ */
+typedef struct FetchTimings
+{
+	/** When the request started, from GetTraceTime (). */
+	uint64 ft_start;
+
+	curl_off_t ft_name_lookup;
+	curl_off_t ft_connect;
+
+	/** This is 0 if the request didn't use TLS. */
+	curl_off_t ft_tls;
+
+	curl_off_t ft_first_byte;
+	curl_off_t ft_total;
+
+	curl_off_t ft_num_bytes;
+
+	long ft_response_code;
+} FetchTimings;
+
+
+typedef struct BackendLatencies
+{
+	/** The scheme and host of the portal's addresses. */
+	char *bl_host_s;
+
+	/** The latencies in milliseconds as a ring buffer. */
+	uint32 bl_samples [S_NUM_SAMPLES];
+
+	uint32 bl_num_samples;
+
+	uint32 bl_next_sample;
+
+	struct BackendLatencies *bl_next_p;
+} BackendLatencies;
+
+
+struct HedgePolicy
+{
+	uint32 hp_percentile;
+
+	/** The share of requests that earn a duplicate. */
+	double hp_hedge_rate;
+
+	uint32 hp_min_delay;
+
+	/** A token bucket that each duplicate request needs a whole token from. */
+	double hp_hedge_tokens;
+
+	BackendLatencies *hp_backends_p;
+
+	/**
+	 * The number of request threads that haven't finished yet, including
+	 * the ones that lost and are still running after their callers have
+	 * returned.
+	 */
+	uint32 hp_num_running;
+
+	pthread_mutex_t hp_lock;
+
+	/** Signalled when hp_num_running drops to 0. */
+	pthread_cond_t hp_idle_cond;
+};
+
+
+/*
+ * The state shared by a caller and its requests. The requests that lose
+ * carry on after the caller has returned until they notice that they've
+ * been cancelled, so this is freed by whichever lets go of it last.
+ */
+typedef struct HedgedRequest
+{
+	HedgePolicy *hr_policy_p;
+
+	char *hr_url_s;
+
+	/** The validators to send with each request. */
+	FetchValidators hr_validators;
+
+	/** Set once a request has succeeded and the rest of the results are filled in. */
+	bool hr_done_flag;
+
+	/** The first successful response. */
+	json_t *hr_response_p;
+
+	/** Did the first successful request say the cached copy is still current? */
+	bool hr_not_modified_flag;
+
+	/** The phases of the request that answered first. */
+	FetchTimings hr_timings;
+
+	/** The number of requests that have been sent. */
+	uint32 hr_num_sent;
+
+	/** The validators from the first successful request. */
+	FetchValidators hr_response_validators;
+
+	/** The latency of the first successful request. */
+	uint64 hr_latency;
+
+	uint32 hr_num_running;
+
+	uint32 hr_num_refs;
+
+	/** Set once the caller has what it needs so that any other requests stop. */
+	bool hr_cancel_flag;
+
+	pthread_mutex_t hr_lock;
+
+	pthread_cond_t hr_cond;
+} HedgedRequest;
+
+
+static json_t *FetchResponse (const char *url_s, const bool *cancel_flag_p, FetchValidators *validators_p, bool *not_modified_flag_p, FetchTimings *timings_p);
+
+static void GetFetchTimings (CURL *curl_p, FetchTimings *timings_p);
+
+static void AddFetchSpans (SearchTrace *trace_p, const char *url_s, const FetchTimings *timings_p, const uint32 num_sent);
+
+static struct curl_slist *AddValidatorHeaders (const FetchValidators *validators_p);
+
+static size_t ReadResponseHeader (char *header_s, size_t size, size_t num_items, void *data_p);
+
+static bool SetValidator (char **value_ss, const char *header_s, const size_t header_length, const char *key_s);
+
+static int CheckCancelled (void *data_p, curl_off_t download_total, curl_off_t download_now, curl_off_t upload_total, curl_off_t upload_now);
+
+static uint64 GetFetchTime (void);
+
+static BackendLatencies *GetBackendLatencies (HedgePolicy *policy_p, const char *url_s);
+
+static uint32 GetHedgeDelay (HedgePolicy *policy_p, BackendLatencies *backend_p);
+
+static void AddLatency (HedgePolicy *policy_p, BackendLatencies *backend_p, const uint64 latency);
+
+static bool TakeHedgeToken (HedgePolicy *policy_p);
+
+static int CompareLatencies (const void *v0_p, const void *v1_p);
+
+static bool StartRequest (HedgedRequest *request_p);
+
+static void *RunRequest (void *data_p);
+
+static void ReleaseHedgedRequest (HedgedRequest *request_p);
+
+static void FinishRequest (HedgePolicy *policy_p);
+
+
+
+HedgePolicy *AllocateHedgePolicy (const uint32 percentile, const uint32 max_percent, const uint32 min_delay)
+{
+	HedgePolicy *policy_p = (HedgePolicy *) AllocMemory (sizeof (HedgePolicy));
+
+	if (policy_p)
+		{
+			policy_p -> hp_percentile = (percentile < 100) ? percentile : 99;
+			policy_p -> hp_hedge_rate = ((double) max_percent) / 100.0;
+			policy_p -> hp_min_delay = min_delay;
+			policy_p -> hp_hedge_tokens = 0.0;
+			policy_p -> hp_backends_p = NULL;
+			policy_p -> hp_num_running = 0;
+
+			if (pthread_mutex_init (& (policy_p -> hp_lock), NULL) == 0)
+				{
+					if (pthread_cond_init (& (policy_p -> hp_idle_cond), NULL) == 0)
+						{
+							return policy_p;
+						}
+
+					pthread_mutex_destroy (& (policy_p -> hp_lock));
+				}
+
+			FreeMemory (policy_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate HedgePolicy");
+
+	return NULL;
+}
+
+
+/*
+ * The requests that lost are still running plugin code, so wait for
+ * them to stop before the service and its module can go away.
+ */
+void FreeHedgePolicy (HedgePolicy *policy_p)
+{
+	BackendLatencies *backend_p = NULL;
+
+	pthread_mutex_lock (& (policy_p -> hp_lock));
+
+	while (policy_p -> hp_num_running > 0)
+		{
+			pthread_cond_wait (& (policy_p -> hp_idle_cond), & (policy_p -> hp_lock));
+		}
+
+	pthread_mutex_unlock (& (policy_p -> hp_lock));
+
+	backend_p = policy_p -> hp_backends_p;
+
+	while (backend_p)
+		{
+			BackendLatencies *next_p = backend_p -> bl_next_p;
+
+			FreeCopiedString (backend_p -> bl_host_s);
+			FreeMemory (backend_p);
+
+			backend_p = next_p;
+		}
+
+	pthread_cond_destroy (& (policy_p -> hp_idle_cond));
+	pthread_mutex_destroy (& (policy_p -> hp_lock));
+	FreeMemory (policy_p);
+}
+
+
+json_t *FetchExternalResponse (HedgePolicy *policy_p, const char *url_s, FetchValidators *validators_p, bool *not_modified_flag_p, SearchTrace *trace_p)
+{
+	json_t *response_p = NULL;
+	BackendLatencies *backend_p = NULL;
+	uint32 delay = 0;
+	bool not_modified_flag = false;
+	FetchTimings timings;
+
+	memset (&timings, 0, sizeof (FetchTimings));
+
+	if (policy_p)
+		{
+			pthread_mutex_lock (& (policy_p -> hp_lock));
+
+			backend_p = GetBackendLatencies (policy_p, url_s);
+
+			if (backend_p)
+				{
+					delay = GetHedgeDelay (policy_p, backend_p);
+				}
+
+			/* Each request earns a share of a duplicate */
+			policy_p -> hp_hedge_tokens += policy_p -> hp_hedge_rate;
+
+			if (policy_p -> hp_hedge_tokens > S_MAX_HEDGE_TOKENS)
+				{
+					policy_p -> hp_hedge_tokens = S_MAX_HEDGE_TOKENS;
+				}
+
+			pthread_mutex_unlock (& (policy_p -> hp_lock));
+		}
+
+	if (delay > 0)
+		{
+			HedgedRequest *request_p = (HedgedRequest *) AllocMemory (sizeof (HedgedRequest));
+
+			if (request_p)
+				{
+					memset (request_p, 0, sizeof (HedgedRequest));
+
+					request_p -> hr_policy_p = policy_p;
+					request_p -> hr_url_s = EasyCopyToNewString (url_s);
+					request_p -> hr_num_refs = 1;
+
+					if (validators_p)
+						{
+							if (!CopyFetchValidators (& (request_p -> hr_validators), validators_p))
+								{
+									/* Fall back to a single request rather than lose the validators */
+									FreeCopiedString (request_p -> hr_url_s);
+									request_p -> hr_url_s = NULL;
+								}
+						}
+
+					if ((request_p -> hr_url_s) && (pthread_mutex_init (& (request_p -> hr_lock), NULL) == 0))
+						{
+							if (pthread_cond_init (& (request_p -> hr_cond), NULL) == 0)
+								{
+									pthread_mutex_lock (& (request_p -> hr_lock));
+
+									if (StartRequest (request_p))
+										{
+											struct timespec wake_time;
+											int res = 0;
+											uint32 num_sent;
+
+											clock_gettime (CLOCK_REALTIME, &wake_time);
+											wake_time.tv_sec += delay / 1000;
+											wake_time.tv_nsec += (delay % 1000) * 1000000L;
+
+											if (wake_time.tv_nsec >= 1000000000L)
+												{
+													++ wake_time.tv_sec;
+													wake_time.tv_nsec -= 1000000000L;
+												}
+
+											while ((! (request_p -> hr_done_flag)) && (request_p -> hr_num_running > 0) && (res != ETIMEDOUT))
+												{
+													res = pthread_cond_timedwait (& (request_p -> hr_cond), & (request_p -> hr_lock), &wake_time);
+												}
+
+											if ((! (request_p -> hr_done_flag)) && (request_p -> hr_num_running > 0))
+												{
+													if (TakeHedgeToken (policy_p))
+														{
+															PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "No response from \"%s\" after " UINT32_FMT " ms, sending a duplicate request", url_s, delay);
+															StartRequest (request_p);
+														}
+												}
+
+											while ((! (request_p -> hr_done_flag)) && (request_p -> hr_num_running > 0))
+												{
+													pthread_cond_wait (& (request_p -> hr_cond), & (request_p -> hr_lock));
+												}
+
+											__atomic_store_n (& (request_p -> hr_cancel_flag), true, __ATOMIC_RELEASE);
+
+											if (request_p -> hr_done_flag)
+												{
+													FetchValidators temp = request_p -> hr_response_validators;
+
+													response_p = request_p -> hr_response_p;
+													request_p -> hr_response_p = NULL;
+													not_modified_flag = request_p -> hr_not_modified_flag;
+													timings = request_p -> hr_timings;
+
+													/* Swap so that the caller's old validators get freed along with the request */
+													if (validators_p)
+														{
+															request_p -> hr_response_validators = *validators_p;
+															*validators_p = temp;
+														}
+
+													AddLatency (policy_p, backend_p, request_p -> hr_latency);
+												}
+
+											num_sent = request_p -> hr_num_sent;
+
+											pthread_mutex_unlock (& (request_p -> hr_lock));
+											ReleaseHedgedRequest (request_p);
+
+											if (response_p || not_modified_flag)
+												{
+													AddFetchSpans (trace_p, url_s, &timings, num_sent);
+												}
+
+											if (not_modified_flag_p)
+												{
+													*not_modified_flag_p = not_modified_flag;
+												}
+
+											return response_p;
+										}
+
+									pthread_mutex_unlock (& (request_p -> hr_lock));
+									pthread_cond_destroy (& (request_p -> hr_cond));
+								}
+
+							pthread_mutex_destroy (& (request_p -> hr_lock));
+						}
+
+					if (request_p -> hr_url_s)
+						{
+							FreeCopiedString (request_p -> hr_url_s);
+						}
+
+					ClearFetchValidators (& (request_p -> hr_validators));
+					FreeMemory (request_p);
+				}
+
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up hedged request for \"%s\", sending a single request", url_s);
+		}
+
+	/* Either hedging is off, we don't know enough about the portal yet or it failed */
+	if (backend_p)
+		{
+			const uint64 start_time = GetFetchTime ();
+
+			response_p = FetchResponse (url_s, NULL, validators_p, &not_modified_flag, &timings);
+
+			if (response_p || not_modified_flag)
+				{
+					AddLatency (policy_p, backend_p, GetFetchTime () - start_time);
+				}
+		}
+	else
+		{
+			response_p = FetchResponse (url_s, NULL, validators_p, &not_modified_flag, &timings);
+		}
+
+	if (response_p || not_modified_flag)
+		{
+			AddFetchSpans (trace_p, url_s, &timings, 1);
+		}
+
+	if (not_modified_flag_p)
+		{
+			*not_modified_flag_p = not_modified_flag;
+		}
+
+	return response_p;
+}
+
+
+bool CopyFetchValidators (FetchValidators *dest_p, const FetchValidators *src_p)
+{
+	ClearFetchValidators (dest_p);
+
+	if (src_p -> fv_etag_s)
+		{
+			dest_p -> fv_etag_s = EasyCopyToNewString (src_p -> fv_etag_s);
+
+			if (! (dest_p -> fv_etag_s))
+				{
+					return false;
+				}
+		}
+
+	if (src_p -> fv_last_modified_s)
+		{
+			dest_p -> fv_last_modified_s = EasyCopyToNewString (src_p -> fv_last_modified_s);
+
+			if (! (dest_p -> fv_last_modified_s))
+				{
+					ClearFetchValidators (dest_p);
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+void ClearFetchValidators (FetchValidators *validators_p)
+{
+	if (validators_p -> fv_etag_s)
+		{
+			FreeCopiedString (validators_p -> fv_etag_s);
+			validators_p -> fv_etag_s = NULL;
+		}
+
+	if (validators_p -> fv_last_modified_s)
+		{
+			FreeCopiedString (validators_p -> fv_last_modified_s);
+			validators_p -> fv_last_modified_s = NULL;
+		}
+}
+
+
+static json_t *FetchResponse (const char *url_s, const bool *cancel_flag_p, FetchValidators *validators_p, bool *not_modified_flag_p, FetchTimings *timings_p)
+{
+	json_t *response_p = NULL;
+	CurlTool *curl_p = AllocateMemoryCurlTool (0);
+
+	*not_modified_flag_p = false;
+
+	if (curl_p)
+		{
+			if (SetUriForCurlTool (curl_p, url_s))
+				{
+					FetchValidators received_validators;
+					struct curl_slist *headers_p = NULL;
+					CURLcode res;
+
+					memset (&received_validators, 0, sizeof (FetchValidators));
+
+					if (cancel_flag_p)
+						{
+							curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_NOPROGRESS, 0L);
+							curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_XFERINFOFUNCTION, CheckCancelled);
+							curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_XFERINFODATA, cancel_flag_p);
+						}
+
+					if (validators_p)
+						{
+							headers_p = AddValidatorHeaders (validators_p);
+
+							if (headers_p)
+								{
+									curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_HTTPHEADER, headers_p);
+								}
+
+							curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_HEADERFUNCTION, ReadResponseHeader);
+							curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_HEADERDATA, &received_validators);
+						}
+
+					timings_p -> ft_start = GetTraceTime ();
+
+					res = RunCurlTool (curl_p);
+
+					GetFetchTimings (curl_p -> ct_curl_p, timings_p);
+
+					if (res == CURLE_OK)
+						{
+							long response_code = 0;
+
+							curl_easy_getinfo (curl_p -> ct_curl_p, CURLINFO_RESPONSE_CODE, &response_code);
+
+							if ((response_code == S_NOT_MODIFIED_CODE) && (headers_p))
+								{
+									/* A 304 needn't repeat the validators, so only replace those that it does */
+									if (received_validators.fv_etag_s)
+										{
+											if (validators_p -> fv_etag_s)
+												{
+													FreeCopiedString (validators_p -> fv_etag_s);
+												}
+
+											validators_p -> fv_etag_s = received_validators.fv_etag_s;
+											received_validators.fv_etag_s = NULL;
+										}
+
+									if (received_validators.fv_last_modified_s)
+										{
+											if (validators_p -> fv_last_modified_s)
+												{
+													FreeCopiedString (validators_p -> fv_last_modified_s);
+												}
+
+											validators_p -> fv_last_modified_s = received_validators.fv_last_modified_s;
+											received_validators.fv_last_modified_s = NULL;
+										}
+
+									*not_modified_flag_p = true;
+								}
+							else
+								{
+									const char *result_s = GetCurlToolData (curl_p);
+
+									if (result_s)
+										{
+											json_error_t err;
+
+											response_p = json_loads (result_s, 0, &err);
+
+											if (response_p)
+												{
+													if (validators_p)
+														{
+															ClearFetchValidators (validators_p);
+															*validators_p = received_validators;
+															memset (&received_validators, 0, sizeof (FetchValidators));
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "json_loads () failed for url \"%s\" with error at %d,%d\n\"%s\"\n", url_s, err.line, err.column, err.text, result_s);
+												}
+
+										}		/* if (result_s) */
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetCurlToolData () failed for \"%s\"", url_s);
+										}
+								}
+
+						}		/* if (res == CURLE_OK) */
+					else if (res != CURLE_ABORTED_BY_CALLBACK)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "RunCurlTool () Failed for \"%s\" with error code %d", url_s, res);
+						}
+
+					if (headers_p)
+						{
+							curl_easy_setopt (curl_p -> ct_curl_p, CURLOPT_HTTPHEADER, NULL);
+							curl_slist_free_all (headers_p);
+						}
+
+					ClearFetchValidators (&received_validators);
+				}		/* if (SetUriForCurlTool (curl_p, url_s)) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "SetUriForCurlTool () failed for \"%s\"", url_s);
+				}
+
+			FreeCurlTool (curl_p);
+		}		/* if (curl_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate CurlTool for \"%s\"", url_s);
+		}
+
+	return response_p;
+}
+
+
+/*
+ * Make the request conditional on the cached copy being out of date. If
+ * this fails, the request is just unconditional.
+ */
+static struct curl_slist *AddValidatorHeaders (const FetchValidators *validators_p)
+{
+	struct curl_slist *headers_p = NULL;
+
+	if (validators_p -> fv_etag_s)
+		{
+			char *header_s = ConcatenateVarargsStrings ("If-None-Match: ", validators_p -> fv_etag_s, NULL);
+
+			if (header_s)
+				{
+					struct curl_slist *list_p = curl_slist_append (headers_p, header_s);
+
+					if (list_p)
+						{
+							headers_p = list_p;
+						}
+
+					FreeCopiedString (header_s);
+				}
+		}
+
+	if (validators_p -> fv_last_modified_s)
+		{
+			char *header_s = ConcatenateVarargsStrings ("If-Modified-Since: ", validators_p -> fv_last_modified_s, NULL);
+
+			if (header_s)
+				{
+					struct curl_slist *list_p = curl_slist_append (headers_p, header_s);
+
+					if (list_p)
+						{
+							headers_p = list_p;
+						}
+
+					FreeCopiedString (header_s);
+				}
+		}
+
+	return headers_p;
+}
+
+
+/*
+ * This is called by curl for each header line, which isn't
+ * nul-terminated. If there are redirects, the last response's
+ * headers win.
+ */
+static size_t ReadResponseHeader (char *header_s, size_t size, size_t num_items, void *data_p)
+{
+	FetchValidators *validators_p = (FetchValidators *) data_p;
+	const size_t length = size * num_items;
+
+	if (!SetValidator (& (validators_p -> fv_etag_s), header_s, length, "ETag:"))
+		{
+			SetValidator (& (validators_p -> fv_last_modified_s), header_s, length, "Last-Modified:");
+		}
+
+	return length;
+}
+
+
+static bool SetValidator (char **value_ss, const char *header_s, const size_t header_length, const char *key_s)
+{
+	const size_t key_length = strlen (key_s);
+
+	if ((header_length > key_length) && (strncasecmp (header_s, key_s, key_length) == 0))
+		{
+			const char *start_s = header_s + key_length;
+			const char *end_s = header_s + header_length;
+
+			while ((start_s < end_s) && ((*start_s == ' ') || (*start_s == '\t')))
+				{
+					++ start_s;
+				}
+
+			while ((end_s > start_s) && ((* (end_s - 1) == '\r') || (* (end_s - 1) == '\n') || (* (end_s - 1) == ' ')))
+				{
+					-- end_s;
+				}
+
+			if (*value_ss)
+				{
+					FreeCopiedString (*value_ss);
+					*value_ss = NULL;
+				}
+
+			if (end_s > start_s)
+				{
+					*value_ss = CopyToNewString (start_s, (size_t) (end_s - start_s), false);
+				}
+
+			return true;
+		}
+
+	return false;
+}
+
+
+/*
+ * Returning non-zero makes curl abort the transfer.
+ */
+static int CheckCancelled (void *data_p, curl_off_t UNUSED_PARAM (download_total), curl_off_t UNUSED_PARAM (download_now), curl_off_t UNUSED_PARAM (upload_total), curl_off_t UNUSED_PARAM (upload_now))
+{
+	const bool *cancel_flag_p = (const bool *) data_p;
+
+	return __atomic_load_n (cancel_flag_p, __ATOMIC_ACQUIRE) ? 1 : 0;
+}
+
+
+static uint64 GetFetchTime (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return ((uint64) now.tv_sec) * 1000 + ((uint64) now.tv_nsec) / 1000000;
+}
+
+
+/*
+ * This must be called with the policy's lock held. The portals are
+ * told apart by the scheme and host of their addresses.
+ */
+static BackendLatencies *GetBackendLatencies (HedgePolicy *policy_p, const char *url_s)
+{
+	BackendLatencies *backend_p = policy_p -> hp_backends_p;
+	const char *end_s = strstr (url_s, "://");
+	size_t host_length;
+
+	end_s = end_s ? strchr (end_s + 3, '/') : NULL;
+	host_length = end_s ? (size_t) (end_s - url_s) : strlen (url_s);
+
+	while (backend_p)
+		{
+			if ((strncmp (backend_p -> bl_host_s, url_s, host_length) == 0) && (* ((backend_p -> bl_host_s) + host_length) == '\0'))
+				{
+					return backend_p;
+				}
+
+			backend_p = backend_p -> bl_next_p;
+		}
+
+	backend_p = (BackendLatencies *) AllocMemory (sizeof (BackendLatencies));
+
+	if (backend_p)
+		{
+			memset (backend_p, 0, sizeof (BackendLatencies));
+
+			backend_p -> bl_host_s = CopyToNewString (url_s, host_length, false);
+
+			if (backend_p -> bl_host_s)
+				{
+					backend_p -> bl_next_p = policy_p -> hp_backends_p;
+					policy_p -> hp_backends_p = backend_p;
+
+					return backend_p;
+				}
+
+			FreeMemory (backend_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * This must be called with the policy's lock held.
+ */
+static uint32 GetHedgeDelay (HedgePolicy *policy_p, BackendLatencies *backend_p)
+{
+	uint32 delay = 0;
+
+	if (backend_p -> bl_num_samples >= S_MIN_SAMPLES)
+		{
+			uint32 samples [S_NUM_SAMPLES];
+
+			memcpy (samples, backend_p -> bl_samples, (backend_p -> bl_num_samples) * sizeof (uint32));
+			qsort (samples, backend_p -> bl_num_samples, sizeof (uint32), CompareLatencies);
+
+			delay = samples [((backend_p -> bl_num_samples) * (policy_p -> hp_percentile)) / 100];
+
+			if (delay < policy_p -> hp_min_delay)
+				{
+					delay = policy_p -> hp_min_delay;
+				}
+
+			/* Zero means don't hedge */
+			if (delay == 0)
+				{
+					delay = 1;
+				}
+		}
+
+	return delay;
+}
+
+
+static void AddLatency (HedgePolicy *policy_p, BackendLatencies *backend_p, const uint64 latency)
+{
+	pthread_mutex_lock (& (policy_p -> hp_lock));
+
+	backend_p -> bl_samples [backend_p -> bl_next_sample] = (latency < 0xFFFFFFFF) ? (uint32) latency : 0xFFFFFFFF;
+	backend_p -> bl_next_sample = ((backend_p -> bl_next_sample) + 1) % S_NUM_SAMPLES;
+
+	if (backend_p -> bl_num_samples < S_NUM_SAMPLES)
+		{
+			++ (backend_p -> bl_num_samples);
+		}
+
+	pthread_mutex_unlock (& (policy_p -> hp_lock));
+}
+
+
+static bool TakeHedgeToken (HedgePolicy *policy_p)
+{
+	bool success_flag = false;
+
+	pthread_mutex_lock (& (policy_p -> hp_lock));
+
+	if (policy_p -> hp_hedge_tokens >= 1.0)
+		{
+			policy_p -> hp_hedge_tokens -= 1.0;
+			success_flag = true;
+		}
+
+	pthread_mutex_unlock (& (policy_p -> hp_lock));
+
+	return success_flag;
+}
+
+
+static int CompareLatencies (const void *v0_p, const void *v1_p)
+{
+	const uint32 latency_0 = * ((const uint32 *) v0_p);
+	const uint32 latency_1 = * ((const uint32 *) v1_p);
+
+	if (latency_0 < latency_1)
+		{
+			return -1;
+		}
+	else if (latency_0 > latency_1)
+		{
+			return 1;
+		}
+
+	return 0;
+}
+
+
+/*
+ * This must be called with the request's lock held. Each request gets
+ * its own CurlTool and so its own connection.
+ */
+static bool StartRequest (HedgedRequest *request_p)
+{
+	HedgePolicy *policy_p = request_p -> hr_policy_p;
+	pthread_t thread;
+
+	++ (request_p -> hr_num_refs);
+	++ (request_p -> hr_num_running);
+
+	pthread_mutex_lock (& (policy_p -> hp_lock));
+	++ (policy_p -> hp_num_running);
+	pthread_mutex_unlock (& (policy_p -> hp_lock));
+
+	if (pthread_create (&thread, NULL, RunRequest, request_p) == 0)
+		{
+			pthread_detach (thread);
+			++ (request_p -> hr_num_sent);
+			return true;
+		}
+
+	-- (request_p -> hr_num_refs);
+	-- (request_p -> hr_num_running);
+	FinishRequest (policy_p);
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start request thread for \"%s\"", request_p -> hr_url_s);
+
+	return false;
+}
+
+
+static void *RunRequest (void *data_p)
+{
+	HedgedRequest *request_p = (HedgedRequest *) data_p;
+	HedgePolicy *policy_p = request_p -> hr_policy_p;
+	const uint64 start_time = GetFetchTime ();
+	FetchValidators validators;
+	json_t *response_p = NULL;
+	bool not_modified_flag = false;
+	FetchTimings timings;
+
+	memset (&timings, 0, sizeof (FetchTimings));
+
+	/* The request's validators aren't changed once the requests have started */
+	memset (&validators, 0, sizeof (FetchValidators));
+
+	if (CopyFetchValidators (&validators, & (request_p -> hr_validators)))
+		{
+			response_p = FetchResponse (request_p -> hr_url_s, & (request_p -> hr_cancel_flag), &validators, &not_modified_flag, &timings);
+		}
+
+	pthread_mutex_lock (& (request_p -> hr_lock));
+
+	if (response_p || not_modified_flag)
+		{
+			if ((! (request_p -> hr_done_flag)) && (! (request_p -> hr_cancel_flag)))
+				{
+					request_p -> hr_done_flag = true;
+					request_p -> hr_response_p = response_p;
+					request_p -> hr_not_modified_flag = not_modified_flag;
+					request_p -> hr_response_validators = validators;
+					request_p -> hr_latency = GetFetchTime () - start_time;
+					request_p -> hr_timings = timings;
+
+					memset (&validators, 0, sizeof (FetchValidators));
+				}
+			else if (response_p)
+				{
+					json_decref (response_p);
+				}
+		}
+
+	-- (request_p -> hr_num_running);
+	pthread_cond_broadcast (& (request_p -> hr_cond));
+
+	pthread_mutex_unlock (& (request_p -> hr_lock));
+
+	ClearFetchValidators (&validators);
+	ReleaseHedgedRequest (request_p);
+
+	/* This must be the last thing that the thread does with the policy */
+	FinishRequest (policy_p);
+
+	return NULL;
+}
+
+
+static void ReleaseHedgedRequest (HedgedRequest *request_p)
+{
+	bool free_flag;
+
+	pthread_mutex_lock (& (request_p -> hr_lock));
+	free_flag = (-- (request_p -> hr_num_refs) == 0);
+	pthread_mutex_unlock (& (request_p -> hr_lock));
+
+	if (free_flag)
+		{
+			if (request_p -> hr_response_p)
+				{
+					json_decref (request_p -> hr_response_p);
+				}
+
+			ClearFetchValidators (& (request_p -> hr_validators));
+			ClearFetchValidators (& (request_p -> hr_response_validators));
+
+			pthread_cond_destroy (& (request_p -> hr_cond));
+			pthread_mutex_destroy (& (request_p -> hr_lock));
+			FreeCopiedString (request_p -> hr_url_s);
+			FreeMemory (request_p);
+		}
+}
+
+
+static void FinishRequest (HedgePolicy *policy_p)
+{
+	pthread_mutex_lock (& (policy_p -> hp_lock));
+
+	if (-- (policy_p -> hp_num_running) == 0)
+		{
+			pthread_cond_broadcast (& (policy_p -> hp_idle_cond));
+		}
+
+	pthread_mutex_unlock (& (policy_p -> hp_lock));
+}
+
+
+static void GetFetchTimings (CURL *curl_p, FetchTimings *timings_p)
+{
+	curl_easy_getinfo (curl_p, CURLINFO_NAMELOOKUP_TIME_T, & (timings_p -> ft_name_lookup));
+	curl_easy_getinfo (curl_p, CURLINFO_CONNECT_TIME_T, & (timings_p -> ft_connect));
+	curl_easy_getinfo (curl_p, CURLINFO_APPCONNECT_TIME_T, & (timings_p -> ft_tls));
+	curl_easy_getinfo (curl_p, CURLINFO_STARTTRANSFER_TIME_T, & (timings_p -> ft_first_byte));
+	curl_easy_getinfo (curl_p, CURLINFO_TOTAL_TIME_T, & (timings_p -> ft_total));
+	curl_easy_getinfo (curl_p, CURLINFO_SIZE_DOWNLOAD_T, & (timings_p -> ft_num_bytes));
+	curl_easy_getinfo (curl_p, CURLINFO_RESPONSE_CODE, & (timings_p -> ft_response_code));
+}
+
+
+/*
+ * Each of curl's times is from the start of the request, so each phase
+ * runs from the end of the one before it. A reused connection has no
+ * lookup, connect or TLS phases.
+ */
+static void AddFetchSpans (SearchTrace *trace_p, const char *url_s, const FetchTimings *timings_p, const uint32 num_sent)
+{
+	if (trace_p)
+		{
+			const uint64 start = timings_p -> ft_start;
+			const uint64 connected = start + (uint64) ((timings_p -> ft_tls > timings_p -> ft_connect) ? timings_p -> ft_tls : timings_p -> ft_connect);
+			const int32 span = AddTraceSpan (trace_p, "HTTP", start, start + (uint64) (timings_p -> ft_total));
+
+			SetTraceSpanString (trace_p, span, "url", url_s);
+			SetTraceSpanInteger (trace_p, span, "status", timings_p -> ft_response_code);
+			SetTraceSpanInteger (trace_p, span, "bytes", timings_p -> ft_num_bytes);
+			SetTraceSpanInteger (trace_p, span, "requests_sent", num_sent);
+
+			if (timings_p -> ft_name_lookup > 0)
+				{
+					AddTraceSpan (trace_p, "DNS", start, start + (uint64) (timings_p -> ft_name_lookup));
+				}
+
+			if (timings_p -> ft_connect > timings_p -> ft_name_lookup)
+				{
+					AddTraceSpan (trace_p, "Connect", start + (uint64) (timings_p -> ft_name_lookup), start + (uint64) (timings_p -> ft_connect));
+				}
+
+			if (timings_p -> ft_tls > timings_p -> ft_connect)
+				{
+					AddTraceSpan (trace_p, "TLS", start + (uint64) (timings_p -> ft_connect), start + (uint64) (timings_p -> ft_tls));
+				}
+
+			AddTraceSpan (trace_p, "Wait", connected, start + (uint64) (timings_p -> ft_first_byte));
+			AddTraceSpan (trace_p, "Transfer", start + (uint64) (timings_p -> ft_first_byte), start + (uint64) (timings_p -> ft_total));
+		}
+}
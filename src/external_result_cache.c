@@ -0,0 +1,705 @@
+/*
+ * external_result_cache.c
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "external_result_cache.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+typedef struct CacheEntry
+{
+	char *ce_url_s;
+
+	uint32 ce_hash;
+
+	/** The portal's response. This is shared, never altered. */
+	json_t *ce_response_p;
+
+	/** When the response was fetched or last confirmed as current by the portal. */
+	time_t ce_fetched_time;
+
+	/** Used to ask the portal whether the response is still current once it expires. */
+	FetchValidators ce_validators;
+
+	/** Is there a background refresh of this entry queued or running? */
+	bool ce_refreshing_flag;
+
+	struct CacheEntry *ce_bucket_next_p;
+
+	/** The neighbouring entries in least recently used order. */
+	struct CacheEntry *ce_lru_prev_p;
+	struct CacheEntry *ce_lru_next_p;
+} CacheEntry;
+
+
+typedef struct RefreshRequest
+{
+	char *rr_url_s;
+	struct RefreshRequest *rr_next_p;
+} RefreshRequest;
+
+
+/*
+ * A single lock covers the whole cache. It is only held for lookups
+ * and updates, never while talking to a portal.
+ */
+struct ExternalResultCache
+{
+	CacheEntry **erc_buckets_pp;
+	uint32 erc_num_buckets;
+
+	uint32 erc_num_entries;
+	uint32 erc_max_entries;
+
+	/** The most recently used entry. */
+	CacheEntry *erc_lru_head_p;
+
+	/** The least recently used entry, which is the next to be removed. */
+	CacheEntry *erc_lru_tail_p;
+
+	uint32 erc_ttl;
+	uint32 erc_grace;
+	uint32 erc_stale_if_error;
+
+	/** The optional second tier. This has its own lock. */
+	DiskResultCache *erc_disk_p;
+
+	RefreshRequest *erc_refresh_head_p;
+	RefreshRequest *erc_refresh_tail_p;
+
+	bool erc_stop_flag;
+
+	pthread_mutex_t erc_lock;
+	pthread_cond_t erc_refresh_cond;
+	pthread_t erc_refresh_thread;
+};
+
+
+static uint32 GetURLHash (const char *url_s);
+
+static CacheEntry *FindCacheEntry (ExternalResultCache *cache_p, const char *url_s, const uint32 hash);
+
+static bool StoreCacheEntry (ExternalResultCache *cache_p, const char *url_s, const uint32 hash, json_t *response_p, const FetchValidators *validators_p, const time_t fetched_time);
+
+static void RemoveLeastRecentlyUsedEntry (ExternalResultCache *cache_p);
+
+static void MoveToFrontOfLRU (ExternalResultCache *cache_p, CacheEntry *entry_p);
+
+static void UnlinkFromLRU (ExternalResultCache *cache_p, CacheEntry *entry_p);
+
+static void FreeCacheEntry (CacheEntry *entry_p);
+
+static bool QueueRefresh (ExternalResultCache *cache_p, const char *url_s);
+
+static void *RunRefreshThread (void *data_p);
+
+static json_t *GetExpiredResponse (CacheEntry *entry_p, FetchValidators *validators_p);
+
+static json_t *RevalidateResponse (HedgePolicy *hedge_p, const char *url_s, json_t *expired_p, FetchValidators *validators_p, SearchTrace *trace_p, bool *revalidated_flag_p);
+
+
+
+ExternalResultCache *AllocateExternalResultCache (const uint32 max_entries, const uint32 ttl, const uint32 grace, const uint32 stale_if_error, DiskResultCache *disk_p)
+{
+	ExternalResultCache *cache_p = (ExternalResultCache *) AllocMemory (sizeof (ExternalResultCache));
+
+	if (cache_p)
+		{
+			uint32 num_buckets = 16;
+
+			memset (cache_p, 0, sizeof (ExternalResultCache));
+
+			while ((num_buckets < max_entries) && (num_buckets < (1u << 30)))
+				{
+					num_buckets <<= 1;
+				}
+
+			cache_p -> erc_buckets_pp = (CacheEntry **) AllocMemoryArray (num_buckets, sizeof (CacheEntry *));
+
+			if (cache_p -> erc_buckets_pp)
+				{
+					cache_p -> erc_num_buckets = num_buckets;
+					cache_p -> erc_max_entries = max_entries;
+					cache_p -> erc_ttl = ttl;
+					cache_p -> erc_grace = grace;
+					cache_p -> erc_stale_if_error = stale_if_error;
+					cache_p -> erc_disk_p = disk_p;
+
+					if (pthread_mutex_init (& (cache_p -> erc_lock), NULL) == 0)
+						{
+							if (pthread_cond_init (& (cache_p -> erc_refresh_cond), NULL) == 0)
+								{
+									if (pthread_create (& (cache_p -> erc_refresh_thread), NULL, RunRefreshThread, cache_p) == 0)
+										{
+											return cache_p;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the external result refresh thread");
+										}
+
+									pthread_cond_destroy (& (cache_p -> erc_refresh_cond));
+								}
+
+							pthread_mutex_destroy (& (cache_p -> erc_lock));
+						}
+
+					FreeMemory (cache_p -> erc_buckets_pp);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " external result cache buckets", num_buckets);
+				}
+
+			FreeMemory (cache_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeExternalResultCache (ExternalResultCache *cache_p)
+{
+	CacheEntry *entry_p;
+	RefreshRequest *request_p;
+
+	pthread_mutex_lock (& (cache_p -> erc_lock));
+	cache_p -> erc_stop_flag = true;
+	pthread_cond_signal (& (cache_p -> erc_refresh_cond));
+	pthread_mutex_unlock (& (cache_p -> erc_lock));
+
+	pthread_join (cache_p -> erc_refresh_thread, NULL);
+
+	request_p = cache_p -> erc_refresh_head_p;
+
+	while (request_p)
+		{
+			RefreshRequest *next_p = request_p -> rr_next_p;
+
+			FreeCopiedString (request_p -> rr_url_s);
+			FreeMemory (request_p);
+
+			request_p = next_p;
+		}
+
+	entry_p = cache_p -> erc_lru_head_p;
+
+	while (entry_p)
+		{
+			CacheEntry *next_p = entry_p -> ce_lru_next_p;
+
+			FreeCacheEntry (entry_p);
+			entry_p = next_p;
+		}
+
+	pthread_cond_destroy (& (cache_p -> erc_refresh_cond));
+	pthread_mutex_destroy (& (cache_p -> erc_lock));
+
+	if (cache_p -> erc_disk_p)
+		{
+			FreeDiskResultCache (cache_p -> erc_disk_p);
+		}
+
+	FreeMemory (cache_p -> erc_buckets_pp);
+	FreeMemory (cache_p);
+}
+
+
+json_t *GetExternalResults (ExternalResultCache *cache_p, HedgePolicy *hedge_p, const char *url_s, SearchTrace *trace_p)
+{
+	json_t *response_p = NULL;
+	uint32 hash;
+	time_t now;
+	CacheEntry *entry_p;
+	const char *cache_status_s = "hit";
+	int32 span;
+
+	if (!cache_p)
+		{
+			return FetchExternalResponse (hedge_p, url_s, NULL, NULL, trace_p);
+		}
+
+	span = BeginTraceSpan (trace_p, "GetExternalResults");
+
+	hash = GetURLHash (url_s);
+	now = time (NULL);
+
+	pthread_mutex_lock (& (cache_p -> erc_lock));
+
+	entry_p = FindCacheEntry (cache_p, url_s, hash);
+
+	if ((!entry_p) && (cache_p -> erc_disk_p))
+		{
+			FetchValidators disk_validators;
+			time_t fetched_time;
+			json_t *disk_response_p;
+
+			memset (&disk_validators, 0, sizeof (FetchValidators));
+
+			/* The disk tier has its own lock so don't hold ours while reading it */
+			pthread_mutex_unlock (& (cache_p -> erc_lock));
+			disk_response_p = GetDiskResult (cache_p -> erc_disk_p, url_s, &fetched_time, &disk_validators);
+			pthread_mutex_lock (& (cache_p -> erc_lock));
+
+			if (disk_response_p)
+				{
+					/* Keep its original time so that it goes stale when it should */
+					if (!FindCacheEntry (cache_p, url_s, hash))
+						{
+							StoreCacheEntry (cache_p, url_s, hash, disk_response_p, &disk_validators, fetched_time);
+						}
+
+					json_decref (disk_response_p);
+				}
+
+			ClearFetchValidators (&disk_validators);
+
+			entry_p = FindCacheEntry (cache_p, url_s, hash);
+		}
+
+	if (entry_p)
+		{
+			const time_t age = now - (entry_p -> ce_fetched_time);
+
+			if (age <= (time_t) (cache_p -> erc_ttl))
+				{
+					response_p = json_incref (entry_p -> ce_response_p);
+					MoveToFrontOfLRU (cache_p, entry_p);
+				}
+			else if (age <= (time_t) (cache_p -> erc_ttl) + (time_t) (cache_p -> erc_grace))
+				{
+					/* Serve the stale copy now and get a new one in the background */
+					response_p = json_incref (entry_p -> ce_response_p);
+					MoveToFrontOfLRU (cache_p, entry_p);
+					cache_status_s = "stale";
+
+					if (!entry_p -> ce_refreshing_flag)
+						{
+							entry_p -> ce_refreshing_flag = QueueRefresh (cache_p, url_s);
+						}
+				}
+		}
+
+	if (!response_p)
+		{
+			FetchValidators validators;
+			json_t *expired_p = NULL;
+			bool revalidated_flag = false;
+
+			memset (&validators, 0, sizeof (FetchValidators));
+
+			if (entry_p)
+				{
+					expired_p = GetExpiredResponse (entry_p, &validators);
+				}
+
+			pthread_mutex_unlock (& (cache_p -> erc_lock));
+
+			response_p = RevalidateResponse (hedge_p, url_s, expired_p, &validators, trace_p, &revalidated_flag);
+			cache_status_s = revalidated_flag ? "revalidated" : "miss";
+
+			if ((response_p) && (cache_p -> erc_disk_p))
+				{
+					PutDiskResult (cache_p -> erc_disk_p, url_s, response_p, &validators, now);
+				}
+
+			pthread_mutex_lock (& (cache_p -> erc_lock));
+
+			if (response_p)
+				{
+					if (!StoreCacheEntry (cache_p, url_s, hash, response_p, &validators, now))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to cache response for \"%s\"", url_s);
+						}
+				}
+			else
+				{
+					/* The entry may have been removed while we were fetching */
+					entry_p = FindCacheEntry (cache_p, url_s, hash);
+
+					if (entry_p)
+						{
+							if ((now - (entry_p -> ce_fetched_time)) <= (time_t) (cache_p -> erc_ttl) + (time_t) (cache_p -> erc_stale_if_error))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Using stale response for \"%s\" as the portal failed", url_s);
+									response_p = json_incref (entry_p -> ce_response_p);
+									cache_status_s = "stale_if_error";
+								}
+						}
+				}
+
+			pthread_mutex_unlock (& (cache_p -> erc_lock));
+
+			ClearFetchValidators (&validators);
+		}
+	else
+		{
+			pthread_mutex_unlock (& (cache_p -> erc_lock));
+		}
+
+	SetTraceSpanString (trace_p, span, "cache", cache_status_s);
+	EndTraceSpan (trace_p, span);
+
+	return response_p;
+}
+
+
+/* FNV-1a */
+static uint32 GetURLHash (const char *url_s)
+{
+	uint32 hash = 2166136261u;
+	const unsigned char *c_p = (const unsigned char *) url_s;
+
+	while (*c_p)
+		{
+			hash ^= *c_p;
+			hash *= 16777619u;
+			++ c_p;
+		}
+
+	return hash;
+}
+
+
+static CacheEntry *FindCacheEntry (ExternalResultCache *cache_p, const char *url_s, const uint32 hash)
+{
+	CacheEntry *entry_p = cache_p -> erc_buckets_pp [hash & (cache_p -> erc_num_buckets - 1)];
+
+	while (entry_p)
+		{
+			if ((entry_p -> ce_hash == hash) && (strcmp (entry_p -> ce_url_s, url_s) == 0))
+				{
+					return entry_p;
+				}
+
+			entry_p = entry_p -> ce_bucket_next_p;
+		}
+
+	return NULL;
+}
+
+
+/*
+ * This must be called with the cache's lock held. The cache takes
+ * its own reference to the response.
+ */
+static bool StoreCacheEntry (ExternalResultCache *cache_p, const char *url_s, const uint32 hash, json_t *response_p, const FetchValidators *validators_p, const time_t fetched_time)
+{
+	CacheEntry *entry_p = FindCacheEntry (cache_p, url_s, hash);
+	json_t *old_response_p = NULL;
+
+	if (entry_p)
+		{
+			old_response_p = entry_p -> ce_response_p;
+		}
+	else
+		{
+			const uint32 bucket = hash & (cache_p -> erc_num_buckets - 1);
+
+			if (cache_p -> erc_num_entries >= cache_p -> erc_max_entries)
+				{
+					RemoveLeastRecentlyUsedEntry (cache_p);
+				}
+
+			entry_p = (CacheEntry *) AllocMemory (sizeof (CacheEntry));
+
+			if (!entry_p)
+				{
+					return false;
+				}
+
+			memset (entry_p, 0, sizeof (CacheEntry));
+
+			entry_p -> ce_url_s = EasyCopyToNewString (url_s);
+
+			if (! (entry_p -> ce_url_s))
+				{
+					FreeMemory (entry_p);
+					return false;
+				}
+
+			entry_p -> ce_hash = hash;
+			entry_p -> ce_bucket_next_p = cache_p -> erc_buckets_pp [bucket];
+			cache_p -> erc_buckets_pp [bucket] = entry_p;
+
+			++ (cache_p -> erc_num_entries);
+		}
+
+	/* The old response may be the same one if the portal said it is still current */
+	entry_p -> ce_response_p = json_incref (response_p);
+
+	if (old_response_p)
+		{
+			json_decref (old_response_p);
+		}
+
+	entry_p -> ce_fetched_time = fetched_time;
+
+	/* If this fails, the response is just fetched in full when it expires */
+	CopyFetchValidators (& (entry_p -> ce_validators), validators_p);
+
+	MoveToFrontOfLRU (cache_p, entry_p);
+
+	return true;
+}
+
+
+static void RemoveLeastRecentlyUsedEntry (ExternalResultCache *cache_p)
+{
+	CacheEntry *entry_p = cache_p -> erc_lru_tail_p;
+
+	if (entry_p)
+		{
+			CacheEntry **link_pp = & (cache_p -> erc_buckets_pp [entry_p -> ce_hash & (cache_p -> erc_num_buckets - 1)]);
+
+			while (*link_pp != entry_p)
+				{
+					link_pp = & ((*link_pp) -> ce_bucket_next_p);
+				}
+
+			*link_pp = entry_p -> ce_bucket_next_p;
+
+			UnlinkFromLRU (cache_p, entry_p);
+			FreeCacheEntry (entry_p);
+
+			-- (cache_p -> erc_num_entries);
+		}
+}
+
+
+static void MoveToFrontOfLRU (ExternalResultCache *cache_p, CacheEntry *entry_p)
+{
+	if (cache_p -> erc_lru_head_p != entry_p)
+		{
+			if ((entry_p -> ce_lru_prev_p) || (cache_p -> erc_lru_tail_p == entry_p))
+				{
+					UnlinkFromLRU (cache_p, entry_p);
+				}
+
+			entry_p -> ce_lru_prev_p = NULL;
+			entry_p -> ce_lru_next_p = cache_p -> erc_lru_head_p;
+
+			if (cache_p -> erc_lru_head_p)
+				{
+					cache_p -> erc_lru_head_p -> ce_lru_prev_p = entry_p;
+				}
+			else
+				{
+					cache_p -> erc_lru_tail_p = entry_p;
+				}
+
+			cache_p -> erc_lru_head_p = entry_p;
+		}
+}
+
+
+static void UnlinkFromLRU (ExternalResultCache *cache_p, CacheEntry *entry_p)
+{
+	if (entry_p -> ce_lru_prev_p)
+		{
+			entry_p -> ce_lru_prev_p -> ce_lru_next_p = entry_p -> ce_lru_next_p;
+		}
+	else
+		{
+			cache_p -> erc_lru_head_p = entry_p -> ce_lru_next_p;
+		}
+
+	if (entry_p -> ce_lru_next_p)
+		{
+			entry_p -> ce_lru_next_p -> ce_lru_prev_p = entry_p -> ce_lru_prev_p;
+		}
+	else
+		{
+			cache_p -> erc_lru_tail_p = entry_p -> ce_lru_prev_p;
+		}
+
+	entry_p -> ce_lru_prev_p = NULL;
+	entry_p -> ce_lru_next_p = NULL;
+}
+
+
+static void FreeCacheEntry (CacheEntry *entry_p)
+{
+	ClearFetchValidators (& (entry_p -> ce_validators));
+	json_decref (entry_p -> ce_response_p);
+	FreeCopiedString (entry_p -> ce_url_s);
+	FreeMemory (entry_p);
+}
+
+
+/*
+ * This must be called with the cache's lock held.
+ */
+static bool QueueRefresh (ExternalResultCache *cache_p, const char *url_s)
+{
+	RefreshRequest *request_p = (RefreshRequest *) AllocMemory (sizeof (RefreshRequest));
+
+	if (request_p)
+		{
+			request_p -> rr_url_s = EasyCopyToNewString (url_s);
+
+			if (request_p -> rr_url_s)
+				{
+					request_p -> rr_next_p = NULL;
+
+					if (cache_p -> erc_refresh_tail_p)
+						{
+							cache_p -> erc_refresh_tail_p -> rr_next_p = request_p;
+						}
+					else
+						{
+							cache_p -> erc_refresh_head_p = request_p;
+						}
+
+					cache_p -> erc_refresh_tail_p = request_p;
+
+					pthread_cond_signal (& (cache_p -> erc_refresh_cond));
+
+					return true;
+				}
+
+			FreeMemory (request_p);
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to queue refresh for \"%s\"", url_s);
+
+	return false;
+}
+
+
+static void *RunRefreshThread (void *data_p)
+{
+	ExternalResultCache *cache_p = (ExternalResultCache *) data_p;
+
+	pthread_mutex_lock (& (cache_p -> erc_lock));
+
+	while (!cache_p -> erc_stop_flag)
+		{
+			RefreshRequest *request_p = cache_p -> erc_refresh_head_p;
+
+			if (request_p)
+				{
+					const uint32 hash = GetURLHash (request_p -> rr_url_s);
+					json_t *response_p = NULL;
+					json_t *expired_p = NULL;
+					FetchValidators validators;
+					CacheEntry *entry_p;
+
+					memset (&validators, 0, sizeof (FetchValidators));
+
+					cache_p -> erc_refresh_head_p = request_p -> rr_next_p;
+
+					if (! (cache_p -> erc_refresh_head_p))
+						{
+							cache_p -> erc_refresh_tail_p = NULL;
+						}
+
+					entry_p = FindCacheEntry (cache_p, request_p -> rr_url_s, hash);
+
+					if (entry_p)
+						{
+							expired_p = GetExpiredResponse (entry_p, &validators);
+						}
+
+					pthread_mutex_unlock (& (cache_p -> erc_lock));
+
+					/* Nobody is waiting for a refresh so there's no point in hedging it */
+					response_p = RevalidateResponse (NULL, request_p -> rr_url_s, expired_p, &validators, NULL, NULL);
+
+					if ((response_p) && (cache_p -> erc_disk_p))
+						{
+							PutDiskResult (cache_p -> erc_disk_p, request_p -> rr_url_s, response_p, &validators, time (NULL));
+						}
+
+					pthread_mutex_lock (& (cache_p -> erc_lock));
+
+					/* If the refresh failed, the stale entry is kept for stale-if-error */
+					if (response_p)
+						{
+							StoreCacheEntry (cache_p, request_p -> rr_url_s, hash, response_p, &validators, time (NULL));
+							json_decref (response_p);
+						}
+
+					ClearFetchValidators (&validators);
+
+					entry_p = FindCacheEntry (cache_p, request_p -> rr_url_s, hash);
+
+					if (entry_p)
+						{
+							entry_p -> ce_refreshing_flag = false;
+						}
+
+					FreeCopiedString (request_p -> rr_url_s);
+					FreeMemory (request_p);
+				}
+			else
+				{
+					pthread_cond_wait (& (cache_p -> erc_refresh_cond), & (cache_p -> erc_lock));
+				}
+		}
+
+	pthread_mutex_unlock (& (cache_p -> erc_lock));
+
+	return NULL;
+}
+
+
+/*
+ * This must be called with the cache's lock held. The expired response
+ * is kept hold of in case the portal says that it is still current, by
+ * which time the entry may have been removed.
+ */
+static json_t *GetExpiredResponse (CacheEntry *entry_p, FetchValidators *validators_p)
+{
+	if ((entry_p -> ce_validators.fv_etag_s) || (entry_p -> ce_validators.fv_last_modified_s))
+		{
+			if (CopyFetchValidators (validators_p, & (entry_p -> ce_validators)))
+				{
+					return json_incref (entry_p -> ce_response_p);
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Ask the portal for a response, sending the validators of any expired
+ * copy so that it needn't send the response again if it hasn't changed.
+ * Afterwards validators_p holds the validators of the returned response.
+ */
+static json_t *RevalidateResponse (HedgePolicy *hedge_p, const char *url_s, json_t *expired_p, FetchValidators *validators_p, SearchTrace *trace_p, bool *revalidated_flag_p)
+{
+	bool not_modified_flag = false;
+	json_t *response_p = FetchExternalResponse (hedge_p, url_s, validators_p, &not_modified_flag, trace_p);
+
+	if (expired_p)
+		{
+			if (not_modified_flag)
+				{
+					PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Cached response for \"%s\" is still current", url_s);
+
+					if (revalidated_flag_p)
+						{
+							*revalidated_flag_p = true;
+						}
+
+					/* Hand over our reference */
+					return expired_p;
+				}
+
+			json_decref (expired_p);
+		}
+
+	return response_p;
+}
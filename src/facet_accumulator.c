@@ -0,0 +1,343 @@
+/*
+ * facet_accumulator.c
+ *
+ *  Created on: 13 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "facet_accumulator.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+/*
+ * A count for a facet name that wasn't interned when
+ * the FacetAccumulator was allocated.
+ */
+typedef struct ExtraFacetCount
+{
+	char *efc_name_s;
+	uint32 efc_count;
+	struct ExtraFacetCount *efc_next_p;
+} ExtraFacetCount;
+
+
+struct FacetAccumulator
+{
+	const FacetKeys *fa_keys_p;
+
+	/* One counter for each of the interned keys, only ever accessed atomically */
+	uint32 *fa_counts_p;
+
+	pthread_mutex_t fa_extras_lock;
+	ExtraFacetCount *fa_extras_p;
+};
+
+
+static int32 GetFacetKeyIndex (const FacetKeys *keys_p, const char *name_s);
+
+static bool IncrementExtraFacetCount (FacetAccumulator *accumulator_p, const char *name_s, const uint32 count);
+
+
+
+FacetKeys *AllocateFacetKeys (void)
+{
+	FacetKeys *keys_p = (FacetKeys *) AllocMemory (sizeof (FacetKeys));
+
+	if (keys_p)
+		{
+			keys_p -> fk_names_ss = NULL;
+			keys_p -> fk_num_names = 0;
+			keys_p -> fk_capacity = 0;
+		}
+
+	return keys_p;
+}
+
+
+void FreeFacetKeys (FacetKeys *keys_p)
+{
+	if (keys_p -> fk_names_ss)
+		{
+			FreeMemory (keys_p -> fk_names_ss);
+		}
+
+	FreeMemory (keys_p);
+}
+
+
+bool InternFacetKey (FacetKeys *keys_p, const char *name_s)
+{
+	if (GetFacetKeyIndex (keys_p, name_s) >= 0)
+		{
+			return true;
+		}
+
+	if (keys_p -> fk_num_names == keys_p -> fk_capacity)
+		{
+			const uint32 new_capacity = (keys_p -> fk_capacity > 0) ? (keys_p -> fk_capacity << 1) : 16;
+			const char **new_names_ss = (const char **) AllocMemoryArray (new_capacity, sizeof (const char *));
+
+			if (!new_names_ss)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " facet keys", new_capacity);
+					return false;
+				}
+
+			if (keys_p -> fk_names_ss)
+				{
+					memcpy (new_names_ss, keys_p -> fk_names_ss, (keys_p -> fk_num_names) * sizeof (const char *));
+					FreeMemory (keys_p -> fk_names_ss);
+				}
+
+			keys_p -> fk_names_ss = new_names_ss;
+			keys_p -> fk_capacity = new_capacity;
+		}
+
+	keys_p -> fk_names_ss [keys_p -> fk_num_names] = name_s;
+	++ (keys_p -> fk_num_names);
+
+	return true;
+}
+
+
+bool InternFacetKeysFromMappings (FacetKeys *keys_p, const json_t *mappings_p)
+{
+	bool success_flag = true;
+	const char *key_s;
+	json_t *value_p;
+
+	json_object_foreach ((json_t *) mappings_p, key_s, value_p)
+		{
+			const char *description_s = GetJSONString (value_p, INDEXING_DESCRIPTION_S);
+
+			if (description_s)
+				{
+					if (!InternFacetKey (keys_p, description_s))
+						{
+							success_flag = false;
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+FacetAccumulator *AllocateFacetAccumulator (const FacetKeys *keys_p)
+{
+	FacetAccumulator *accumulator_p = (FacetAccumulator *) AllocMemory (sizeof (FacetAccumulator));
+
+	if (accumulator_p)
+		{
+			const uint32 num_keys = keys_p ? keys_p -> fk_num_names : 0;
+
+			accumulator_p -> fa_keys_p = keys_p;
+			accumulator_p -> fa_extras_p = NULL;
+			accumulator_p -> fa_counts_p = NULL;
+
+			if ((num_keys == 0) || ((accumulator_p -> fa_counts_p = (uint32 *) AllocMemoryArray (num_keys, sizeof (uint32))) != NULL))
+				{
+					if (num_keys > 0)
+						{
+							memset (accumulator_p -> fa_counts_p, 0, num_keys * sizeof (uint32));
+						}
+
+					if (pthread_mutex_init (& (accumulator_p -> fa_extras_lock), NULL) == 0)
+						{
+							return accumulator_p;
+						}
+
+					if (accumulator_p -> fa_counts_p)
+						{
+							FreeMemory (accumulator_p -> fa_counts_p);
+						}
+				}
+
+			FreeMemory (accumulator_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate FacetAccumulator");
+
+	return NULL;
+}
+
+
+void FreeFacetAccumulator (FacetAccumulator *accumulator_p)
+{
+	ExtraFacetCount *extra_p = accumulator_p -> fa_extras_p;
+
+	while (extra_p)
+		{
+			ExtraFacetCount *next_p = extra_p -> efc_next_p;
+
+			FreeCopiedString (extra_p -> efc_name_s);
+			FreeMemory (extra_p);
+
+			extra_p = next_p;
+		}
+
+	pthread_mutex_destroy (& (accumulator_p -> fa_extras_lock));
+
+	if (accumulator_p -> fa_counts_p)
+		{
+			FreeMemory (accumulator_p -> fa_counts_p);
+		}
+
+	FreeMemory (accumulator_p);
+}
+
+
+bool IncrementFacetAccumulator (FacetAccumulator *accumulator_p, const char *name_s, const uint32 count)
+{
+	int32 index;
+
+	/* The search goes ahead without facet counts if its accumulator couldn't be allocated */
+	if (!accumulator_p)
+		{
+			return true;
+		}
+
+	index = accumulator_p -> fa_keys_p ? GetFacetKeyIndex (accumulator_p -> fa_keys_p, name_s) : -1;
+
+	if (index >= 0)
+		{
+			__atomic_fetch_add ((accumulator_p -> fa_counts_p) + index, count, __ATOMIC_RELAXED);
+			return true;
+		}
+
+	return IncrementExtraFacetCount (accumulator_p, name_s, count);
+}
+
+
+bool FlushFacetAccumulatorToLucene (const FacetAccumulator *accumulator_p, LuceneTool *lucene_p)
+{
+	bool success_flag = true;
+	const ExtraFacetCount *extra_p = accumulator_p -> fa_extras_p;
+
+	if (accumulator_p -> fa_keys_p)
+		{
+			const uint32 num_keys = accumulator_p -> fa_keys_p -> fk_num_names;
+			uint32 i;
+
+			for (i = 0; i < num_keys; ++ i)
+				{
+					const uint32 count = __atomic_load_n ((accumulator_p -> fa_counts_p) + i, __ATOMIC_ACQUIRE);
+
+					if (count > 0)
+						{
+							const char *name_s = accumulator_p -> fa_keys_p -> fk_names_ss [i];
+
+							if (!AddFacetResultToLucene (lucene_p, name_s, count))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\": " UINT32_FMT " as lucene facet", name_s, count);
+									success_flag = false;
+								}
+						}
+				}
+		}
+
+	while (extra_p)
+		{
+			if (!AddFacetResultToLucene (lucene_p, extra_p -> efc_name_s, extra_p -> efc_count))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\": " UINT32_FMT " as lucene facet", extra_p -> efc_name_s, extra_p -> efc_count);
+					success_flag = false;
+				}
+
+			extra_p = extra_p -> efc_next_p;
+		}
+
+	return success_flag;
+}
+
+
+
+/*
+ * The producers pass the name strings straight from the configuration,
+ * which are the same pointers that were interned, so the pointer
+ * comparison nearly always matches before any string comparisons
+ * are needed.
+ */
+static int32 GetFacetKeyIndex (const FacetKeys *keys_p, const char *name_s)
+{
+	const char **names_ss = keys_p -> fk_names_ss;
+	uint32 i;
+
+	for (i = 0; i < keys_p -> fk_num_names; ++ i)
+		{
+			if (names_ss [i] == name_s)
+				{
+					return (int32) i;
+				}
+		}
+
+	for (i = 0; i < keys_p -> fk_num_names; ++ i)
+		{
+			if (strcmp (names_ss [i], name_s) == 0)
+				{
+					return (int32) i;
+				}
+		}
+
+	return -1;
+}
+
+
+static bool IncrementExtraFacetCount (FacetAccumulator *accumulator_p, const char *name_s, const uint32 count)
+{
+	bool success_flag = false;
+	ExtraFacetCount *extra_p;
+
+	pthread_mutex_lock (& (accumulator_p -> fa_extras_lock));
+
+	extra_p = accumulator_p -> fa_extras_p;
+
+	while (extra_p && (strcmp (extra_p -> efc_name_s, name_s) != 0))
+		{
+			extra_p = extra_p -> efc_next_p;
+		}
+
+	if (extra_p)
+		{
+			extra_p -> efc_count += count;
+			success_flag = true;
+		}
+	else
+		{
+			extra_p = (ExtraFacetCount *) AllocMemory (sizeof (ExtraFacetCount));
+
+			if (extra_p)
+				{
+					extra_p -> efc_name_s = EasyCopyToNewString (name_s);
+
+					if (extra_p -> efc_name_s)
+						{
+							extra_p -> efc_count = count;
+							extra_p -> efc_next_p = accumulator_p -> fa_extras_p;
+							accumulator_p -> fa_extras_p = extra_p;
+
+							success_flag = true;
+						}
+					else
+						{
+							FreeMemory (extra_p);
+						}
+				}
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add facet count for \"%s\"", name_s);
+				}
+		}
+
+	pthread_mutex_unlock (& (accumulator_p -> fa_extras_lock));
+
+	return success_flag;
+}
@@ -0,0 +1,431 @@
+/*
+ * hit_converter.c
+ *
+ *  Created on: 12 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "hit_converter.h"
+#include "search_config.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * Don't hand out chunks smaller than this as the cost of
+ * the synchronisation would outweigh the work.
+ */
+static const size_t S_MIN_CHUNK_SIZE = 16;
+
+
+/*
+ * A set of hits being converted by the pool. The caller's thread
+ * takes chunks alongside the workers and then waits for any
+ * chunks still in progress to complete.
+ */
+typedef struct ConversionBatch
+{
+	const json_t *cb_hits_p;
+	json_t **cb_results_pp;
+	FacetAccumulator *cb_facets_p;
+	const ResultProjection *cb_projection_p;
+	ConvertHitFn cb_convert_fn;
+	const SearchConfig *cb_config_p;
+	size_t cb_num_hits;
+	size_t cb_chunk_size;
+	size_t cb_num_chunks;
+
+	/* These are protected by the pool's lock */
+	size_t cb_next_chunk;
+	size_t cb_num_done;
+	pthread_cond_t cb_done_cond;
+	struct ConversionBatch *cb_next_p;
+} ConversionBatch;
+
+
+struct ConversionPool
+{
+	pthread_t *cp_threads_p;
+	uint32 cp_num_threads;
+	pthread_mutex_t cp_lock;
+	pthread_cond_t cp_work_cond;
+	ConversionBatch *cp_queue_head_p;
+	ConversionBatch *cp_queue_tail_p;
+	bool cp_shutdown_flag;
+};
+
+
+static void *RunConversionWorker (void *data_p);
+
+static bool TakeChunk (ConversionPool *pool_p, const ConversionBatch *own_batch_p, ConversionBatch **batch_pp, size_t *chunk_p);
+
+static void ConvertChunk (ConversionBatch *batch_p, const size_t chunk);
+
+static void FinishChunk (ConversionPool *pool_p, ConversionBatch *batch_p);
+
+static json_t *ConvertHitsInParallel (ConversionPool *pool_p, const json_t *hits_p, const size_t num_hits, ConvertHitFn convert_fn, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
+
+static json_t *ConvertHitsSequentially (const json_t *hits_p, ConvertHitFn convert_fn, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
+
+static bool AddConvertedResult (json_t *results_p, json_t *result_p, const json_t *hit_p);
+
+
+
+ConversionPool *AllocateConversionPool (const uint32 num_threads)
+{
+	ConversionPool *pool_p = (ConversionPool *) AllocMemory (sizeof (ConversionPool));
+
+	if (pool_p)
+		{
+			memset (pool_p, 0, sizeof (ConversionPool));
+
+			pool_p -> cp_threads_p = (pthread_t *) AllocMemoryArray (num_threads, sizeof (pthread_t));
+
+			if (pool_p -> cp_threads_p)
+				{
+					if (pthread_mutex_init (& (pool_p -> cp_lock), NULL) == 0)
+						{
+							if (pthread_cond_init (& (pool_p -> cp_work_cond), NULL) == 0)
+								{
+									while (pool_p -> cp_num_threads < num_threads)
+										{
+											if (pthread_create ((pool_p -> cp_threads_p) + (pool_p -> cp_num_threads), NULL, RunConversionWorker, pool_p) == 0)
+												{
+													++ (pool_p -> cp_num_threads);
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start conversion thread " UINT32_FMT " of " UINT32_FMT, pool_p -> cp_num_threads, num_threads);
+													break;
+												}
+										}
+
+									if (pool_p -> cp_num_threads > 0)
+										{
+											return pool_p;
+										}
+
+									pthread_cond_destroy (& (pool_p -> cp_work_cond));
+								}
+
+							pthread_mutex_destroy (& (pool_p -> cp_lock));
+						}
+
+					FreeMemory (pool_p -> cp_threads_p);
+				}
+
+			FreeMemory (pool_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate conversion pool with " UINT32_FMT " threads", num_threads);
+
+	return NULL;
+}
+
+
+void FreeConversionPool (ConversionPool *pool_p)
+{
+	uint32 i;
+
+	pthread_mutex_lock (& (pool_p -> cp_lock));
+	pool_p -> cp_shutdown_flag = true;
+	pthread_cond_broadcast (& (pool_p -> cp_work_cond));
+	pthread_mutex_unlock (& (pool_p -> cp_lock));
+
+	for (i = 0; i < pool_p -> cp_num_threads; ++ i)
+		{
+			pthread_join (pool_p -> cp_threads_p [i], NULL);
+		}
+
+	pthread_cond_destroy (& (pool_p -> cp_work_cond));
+	pthread_mutex_destroy (& (pool_p -> cp_lock));
+
+	FreeMemory (pool_p -> cp_threads_p);
+	FreeMemory (pool_p);
+}
+
+
+json_t *ConvertHits (const json_t *hits_p, ConvertHitFn convert_fn, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
+{
+	const size_t num_hits = json_array_size (hits_p);
+
+	if ((config_p -> sc_conversion_pool_p) && (num_hits >= config_p -> sc_parallel_conversion_min_hits) && (num_hits >= (S_MIN_CHUNK_SIZE << 1)))
+		{
+			return ConvertHitsInParallel (config_p -> sc_conversion_pool_p, hits_p, num_hits, convert_fn, facets_p, projection_p, config_p);
+		}
+
+	return ConvertHitsSequentially (hits_p, convert_fn, facets_p, projection_p, config_p);
+}
+
+
+
+static json_t *ConvertHitsSequentially (const json_t *hits_p, ConvertHitFn convert_fn, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
+{
+	json_t *results_p = json_array ();
+
+	if (results_p)
+		{
+			size_t i;
+			const json_t *hit_p;
+
+			json_array_foreach (hits_p, i, hit_p)
+				{
+					json_t *result_p = convert_fn (hit_p, facets_p, projection_p, config_p);
+
+					AddConvertedResult (results_p, result_p, hit_p);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create grassroots results array");
+		}
+
+	return results_p;
+}
+
+
+static json_t *ConvertHitsInParallel (ConversionPool *pool_p, const json_t *hits_p, const size_t num_hits, ConvertHitFn convert_fn, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
+{
+	json_t *results_p = NULL;
+	ConversionBatch batch;
+	size_t num_chunks = (pool_p -> cp_num_threads) + 1;
+
+	/* Share the hits between the workers and the calling thread */
+	batch.cb_chunk_size = (num_hits + num_chunks - 1) / num_chunks;
+
+	if (batch.cb_chunk_size < S_MIN_CHUNK_SIZE)
+		{
+			batch.cb_chunk_size = S_MIN_CHUNK_SIZE;
+		}
+
+	num_chunks = (num_hits + batch.cb_chunk_size - 1) / batch.cb_chunk_size;
+
+	batch.cb_hits_p = hits_p;
+	batch.cb_num_hits = num_hits;
+	batch.cb_num_chunks = num_chunks;
+	batch.cb_convert_fn = convert_fn;
+	batch.cb_config_p = config_p;
+	batch.cb_facets_p = facets_p;
+	batch.cb_projection_p = projection_p;
+	batch.cb_next_chunk = 0;
+	batch.cb_num_done = 0;
+	batch.cb_next_p = NULL;
+	batch.cb_results_pp = (json_t **) AllocMemoryArray (num_hits, sizeof (json_t *));
+
+	if (batch.cb_results_pp)
+		{
+			if (pthread_cond_init (& (batch.cb_done_cond), NULL) == 0)
+				{
+					ConversionBatch *current_batch_p;
+					size_t chunk;
+					size_t i;
+
+					pthread_mutex_lock (& (pool_p -> cp_lock));
+
+					if (pool_p -> cp_queue_tail_p)
+						{
+							pool_p -> cp_queue_tail_p -> cb_next_p = &batch;
+						}
+					else
+						{
+							pool_p -> cp_queue_head_p = &batch;
+						}
+
+					pool_p -> cp_queue_tail_p = &batch;
+
+					pthread_cond_broadcast (& (pool_p -> cp_work_cond));
+					pthread_mutex_unlock (& (pool_p -> cp_lock));
+
+
+					/*
+					 * Do our share of the work. Any earlier batches still in the queue
+					 * are helped along too since ours can't start until they are
+					 * all handed out.
+					 */
+					while (TakeChunk (pool_p, &batch, &current_batch_p, &chunk))
+						{
+							ConvertChunk (current_batch_p, chunk);
+							FinishChunk (pool_p, current_batch_p);
+						}
+
+					pthread_mutex_lock (& (pool_p -> cp_lock));
+
+					while (batch.cb_num_done < batch.cb_num_chunks)
+						{
+							pthread_cond_wait (& (batch.cb_done_cond), & (pool_p -> cp_lock));
+						}
+
+					pthread_mutex_unlock (& (pool_p -> cp_lock));
+
+
+					/* Gather the results back in their original order */
+					results_p = json_array ();
+
+					if (results_p)
+						{
+							for (i = 0; i < num_hits; ++ i)
+								{
+									AddConvertedResult (results_p, batch.cb_results_pp [i], json_array_get (hits_p, i));
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create grassroots results array");
+
+							for (i = 0; i < num_hits; ++ i)
+								{
+									if (batch.cb_results_pp [i])
+										{
+											json_decref (batch.cb_results_pp [i]);
+										}
+								}
+						}
+
+					pthread_cond_destroy (& (batch.cb_done_cond));
+				}		/* if (pthread_cond_init (& (batch.cb_done_cond), NULL) == 0) */
+
+			FreeMemory (batch.cb_results_pp);
+		}		/* if (batch.cb_results_pp) */
+
+	/* If we couldn't set up the batch, fall back to doing it all ourselves */
+	if (!results_p)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up parallel conversion of " SIZET_FMT " hits, converting sequentially", num_hits);
+			results_p = ConvertHitsSequentially (hits_p, convert_fn, facets_p, projection_p, config_p);
+		}
+
+	return results_p;
+}
+
+
+static bool AddConvertedResult (json_t *results_p, json_t *result_p, const json_t *hit_p)
+{
+	if (result_p)
+		{
+			if (json_array_append_new (results_p, result_p) == 0)
+				{
+					return true;
+				}
+			else
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, result_p, "Failed to add grassroots result");
+					json_decref (result_p);
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, hit_p, "Failed to create grassroots result");
+		}
+
+	return false;
+}
+
+
+static void *RunConversionWorker (void *data_p)
+{
+	ConversionPool *pool_p = (ConversionPool *) data_p;
+	ConversionBatch *batch_p;
+	size_t chunk;
+
+	while (TakeChunk (pool_p, NULL, &batch_p, &chunk))
+		{
+			ConvertChunk (batch_p, chunk);
+			FinishChunk (pool_p, batch_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Get the next chunk to convert. Worker threads pass NULL for own_batch_p
+ * and block until there is work available or the pool is shutting down.
+ * The thread that submitted a batch passes that batch and will help with
+ * any queued chunks until all of the chunks of its own batch have been
+ * handed out. This returns false when there is no more work for the
+ * calling thread.
+ */
+static bool TakeChunk (ConversionPool *pool_p, const ConversionBatch *own_batch_p, ConversionBatch **batch_pp, size_t *chunk_p)
+{
+	bool got_chunk_flag = false;
+
+	pthread_mutex_lock (& (pool_p -> cp_lock));
+
+	while ((!got_chunk_flag) && (!pool_p -> cp_shutdown_flag))
+		{
+			ConversionBatch *batch_p = pool_p -> cp_queue_head_p;
+
+			if (own_batch_p && (own_batch_p -> cb_next_chunk == own_batch_p -> cb_num_chunks))
+				{
+					break;
+				}
+			else if (batch_p)
+				{
+					*batch_pp = batch_p;
+					*chunk_p = batch_p -> cb_next_chunk;
+					got_chunk_flag = true;
+
+					++ (batch_p -> cb_next_chunk);
+
+					/* Once all of its chunks have been handed out, remove the batch from the queue */
+					if (batch_p -> cb_next_chunk == batch_p -> cb_num_chunks)
+						{
+							pool_p -> cp_queue_head_p = batch_p -> cb_next_p;
+
+							if (!pool_p -> cp_queue_head_p)
+								{
+									pool_p -> cp_queue_tail_p = NULL;
+								}
+						}
+				}
+			else if (!own_batch_p)
+				{
+					pthread_cond_wait (& (pool_p -> cp_work_cond), & (pool_p -> cp_lock));
+				}
+			else
+				{
+					break;
+				}
+		}
+
+	pthread_mutex_unlock (& (pool_p -> cp_lock));
+
+	return got_chunk_flag;
+}
+
+
+static void ConvertChunk (ConversionBatch *batch_p, const size_t chunk)
+{
+	const size_t from = chunk * (batch_p -> cb_chunk_size);
+	size_t to = from + (batch_p -> cb_chunk_size);
+	size_t i;
+
+	if (to > batch_p -> cb_num_hits)
+		{
+			to = batch_p -> cb_num_hits;
+		}
+
+	for (i = from; i < to; ++ i)
+		{
+			batch_p -> cb_results_pp [i] = batch_p -> cb_convert_fn (json_array_get (batch_p -> cb_hits_p, i), batch_p -> cb_facets_p, batch_p -> cb_projection_p, batch_p -> cb_config_p);
+		}
+}
+
+
+static void FinishChunk (ConversionPool *pool_p, ConversionBatch *batch_p)
+{
+	pthread_mutex_lock (& (pool_p -> cp_lock));
+
+	++ (batch_p -> cb_num_done);
+
+	if (batch_p -> cb_num_done == batch_p -> cb_num_chunks)
+		{
+			pthread_cond_signal (& (batch_p -> cb_done_cond));
+		}
+
+	pthread_mutex_unlock (& (pool_p -> cp_lock));
+}
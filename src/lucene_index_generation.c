@@ -0,0 +1,58 @@
+/*
+ * lucene_index_generation.c
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lucene_index_generation.h"
+
+#include "streams.h"
+
+
+static const char * const S_SEGMENTS_PREFIX_S = "segments_";
+
+
+uint64 GetLuceneIndexGeneration (const char *index_dir_s)
+{
+	uint64 generation = 0;
+
+	if (index_dir_s)
+		{
+			DIR *dir_p = opendir (index_dir_s);
+
+			if (dir_p)
+				{
+					const size_t prefix_length = strlen (S_SEGMENTS_PREFIX_S);
+					struct dirent *entry_p;
+
+					/* Old segments files can linger until they are deleted, so use the newest */
+					while ((entry_p = readdir (dir_p)) != NULL)
+						{
+							if (strncmp (entry_p -> d_name, S_SEGMENTS_PREFIX_S, prefix_length) == 0)
+								{
+									const char *value_s = entry_p -> d_name + prefix_length;
+									char *end_s = NULL;
+									unsigned long long value = strtoull (value_s, &end_s, 36);
+
+									if ((end_s != value_s) && (*end_s == '\0') && (value > generation))
+										{
+											generation = (uint64) value;
+										}
+								}
+						}
+
+					closedir (dir_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open Lucene index directory \"%s\"", index_dir_s);
+				}
+		}
+
+	return generation;
+}
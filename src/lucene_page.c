@@ -0,0 +1,67 @@
+/*
+ * lucene_page.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include "lucene_page.h"
+
+
+json_t *GetCachedLucenePage (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, const SearchCursor *cursor_p, const uint64 generation)
+{
+	json_t *page_p = NULL;
+
+	if ((cache_p) && (generation > 0) && (! ((cursor_p -> sc_exhausted_flags) & SC_LUCENE_EXHAUSTED)))
+		{
+			page_p = GetCachedLuceneResults (cache_p, query_s, facet_s, cursor_p -> sc_lucene_page, cursor_p -> sc_page_size, generation);
+		}
+
+	return page_p;
+}
+
+
+/*
+ * A cached page moves the cursor on in the same way as a searched one,
+ * as otherwise a client paging through a cached query would get the
+ * same page back forever.
+ */
+OperationStatus ServeLucenePage (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, SearchCursor *cursor_p, const uint64 generation, const json_t *cached_page_p, const LucenePageSource *source_p)
+{
+	OperationStatus status = OS_SUCCEEDED;
+
+	/* Once Lucene has run out of hits, the cursor skips it for every later page */
+	if (! ((cursor_p -> sc_exhausted_flags) & SC_LUCENE_EXHAUSTED))
+		{
+			/* The cursor was checked when it was set up, so the end of the page fits */
+			const uint32 from = (cursor_p -> sc_lucene_page) * (cursor_p -> sc_page_size);
+			const uint32 to = from + (cursor_p -> sc_page_size) - 1;
+
+			if (cached_page_p)
+				{
+					status = source_p -> lps_add_cached_hits_fn (cached_page_p, from, source_p -> lps_data_p);
+				}
+			else
+				{
+					json_t *page_p = NULL;
+					const bool cache_flag = (cache_p != NULL) && (generation > 0);
+
+					status = source_p -> lps_add_searched_hits_fn (from, to, cache_flag ? &page_p : NULL, source_p -> lps_data_p);
+
+					if (page_p)
+						{
+							if (status == OS_SUCCEEDED)
+								{
+									/* If this fails, the page is just searched for again next time */
+									AddCachedLuceneResults (cache_p, query_s, facet_s, cursor_p -> sc_lucene_page, cursor_p -> sc_page_size, generation, page_p);
+								}
+
+							json_decref (page_p);
+						}
+				}
+
+			AdvanceSearchCursorLucene (cursor_p, source_p -> lps_get_num_total_hits_fn (source_p -> lps_data_p));
+		}
+
+	return status;
+}
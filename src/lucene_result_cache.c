@@ -0,0 +1,544 @@
+/*
+ * lucene_result_cache.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lucene_result_cache.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+typedef struct LuceneResultEntry
+{
+	char *lre_key_s;
+
+	uint32 lre_hash;
+
+	/** The facet of the page or <code>NULL</code> for any. */
+	char *lre_facet_s;
+
+	/** The page as compact JSON, allocated by jansson. */
+	char *lre_results_s;
+
+	/** The number of bytes that this entry counts towards the cache's size. */
+	size_t lre_size;
+
+	struct LuceneResultEntry *lre_bucket_next_p;
+
+	/** The neighbouring entries in least recently used order. */
+	struct LuceneResultEntry *lre_lru_prev_p;
+	struct LuceneResultEntry *lre_lru_next_p;
+} LuceneResultEntry;
+
+
+/*
+ * A single lock covers the whole cache. Pages are serialised and
+ * parsed outside of it.
+ */
+struct LuceneResultCache
+{
+	LuceneResultEntry **lrc_buckets_pp;
+	uint32 lrc_num_buckets;
+
+	uint32 lrc_num_entries;
+	uint32 lrc_max_entries;
+
+	uint64 lrc_size;
+	uint64 lrc_max_size;
+
+	/** The generation of the Lucene index that every entry belongs to. */
+	uint64 lrc_generation;
+
+	/**
+	 * If this is set, entries are removed by InvalidateLuceneResults ()
+	 * rather than when the generation changes.
+	 */
+	bool lrc_notified_flag;
+
+	/** The most recently used entry. */
+	LuceneResultEntry *lrc_lru_head_p;
+
+	/** The least recently used entry, which is the next to be removed. */
+	LuceneResultEntry *lrc_lru_tail_p;
+
+	pthread_mutex_t lrc_lock;
+};
+
+
+static char *GetLuceneResultKey (const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size);
+
+static uint32 GetKeyHash (const char *key_s);
+
+static LuceneResultEntry *FindLuceneResultEntry (LuceneResultCache *cache_p, const char *key_s, const uint32 hash);
+
+static void UpdateLuceneResultGeneration (LuceneResultCache *cache_p, const uint64 generation);
+
+static void RemoveLuceneResultEntry (LuceneResultCache *cache_p, LuceneResultEntry *entry_p);
+
+static void MoveToFrontOfLRU (LuceneResultCache *cache_p, LuceneResultEntry *entry_p);
+
+static void UnlinkFromLRU (LuceneResultCache *cache_p, LuceneResultEntry *entry_p);
+
+static void FreeLuceneResultEntry (LuceneResultEntry *entry_p);
+
+
+
+LuceneResultCache *AllocateLuceneResultCache (const uint32 max_entries, const uint64 max_size, const bool notified_flag)
+{
+	LuceneResultCache *cache_p = (LuceneResultCache *) AllocMemory (sizeof (LuceneResultCache));
+
+	if (cache_p)
+		{
+			uint32 num_buckets = 16;
+
+			memset (cache_p, 0, sizeof (LuceneResultCache));
+
+			while ((num_buckets < max_entries) && (num_buckets < (1u << 30)))
+				{
+					num_buckets <<= 1;
+				}
+
+			cache_p -> lrc_buckets_pp = (LuceneResultEntry **) AllocMemoryArray (num_buckets, sizeof (LuceneResultEntry *));
+
+			if (cache_p -> lrc_buckets_pp)
+				{
+					cache_p -> lrc_num_buckets = num_buckets;
+					cache_p -> lrc_max_entries = max_entries;
+					cache_p -> lrc_max_size = max_size;
+					cache_p -> lrc_notified_flag = notified_flag;
+
+					if (pthread_mutex_init (& (cache_p -> lrc_lock), NULL) == 0)
+						{
+							return cache_p;
+						}
+
+					FreeMemory (cache_p -> lrc_buckets_pp);
+				}
+
+			FreeMemory (cache_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate LuceneResultCache with " UINT32_FMT " entries", max_entries);
+
+	return NULL;
+}
+
+
+void FreeLuceneResultCache (LuceneResultCache *cache_p)
+{
+	while (cache_p -> lrc_lru_tail_p)
+		{
+			RemoveLuceneResultEntry (cache_p, cache_p -> lrc_lru_tail_p);
+		}
+
+	pthread_mutex_destroy (& (cache_p -> lrc_lock));
+	FreeMemory (cache_p -> lrc_buckets_pp);
+	FreeMemory (cache_p);
+}
+
+
+json_t *GetCachedLuceneResults (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const uint64 generation)
+{
+	json_t *results_p = NULL;
+	char *key_s = GetLuceneResultKey (query_s, facet_s, page, page_size);
+
+	if (key_s)
+		{
+			const uint32 hash = GetKeyHash (key_s);
+			char *results_s = NULL;
+
+			pthread_mutex_lock (& (cache_p -> lrc_lock));
+
+			UpdateLuceneResultGeneration (cache_p, generation);
+
+			if (cache_p -> lrc_generation == generation)
+				{
+					LuceneResultEntry *entry_p = FindLuceneResultEntry (cache_p, key_s, hash);
+
+					if (entry_p)
+						{
+							/* Take a copy so that it can be parsed without holding the lock */
+							results_s = EasyCopyToNewString (entry_p -> lre_results_s);
+							MoveToFrontOfLRU (cache_p, entry_p);
+						}
+				}
+
+			pthread_mutex_unlock (& (cache_p -> lrc_lock));
+
+			if (results_s)
+				{
+					json_error_t error;
+
+					results_p = json_loads (results_s, 0, &error);
+
+					if (!results_p)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to parse cached Lucene results for \"%s\": %s", query_s, error.text);
+						}
+
+					FreeCopiedString (results_s);
+				}
+
+			FreeCopiedString (key_s);
+		}
+
+	return results_p;
+}
+
+
+bool AddCachedLuceneResults (LuceneResultCache *cache_p, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const uint64 generation, const json_t *results_p)
+{
+	bool success_flag = false;
+	char *results_s = json_dumps (results_p, JSON_COMPACT);
+
+	if (results_s)
+		{
+			char *key_s = GetLuceneResultKey (query_s, facet_s, page, page_size);
+
+			if (key_s)
+				{
+					const size_t size = sizeof (LuceneResultEntry) + strlen (key_s) + strlen (results_s) + 2;
+
+					/* A page that would fill the cache on its own is not worth keeping */
+					if (size <= (cache_p -> lrc_max_size) / 2)
+						{
+							LuceneResultEntry *entry_p = (LuceneResultEntry *) AllocMemory (sizeof (LuceneResultEntry));
+
+							if (entry_p)
+								{
+									memset (entry_p, 0, sizeof (LuceneResultEntry));
+
+									entry_p -> lre_key_s = key_s;
+									entry_p -> lre_hash = GetKeyHash (key_s);
+									entry_p -> lre_results_s = results_s;
+									entry_p -> lre_size = size;
+
+									key_s = NULL;
+									results_s = NULL;
+
+									if (facet_s)
+										{
+											/* If this fails, the page is just removed by a change to any type */
+											entry_p -> lre_facet_s = EasyCopyToNewString (facet_s);
+										}
+
+									pthread_mutex_lock (& (cache_p -> lrc_lock));
+
+									UpdateLuceneResultGeneration (cache_p, generation);
+
+									/* A search that started before the index changed mustn't add to the new generation */
+									if (cache_p -> lrc_generation == generation)
+										{
+											LuceneResultEntry *old_entry_p = FindLuceneResultEntry (cache_p, entry_p -> lre_key_s, entry_p -> lre_hash);
+											const uint32 bucket = (entry_p -> lre_hash) & (cache_p -> lrc_num_buckets - 1);
+
+											if (old_entry_p)
+												{
+													RemoveLuceneResultEntry (cache_p, old_entry_p);
+												}
+
+											while ((cache_p -> lrc_lru_tail_p) && (((cache_p -> lrc_num_entries) >= (cache_p -> lrc_max_entries)) || ((cache_p -> lrc_size) + size > (cache_p -> lrc_max_size))))
+												{
+													RemoveLuceneResultEntry (cache_p, cache_p -> lrc_lru_tail_p);
+												}
+
+											entry_p -> lre_bucket_next_p = cache_p -> lrc_buckets_pp [bucket];
+											cache_p -> lrc_buckets_pp [bucket] = entry_p;
+
+											++ (cache_p -> lrc_num_entries);
+											cache_p -> lrc_size += size;
+
+											MoveToFrontOfLRU (cache_p, entry_p);
+
+											entry_p = NULL;
+											success_flag = true;
+										}
+
+									pthread_mutex_unlock (& (cache_p -> lrc_lock));
+
+									if (entry_p)
+										{
+											FreeLuceneResultEntry (entry_p);
+										}
+								}
+						}
+
+					if (key_s)
+						{
+							FreeCopiedString (key_s);
+						}
+				}
+
+			if (results_s)
+				{
+					free (results_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to serialise Lucene results for \"%s\"", query_s);
+		}
+
+	return success_flag;
+}
+
+
+uint32 InvalidateLuceneResults (LuceneResultCache *cache_p, const char *facet_s, const uint64 generation)
+{
+	uint32 num_removed = 0;
+	LuceneResultEntry *entry_p;
+
+	pthread_mutex_lock (& (cache_p -> lrc_lock));
+
+	if (generation > cache_p -> lrc_generation)
+		{
+			cache_p -> lrc_generation = generation;
+		}
+
+	entry_p = cache_p -> lrc_lru_head_p;
+
+	while (entry_p)
+		{
+			LuceneResultEntry *next_p = entry_p -> lre_lru_next_p;
+
+			/* The pages for any facet include every type */
+			if ((!facet_s) || (! (entry_p -> lre_facet_s)) || (strcmp (entry_p -> lre_facet_s, facet_s) == 0))
+				{
+					RemoveLuceneResultEntry (cache_p, entry_p);
+					++ num_removed;
+				}
+
+			entry_p = next_p;
+		}
+
+	pthread_mutex_unlock (& (cache_p -> lrc_lock));
+
+	return num_removed;
+}
+
+
+void UseLuceneIndexGenerations (LuceneResultCache *cache_p)
+{
+	pthread_mutex_lock (& (cache_p -> lrc_lock));
+
+	while (cache_p -> lrc_lru_tail_p)
+		{
+			RemoveLuceneResultEntry (cache_p, cache_p -> lrc_lru_tail_p);
+		}
+
+	cache_p -> lrc_notified_flag = false;
+
+	pthread_mutex_unlock (& (cache_p -> lrc_lock));
+}
+
+
+/*
+ * Queries that only differ in the amount of white space around and
+ * between their terms have the same hits, so they share a key. Case
+ * is kept as the query parser treats AND, OR and NOT differently to
+ * and, or and not.
+ */
+static char *GetLuceneResultKey (const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size)
+{
+	const char *safe_query_s = query_s ? query_s : "";
+	const char *safe_facet_s = facet_s ? facet_s : "";
+	const size_t facet_length = strlen (safe_facet_s);
+
+	/* Room for the two numbers, three separators and the terminator */
+	char *key_s = (char *) AllocMemory (strlen (safe_query_s) + facet_length + 26);
+
+	if (key_s)
+		{
+			const unsigned char *c_p = (const unsigned char *) safe_query_s;
+			char *dest_p = key_s;
+			bool space_flag = false;
+			bool started_flag = false;
+
+			dest_p += sprintf (dest_p, UINT32_FMT "\x1F" UINT32_FMT "\x1F", page, page_size);
+
+			memcpy (dest_p, safe_facet_s, facet_length);
+			dest_p += facet_length;
+			*dest_p = '\x1F';
+			++ dest_p;
+
+			while (*c_p)
+				{
+					if (isspace (*c_p))
+						{
+							space_flag = started_flag;
+						}
+					else
+						{
+							if (space_flag)
+								{
+									*dest_p = ' ';
+									++ dest_p;
+									space_flag = false;
+								}
+
+							*dest_p = (char) *c_p;
+							++ dest_p;
+							started_flag = true;
+						}
+
+					++ c_p;
+				}
+
+			*dest_p = '\0';
+		}
+
+	return key_s;
+}
+
+
+/* FNV-1a */
+static uint32 GetKeyHash (const char *key_s)
+{
+	uint32 hash = 2166136261u;
+	const unsigned char *c_p = (const unsigned char *) key_s;
+
+	while (*c_p)
+		{
+			hash ^= *c_p;
+			hash *= 16777619u;
+			++ c_p;
+		}
+
+	return hash;
+}
+
+
+static LuceneResultEntry *FindLuceneResultEntry (LuceneResultCache *cache_p, const char *key_s, const uint32 hash)
+{
+	LuceneResultEntry *entry_p = cache_p -> lrc_buckets_pp [hash & (cache_p -> lrc_num_buckets - 1)];
+
+	while (entry_p)
+		{
+			if ((entry_p -> lre_hash == hash) && (strcmp (entry_p -> lre_key_s, key_s) == 0))
+				{
+					return entry_p;
+				}
+
+			entry_p = entry_p -> lre_bucket_next_p;
+		}
+
+	return NULL;
+}
+
+
+/*
+ * This must be called with the cache's lock held. A newer generation
+ * empties the cache unless the affected entries are removed by
+ * notifications instead. An older one, from a search that started
+ * before the change, is ignored.
+ */
+static void UpdateLuceneResultGeneration (LuceneResultCache *cache_p, const uint64 generation)
+{
+	if (generation > cache_p -> lrc_generation)
+		{
+			if (! (cache_p -> lrc_notified_flag))
+				{
+					while (cache_p -> lrc_lru_tail_p)
+						{
+							RemoveLuceneResultEntry (cache_p, cache_p -> lrc_lru_tail_p);
+						}
+				}
+
+			cache_p -> lrc_generation = generation;
+		}
+}
+
+
+static void RemoveLuceneResultEntry (LuceneResultCache *cache_p, LuceneResultEntry *entry_p)
+{
+	LuceneResultEntry **link_pp = & (cache_p -> lrc_buckets_pp [entry_p -> lre_hash & (cache_p -> lrc_num_buckets - 1)]);
+
+	while (*link_pp != entry_p)
+		{
+			link_pp = & ((*link_pp) -> lre_bucket_next_p);
+		}
+
+	*link_pp = entry_p -> lre_bucket_next_p;
+
+	UnlinkFromLRU (cache_p, entry_p);
+
+	-- (cache_p -> lrc_num_entries);
+	cache_p -> lrc_size -= entry_p -> lre_size;
+
+	FreeLuceneResultEntry (entry_p);
+}
+
+
+static void MoveToFrontOfLRU (LuceneResultCache *cache_p, LuceneResultEntry *entry_p)
+{
+	if (cache_p -> lrc_lru_head_p != entry_p)
+		{
+			if ((entry_p -> lre_lru_prev_p) || (cache_p -> lrc_lru_tail_p == entry_p))
+				{
+					UnlinkFromLRU (cache_p, entry_p);
+				}
+
+			entry_p -> lre_lru_prev_p = NULL;
+			entry_p -> lre_lru_next_p = cache_p -> lrc_lru_head_p;
+
+			if (cache_p -> lrc_lru_head_p)
+				{
+					cache_p -> lrc_lru_head_p -> lre_lru_prev_p = entry_p;
+				}
+			else
+				{
+					cache_p -> lrc_lru_tail_p = entry_p;
+				}
+
+			cache_p -> lrc_lru_head_p = entry_p;
+		}
+}
+
+
+static void UnlinkFromLRU (LuceneResultCache *cache_p, LuceneResultEntry *entry_p)
+{
+	if (entry_p -> lre_lru_prev_p)
+		{
+			entry_p -> lre_lru_prev_p -> lre_lru_next_p = entry_p -> lre_lru_next_p;
+		}
+	else
+		{
+			cache_p -> lrc_lru_head_p = entry_p -> lre_lru_next_p;
+		}
+
+	if (entry_p -> lre_lru_next_p)
+		{
+			entry_p -> lre_lru_next_p -> lre_lru_prev_p = entry_p -> lre_lru_prev_p;
+		}
+	else
+		{
+			cache_p -> lrc_lru_tail_p = entry_p -> lre_lru_prev_p;
+		}
+
+	entry_p -> lre_lru_prev_p = NULL;
+	entry_p -> lre_lru_next_p = NULL;
+}
+
+
+static void FreeLuceneResultEntry (LuceneResultEntry *entry_p)
+{
+	/* The results were allocated by jansson */
+	free (entry_p -> lre_results_s);
+	FreeCopiedString (entry_p -> lre_key_s);
+
+	if (entry_p -> lre_facet_s)
+		{
+			FreeCopiedString (entry_p -> lre_facet_s);
+		}
+	FreeMemory (entry_p);
+}
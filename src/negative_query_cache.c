@@ -0,0 +1,375 @@
+/*
+ * negative_query_cache.c
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "negative_query_cache.h"
+#include "search_cursor.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/* The number of bits set for each query */
+#define S_NUM_HASHES (4)
+
+#define S_NUM_SOURCES (3)
+
+
+/*
+ * To expire entries without being able to remove them, each filter
+ * has two halves. Queries are added to the current half and looked
+ * up in both. Every half of the time to live, the previous half is
+ * dropped and the current half takes its place, so an entry lasts
+ * for between a half and the whole of the time to live.
+ */
+typedef struct NegativeFilter
+{
+	uint64 *nf_current_bits_p;
+	uint64 *nf_previous_bits_p;
+	uint64 nf_generation;
+	time_t nf_rotated_time;
+} NegativeFilter;
+
+
+struct NegativeQueryCache
+{
+	NegativeFilter nqc_filters [S_NUM_SOURCES];
+
+	uint32 nqc_num_bits;
+
+	/** The number of uint64s in each half of a filter. */
+	uint32 nqc_num_words;
+
+	uint32 nqc_ttl;
+
+	pthread_mutex_t nqc_lock;
+};
+
+
+static NegativeFilter *GetNegativeFilter (NegativeQueryCache *cache_p, const uint32 source_flag);
+
+static void GetQueryHashes (const char *query_s, const char *facet_s, uint64 *hash_1_p, uint64 *hash_2_p);
+
+static uint64 AddToHash (uint64 hash, const unsigned char c);
+
+static void UpdateNegativeFilter (NegativeQueryCache *cache_p, NegativeFilter *filter_p, const uint32 source_flag, const uint64 generation);
+
+
+
+NegativeQueryCache *AllocateNegativeQueryCache (const uint32 num_bits, const uint32 ttl)
+{
+	NegativeQueryCache *cache_p = (NegativeQueryCache *) AllocMemory (sizeof (NegativeQueryCache));
+
+	if (cache_p)
+		{
+			const uint32 num_words = (num_bits + 63) >> 6;
+			uint32 i;
+			bool success_flag = true;
+
+			memset (cache_p, 0, sizeof (NegativeQueryCache));
+
+			cache_p -> nqc_num_words = num_words;
+			cache_p -> nqc_num_bits = num_words << 6;
+			cache_p -> nqc_ttl = ttl;
+
+			for (i = 0; i < S_NUM_SOURCES; ++ i)
+				{
+					NegativeFilter *filter_p = & (cache_p -> nqc_filters [i]);
+
+					filter_p -> nf_current_bits_p = (uint64 *) AllocMemoryArray (num_words, sizeof (uint64));
+					filter_p -> nf_previous_bits_p = (uint64 *) AllocMemoryArray (num_words, sizeof (uint64));
+					filter_p -> nf_rotated_time = time (NULL);
+
+					if ((! (filter_p -> nf_current_bits_p)) || (! (filter_p -> nf_previous_bits_p)))
+						{
+							success_flag = false;
+						}
+				}
+
+			if (success_flag)
+				{
+					if (pthread_mutex_init (& (cache_p -> nqc_lock), NULL) == 0)
+						{
+							return cache_p;
+						}
+				}
+
+			for (i = 0; i < S_NUM_SOURCES; ++ i)
+				{
+					NegativeFilter *filter_p = & (cache_p -> nqc_filters [i]);
+
+					if (filter_p -> nf_current_bits_p)
+						{
+							FreeMemory (filter_p -> nf_current_bits_p);
+						}
+
+					if (filter_p -> nf_previous_bits_p)
+						{
+							FreeMemory (filter_p -> nf_previous_bits_p);
+						}
+				}
+
+			FreeMemory (cache_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate NegativeQueryCache with " UINT32_FMT " bits", num_bits);
+
+	return NULL;
+}
+
+
+void FreeNegativeQueryCache (NegativeQueryCache *cache_p)
+{
+	uint32 i;
+
+	for (i = 0; i < S_NUM_SOURCES; ++ i)
+		{
+			FreeMemory (cache_p -> nqc_filters [i].nf_current_bits_p);
+			FreeMemory (cache_p -> nqc_filters [i].nf_previous_bits_p);
+		}
+
+	pthread_mutex_destroy (& (cache_p -> nqc_lock));
+	FreeMemory (cache_p);
+}
+
+
+bool IsKnownEmptyQuery (NegativeQueryCache *cache_p, const uint32 source_flag, const char *query_s, const char *facet_s, const uint64 generation)
+{
+	bool empty_flag = false;
+	NegativeFilter *filter_p = GetNegativeFilter (cache_p, source_flag);
+
+	if (filter_p)
+		{
+			uint64 hash_1;
+			uint64 hash_2;
+
+			GetQueryHashes (query_s, facet_s, &hash_1, &hash_2);
+
+			pthread_mutex_lock (& (cache_p -> nqc_lock));
+
+			UpdateNegativeFilter (cache_p, filter_p, source_flag, generation);
+
+			if (filter_p -> nf_generation == generation)
+				{
+					bool in_current_flag = true;
+					bool in_previous_flag = true;
+					uint32 i;
+
+					for (i = 0; i < S_NUM_HASHES; ++ i)
+						{
+							const uint64 bit = (hash_1 + i * hash_2) % (cache_p -> nqc_num_bits);
+							const uint64 mask = ((uint64) 1) << (bit & 63);
+
+							if (! ((filter_p -> nf_current_bits_p [bit >> 6]) & mask))
+								{
+									in_current_flag = false;
+								}
+
+							if (! ((filter_p -> nf_previous_bits_p [bit >> 6]) & mask))
+								{
+									in_previous_flag = false;
+								}
+						}
+
+					empty_flag = in_current_flag || in_previous_flag;
+				}
+
+			pthread_mutex_unlock (& (cache_p -> nqc_lock));
+		}
+
+	return empty_flag;
+}
+
+
+void AddEmptyQuery (NegativeQueryCache *cache_p, const uint32 source_flag, const char *query_s, const char *facet_s, const uint64 generation)
+{
+	NegativeFilter *filter_p = GetNegativeFilter (cache_p, source_flag);
+
+	if (filter_p)
+		{
+			uint64 hash_1;
+			uint64 hash_2;
+
+			GetQueryHashes (query_s, facet_s, &hash_1, &hash_2);
+
+			pthread_mutex_lock (& (cache_p -> nqc_lock));
+
+			UpdateNegativeFilter (cache_p, filter_p, source_flag, generation);
+
+			/* A search that started before the source changed mustn't add to the new generation */
+			if (filter_p -> nf_generation == generation)
+				{
+					uint32 i;
+
+					for (i = 0; i < S_NUM_HASHES; ++ i)
+						{
+							const uint64 bit = (hash_1 + i * hash_2) % (cache_p -> nqc_num_bits);
+
+							filter_p -> nf_current_bits_p [bit >> 6] |= ((uint64) 1) << (bit & 63);
+						}
+				}
+
+			pthread_mutex_unlock (& (cache_p -> nqc_lock));
+		}
+}
+
+
+void ForgetEmptyQueries (NegativeQueryCache *cache_p, const uint32 source_flag)
+{
+	NegativeFilter *filter_p = GetNegativeFilter (cache_p, source_flag);
+
+	if (filter_p)
+		{
+			const size_t num_bytes = (cache_p -> nqc_num_words) * sizeof (uint64);
+
+			pthread_mutex_lock (& (cache_p -> nqc_lock));
+
+			memset (filter_p -> nf_current_bits_p, 0, num_bytes);
+			memset (filter_p -> nf_previous_bits_p, 0, num_bytes);
+			filter_p -> nf_rotated_time = time (NULL);
+
+			pthread_mutex_unlock (& (cache_p -> nqc_lock));
+		}
+}
+
+
+static NegativeFilter *GetNegativeFilter (NegativeQueryCache *cache_p, const uint32 source_flag)
+{
+	switch (source_flag)
+		{
+			case SC_LUCENE_EXHAUSTED:
+				return & (cache_p -> nqc_filters [0]);
+
+			case SC_CKAN_EXHAUSTED:
+				return & (cache_p -> nqc_filters [1]);
+
+			case SC_ZENODO_EXHAUSTED:
+				return & (cache_p -> nqc_filters [2]);
+
+			default:
+				PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown search source " UINT32_FMT, source_flag);
+				break;
+		}
+
+	return NULL;
+}
+
+
+/*
+ * This must be called with the cache's lock held. A newer generation
+ * clears the filter. An older one, from a search that started before
+ * the change, is ignored.
+ */
+static void UpdateNegativeFilter (NegativeQueryCache *cache_p, NegativeFilter *filter_p, const uint32 source_flag, const uint64 generation)
+{
+	const size_t num_bytes = (cache_p -> nqc_num_words) * sizeof (uint64);
+
+	if (generation > filter_p -> nf_generation)
+		{
+			memset (filter_p -> nf_current_bits_p, 0, num_bytes);
+			memset (filter_p -> nf_previous_bits_p, 0, num_bytes);
+
+			filter_p -> nf_generation = generation;
+			filter_p -> nf_rotated_time = time (NULL);
+		}
+	else if ((source_flag != SC_LUCENE_EXHAUSTED) && (cache_p -> nqc_ttl > 0))
+		{
+			/* The Lucene filter only changes with the index */
+			const time_t now = time (NULL);
+			const time_t half_ttl = (cache_p -> nqc_ttl + 1) / 2;
+
+			if (now - (filter_p -> nf_rotated_time) >= 2 * half_ttl)
+				{
+					memset (filter_p -> nf_current_bits_p, 0, num_bytes);
+					memset (filter_p -> nf_previous_bits_p, 0, num_bytes);
+					filter_p -> nf_rotated_time = now;
+				}
+			else if (now - (filter_p -> nf_rotated_time) >= half_ttl)
+				{
+					uint64 *bits_p = filter_p -> nf_previous_bits_p;
+
+					filter_p -> nf_previous_bits_p = filter_p -> nf_current_bits_p;
+					filter_p -> nf_current_bits_p = bits_p;
+					memset (filter_p -> nf_current_bits_p, 0, num_bytes);
+
+					filter_p -> nf_rotated_time = now;
+				}
+		}
+}
+
+
+/*
+ * Queries that only differ in the amount of white space around and
+ * between their terms have the same hits, so hash them the same way.
+ * Case is kept as the query parser treats AND, OR and NOT differently
+ * to and, or and not.
+ */
+static void GetQueryHashes (const char *query_s, const char *facet_s, uint64 *hash_1_p, uint64 *hash_2_p)
+{
+	uint64 hash = 14695981039346656037ULL;
+	const unsigned char *c_p = (const unsigned char *) (query_s ? query_s : "");
+	bool space_flag = false;
+	bool started_flag = false;
+
+	while (*c_p)
+		{
+			if (isspace (*c_p))
+				{
+					space_flag = started_flag;
+				}
+			else
+				{
+					if (space_flag)
+						{
+							hash = AddToHash (hash, ' ');
+							space_flag = false;
+						}
+
+					hash = AddToHash (hash, *c_p);
+					started_flag = true;
+				}
+
+			++ c_p;
+		}
+
+	/* Separate the query from the facet */
+	hash = AddToHash (hash, 0x1F);
+
+	if (facet_s)
+		{
+			for (c_p = (const unsigned char *) facet_s; *c_p; ++ c_p)
+				{
+					hash = AddToHash (hash, *c_p);
+				}
+		}
+
+	*hash_1_p = hash;
+
+	/* A second, independent hash from the first for the double hashing */
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+
+	/* An odd step so that the bits don't repeat */
+	*hash_2_p = hash | 1;
+}
+
+
+/* FNV-1a */
+static uint64 AddToHash (uint64 hash, const unsigned char c)
+{
+	hash ^= c;
+	hash *= 1099511628211ULL;
+
+	return hash;
+}
@@ -0,0 +1,589 @@
+/*
+ * query_log.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "query_log.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+/*
+ * Only compact the file once it has at least this many lines
+ * and twice as many lines as different queries.
+ */
+static const size_t S_MIN_LINES_TO_COMPACT = 1000;
+
+
+/* Separates the facet and the query in the keys of the counts */
+static const char * const S_KEY_SEPARATOR_S = "\x1F";
+
+
+struct QueryLog
+{
+	char *ql_filename_s;
+
+	FILE *ql_out_f;
+
+	/** The file that ql_out_f appends to, so that we can tell when another process replaces it. */
+	ino_t ql_inode;
+
+	/** The size that the file can grow to before it is compacted. 0 means that it never is. */
+	uint64 ql_max_size;
+
+	/**
+	 * The size that the file is next compacted at. This is raised if
+	 * compacting can't get the file well below ql_max_size.
+	 */
+	uint64 ql_compact_size;
+
+	/** Set while the file is being compacted so that only one thread does it. */
+	bool ql_compacting_flag;
+
+	/** This covers ql_out_f, ql_inode and ql_compact_size. */
+	pthread_mutex_t ql_lock;
+};
+
+
+typedef struct QueryCount
+{
+	const char *qc_key_s;
+	json_int_t qc_count;
+} QueryCount;
+
+
+static json_t *GetQueryCounts (const char *filename_s, size_t *num_lines_p);
+
+static QueryCount *GetSortedQueryCounts (const json_t *counts_p);
+
+static int CompareQueryCounts (const void *v0_p, const void *v1_p);
+
+static json_t *GetQueryCountAsJSON (const QueryCount *count_p);
+
+static bool CompactQueryLog (QueryLog *log_p, const QueryCount *counts_p, const size_t num_counts);
+
+static void CompactQueryLogFile (QueryLog *log_p);
+
+static bool OpenQueryLogFile (QueryLog *log_p, struct stat *info_p);
+
+static bool RefreshQueryLogFile (QueryLog *log_p, uint64 *size_p);
+
+
+
+QueryLog *AllocateQueryLog (const char *filename_s, const uint64 max_size)
+{
+	QueryLog *log_p = (QueryLog *) AllocMemory (sizeof (QueryLog));
+
+	if (log_p)
+		{
+			memset (log_p, 0, sizeof (QueryLog));
+
+			log_p -> ql_max_size = max_size;
+			log_p -> ql_compact_size = max_size;
+
+			log_p -> ql_filename_s = EasyCopyToNewString (filename_s);
+
+			if (log_p -> ql_filename_s)
+				{
+					struct stat info;
+
+					if (OpenQueryLogFile (log_p, &info))
+						{
+							if (pthread_mutex_init (& (log_p -> ql_lock), NULL) == 0)
+								{
+									return log_p;
+								}
+
+							fclose (log_p -> ql_out_f);
+						}
+
+					FreeCopiedString (log_p -> ql_filename_s);
+				}
+
+			FreeMemory (log_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeQueryLog (QueryLog *log_p)
+{
+	fclose (log_p -> ql_out_f);
+	pthread_mutex_destroy (& (log_p -> ql_lock));
+	FreeCopiedString (log_p -> ql_filename_s);
+	FreeMemory (log_p);
+}
+
+
+bool RecordQuery (QueryLog *log_p, const char *query_s, const char *facet_s)
+{
+	bool success_flag = false;
+	bool compact_flag = false;
+	json_t *entry_p = json_pack ("{s:s}", QL_QUERY_S, query_s);
+
+	if (entry_p)
+		{
+			if ((facet_s == NULL) || (SetJSONString (entry_p, QL_FACET_S, facet_s)))
+				{
+					char *entry_s = json_dumps (entry_p, JSON_COMPACT);
+
+					if (entry_s)
+						{
+							/*
+							 * Write each line in one go so that lines from other
+							 * processes appending to the file can't interleave with it.
+							 */
+							uint64 size = 0;
+
+							pthread_mutex_lock (& (log_p -> ql_lock));
+
+							if (RefreshQueryLogFile (log_p, &size))
+								{
+									const int length = fprintf (log_p -> ql_out_f, "%s\n", entry_s);
+
+									if ((length > 0) && (fflush (log_p -> ql_out_f) == 0))
+										{
+											success_flag = true;
+											size += (uint64) length;
+
+											if ((log_p -> ql_max_size > 0) && (size >= log_p -> ql_compact_size))
+												{
+													compact_flag = !__atomic_exchange_n (& (log_p -> ql_compacting_flag), true, __ATOMIC_ACQ_REL);
+												}
+										}
+								}
+
+							pthread_mutex_unlock (& (log_p -> ql_lock));
+
+							free (entry_s);
+						}
+				}
+
+			json_decref (entry_p);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%s\" to query log \"%s\"", query_s, log_p -> ql_filename_s);
+		}
+
+	/* The file is read without the lock so other searches can carry on recording */
+	if (compact_flag)
+		{
+			CompactQueryLogFile (log_p);
+		}
+
+	return success_flag;
+}
+
+
+json_t *GetTopQueries (QueryLog *log_p, const uint32 max_queries)
+{
+	json_t *top_queries_p = NULL;
+	json_t *counts_p = NULL;
+	size_t num_lines = 0;
+
+	/* This only reads the file so the searches recording their queries aren't held up */
+	counts_p = GetQueryCounts (log_p -> ql_filename_s, &num_lines);
+
+	if (counts_p)
+		{
+			const size_t num_counts = json_object_size (counts_p);
+			QueryCount *sorted_counts_p = GetSortedQueryCounts (counts_p);
+
+			if ((sorted_counts_p) || (num_counts == 0))
+				{
+					top_queries_p = json_array ();
+
+					if (top_queries_p)
+						{
+							size_t i;
+
+							for (i = 0; (i < num_counts) && (i < max_queries); ++ i)
+								{
+									json_t *entry_p = GetQueryCountAsJSON (sorted_counts_p + i);
+
+									if (!entry_p || (json_array_append_new (top_queries_p, entry_p) != 0))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add top query \"%s\"", sorted_counts_p [i].qc_key_s);
+										}
+								}
+						}
+
+					if ((num_lines >= S_MIN_LINES_TO_COMPACT) && (num_lines >= (num_counts << 1)))
+						{
+							if (!__atomic_exchange_n (& (log_p -> ql_compacting_flag), true, __ATOMIC_ACQ_REL))
+								{
+									if (!CompactQueryLog (log_p, sorted_counts_p, num_counts))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to compact query log \"%s\"", log_p -> ql_filename_s);
+										}
+
+									__atomic_store_n (& (log_p -> ql_compacting_flag), false, __ATOMIC_RELEASE);
+								}
+						}
+
+					if (sorted_counts_p)
+						{
+							FreeMemory (sorted_counts_p);
+						}
+				}
+
+			json_decref (counts_p);
+		}
+
+	return top_queries_p;
+}
+
+
+/*
+ * Each line is either a single use of a query or, after the file has
+ * been compacted, a query with its count.
+ */
+static json_t *GetQueryCounts (const char *filename_s, size_t *num_lines_p)
+{
+	json_t *counts_p = NULL;
+	FILE *in_f = fopen (filename_s, "r");
+
+	if (in_f)
+		{
+			counts_p = json_object ();
+
+			if (counts_p)
+				{
+					char *line_s = NULL;
+					size_t line_size = 0;
+
+					while (getline (&line_s, &line_size, in_f) != -1)
+						{
+							json_error_t err;
+							json_t *entry_p = json_loads (line_s, 0, &err);
+
+							++ (*num_lines_p);
+
+							if (entry_p)
+								{
+									const char *query_s = GetJSONString (entry_p, QL_QUERY_S);
+
+									if (query_s)
+										{
+											const char *facet_s = GetJSONString (entry_p, QL_FACET_S);
+											char *key_s = ConcatenateVarargsStrings (facet_s ? facet_s : "", S_KEY_SEPARATOR_S, query_s, NULL);
+
+											if (key_s)
+												{
+													json_int_t count = 1;
+													json_int_t previous_count = 0;
+
+													GetJSONInteger (entry_p, QL_COUNT_S, &count);
+													GetJSONInteger (counts_p, key_s, &previous_count);
+
+													if (json_object_set_new (counts_p, key_s, json_integer (previous_count + count)) != 0)
+														{
+															PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to count query \"%s\"", query_s);
+														}
+
+													FreeCopiedString (key_s);
+												}
+										}
+
+									json_decref (entry_p);
+								}
+							else
+								{
+									/* A line may have been cut short by a crash so just skip it */
+									PrintErrors (STM_LEVEL_FINE, __FILE__, __LINE__, "Skipping invalid line in query log \"%s\": %s", filename_s, err.text);
+								}
+						}
+
+					free (line_s);
+				}
+
+			fclose (in_f);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to read query log \"%s\"", filename_s);
+		}
+
+	return counts_p;
+}
+
+
+static QueryCount *GetSortedQueryCounts (const json_t *counts_p)
+{
+	const size_t num_counts = json_object_size (counts_p);
+	QueryCount *sorted_counts_p = NULL;
+
+	if (num_counts > 0)
+		{
+			sorted_counts_p = (QueryCount *) AllocMemoryArray (num_counts, sizeof (QueryCount));
+
+			if (sorted_counts_p)
+				{
+					const char *key_s;
+					json_t *value_p;
+					QueryCount *count_p = sorted_counts_p;
+
+					json_object_foreach ((json_t *) counts_p, key_s, value_p)
+						{
+							count_p -> qc_key_s = key_s;
+							count_p -> qc_count = json_integer_value (value_p);
+							++ count_p;
+						}
+
+					qsort (sorted_counts_p, num_counts, sizeof (QueryCount), CompareQueryCounts);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " query counts", num_counts);
+				}
+		}
+
+	return sorted_counts_p;
+}
+
+
+/* Most frequent first */
+static int CompareQueryCounts (const void *v0_p, const void *v1_p)
+{
+	const QueryCount *count_0_p = (const QueryCount *) v0_p;
+	const QueryCount *count_1_p = (const QueryCount *) v1_p;
+
+	if (count_0_p -> qc_count > count_1_p -> qc_count)
+		{
+			return -1;
+		}
+	else if (count_0_p -> qc_count < count_1_p -> qc_count)
+		{
+			return 1;
+		}
+
+	return strcmp (count_0_p -> qc_key_s, count_1_p -> qc_key_s);
+}
+
+
+static json_t *GetQueryCountAsJSON (const QueryCount *count_p)
+{
+	const char *separator_s = strstr (count_p -> qc_key_s, S_KEY_SEPARATOR_S);
+
+	if (separator_s)
+		{
+			json_t *entry_p = json_pack ("{s:s,s:I}", QL_QUERY_S, separator_s + 1, QL_COUNT_S, count_p -> qc_count);
+
+			if (entry_p)
+				{
+					if (separator_s != count_p -> qc_key_s)
+						{
+							json_t *facet_p = json_stringn (count_p -> qc_key_s, separator_s - (count_p -> qc_key_s));
+
+							if (!facet_p || (json_object_set_new (entry_p, QL_FACET_S, facet_p) != 0))
+								{
+									json_decref (entry_p);
+									entry_p = NULL;
+								}
+						}
+
+					return entry_p;
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Only one thread at a time can do this, which it marks by setting
+ * ql_compacting_flag, and the lock is only taken to swap the files over.
+ * Any lines that are appended between reading and replacing the file
+ * are lost, which doesn't matter for a frequency count. The other
+ * processes sharing the file see that it has been replaced the next
+ * time that they record a query and reopen it.
+ */
+static bool CompactQueryLog (QueryLog *log_p, const QueryCount *counts_p, const size_t num_counts)
+{
+	bool success_flag = false;
+	char *temp_filename_s = ConcatenateVarargsStrings (log_p -> ql_filename_s, ".tmp", NULL);
+
+	if (temp_filename_s)
+		{
+			FILE *out_f = fopen (temp_filename_s, "w");
+
+			if (out_f)
+				{
+					uint64 compacted_size = 0;
+					size_t i;
+
+					success_flag = true;
+
+					for (i = 0; (i < num_counts) && success_flag; ++ i)
+						{
+							json_t *entry_p = GetQueryCountAsJSON (counts_p + i);
+
+							if (entry_p)
+								{
+									if ((json_dumpf (entry_p, out_f, JSON_COMPACT) != 0) || (fputc ('\n', out_f) == EOF))
+										{
+											success_flag = false;
+										}
+
+									json_decref (entry_p);
+								}
+						}
+
+					if (success_flag)
+						{
+							const off_t position = ftello (out_f);
+
+							if (position > 0)
+								{
+									compacted_size = (uint64) position;
+								}
+						}
+
+					if (fclose (out_f) != 0)
+						{
+							success_flag = false;
+						}
+
+					if (success_flag)
+						{
+							pthread_mutex_lock (& (log_p -> ql_lock));
+
+							if (rename (temp_filename_s, log_p -> ql_filename_s) == 0)
+								{
+									struct stat info;
+
+									/* Our stream still points at the old file */
+									OpenQueryLogFile (log_p, &info);
+
+									/* Don't compact again straight away if there are lots of different queries */
+									log_p -> ql_compact_size = compacted_size << 1;
+
+									if (log_p -> ql_compact_size < log_p -> ql_max_size)
+										{
+											log_p -> ql_compact_size = log_p -> ql_max_size;
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+
+							pthread_mutex_unlock (& (log_p -> ql_lock));
+						}
+
+					if (!success_flag)
+						{
+							remove (temp_filename_s);
+						}
+				}
+
+			FreeCopiedString (temp_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * This is called once RecordQuery () has set ql_compacting_flag.
+ */
+static void CompactQueryLogFile (QueryLog *log_p)
+{
+	size_t num_lines = 0;
+	json_t *counts_p = GetQueryCounts (log_p -> ql_filename_s, &num_lines);
+	bool success_flag = false;
+
+	if (counts_p)
+		{
+			const size_t num_counts = json_object_size (counts_p);
+			QueryCount *sorted_counts_p = GetSortedQueryCounts (counts_p);
+
+			if ((sorted_counts_p) || (num_counts == 0))
+				{
+					success_flag = CompactQueryLog (log_p, sorted_counts_p, num_counts);
+
+					if (sorted_counts_p)
+						{
+							FreeMemory (sorted_counts_p);
+						}
+				}
+
+			json_decref (counts_p);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to compact query log \"%s\"", log_p -> ql_filename_s);
+		}
+
+	__atomic_store_n (& (log_p -> ql_compacting_flag), false, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * (Re)open the file for appending. Apart from when the QueryLog is
+ * being created, this must be called with the log's lock held.
+ */
+static bool OpenQueryLogFile (QueryLog *log_p, struct stat *info_p)
+{
+	FILE *out_f = fopen (log_p -> ql_filename_s, "a");
+
+	if (out_f)
+		{
+			if (fstat (fileno (out_f), info_p) == 0)
+				{
+					if (log_p -> ql_out_f)
+						{
+							fclose (log_p -> ql_out_f);
+						}
+
+					log_p -> ql_out_f = out_f;
+					log_p -> ql_inode = info_p -> st_ino;
+
+					return true;
+				}
+
+			fclose (out_f);
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open query log \"%s\"", log_p -> ql_filename_s);
+
+	return false;
+}
+
+
+/*
+ * This must be called with the log's lock held. If another process has
+ * compacted the file, or it has been removed, our stream is appending to
+ * a file that no one will read, so open the new one.
+ */
+static bool RefreshQueryLogFile (QueryLog *log_p, uint64 *size_p)
+{
+	struct stat info;
+
+	if ((stat (log_p -> ql_filename_s, &info) != 0) || (info.st_ino != log_p -> ql_inode))
+		{
+			if (!OpenQueryLogFile (log_p, &info))
+				{
+					return false;
+				}
+		}
+
+	*size_p = (uint64) info.st_size;
+
+	return true;
+}
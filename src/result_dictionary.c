@@ -0,0 +1,186 @@
+/*
+ * result_dictionary.c
+ *
+ *  Created on: 14 Oct 2026
+ *      Author: billy
+ */
+
+#include "result_dictionary.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "service.h"
+
+
+/*
+ * The keys of the values that are repeated across the results. The
+ * providers are whole objects and the rest are usually the same handful
+ * of strings for every page.
+ */
+static const char *S_SHARED_KEYS_SS [] =
+{
+	SERVER_PROVIDER_S,
+	INDEXING_TYPE_DESCRIPTION_S,
+	INDEXING_ICON_URI_S
+};
+
+
+struct ResultDictionary
+{
+	/* Each shared key maps to the array of its distinct values */
+	json_t *rd_values_p;
+};
+
+
+static bool GetDictionaryIndex (json_t *values_p, json_t *value_p, size_t *index_p);
+
+
+
+ResultDictionary *AllocateResultDictionary (void)
+{
+	json_t *values_p = json_object ();
+
+	if (values_p)
+		{
+			ResultDictionary *dictionary_p = (ResultDictionary *) AllocMemory (sizeof (ResultDictionary));
+
+			if (dictionary_p)
+				{
+					dictionary_p -> rd_values_p = values_p;
+
+					return dictionary_p;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate ResultDictionary");
+				}
+
+			json_decref (values_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate ResultDictionary values");
+		}
+
+	return NULL;
+}
+
+
+void FreeResultDictionary (ResultDictionary *dictionary_p)
+{
+	json_decref (dictionary_p -> rd_values_p);
+	FreeMemory (dictionary_p);
+}
+
+
+bool CompactResult (ResultDictionary *dictionary_p, json_t *result_p)
+{
+	bool success_flag = true;
+	size_t i;
+
+	for (i = 0; i < sizeof (S_SHARED_KEYS_SS) / sizeof (S_SHARED_KEYS_SS [0]); ++ i)
+		{
+			const char *key_s = S_SHARED_KEYS_SS [i];
+			json_t *value_p = json_object_get (result_p, key_s);
+
+			/* Skip any missing values and any that have already been compacted */
+			if ((value_p) && (!json_is_integer (value_p)))
+				{
+					json_t *values_p = json_object_get (dictionary_p -> rd_values_p, key_s);
+
+					if (!values_p)
+						{
+							values_p = json_array ();
+
+							if (values_p)
+								{
+									if (json_object_set_new (dictionary_p -> rd_values_p, key_s, values_p) != 0)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add dictionary values for \"%s\"", key_s);
+											values_p = NULL;
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate dictionary values for \"%s\"", key_s);
+								}
+						}
+
+					if (values_p)
+						{
+							size_t index;
+
+							if (GetDictionaryIndex (values_p, value_p, &index))
+								{
+									if (json_object_set_new (result_p, key_s, json_integer ((json_int_t) index)) != 0)
+										{
+											PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, result_p, "Failed to set dictionary index " SIZET_FMT " for \"%s\"", index, key_s);
+											success_flag = false;
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+					else
+						{
+							success_flag = false;
+						}
+
+				}		/* if ((value_p) && (!json_is_integer (value_p))) */
+
+		}		/* for (i = 0; i < sizeof (S_SHARED_KEYS_SS) / sizeof (S_SHARED_KEYS_SS [0]); ++ i) */
+
+	return success_flag;
+}
+
+
+bool AddResultDictionaryToJSON (const ResultDictionary *dictionary_p, json_t *metadata_p)
+{
+	if (json_object_set (metadata_p, RD_DICTIONARY_S, dictionary_p -> rd_values_p) == 0)
+		{
+			return true;
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, dictionary_p -> rd_values_p, "Failed to add \"%s\" to metadata", RD_DICTIONARY_S);
+		}
+
+	return false;
+}
+
+
+/*
+ * There are only ever a few distinct values for each key so a linear
+ * scan is quicker than hashing the objects. Most results share the same
+ * configured provider, so check for that before comparing the contents.
+ */
+static bool GetDictionaryIndex (json_t *values_p, json_t *value_p, size_t *index_p)
+{
+	const size_t num_values = json_array_size (values_p);
+	size_t i;
+
+	for (i = 0; i < num_values; ++ i)
+		{
+			const json_t *entry_p = json_array_get (values_p, i);
+
+			if ((entry_p == value_p) || (json_equal (entry_p, value_p)))
+				{
+					*index_p = i;
+					return true;
+				}
+		}
+
+	if (json_array_append (values_p, value_p) == 0)
+		{
+			*index_p = num_values;
+			return true;
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, value_p, "Failed to add value to dictionary");
+		}
+
+	return false;
+}
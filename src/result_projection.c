@@ -0,0 +1,239 @@
+/*
+ * result_projection.c
+ *
+ *  Created on: 13 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "jansson.h"
+
+#include "result_projection.h"
+#include "author_parser.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "service.h"
+
+
+static const char *S_SUMMARY_FIELDS_SS [] =
+{
+	LUCENE_ID_S,
+	INDEXING_NAME_S,
+	INDEXING_TYPE_S,
+	INDEXING_TYPE_DESCRIPTION_S,
+	INDEXING_ICON_URI_S,
+	WEB_SERVICE_URL_S
+};
+
+
+static bool AddProjectedField (json_t *result_p, const json_t *document_p, const char *key_s);
+
+
+
+bool InitResultProjection (ResultProjection *projection_p, const char *fields_s)
+{
+	projection_p -> rp_full_flag = false;
+	projection_p -> rp_fields_ss = NULL;
+	projection_p -> rp_num_fields = 0;
+	projection_p -> rp_buffer_s = NULL;
+
+	if ((IsStringEmpty (fields_s)) || (strcmp (fields_s, RP_FULL_S) == 0))
+		{
+			projection_p -> rp_full_flag = true;
+		}
+	else if (strcmp (fields_s, RP_SUMMARY_S) == 0)
+		{
+			projection_p -> rp_fields_ss = S_SUMMARY_FIELDS_SS;
+			projection_p -> rp_num_fields = sizeof (S_SUMMARY_FIELDS_SS) / sizeof (S_SUMMARY_FIELDS_SS [0]);
+		}
+	else
+		{
+			uint32 max_num_fields = 1;
+			const char *c_p = fields_s;
+
+			while ((c_p = strchr (c_p, ',')) != NULL)
+				{
+					++ max_num_fields;
+					++ c_p;
+				}
+
+			projection_p -> rp_buffer_s = EasyCopyToNewString (fields_s);
+
+			if (projection_p -> rp_buffer_s)
+				{
+					const char **fields_ss = (const char **) AllocMemoryArray (max_num_fields, sizeof (const char *));
+
+					if (fields_ss)
+						{
+							char *field_s = projection_p -> rp_buffer_s;
+							bool loop_flag = true;
+
+							projection_p -> rp_fields_ss = fields_ss;
+
+							/* Split the copied list in place, trimming any surrounding whitespace */
+							while (loop_flag)
+								{
+									char *end_s = strchr (field_s, ',');
+									char *last_s;
+
+									if (end_s)
+										{
+											*end_s = '\0';
+										}
+									else
+										{
+											loop_flag = false;
+										}
+
+									while ((*field_s == ' ') || (*field_s == '\t'))
+										{
+											++ field_s;
+										}
+
+									last_s = field_s + strlen (field_s);
+
+									while ((last_s > field_s) && ((* (last_s - 1) == ' ') || (* (last_s - 1) == '\t')))
+										{
+											-- last_s;
+										}
+
+									*last_s = '\0';
+
+									if (*field_s != '\0')
+										{
+											fields_ss [projection_p -> rp_num_fields] = field_s;
+											++ (projection_p -> rp_num_fields);
+										}
+
+									if (end_s)
+										{
+											field_s = end_s + 1;
+										}
+								}
+
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " projection fields for \"%s\"", max_num_fields, fields_s);
+						}
+
+					FreeCopiedString (projection_p -> rp_buffer_s);
+					projection_p -> rp_buffer_s = NULL;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy projection fields \"%s\"", fields_s);
+				}
+
+			return false;
+		}
+
+	return true;
+}
+
+
+void ClearResultProjection (ResultProjection *projection_p)
+{
+	if (projection_p -> rp_buffer_s)
+		{
+			FreeMemory ((void *) (projection_p -> rp_fields_ss));
+			FreeCopiedString (projection_p -> rp_buffer_s);
+		}
+
+	projection_p -> rp_fields_ss = NULL;
+	projection_p -> rp_buffer_s = NULL;
+	projection_p -> rp_num_fields = 0;
+	projection_p -> rp_full_flag = true;
+}
+
+
+bool IsFieldInResultProjection (const ResultProjection *projection_p, const char *key_s)
+{
+	if (projection_p -> rp_full_flag)
+		{
+			return true;
+		}
+	else
+		{
+			uint32 i;
+
+			for (i = 0; i < projection_p -> rp_num_fields; ++ i)
+				{
+					if (strcmp (projection_p -> rp_fields_ss [i], key_s) == 0)
+						{
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+bool IsAuthorsListInResultProjection (const ResultProjection *projection_p, const bool default_flag)
+{
+	/*
+	 * The list of names is optional in the full results so only
+	 * add it if it has been configured or explicitly requested.
+	 */
+	if (projection_p -> rp_full_flag)
+		{
+			return default_flag;
+		}
+
+	return IsFieldInResultProjection (projection_p, AP_AUTHORS_LIST_S);
+}
+
+
+json_t *GetProjectedResult (const json_t *document_p, const ResultProjection *projection_p)
+{
+	json_t *result_p = json_object ();
+
+	if (result_p)
+		{
+			uint32 i;
+
+			/* We always need the name to make the resource */
+			if (!IsFieldInResultProjection (projection_p, INDEXING_NAME_S))
+				{
+					AddProjectedField (result_p, document_p, INDEXING_NAME_S);
+				}
+
+			for (i = 0; i < projection_p -> rp_num_fields; ++ i)
+				{
+					if (!AddProjectedField (result_p, document_p, projection_p -> rp_fields_ss [i]))
+						{
+							json_decref (result_p);
+							return NULL;
+						}
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate projected result");
+		}
+
+	return result_p;
+}
+
+
+static bool AddProjectedField (json_t *result_p, const json_t *document_p, const char *key_s)
+{
+	json_t *value_p = json_object_get (document_p, key_s);
+
+	if (value_p)
+		{
+			/* The values are shared rather than copied as neither side changes them */
+			if (json_object_set (result_p, key_s, value_p) != 0)
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, document_p, "Failed to add projected field \"%s\"", key_s);
+					return false;
+				}
+		}
+
+	return true;
+}
@@ -0,0 +1,118 @@
+/*
+ * search_capture.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "search_capture.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+struct SearchCapture
+{
+	char *scp_filename_s;
+
+	FILE *scp_out_f;
+
+	pthread_mutex_t scp_lock;
+};
+
+
+
+SearchCapture *AllocateSearchCapture (const char *filename_s)
+{
+	SearchCapture *capture_p = (SearchCapture *) AllocMemory (sizeof (SearchCapture));
+
+	if (capture_p)
+		{
+			capture_p -> scp_filename_s = EasyCopyToNewString (filename_s);
+
+			if (capture_p -> scp_filename_s)
+				{
+					capture_p -> scp_out_f = fopen (filename_s, "a");
+
+					if (capture_p -> scp_out_f)
+						{
+							if (pthread_mutex_init (& (capture_p -> scp_lock), NULL) == 0)
+								{
+									return capture_p;
+								}
+
+							fclose (capture_p -> scp_out_f);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open search capture \"%s\"", filename_s);
+						}
+
+					FreeCopiedString (capture_p -> scp_filename_s);
+				}
+
+			FreeMemory (capture_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeSearchCapture (SearchCapture *capture_p)
+{
+	fclose (capture_p -> scp_out_f);
+	pthread_mutex_destroy (& (capture_p -> scp_lock));
+	FreeCopiedString (capture_p -> scp_filename_s);
+	FreeMemory (capture_p);
+}
+
+
+bool CaptureSearch (SearchCapture *capture_p, const json_t *params_p)
+{
+	bool success_flag = false;
+	struct timespec now;
+	json_t *entry_p;
+
+	/* The replay only needs the gaps between searches, but wall clock times can be lined up with other logs */
+	clock_gettime (CLOCK_REALTIME, &now);
+
+	entry_p = json_pack ("{s:I,s:O}",
+											 SCP_TIME_S, (json_int_t) ((((json_int_t) now.tv_sec) * 1000) + (now.tv_nsec / 1000000)),
+											 SCP_PARAMS_S, (json_t *) params_p);
+
+	if (entry_p)
+		{
+			char *entry_s = json_dumps (entry_p, JSON_COMPACT);
+
+			if (entry_s)
+				{
+					/* Write each line in one go so that the lines of concurrent searches can't interleave */
+					pthread_mutex_lock (& (capture_p -> scp_lock));
+
+					if ((fprintf (capture_p -> scp_out_f, "%s\n", entry_s) > 0) && (fflush (capture_p -> scp_out_f) == 0))
+						{
+							success_flag = true;
+						}
+
+					pthread_mutex_unlock (& (capture_p -> scp_lock));
+
+					free (entry_s);
+				}
+
+			json_decref (entry_p);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add search to capture \"%s\"", capture_p -> scp_filename_s);
+		}
+
+	return success_flag;
+}
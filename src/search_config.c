@@ -0,0 +1,231 @@
+/*
+ * search_config.c
+ *
+ *  Created on: 15 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "search_config.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "json_util.h"
+#include "service.h"
+
+
+static const uint32 S_DEFAULT_PARALLEL_CONVERSION_MIN_HITS = 100;
+
+/* This matches the default number of rows returned by both CKAN and Zenodo */
+static const uint32 S_DEFAULT_EXTERNAL_PAGE_SIZE = 10;
+
+static const uint32 S_DEFAULT_EXPORT_MAX_HITS = 1000000;
+
+
+static FacetKeys *GetFacetKeys (const json_t *config_p, const SearchConfig *search_config_p);
+
+static uint32 GetBackendGeneration (const json_t *config_p, const SearchConfig *previous_p, const char *backend_s, const uint32 previous_generation);
+
+
+
+SearchConfig *AllocateSearchConfig (json_t *config_p, const SearchConfig *previous_p, struct ConversionPool *pool_p, struct ExternalResultCache *cache_p, struct HedgePolicy *hedge_p)
+{
+	SearchConfig *search_config_p = (SearchConfig *) AllocMemory (sizeof (SearchConfig));
+
+	if (search_config_p)
+		{
+			const json_t *ckan_p = json_object_get (config_p, "ckan");
+			const json_t *zenodo_p = json_object_get (config_p, "zenodo");
+			const json_t *conversion_p = json_object_get (config_p, "parallel_conversion");
+			const json_t *export_p = json_object_get (config_p, "export");
+
+			memset (search_config_p, 0, sizeof (SearchConfig));
+
+			search_config_p -> sc_config_p = json_incref (config_p);
+			search_config_p -> sc_conversion_pool_p = pool_p;
+			search_config_p -> sc_external_cache_p = cache_p;
+			search_config_p -> sc_hedge_p = hedge_p;
+			search_config_p -> sc_num_refs = 1;
+
+			GetJSONBoolean (config_p, "author_list", & (search_config_p -> sc_author_list_flag));
+			GetJSONUnsignedInteger (config_p, "external_page_size", & (search_config_p -> sc_external_page_size));
+
+			if (search_config_p -> sc_external_page_size == 0)
+				{
+					search_config_p -> sc_external_page_size = S_DEFAULT_EXTERNAL_PAGE_SIZE;
+				}
+
+			if (ckan_p)
+				{
+					search_config_p -> sc_ckan_url_s = GetJSONString (ckan_p, CONTEXT_PREFIX_SCHEMA_ORG_S "url");
+
+					if (search_config_p -> sc_ckan_url_s)
+						{
+							search_config_p -> sc_ckan_resource_mappings_p = json_object_get (ckan_p, "mappings");
+
+							search_config_p -> sc_ckan_provider_p = json_object_get (ckan_p, SERVER_PROVIDER_S);
+							search_config_p -> sc_ckan_filters_p = json_object_get (ckan_p, "filters");
+						}
+				}
+
+			if (zenodo_p)
+				{
+					search_config_p -> sc_zenodo_url_s = GetJSONString (zenodo_p, CONTEXT_PREFIX_SCHEMA_ORG_S "url");
+
+					if (search_config_p -> sc_zenodo_url_s)
+						{
+							search_config_p -> sc_zenodo_provider_p = json_object_get (zenodo_p, SERVER_PROVIDER_S);
+							search_config_p -> sc_zenodo_community_s = GetJSONString (zenodo_p, "community");
+							search_config_p -> sc_zenodo_api_token_s = GetJSONString (zenodo_p, "api_token");
+
+							search_config_p -> sc_zenodo_resource_mappings_p = json_object_get (zenodo_p, "mappings");
+						}
+				}
+
+			search_config_p -> sc_parallel_conversion_min_hits = S_DEFAULT_PARALLEL_CONVERSION_MIN_HITS;
+
+			if (conversion_p)
+				{
+					json_int_t min_hits = 0;
+
+					if (GetJSONInteger (conversion_p, "min_hits", &min_hits) && (min_hits > 0))
+						{
+							search_config_p -> sc_parallel_conversion_min_hits = (uint32) min_hits;
+						}
+				}
+
+			if (export_p)
+				{
+					search_config_p -> sc_export_directory_s = GetJSONString (export_p, "directory");
+
+					if (search_config_p -> sc_export_directory_s)
+						{
+							search_config_p -> sc_export_url_s = GetJSONString (export_p, CONTEXT_PREFIX_SCHEMA_ORG_S "url");
+
+							if (! ((GetJSONUnsignedInteger (export_p, "max_hits", & (search_config_p -> sc_export_max_hits))) && (search_config_p -> sc_export_max_hits > 0)))
+								{
+									search_config_p -> sc_export_max_hits = S_DEFAULT_EXPORT_MAX_HITS;
+								}
+						}
+				}
+
+			search_config_p -> sc_ckan_generation = GetBackendGeneration (config_p, previous_p, "ckan", previous_p ? previous_p -> sc_ckan_generation : 0);
+			search_config_p -> sc_zenodo_generation = GetBackendGeneration (config_p, previous_p, "zenodo", previous_p ? previous_p -> sc_zenodo_generation : 0);
+
+			search_config_p -> sc_facet_keys_p = GetFacetKeys (config_p, search_config_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate SearchConfig");
+		}
+
+	return search_config_p;
+}
+
+
+SearchConfig *RetainSearchConfig (SearchConfig *config_p)
+{
+	__atomic_add_fetch (& (config_p -> sc_num_refs), 1, __ATOMIC_RELAXED);
+
+	return config_p;
+}
+
+
+void ReleaseSearchConfig (SearchConfig *config_p)
+{
+	/* The last release has to see every write made by the other users */
+	if (__atomic_sub_fetch (& (config_p -> sc_num_refs), 1, __ATOMIC_ACQ_REL) == 0)
+		{
+			if (config_p -> sc_facet_keys_p)
+				{
+					FreeFacetKeys (config_p -> sc_facet_keys_p);
+				}
+
+			json_decref (config_p -> sc_config_p);
+			FreeMemory (config_p);
+		}
+}
+
+
+/*
+ * A backend keeps its generation if its part of the configuration
+ * hasn't changed since the previous snapshot.
+ */
+static uint32 GetBackendGeneration (const json_t *config_p, const SearchConfig *previous_p, const char *backend_s, const uint32 previous_generation)
+{
+	if (previous_p)
+		{
+			const json_t *backend_p = json_object_get (config_p, backend_s);
+			const json_t *previous_backend_p = json_object_get (previous_p -> sc_config_p, backend_s);
+
+			if ((backend_p == previous_backend_p) || ((backend_p) && (previous_backend_p) && (json_equal (backend_p, previous_backend_p))))
+				{
+					return previous_generation;
+				}
+		}
+
+	return previous_generation + 1;
+}
+
+
+static FacetKeys *GetFacetKeys (const json_t *config_p, const SearchConfig *search_config_p)
+{
+	FacetKeys *keys_p = AllocateFacetKeys ();
+
+	if (keys_p)
+		{
+			bool success_flag = true;
+			const json_t *facets_p = json_object_get (config_p, "facets");
+
+			if (json_is_array (facets_p))
+				{
+					size_t i;
+					const json_t *facet_p;
+
+					json_array_foreach (facets_p, i, facet_p)
+						{
+							const char *name_s = GetJSONString (facet_p, "so:name");
+
+							if (name_s)
+								{
+									if (!InternFacetKey (keys_p, name_s))
+										{
+											success_flag = false;
+										}
+								}
+						}
+				}
+
+			if (search_config_p -> sc_ckan_resource_mappings_p)
+				{
+					if (!InternFacetKeysFromMappings (keys_p, search_config_p -> sc_ckan_resource_mappings_p))
+						{
+							success_flag = false;
+						}
+				}
+
+			if (search_config_p -> sc_zenodo_resource_mappings_p)
+				{
+					if (!InternFacetKeysFromMappings (keys_p, search_config_p -> sc_zenodo_resource_mappings_p))
+						{
+							success_flag = false;
+						}
+				}
+
+			if (success_flag)
+				{
+					return keys_p;
+				}
+
+			FreeFacetKeys (keys_p);
+		}
+
+	/*
+	 * Without the interned keys, the facet counts will all
+	 * go through the slower locked path.
+	 */
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get facet keys");
+
+	return NULL;
+}
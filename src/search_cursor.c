@@ -0,0 +1,215 @@
+/*
+ * search_cursor.c
+ *
+ *  Created on: 14 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "search_cursor.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+/*
+ * The cursor is the version prefix followed by each of the
+ * SearchCursor's fields in hex separated by dots. The version
+ * lets us change the layout without misreading older cursors.
+ */
+static const char * const S_CURSOR_VERSION_S = "c1";
+
+#define S_NUM_CURSOR_FIELDS (6)
+
+
+static uint32 *GetSearchCursorSourcePosition (SearchCursor *cursor_p, const uint32 source_flag);
+
+static bool IsSearchCursorInRange (const SearchCursor *cursor_p);
+
+
+
+bool InitSearchCursor (SearchCursor *cursor_p, const uint32 page_number, const uint32 page_size, const uint32 external_page_size)
+{
+	const uint64 external_from = ((uint64) page_number) * external_page_size;
+
+	cursor_p -> sc_lucene_page = page_number;
+	cursor_p -> sc_page_size = page_size;
+	cursor_p -> sc_external_page_size = external_page_size;
+	cursor_p -> sc_ckan_from = (uint32) external_from;
+	cursor_p -> sc_zenodo_from = (uint32) external_from;
+	cursor_p -> sc_exhausted_flags = 0;
+
+	if ((external_from <= UINT32_MAX) && (IsSearchCursorInRange (cursor_p)))
+		{
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Page " UINT32_FMT " of size " UINT32_FMT " is out of range", page_number, page_size);
+
+	return false;
+}
+
+
+bool ParseSearchCursor (SearchCursor *cursor_p, const char *cursor_s, const uint32 external_page_size)
+{
+	const size_t version_length = strlen (S_CURSOR_VERSION_S);
+
+	if ((strncmp (cursor_s, S_CURSOR_VERSION_S, version_length) == 0) && (cursor_s [version_length] == '.'))
+		{
+			uint32 values [S_NUM_CURSOR_FIELDS];
+			const char *value_s = cursor_s + version_length + 1;
+			uint32 i;
+
+			for (i = 0; i < S_NUM_CURSOR_FIELDS; ++ i)
+				{
+					char *end_s = NULL;
+					unsigned long value = strtoul (value_s, &end_s, 16);
+					const char expected_end = (i < S_NUM_CURSOR_FIELDS - 1) ? '.' : '\0';
+
+					if ((end_s == value_s) || (*end_s != expected_end) || (value > UINT32_MAX))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid field " UINT32_FMT " in search cursor \"%s\"", i, cursor_s);
+							return false;
+						}
+
+					values [i] = (uint32) value;
+					value_s = end_s + 1;
+				}
+
+			/*
+			 * The external page size is still written to the cursor so
+			 * that older cursors parse, but a client could change it to
+			 * make the portals return any number of hits, so only the
+			 * configured one is used.
+			 */
+			cursor_p -> sc_lucene_page = values [0];
+			cursor_p -> sc_page_size = values [1];
+			cursor_p -> sc_ckan_from = values [2];
+			cursor_p -> sc_zenodo_from = values [3];
+			cursor_p -> sc_external_page_size = external_page_size;
+			cursor_p -> sc_exhausted_flags = values [5] & (SC_LUCENE_EXHAUSTED | SC_CKAN_EXHAUSTED | SC_ZENODO_EXHAUSTED);
+
+			if (IsSearchCursorInRange (cursor_p))
+				{
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Page size or positions out of range in search cursor \"%s\"", cursor_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown search cursor version \"%s\"", cursor_s);
+		}
+
+	return false;
+}
+
+
+char *GetSearchCursorAsString (const SearchCursor *cursor_p)
+{
+	/* The version, six 8 digit hex fields, their separators and the terminator */
+	char buffer_s [64];
+	const int res = snprintf (buffer_s, sizeof (buffer_s), "%s.%x.%x.%x.%x.%x.%x", S_CURSOR_VERSION_S,
+														cursor_p -> sc_lucene_page, cursor_p -> sc_page_size, cursor_p -> sc_ckan_from,
+														cursor_p -> sc_zenodo_from, cursor_p -> sc_external_page_size, cursor_p -> sc_exhausted_flags);
+
+	if ((res > 0) && ((size_t) res < sizeof (buffer_s)))
+		{
+			char *cursor_s = EasyCopyToNewString (buffer_s);
+
+			if (cursor_s)
+				{
+					return cursor_s;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to copy search cursor \"%s\"", buffer_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to print search cursor");
+		}
+
+	return NULL;
+}
+
+
+void GetSearchCursorSourcePage (const SearchCursor *cursor_p, const uint32 source_flag, SourcePage *page_p)
+{
+	page_p -> sp_from = (source_flag == SC_ZENODO_EXHAUSTED) ? cursor_p -> sc_zenodo_from : cursor_p -> sc_ckan_from;
+	page_p -> sp_size = cursor_p -> sc_external_page_size;
+	page_p -> sp_num_hits = 0;
+}
+
+
+void AdvanceSearchCursorSource (SearchCursor *cursor_p, const uint32 source_flag, const SourcePage *page_p)
+{
+	uint32 *from_p = GetSearchCursorSourcePosition (cursor_p, source_flag);
+
+	*from_p = page_p -> sp_from + page_p -> sp_num_hits;
+
+	if (page_p -> sp_num_hits < page_p -> sp_size)
+		{
+			cursor_p -> sc_exhausted_flags |= source_flag;
+		}
+}
+
+
+void AdvanceSearchCursorLucene (SearchCursor *cursor_p, const uint32 num_total_hits)
+{
+	/* The cursor was checked when it was set up, so the end of the page fits */
+	const uint32 end = ((cursor_p -> sc_lucene_page) + 1) * (cursor_p -> sc_page_size);
+
+	if (end >= num_total_hits)
+		{
+			cursor_p -> sc_exhausted_flags |= SC_LUCENE_EXHAUSTED;
+		}
+	else
+		{
+			++ (cursor_p -> sc_lucene_page);
+		}
+}
+
+
+bool HasMoreSearchCursorResults (const SearchCursor *cursor_p, const uint32 sources_flags)
+{
+	return ((cursor_p -> sc_exhausted_flags & sources_flags) != sources_flags);
+}
+
+
+/*
+ * Every position that a search works out from the cursor, up to the end
+ * of the page that it asks each source for, has to fit in a uint32.
+ */
+static bool IsSearchCursorInRange (const SearchCursor *cursor_p)
+{
+	if ((cursor_p -> sc_page_size > 0) && (cursor_p -> sc_page_size <= SC_MAX_PAGE_SIZE) && (cursor_p -> sc_external_page_size > 0))
+		{
+			const uint64 lucene_end = (((uint64) (cursor_p -> sc_lucene_page)) + 1) * (cursor_p -> sc_page_size);
+			const uint64 ckan_end = ((uint64) (cursor_p -> sc_ckan_from)) + (cursor_p -> sc_external_page_size);
+			const uint64 zenodo_end = ((uint64) (cursor_p -> sc_zenodo_from)) + (cursor_p -> sc_external_page_size);
+
+			return ((lucene_end <= UINT32_MAX) && (ckan_end <= UINT32_MAX) && (zenodo_end <= UINT32_MAX));
+		}
+
+	return false;
+}
+
+
+static uint32 *GetSearchCursorSourcePosition (SearchCursor *cursor_p, const uint32 source_flag)
+{
+	if (source_flag == SC_ZENODO_EXHAUSTED)
+		{
+			return & (cursor_p -> sc_zenodo_from);
+		}
+
+	return & (cursor_p -> sc_ckan_from);
+}
@@ -0,0 +1,314 @@
+/*
+ * search_export.c
+ *
+ *  Created on: 15 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+
+#include "search_export.h"
+#include "search_cursor.h"
+#include "ckan_search_tool.h"
+#include "zenodo_search_tool.h"
+
+#include "streams.h"
+#include "string_utils.h"
+#include "uuid_util.h"
+#include "data_resource.h"
+
+
+typedef struct ExportData
+{
+	FILE *ed_out_f;
+	LuceneDocumentConverter ed_convert_fn;
+	void *ed_convert_data_p;
+	uint32 ed_num_hits;
+	uint32 ed_max_hits;
+	bool ed_write_failed_flag;
+} ExportData;
+
+
+static bool WriteExportedHit (ExportData *export_p, const json_t *result_p);
+
+static bool WriteLuceneHit (const json_t *document_p, const uint32 index, void *data_p);
+
+static void ExportExternalHits (const char *keyword_s, json_t *(*search_fn) (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p),
+																const char *source_s, ExportData *export_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
+
+static bool AddExportToServiceJob (ServiceJob *job_p, const char *keyword_s, const char *filename_s, const char *uuid_s, const uint32 num_hits, const SearchConfig *config_p);
+
+
+
+OperationStatus RunSearchExport (LuceneTool *lucene_p, const char *keyword_s, LinkedList *facets_p, const uint32 sources_flags,
+																 LuceneDocumentConverter convert_fn, void *convert_data_p, const ResultProjection *projection_p,
+																 ServiceJob *job_p, const SearchConfig *config_p)
+{
+	OperationStatus status = OS_FAILED;
+
+	if (config_p -> sc_export_directory_s)
+		{
+			char uuid_s [UUID_STRING_BUFFER_SIZE];
+			char *filename_s = NULL;
+
+			ConvertUUIDToString (job_p -> sj_id, uuid_s);
+
+			filename_s = ConcatenateVarargsStrings (config_p -> sc_export_directory_s, "/", uuid_s, SE_EXPORT_FILE_EXTENSION_S, NULL);
+
+			if (filename_s)
+				{
+					/* Write to a temporary file so that a partial export is never visible */
+					char *temp_filename_s = ConcatenateVarargsStrings (filename_s, ".part", NULL);
+
+					if (temp_filename_s)
+						{
+							ExportData export_data;
+
+							export_data.ed_out_f = fopen (temp_filename_s, "w");
+							export_data.ed_convert_fn = convert_fn;
+							export_data.ed_convert_data_p = convert_data_p;
+							export_data.ed_num_hits = 0;
+							export_data.ed_max_hits = config_p -> sc_export_max_hits;
+							export_data.ed_write_failed_flag = false;
+
+							if (export_data.ed_out_f)
+								{
+									/*
+									 * A single query means that every hit comes from the same
+									 * index searcher and so the same snapshot of the index.
+									 */
+									if (SearchLucene (lucene_p, keyword_s, facets_p, "drill-down", 0, export_data.ed_max_hits, QM_PARSER))
+										{
+											status = ParseLuceneResults (lucene_p, 0, export_data.ed_max_hits - 1, WriteLuceneHit, &export_data);
+
+											if ((status == OS_SUCCEEDED) || (status == OS_PARTIALLY_SUCCEEDED))
+												{
+													/* An export has no facet counts, so the external hits aren't counted */
+													if (sources_flags & SC_CKAN_EXHAUSTED)
+														{
+															ExportExternalHits (keyword_s, SearchCKAN, "CKAN", &export_data, NULL, projection_p, config_p);
+														}
+
+													if (sources_flags & SC_ZENODO_EXHAUSTED)
+														{
+															ExportExternalHits (keyword_s, SearchZenodo, "Zenodo", &export_data, NULL, projection_p, config_p);
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "ParseLuceneResults failed when exporting \"%s\"", keyword_s);
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "SearchLucene for exporting \"%s\" failed", keyword_s);
+										}
+
+									if (fclose (export_data.ed_out_f) != 0)
+										{
+											export_data.ed_write_failed_flag = true;
+										}
+
+									if (export_data.ed_write_failed_flag)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write export file \"%s\"", temp_filename_s);
+											status = OS_FAILED;
+										}
+
+									if ((status == OS_SUCCEEDED) || (status == OS_PARTIALLY_SUCCEEDED))
+										{
+											if (rename (temp_filename_s, filename_s) == 0)
+												{
+													if (!AddExportToServiceJob (job_p, keyword_s, filename_s, uuid_s, export_data.ed_num_hits, config_p))
+														{
+															status = OS_FAILED;
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to rename \"%s\" to \"%s\"", temp_filename_s, filename_s);
+													status = OS_FAILED;
+												}
+										}
+
+									if ((status != OS_SUCCEEDED) && (status != OS_PARTIALLY_SUCCEEDED))
+										{
+											remove (temp_filename_s);
+										}
+
+								}		/* if (export_data.ed_out_f) */
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open export file \"%s\"", temp_filename_s);
+								}
+
+							FreeCopiedString (temp_filename_s);
+						}		/* if (temp_filename_s) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to make temporary export filename for \"%s\"", filename_s);
+						}
+
+					FreeCopiedString (filename_s);
+				}		/* if (filename_s) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to make export filename in \"%s\"", config_p -> sc_export_directory_s);
+				}
+
+		}		/* if (config_p -> sc_export_directory_s) */
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Exports are not enabled as no \"export\" \"directory\" has been configured");
+		}
+
+	return status;
+}
+
+
+static bool WriteExportedHit (ExportData *export_p, const json_t *result_p)
+{
+	if ((json_dumpf (result_p, export_p -> ed_out_f, JSON_COMPACT) == 0) && (fputc ('\n', export_p -> ed_out_f) != EOF))
+		{
+			++ (export_p -> ed_num_hits);
+			return true;
+		}
+
+	export_p -> ed_write_failed_flag = true;
+
+	return false;
+}
+
+
+static bool WriteLuceneHit (const json_t *document_p, const uint32 UNUSED_PARAM (index), void *data_p)
+{
+	ExportData *export_p = (ExportData *) data_p;
+	bool success_flag = false;
+
+	if (!export_p -> ed_write_failed_flag)
+		{
+			json_t *result_p = export_p -> ed_convert_fn (document_p, export_p -> ed_convert_data_p);
+
+			if (result_p)
+				{
+					success_flag = WriteExportedHit (export_p, result_p);
+					json_decref (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Page through an external source until it runs out of hits. Each page
+ * is written and freed before the next one is requested.
+ */
+static void ExportExternalHits (const char *keyword_s, json_t *(*search_fn) (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p),
+																const char *source_s, ExportData *export_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
+{
+	SourcePage page;
+	bool loop_flag = true;
+
+	page.sp_from = 0;
+	page.sp_size = config_p -> sc_external_page_size;
+
+	while (loop_flag && (export_p -> ed_num_hits < export_p -> ed_max_hits) && (!export_p -> ed_write_failed_flag))
+		{
+			json_t *results_p = NULL;
+
+			page.sp_num_hits = 0;
+			results_p = search_fn (keyword_s, &page, facets_p, projection_p, config_p, NULL);
+
+			if (results_p)
+				{
+					size_t i;
+					json_t *result_p;
+
+					/* A page can take the export past its limit, so stop partway through it */
+					json_array_foreach (results_p, i, result_p)
+						{
+							if ((export_p -> ed_num_hits >= export_p -> ed_max_hits) || (!WriteExportedHit (export_p, result_p)))
+								{
+									break;
+								}
+						}
+
+					json_decref (results_p);
+
+					if ((page.sp_num_hits < page.sp_size) || (export_p -> ed_num_hits >= export_p -> ed_max_hits))
+						{
+							loop_flag = false;
+						}
+					else
+						{
+							page.sp_from += page.sp_num_hits;
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to export %s hits from " UINT32_FMT " for \"%s\"", source_s, page.sp_from, keyword_s);
+					loop_flag = false;
+				}
+		}
+}
+
+
+static bool AddExportToServiceJob (ServiceJob *job_p, const char *keyword_s, const char *filename_s, const char *uuid_s, const uint32 num_hits, const SearchConfig *config_p)
+{
+	bool success_flag = false;
+	json_t *data_json_p = json_pack ("{s:s,s:I}", "query", keyword_s ? keyword_s : "", "hits", (json_int_t) num_hits);
+
+	if (data_json_p)
+		{
+			const char *protocol_s = PROTOCOL_FILE_S;
+			char *value_s = NULL;
+			json_t *resource_p = NULL;
+
+			if (config_p -> sc_export_url_s)
+				{
+					protocol_s = PROTOCOL_HTTP_S;
+					value_s = ConcatenateVarargsStrings (config_p -> sc_export_url_s, "/", uuid_s, SE_EXPORT_FILE_EXTENSION_S, NULL);
+				}
+			else
+				{
+					value_s = EasyCopyToNewString (filename_s);
+				}
+
+			if (value_s)
+				{
+					resource_p = GetDataResourceAsJSONByParts (protocol_s, value_s, "Exported search results", data_json_p);
+
+					if (resource_p)
+						{
+							if (AddResultToServiceJob (job_p, resource_p))
+								{
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AddResultToServiceJob () failed for export \"%s\"", value_s);
+									json_decref (resource_p);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetDataResourceAsJSONByParts () failed for export \"%s\"", value_s);
+						}
+
+					FreeCopiedString (value_s);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get the location of export \"%s\"", filename_s);
+				}
+
+			json_decref (data_json_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create export details for \"%s\"", filename_s);
+		}
+
+	return success_flag;
+}
@@ -0,0 +1,306 @@
+/*
+ * search_flight.c
+ *
+ *  Created on: 16 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "search_flight.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+struct SearchFlight
+{
+	char *sf_key_s;
+
+	/** The number of searches using this SearchFlight. */
+	uint32 sf_num_refs;
+
+	bool sf_done_flag;
+
+	OperationStatus sf_status;
+
+	/** The leader's results. These are shared, never altered. */
+	json_t *sf_results_p;
+
+	json_t *sf_metadata_p;
+
+	pthread_cond_t sf_done_cond;
+
+	struct SearchFlight *sf_next_p;
+};
+
+
+/*
+ * The number of different searches running at once is limited by the
+ * number of server threads, so a list is quick enough to search. A single
+ * lock covers the list and every SearchFlight in it.
+ */
+struct SearchFlightTable
+{
+	SearchFlight *sft_flights_p;
+
+	pthread_mutex_t sft_lock;
+};
+
+
+static SearchFlight *AllocateSearchFlight (const char *key_s);
+
+static void FreeSearchFlight (SearchFlight *flight_p);
+
+static void RemoveSearchFlight (SearchFlightTable *table_p, SearchFlight *flight_p);
+
+
+
+SearchFlightTable *AllocateSearchFlightTable (void)
+{
+	SearchFlightTable *table_p = (SearchFlightTable *) AllocMemory (sizeof (SearchFlightTable));
+
+	if (table_p)
+		{
+			if (pthread_mutex_init (& (table_p -> sft_lock), NULL) == 0)
+				{
+					table_p -> sft_flights_p = NULL;
+
+					return table_p;
+				}
+
+			FreeMemory (table_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate SearchFlightTable");
+
+	return NULL;
+}
+
+
+void FreeSearchFlightTable (SearchFlightTable *table_p)
+{
+	pthread_mutex_destroy (& (table_p -> sft_lock));
+	FreeMemory (table_p);
+}
+
+
+SearchFlight *JoinSearchFlight (SearchFlightTable *table_p, const char *key_s, bool *leader_flag_p)
+{
+	SearchFlight *flight_p = NULL;
+
+	pthread_mutex_lock (& (table_p -> sft_lock));
+
+	flight_p = table_p -> sft_flights_p;
+
+	while (flight_p && (strcmp (flight_p -> sf_key_s, key_s) != 0))
+		{
+			flight_p = flight_p -> sf_next_p;
+		}
+
+	if (flight_p)
+		{
+			++ (flight_p -> sf_num_refs);
+			*leader_flag_p = false;
+		}
+	else
+		{
+			flight_p = AllocateSearchFlight (key_s);
+
+			if (flight_p)
+				{
+					flight_p -> sf_next_p = table_p -> sft_flights_p;
+					table_p -> sft_flights_p = flight_p;
+
+					*leader_flag_p = true;
+				}
+		}
+
+	pthread_mutex_unlock (& (table_p -> sft_lock));
+
+	return flight_p;
+}
+
+
+void CompleteSearchFlight (SearchFlightTable *table_p, SearchFlight *flight_p, const ServiceJob *job_p)
+{
+	/*
+	 * The leader's ServiceJob carries on being used after this, so take
+	 * our own array of its results and our own copy of its metadata. Do
+	 * this before taking the lock as the metadata can be large.
+	 */
+	json_t *results_p = (job_p -> sj_result_p) ? json_copy (job_p -> sj_result_p) : NULL;
+	json_t *metadata_p = (job_p -> sj_metadata_p) ? json_deep_copy (job_p -> sj_metadata_p) : NULL;
+	OperationStatus status = job_p -> sj_status;
+
+	if (((job_p -> sj_result_p) && (!results_p)) || ((job_p -> sj_metadata_p) && (!metadata_p)))
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy results for SearchFlight \"%s\"", flight_p -> sf_key_s);
+			status = OS_FAILED;
+		}
+
+	pthread_mutex_lock (& (table_p -> sft_lock));
+
+	RemoveSearchFlight (table_p, flight_p);
+
+	flight_p -> sf_status = status;
+	flight_p -> sf_results_p = results_p;
+	flight_p -> sf_metadata_p = metadata_p;
+
+	flight_p -> sf_done_flag = true;
+	pthread_cond_broadcast (& (flight_p -> sf_done_cond));
+
+	pthread_mutex_unlock (& (table_p -> sft_lock));
+}
+
+
+bool CopySearchFlightResults (SearchFlightTable *table_p, SearchFlight *flight_p, ServiceJob *job_p)
+{
+	bool success_flag = true;
+
+	pthread_mutex_lock (& (table_p -> sft_lock));
+
+	while (!flight_p -> sf_done_flag)
+		{
+			pthread_cond_wait (& (flight_p -> sf_done_cond), & (table_p -> sft_lock));
+		}
+
+	pthread_mutex_unlock (& (table_p -> sft_lock));
+
+	/*
+	 * Once it's done, the SearchFlight doesn't change again so the
+	 * lock isn't needed to read it.
+	 */
+	if (flight_p -> sf_results_p)
+		{
+			size_t i;
+			json_t *result_p;
+
+			json_array_foreach (flight_p -> sf_results_p, i, result_p)
+				{
+					json_incref (result_p);
+
+					if (!AddResultToServiceJob (job_p, result_p))
+						{
+							PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, result_p, "Failed to add shared result to ServiceJob");
+							json_decref (result_p);
+							success_flag = false;
+						}
+				}
+		}
+
+	if (flight_p -> sf_metadata_p)
+		{
+			json_t *metadata_p = json_deep_copy (flight_p -> sf_metadata_p);
+
+			if (metadata_p)
+				{
+					job_p -> sj_metadata_p = metadata_p;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy shared search metadata");
+					success_flag = false;
+				}
+		}
+
+	SetServiceJobStatus (job_p, success_flag ? flight_p -> sf_status : OS_FAILED);
+
+	return success_flag;
+}
+
+
+void LeaveSearchFlight (SearchFlightTable *table_p, SearchFlight *flight_p)
+{
+	bool free_flag = false;
+
+	pthread_mutex_lock (& (table_p -> sft_lock));
+
+	if (-- (flight_p -> sf_num_refs) == 0)
+		{
+			/* In case the leader never completed it */
+			RemoveSearchFlight (table_p, flight_p);
+			free_flag = true;
+		}
+
+	pthread_mutex_unlock (& (table_p -> sft_lock));
+
+	if (free_flag)
+		{
+			FreeSearchFlight (flight_p);
+		}
+}
+
+
+static SearchFlight *AllocateSearchFlight (const char *key_s)
+{
+	SearchFlight *flight_p = (SearchFlight *) AllocMemory (sizeof (SearchFlight));
+
+	if (flight_p)
+		{
+			memset (flight_p, 0, sizeof (SearchFlight));
+
+			flight_p -> sf_key_s = EasyCopyToNewString (key_s);
+
+			if (flight_p -> sf_key_s)
+				{
+					if (pthread_cond_init (& (flight_p -> sf_done_cond), NULL) == 0)
+						{
+							flight_p -> sf_num_refs = 1;
+							flight_p -> sf_status = OS_FAILED;
+
+							return flight_p;
+						}
+
+					FreeCopiedString (flight_p -> sf_key_s);
+				}
+
+			FreeMemory (flight_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate SearchFlight for \"%s\"", key_s);
+
+	return NULL;
+}
+
+
+static void FreeSearchFlight (SearchFlight *flight_p)
+{
+	if (flight_p -> sf_results_p)
+		{
+			json_decref (flight_p -> sf_results_p);
+		}
+
+	if (flight_p -> sf_metadata_p)
+		{
+			json_decref (flight_p -> sf_metadata_p);
+		}
+
+	pthread_cond_destroy (& (flight_p -> sf_done_cond));
+	FreeCopiedString (flight_p -> sf_key_s);
+	FreeMemory (flight_p);
+}
+
+
+/*
+ * This must be called with the table's lock held. It is safe to call
+ * if the SearchFlight has already been removed.
+ */
+static void RemoveSearchFlight (SearchFlightTable *table_p, SearchFlight *flight_p)
+{
+	SearchFlight **link_pp = & (table_p -> sft_flights_p);
+
+	while (*link_pp)
+		{
+			if (*link_pp == flight_p)
+				{
+					*link_pp = flight_p -> sf_next_p;
+					flight_p -> sf_next_p = NULL;
+					return;
+				}
+
+			link_pp = & ((*link_pp) -> sf_next_p);
+		}
+}
@@ -0,0 +1,127 @@
+/*
+ * search_job_sets.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "search_job_sets.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+typedef struct SearchJobSetEntry
+{
+	/** The server thread that ran the search. */
+	pthread_t sjse_thread;
+
+	ServiceJobSet *sjse_jobs_p;
+
+	struct SearchJobSetEntry *sjse_next_p;
+} SearchJobSetEntry;
+
+
+/*
+ * There is an entry for each server thread, so a list is quick enough
+ * to search.
+ */
+struct SearchJobSets
+{
+	SearchJobSetEntry *sjs_entries_p;
+
+	pthread_mutex_t sjs_lock;
+};
+
+
+
+SearchJobSets *AllocateSearchJobSets (void)
+{
+	SearchJobSets *sets_p = (SearchJobSets *) AllocMemory (sizeof (SearchJobSets));
+
+	if (sets_p)
+		{
+			sets_p -> sjs_entries_p = NULL;
+
+			if (pthread_mutex_init (& (sets_p -> sjs_lock), NULL) == 0)
+				{
+					return sets_p;
+				}
+
+			FreeMemory (sets_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate SearchJobSets");
+
+	return NULL;
+}
+
+
+void FreeSearchJobSets (SearchJobSets *sets_p)
+{
+	SearchJobSetEntry *entry_p = sets_p -> sjs_entries_p;
+
+	while (entry_p)
+		{
+			SearchJobSetEntry *next_p = entry_p -> sjse_next_p;
+
+			FreeServiceJobSet (entry_p -> sjse_jobs_p);
+			FreeMemory (entry_p);
+
+			entry_p = next_p;
+		}
+
+	pthread_mutex_destroy (& (sets_p -> sjs_lock));
+	FreeMemory (sets_p);
+}
+
+
+void KeepSearchJobSet (SearchJobSets *sets_p, ServiceJobSet *jobs_p)
+{
+	const pthread_t thread = pthread_self ();
+	ServiceJobSet *old_jobs_p = NULL;
+	SearchJobSetEntry *entry_p;
+
+	pthread_mutex_lock (& (sets_p -> sjs_lock));
+
+	entry_p = sets_p -> sjs_entries_p;
+
+	while ((entry_p) && (!pthread_equal (entry_p -> sjse_thread, thread)))
+		{
+			entry_p = entry_p -> sjse_next_p;
+		}
+
+	if (entry_p)
+		{
+			old_jobs_p = entry_p -> sjse_jobs_p;
+			entry_p -> sjse_jobs_p = jobs_p;
+		}
+	else
+		{
+			entry_p = (SearchJobSetEntry *) AllocMemory (sizeof (SearchJobSetEntry));
+
+			if (entry_p)
+				{
+					entry_p -> sjse_thread = thread;
+					entry_p -> sjse_jobs_p = jobs_p;
+					entry_p -> sjse_next_p = sets_p -> sjs_entries_p;
+
+					sets_p -> sjs_entries_p = entry_p;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to keep the jobs of a search, they won't be freed until the server exits");
+				}
+		}
+
+	pthread_mutex_unlock (& (sets_p -> sjs_lock));
+
+	/* The server has finished with this thread's previous search */
+	if (old_jobs_p)
+		{
+			FreeServiceJobSet (old_jobs_p);
+		}
+}
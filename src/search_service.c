@@ -20,10 +20,23 @@
  *      Author: billy
  */
 
+#include <stdint.h>
+
 #include "search_service.h"
 
 #include "ckan_search_tool.h"
 #include "zenodo_search_tool.h"
+#include "result_projection.h"
+#include "result_dictionary.h"
+#include "search_cursor.h"
+#include "lucene_page.h"
+#include "search_export.h"
+#include "search_flight.h"
+#include "negative_query_cache.h"
+#include "lucene_index_generation.h"
+#include "query_log.h"
+#include "admission_controller.h"
+#include "search_trace.h"
 
 #include "unsigned_int_parameter.h"
 #include "string_parameter.h"
@@ -32,6 +45,7 @@
 #include "streams.h"
 #include "math_utils.h"
 #include "string_utils.h"
+#include "uuid_util.h"
 
 #include "lucene_tool.h"
 #include "key_value_pair.h"
@@ -46,13 +60,47 @@ static NamedParameterType S_KEYWORD = { "SS Keyword Search", PT_KEYWORD };
 static NamedParameterType S_FACET = { "SS Facet", PT_STRING };
 static NamedParameterType S_PAGE_NUMBER = { "SS Results Page Number", PT_UNSIGNED_INT };
 static NamedParameterType S_PAGE_SIZE = { "SS Results Page Size", PT_UNSIGNED_INT };
+static NamedParameterType S_RESULT_FIELDS = { "SS Result Fields", PT_STRING };
+static NamedParameterType S_COMPACT_RESULTS = { "SS Compact Results", PT_BOOLEAN };
+static NamedParameterType S_CURSOR = { "SS Cursor", PT_STRING };
+static NamedParameterType S_EXPORT = { "SS Export", PT_BOOLEAN };
+static NamedParameterType S_LATENCY_BUDGET = { "SS Latency Budget", PT_UNSIGNED_INT };
+static NamedParameterType S_API_KEY = { "SS API Key", PT_STRING };
+static NamedParameterType S_TRACE_ID = { "SS Trace Id", PT_STRING };
 
 static const char * const S_ANY_FACET_S = "<ANY>";
 
+static const char * const S_PAYLOAD_KEY_S = "payload";
+
 
 static const uint32 S_DEFAULT_PAGE_NUMBER = 0;
+
 static const uint32 S_DEFAULT_PAGE_SIZE = 500;
 
+/* No limit */
+static const uint32 S_DEFAULT_LATENCY_BUDGET = 0;
+
+/* The prefix of the scheduling user for an anonymous client that sends an API key */
+static const char * const S_API_KEY_PREFIX_S = "api_key:";
+
+/* The key in the job's metadata for the sources that were skipped to meet the latency budget */
+static const char * const S_SKIPPED_SOURCES_S = "skipped_sources";
+
+/* The keys of a page in the Lucene result cache */
+static const char * const S_CACHED_FACETS_S = "facets";
+
+static const char * const S_CACHED_HITS_S = "hits";
+
+/* Cap each latency sample at a minute so that one hung request can't push the estimate too high */
+static const uint32 S_MAX_LATENCY_SAMPLE = 60000;
+
+/*
+ * A source that is too slow for a budget isn't called, so its estimate
+ * isn't updated. It is halved for each of these many milliseconds since
+ * the last update so that the source is eventually tried again.
+ */
+static const uint64 S_LATENCY_HALF_LIFE = 30000;
+
 
 static Service *GetSearchService (GrassrootsServer *grassroots_p);
 
@@ -80,25 +128,98 @@ static bool CloseSearchService (Service *service_p);
 static ServiceMetadata *GetSearchServiceMetadata (Service *service_p);
 
 
-static void SearchKeyword (const char *keyword_s, const char *facet_s, const uint32 page_number, const uint32 page_size, ServiceJob *job_p, SearchServiceData *data_p);
+typedef struct
+{
+	SearchServiceData *sd_service_data_p;
+	const SearchConfig *sd_config_p;
+	ServiceJob *sd_job_p;
+	const ResultProjection *sd_projection_p;
+	ResultDictionary *sd_dictionary_p;
+	SearchCursor *sd_cursor_p;
+
+	/** The LuceneTool that the query was searched for with. */
+	LuceneTool *sd_lucene_p;
+
+	/**
+	 * If this is not <code>NULL</code>, a copy of each Lucene document
+	 * is added to it so that the page can be cached.
+	 */
+	json_t *sd_lucene_hits_p;
+
+	/** The trace to record the search in. This can be <code>NULL</code>. */
+	SearchTrace *sd_trace_p;
+} SearchData;
+
+
+static void SearchKeyword (const char *keyword_s, const char *facet_s, SearchCursor *cursor_p, const ResultProjection *projection_p, const bool compact_flag, const bool export_flag, const uint32 latency_budget, ServiceJob *job_p, SearchServiceData *data_p, const SearchConfig *config_p, SearchTrace *trace_p);
+
+static void RunSharedSearch (const char *keyword_s, const char *facet_s, SearchCursor *cursor_p, const char *fields_s, const ResultProjection *projection_p, const bool compact_flag, const uint32 latency_budget, ServiceJob *job_p, SearchServiceData *data_p, const SearchConfig *config_p, SearchTrace *trace_p);
+
+static char *GetSearchFlightKey (const char *keyword_s, const char *facet_s, const SearchCursor *cursor_p, const char *fields_s, const bool compact_flag, const uint32 latency_budget, const SearchConfig *config_p);
 
 
 static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const uint32 index, void *data_p);
 
+static json_t *GetSearchResultFromLuceneDocument (const json_t *document_p, void *data_p);
+
 static Parameter *AddFacetParameter (ParameterSet *params_p, ParameterGroup *group_p, SearchServiceData *data_p);
 
-static bool IsCKANSearchEnabled (const char *facet_s, const SearchServiceData * const data_p);
+static bool IsCKANSearchEnabled (const char *facet_s, const SearchConfig * const config_p);
 
-static bool IsZenodoSearchEnabled (const char *facet_s, const SearchServiceData * const data_p);
+static bool IsZenodoSearchEnabled (const char *facet_s, const SearchConfig * const config_p);
 
-static OperationStatus CallSearchEndpoint (const char *keyword_s, json_t *facet_counts_p, json_t *(*search_fn) (const char *query_s, LuceneTool *lucene_p, const SearchServiceData *data_p),
-																ServiceJob *job_p, LuceneTool *lucene_p, const SearchServiceData *data_p);
+static bool IsKnownEmptySearch (const char *keyword_s, const char *facet_s, const uint64 index_generation, SearchServiceData *data_p, const SearchConfig *config_p);
+
+static bool RunLuceneSearch (LuceneTool *lucene_p, const char *keyword_s, const char *facet_s, LinkedList *facets_p, const SearchCursor *cursor_p, const uint64 results_generation, SearchServiceData *data_p, json_t **cached_results_pp, SearchTrace *trace_p);
+
+static bool RestoreLuceneFacets (LuceneTool *lucene_p, const json_t *facets_p);
+
+static OperationStatus AddCachedLuceneHits (const json_t *cached_results_p, const uint32 from, void *data_p);
+
+static OperationStatus AddSearchedLuceneHits (const uint32 from, const uint32 to, json_t **page_pp, void *data_p);
+
+static uint32 GetNumTotalLuceneHits (void *data_p);
+
+static json_t *GetLucenePageToCache (LuceneTool *lucene_p, json_t *hits_p);
+
+static void GetLuceneGenerations (const LuceneTool *lucene_p, SearchServiceData *data_p, uint64 *index_generation_p, uint64 *results_generation_p);
+
+static OperationStatus AddEmptySearchMetadata (ServiceJob *job_p);
+
+static uint64 GetSourceGeneration (const SearchConfig *config_p, const uint32 source_flag);
+
+static OperationStatus CallSearchEndpoint (const char *keyword_s, FacetAccumulator *facets_p, json_t *(*search_fn) (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p),
+																const uint32 source_flag, SearchData *search_data_p, LuceneTool *lucene_p);
+
+static LinkedList *GetLuceneFacets (const char *facet_key_s, const char *facet_s);
+
+static bool AddAdmissionMetadata (ServiceJob *job_p, const char *admission_s);
+
+static SearchTrace *StartTrace (const char *trace_id_s, ServiceJob *job_p, SearchServiceData *data_p);
+
+static bool AddTraceMetadata (ServiceJob *job_p, const SearchTrace *trace_p);
+
+static bool CaptureSearchParameters (SearchCapture *capture_p, ParameterSet *param_set_p);
+
+static char *GetSchedulingUser (const User *user_p, const char *api_key_s);
+
+static bool HasLatencyBudgetForSource (SearchServiceData *data_p, const uint32 source_flag, const uint64 deadline);
+
+static void UpdateSourceLatency (SearchServiceData *data_p, const uint32 source_flag, const uint64 latency);
+
+static bool AddSkippedSourcesToJSON (json_t *metadata_p, const uint32 skipped_flags);
+
+static OperationStatus MergeSourceStatus (const OperationStatus status, const OperationStatus source_status);
+
+static void WarmUpQuery (const char *keyword_s, const char *facet_s, void *data_p);
+
+static void WarmUpLucene (const char *keyword_s, const char *facet_s, SearchServiceData *data_p);
+
+static bool CountLuceneResult (const json_t *document_p, const uint32 index, void *data_p);
+
+static void WarmUpSearchEndpoint (const char *keyword_s, FacetAccumulator *facets_p, json_t *(*search_fn) (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p),
+																	const uint32 source_flag, const SearchCursor *cursor_p, const ResultProjection *projection_p, SearchServiceData *data_p, const SearchConfig *config_p);
 
-typedef struct
-{
-	SearchServiceData *sd_service_data_p;
-	ServiceJob *sd_job_p;
-} SearchData;
 
 
 
@@ -172,6 +293,8 @@ static Service *GetSearchService (GrassrootsServer *grassroots_p)
 						{
 							if (ConfigureSearchServiceData (data_p))
 								{
+									WarmUpSearchServiceData (data_p, WarmUpQuery);
+
 									return service_p;
 								}
 						}		/* if (InitialiseService (.... */
@@ -226,9 +349,11 @@ static Parameter *AddFacetParameter (ParameterSet *params_p, ParameterGroup *gro
 		{
 			if (CreateAndAddStringParameterOption (param_p, S_ANY_FACET_S, "Any"))
 				{
-					if (data_p -> ssd_base_data.sd_config_p)
+					SearchConfig *config_p = AcquireSearchConfig (data_p);
+
+					if (config_p)
 						{
-							json_t *facets_p = json_object_get (data_p -> ssd_base_data.sd_config_p, "facets");
+							json_t *facets_p = json_object_get (config_p -> sc_config_p, "facets");
 
 							if (facets_p)
 								{
@@ -261,7 +386,8 @@ static Parameter *AddFacetParameter (ParameterSet *params_p, ParameterGroup *gro
 
 								}		/* if (facets_p) */
 
-						}		/* if (data_p -> ssd_base_data.sd_config_p) */
+							ReleaseSearchConfig (config_p);
+						}		/* if (config_p) */
 
 					return param_p;
 				}
@@ -293,7 +419,70 @@ static ParameterSet *GetSearchServiceParameters (Service *service_p, DataResourc
 
 									if ((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_PAGE_SIZE.npt_name_s, "Page size", "The maximum number of results on each page", &def, PL_ADVANCED)) != NULL)
 										{
-											return params_p;
+											def = S_DEFAULT_LATENCY_BUDGET;
+
+											if ((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_LATENCY_BUDGET.npt_name_s, "Latency budget",
+																																																																		"The number of milliseconds that the search should take. CKAN and Zenodo are skipped if they are unlikely to answer in time. Use 0 for no limit", &def, PL_ADVANCED)) != NULL)
+												{
+													if ((param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_RESULT_FIELDS.npt_type, S_RESULT_FIELDS.npt_name_s, "Result fields",
+																																												"Either \"" RP_FULL_S "\" to get all of the details for each result, \"" RP_SUMMARY_S "\" to get just their names, types, icons and urls, or a comma-separated list of the fields to get",
+																																												RP_FULL_S, PL_ADVANCED)) != NULL)
+														{
+															bool compact_flag = false;
+
+															if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_COMPACT_RESULTS.npt_name_s, "Compact results",
+																																															"Send each of the providers, type descriptions and icons once in the results metadata and refer to them by index in each result", &compact_flag, PL_ADVANCED)) != NULL)
+																{
+																	if ((param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_CURSOR.npt_type, S_CURSOR.npt_name_s, "Cursor",
+																																																	"The \"" SC_NEXT_CURSOR_S "\" value from the previous page of results to get the next page. If this is set, it is used instead of the page number and page size", NULL, PL_ADVANCED)) != NULL)
+																		{
+																			bool export_flag = false;
+
+																			if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_EXPORT.npt_name_s, "Export all results",
+																																																			"Write every result for the search to a newline-delimited JSON file rather than returning a single page of them", &export_flag, PL_ADVANCED)) != NULL)
+																				{
+																					if ((param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_API_KEY.npt_type, S_API_KEY.npt_name_s, "API key",
+																																																					"The key that identifies the client when no user is logged in, so that its searches get their own share of the service", NULL, PL_ADVANCED)) != NULL)
+																						{
+																							if ((param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_TRACE_ID.npt_type, S_TRACE_ID.npt_name_s, "Trace id",
+																																																							"The id, as 32 hexadecimal digits or a W3C traceparent header, to record the search's trace under so that it can be matched to the client's own trace", NULL, PL_ADVANCED)) != NULL)
+																								{
+																									return params_p;
+																								}
+																							else
+																								{
+																									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_TRACE_ID.npt_name_s);
+																								}
+																						}
+																					else
+																						{
+																							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_API_KEY.npt_name_s);
+																						}
+																				}
+																			else
+																				{
+																					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_EXPORT.npt_name_s);
+																				}
+																		}
+																	else
+																		{
+																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_CURSOR.npt_name_s);
+																		}
+																}
+															else
+																{
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_COMPACT_RESULTS.npt_name_s);
+																}
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_RESULT_FIELDS.npt_name_s);
+														}
+													}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_LATENCY_BUDGET.npt_name_s);
+												}
 										}		/* if ((param_p = EasyCreateAndAddParameterToParameterSet (& (data_p -> ssd_base_data), params_p, group_p, S_PAGE_SIZE.npt_type, S_PAGE_SIZE.npt_name_s, "Page size", "The maximum number of results on each page", def, PL_SIMPLE)) != NULL) */
 									else
 										{
@@ -350,6 +539,34 @@ static bool GetSearchServiceParameterTypesForNamedParameters (const Service *ser
 		{
 			*pt_p = S_PAGE_SIZE.npt_type;
 		}
+	else if (strcmp (param_name_s, S_LATENCY_BUDGET.npt_name_s) == 0)
+		{
+			*pt_p = S_LATENCY_BUDGET.npt_type;
+		}
+	else if (strcmp (param_name_s, S_RESULT_FIELDS.npt_name_s) == 0)
+		{
+			*pt_p = S_RESULT_FIELDS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_COMPACT_RESULTS.npt_name_s) == 0)
+		{
+			*pt_p = S_COMPACT_RESULTS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_CURSOR.npt_name_s) == 0)
+		{
+			*pt_p = S_CURSOR.npt_type;
+		}
+	else if (strcmp (param_name_s, S_EXPORT.npt_name_s) == 0)
+		{
+			*pt_p = S_EXPORT.npt_type;
+		}
+	else if (strcmp (param_name_s, S_API_KEY.npt_name_s) == 0)
+		{
+			*pt_p = S_API_KEY.npt_type;
+		}
+	else if (strcmp (param_name_s, S_TRACE_ID.npt_name_s) == 0)
+		{
+			*pt_p = S_TRACE_ID.npt_type;
+		}
 	else
 		{
 			success_flag = false;
@@ -376,15 +593,24 @@ static bool CloseSearchService (Service *service_p)
 }
 
 
-static ServiceJobSet *RunSearchService (Service *service_p, ParameterSet *param_set_p, User * UNUSED_PARAM (user_p), ProvidersStateTable * UNUSED_PARAM (providers_p))
+/*
+ * One instance of the service runs the searches from every server
+ * thread at once, so each search keeps all of its state, including its
+ * ServiceJobSet, to itself rather than using the Service's se_jobs_p.
+ * Once it has finished, the ServiceJobSet is kept with KeepSearchJobSet ()
+ * until this thread's next search or the service is freed, by which time
+ * the server has finished with it. Everything that the searches share is
+ * in the SearchServiceData and is locked or updated atomically by its
+ * owner.
+ */
+static ServiceJobSet *RunSearchService (Service *service_p, ParameterSet *param_set_p, User *user_p, ProvidersStateTable * UNUSED_PARAM (providers_p))
 {
 	SearchServiceData *data_p = (SearchServiceData *) (service_p -> se_data_p);
+	ServiceJobSet *jobs_p = AllocateSimpleServiceJobSet (service_p, NULL, "");
 
-	service_p -> se_jobs_p = AllocateSimpleServiceJobSet (service_p, NULL, "");
-
-	if (service_p -> se_jobs_p)
+	if (jobs_p)
 		{
-			ServiceJob *job_p = GetServiceJobFromServiceJobSet (service_p -> se_jobs_p, 0);
+			ServiceJob *job_p = GetServiceJobFromServiceJobSet (jobs_p, 0);
 
 			LogParameterSet (param_set_p, job_p);
 
@@ -396,6 +622,24 @@ static ServiceJobSet *RunSearchService (Service *service_p, ParameterSet *param_
 					const char *facet_s = NULL;
 					const uint32 *page_number_p = NULL;
 					const uint32 *page_size_p = NULL;
+					const char *fields_s = NULL;
+					const bool *compact_flag_p = NULL;
+					const char *cursor_s = NULL;
+					const bool *export_flag_p = NULL;
+					const uint32 *latency_budget_p = NULL;
+					const char *api_key_s = NULL;
+					const char *trace_id_s = NULL;
+					char *scheduling_user_s = NULL;
+					SearchTrace *trace_p = NULL;
+					int32 span = ST_NO_SPAN;
+					uint32 first_page = 0;
+					uint32 page_size = 0;
+					ResultProjection projection;
+					SearchCursor cursor;
+					bool got_cursor_flag = true;
+					SearchConfig *config_p = NULL;
+					AdmissionDecision admission = AD_ADMITTED;
+					uint64 start_time = 0;
 
 					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_KEYWORD.npt_name_s, &keyword_s);
 					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_FACET.npt_name_s, &facet_s);
@@ -410,9 +654,156 @@ static ServiceJobSet *RunSearchService (Service *service_p, ParameterSet *param_
 
 					GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_PAGE_NUMBER.npt_name_s, &page_number_p);
 					GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_PAGE_SIZE.npt_name_s, &page_size_p);
+					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_RESULT_FIELDS.npt_name_s, &fields_s);
+					GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_COMPACT_RESULTS.npt_name_s, &compact_flag_p);
+					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_CURSOR.npt_name_s, &cursor_s);
+					GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_EXPORT.npt_name_s, &export_flag_p);
+					GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_LATENCY_BUDGET.npt_name_s, &latency_budget_p);
+					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_API_KEY.npt_name_s, &api_key_s);
+					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_TRACE_ID.npt_name_s, &trace_id_s);
+
+					if (data_p -> ssd_capture_p)
+						{
+							CaptureSearchParameters (data_p -> ssd_capture_p, param_set_p);
+						}
+
+					/* The slow query log needs every search's spans to explain the slow ones */
+					if ((data_p -> ssd_tracer_p) || (data_p -> ssd_slow_query_log_p))
+						{
+							trace_p = StartTrace (trace_id_s, job_p, data_p);
+
+							span = BeginTraceSpan (trace_p, "RunSearchService");
+							SetTraceSpanString (trace_p, span, "keyword", keyword_s);
+							SetTraceSpanString (trace_p, span, "facet", facet_s);
+						}
+
+					/*
+					 * Use the same configuration for the whole search even
+					 * if it is reloaded part of the way through.
+					 */
+					config_p = AcquireSearchConfig (data_p);
+
+					if (config_p)
+						{
+							if (IsStringEmpty (cursor_s))
+								{
+									if (!InitSearchCursor (&cursor, page_number_p ? *page_number_p : S_DEFAULT_PAGE_NUMBER, page_size_p ? *page_size_p : S_DEFAULT_PAGE_SIZE, config_p -> sc_external_page_size))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Invalid page for \"%s\"", keyword_s ? keyword_s : "");
+											got_cursor_flag = false;
+										}
+								}
+							else if (!ParseSearchCursor (&cursor, cursor_s, config_p -> sc_external_page_size))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Invalid cursor \"%s\"", cursor_s);
+									got_cursor_flag = false;
+								}
+
+							if (got_cursor_flag)
+								{
+									/* The search moves the cursor on, so keep where it started */
+									first_page = cursor.sc_lucene_page;
+									page_size = cursor.sc_page_size;
+
+									/*
+									 * Only count new searches rather than each of
+									 * their later pages.
+									 */
+									if ((data_p -> ssd_query_log_p) && (IsStringEmpty (cursor_s)) && (!IsStringEmpty (keyword_s)))
+										{
+											RecordQuery (data_p -> ssd_query_log_p, keyword_s, facet_s);
+										}
+
+									if (data_p -> ssd_admission_p)
+										{
+											int32 admission_span;
+
+											/* If this fails, the search just shares the anonymous users' slots */
+											scheduling_user_s = GetSchedulingUser (user_p, api_key_s);
+
+											admission_span = BeginTraceSpan (trace_p, "AdmitSearch");
+
+											admission = AdmitSearch (data_p -> ssd_admission_p, scheduling_user_s);
+											start_time = GetAdmissionTime ();
+
+											EndTraceSpan (trace_p, admission_span);
+										}
+
+									if (admission == AD_REJECTED)
+										{
+											AddAdmissionMetadata (job_p, AC_REJECTED_S);
+										}
+									else if (InitResultProjection (&projection, fields_s))
+										{
+											const bool compact_flag = compact_flag_p ? *compact_flag_p : false;
+											const uint32 latency_budget = latency_budget_p ? *latency_budget_p : S_DEFAULT_LATENCY_BUDGET;
+
+											/*
+											 * Mark the portals as done so that this search, and any
+											 * later pages of it, only use Lucene.
+											 */
+											if (admission == AD_LOCAL_ONLY)
+												{
+													cursor.sc_exhausted_flags |= (SC_CKAN_EXHAUSTED | SC_ZENODO_EXHAUSTED);
+												}
+
+											/*
+											 * Each export writes its own file for its job, so only
+											 * pages of results can be shared.
+											 */
+											if (((export_flag_p == NULL) || (! (*export_flag_p))) && (data_p -> ssd_flights_p))
+												{
+													RunSharedSearch (keyword_s, facet_s, &cursor, fields_s, &projection, compact_flag, latency_budget, job_p, data_p, config_p, trace_p);
+												}
+											else
+												{
+													SearchKeyword (keyword_s, facet_s, &cursor, &projection, compact_flag, export_flag_p ? *export_flag_p : false, latency_budget, job_p, data_p, config_p, trace_p);
+												}
+
+											if (admission == AD_LOCAL_ONLY)
+												{
+													AddAdmissionMetadata (job_p, AC_LOCAL_ONLY_S);
+												}
+
+											ClearResultProjection (&projection);
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get the result fields from \"%s\"", fields_s);
+										}
+
+									if ((data_p -> ssd_admission_p) && (admission == AD_ADMITTED))
+										{
+											FinishSearch (data_p -> ssd_admission_p, scheduling_user_s, GetAdmissionTime () - start_time);
+										}
+
+									if (scheduling_user_s)
+										{
+											FreeCopiedString (scheduling_user_s);
+										}
+								}
+
+							ReleaseSearchConfig (config_p);
+						}		/* if (config_p) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "The search service has no configuration");
+						}
+
+					if (trace_p)
+						{
+							AddTraceMetadata (job_p, trace_p);
+
+							SetTraceSpanString (trace_p, span, "status", GetOperationStatusAsString (job_p -> sj_status));
+							EndTraceSpan (trace_p, span);
 
+							if (data_p -> ssd_slow_query_log_p)
+								{
+									LogSlowQuery (data_p -> ssd_slow_query_log_p, trace_p, keyword_s, facet_s, first_page, page_size, !IsStringEmpty (cursor_s), job_p);
+								}
 
-					SearchKeyword (keyword_s, facet_s, page_number_p ? *page_number_p : S_DEFAULT_PAGE_NUMBER, page_size_p ? *page_size_p : S_DEFAULT_PAGE_SIZE, job_p, data_p);
+							FinishSearchTrace (trace_p);
+						}
 				}		/* if (param_set_p) */
 
 #if DFW_FIELD_TRIAL_SERVICE_DEBUG >= STM_LEVEL_FINE
@@ -420,9 +811,11 @@ static ServiceJobSet *RunSearchService (Service *service_p, ParameterSet *param_
 #endif
 
 			LogServiceJob (job_p);
-		}		/* if (service_p -> se_jobs_p) */
 
-	return service_p -> se_jobs_p;
+			KeepSearchJobSet (data_p -> ssd_job_sets_p, jobs_p);
+		}		/* if (jobs_p) */
+
+	return jobs_p;
 }
 
 
@@ -609,42 +1002,108 @@ static ParameterSet *IsResourceForSearchService (Service * UNUSED_PARAM (service
 
 
 
-static void SearchKeyword (const char *keyword_s, const char *facet_s, const uint32 page_number, const uint32 page_size, ServiceJob *job_p,  SearchServiceData *data_p)
+/*
+ * If an identical search is already running, wait for it and use its
+ * results rather than hitting Lucene, CKAN and Zenodo again.
+ */
+static void RunSharedSearch (const char *keyword_s, const char *facet_s, SearchCursor *cursor_p, const char *fields_s, const ResultProjection *projection_p, const bool compact_flag, const uint32 latency_budget, ServiceJob *job_p, SearchServiceData *data_p, const SearchConfig *config_p, SearchTrace *trace_p)
+{
+	SearchFlight *flight_p = NULL;
+	bool leader_flag = true;
+	char *key_s = GetSearchFlightKey (keyword_s, facet_s, cursor_p, fields_s, compact_flag, latency_budget, config_p);
+
+	if (key_s)
+		{
+			flight_p = JoinSearchFlight (data_p -> ssd_flights_p, key_s, &leader_flag);
+			FreeCopiedString (key_s);
+		}
+
+	if (leader_flag)
+		{
+			SearchKeyword (keyword_s, facet_s, cursor_p, projection_p, compact_flag, false, latency_budget, job_p, data_p, config_p, trace_p);
+
+			if (flight_p)
+				{
+					CompleteSearchFlight (data_p -> ssd_flights_p, flight_p, job_p);
+				}
+		}
+	else
+		{
+			const int32 span = BeginTraceSpan (trace_p, "WaitForSharedSearch");
+
+			if (!CopySearchFlightResults (data_p -> ssd_flights_p, flight_p, job_p))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy all of the shared results for \"%s\"", keyword_s ? keyword_s : "");
+				}
+
+			EndTraceSpan (trace_p, span);
+		}
+
+	if (flight_p)
+		{
+			LeaveSearchFlight (data_p -> ssd_flights_p, flight_p);
+		}
+}
+
+
+/*
+ * The snapshot's address is part of the key so that searches only share
+ * results if they use the same configuration. The leader holds a reference
+ * to the snapshot, so the address can't be reused while it is running. The
+ * keyword goes last as it is the only part that can contain anything.
+ */
+static char *GetSearchFlightKey (const char *keyword_s, const char *facet_s, const SearchCursor *cursor_p, const char *fields_s, const bool compact_flag, const uint32 latency_budget, const SearchConfig *config_p)
+{
+	char *key_s = NULL;
+	char *cursor_s = GetSearchCursorAsString (cursor_p);
+
+	if (cursor_s)
+		{
+			char config_s [48];
+
+			/* The budget decides which sources are searched */
+			snprintf (config_s, sizeof (config_s), "%p\n" UINT32_FMT, (const void *) config_p, latency_budget);
+
+			key_s = ConcatenateVarargsStrings (config_s, "\n", cursor_s, "\n", compact_flag ? "1" : "0", "\n", facet_s ? facet_s : "", "\n", fields_s ? fields_s : "", "\n", keyword_s ? keyword_s : "", NULL);
+
+			if (!key_s)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to make search key for \"%s\"", keyword_s ? keyword_s : "");
+				}
+
+			FreeCopiedString (cursor_s);
+		}
+
+	return key_s;
+}
+
+
+static void SearchKeyword (const char *keyword_s, const char *facet_s, SearchCursor *cursor_p, const ResultProjection *projection_p, const bool compact_flag, const bool export_flag, const uint32 latency_budget, ServiceJob *job_p, SearchServiceData *data_p, const SearchConfig *config_p, SearchTrace *trace_p)
 {
 	OperationStatus status = OS_FAILED_TO_START;
+	const uint64 deadline = (latency_budget > 0) ? GetAdmissionTime () + latency_budget : 0;
 	GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (data_p -> ssd_base_data.sd_service_p);
+	const int32 span = BeginTraceSpan (trace_p, "SearchKeyword");
 	LuceneTool *lucene_p = AllocateLuceneTool (grassroots_p, job_p -> sj_id);
 
 	if (lucene_p)
 		{
 			bool success_flag = true;
 			LinkedList *facets_p = NULL;
+			json_t *cached_results_p = NULL;
+			uint64 index_generation = 0;
+			uint64 results_generation = 0;
+
+			GetLuceneGenerations (lucene_p, data_p, &index_generation, &results_generation);
 
 			if (facet_s)
 				{
-					facets_p = AllocateLinkedList (FreeKeyValuePairNode);
-
-					if (facets_p)
-						{
-							KeyValuePairNode *facet_p = AllocateKeyValuePairNodeByParts (lucene_p -> lt_facet_key_s, facet_s);
-
-							if (facet_p)
-								{
-									LinkedListAddTail (facets_p, & (facet_p -> kvpn_node));
-								}		/* if (facet_p) */
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AllocateKeyValuePairNode for facet \"type\": \"%s\" failed", facet_s);
-									success_flag = false;
-								}
+					facets_p = GetLuceneFacets (lucene_p -> lt_facet_key_s, facet_s);
 
-						}		/* if (facets_p) */
-					else
+					if (!facets_p)
 						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AllocateLinkedList for facet \"%s\" failed", facet_s);
 							success_flag = false;
 						}
-
 				}		/* if (facet_s) */
 
 
@@ -652,47 +1111,185 @@ static void SearchKeyword (const char *keyword_s, const char *facet_s, const uin
 				{
 					if (SetLuceneToolName (lucene_p, "search_keywords"))
 						{
-							if (SearchLucene (lucene_p, keyword_s, facets_p, "drill-down", page_number, page_size, QM_PARSER))
+							if (export_flag)
 								{
 									SearchData sd;
-									const uint32 from = page_number * page_size;
-									const uint32 to = from + page_size - 1;
+									uint32 sources_flags = 0;
 
 									sd.sd_service_data_p = data_p;
+									sd.sd_config_p = config_p;
 									sd.sd_job_p = job_p;
+									sd.sd_projection_p = projection_p;
+									sd.sd_dictionary_p = NULL;
+									sd.sd_cursor_p = NULL;
+									sd.sd_lucene_p = lucene_p;
+									sd.sd_lucene_hits_p = NULL;
+									sd.sd_trace_p = trace_p;
+
+									if (IsCKANSearchEnabled (facet_s, config_p))
+										{
+											sources_flags |= SC_CKAN_EXHAUSTED;
+										}
 
-									status = ParseLuceneResults (lucene_p, from, to, AddSearchResultsFromLuceneResults, &sd);
-
-									if (IsCKANSearchEnabled (facet_s, data_p))
+									if (IsZenodoSearchEnabled (facet_s, config_p))
 										{
-											OperationStatus search_status = CallSearchEndpoint (keyword_s, lucene_p, SearchCKAN, job_p, lucene_p, data_p);
+											sources_flags |= SC_ZENODO_EXHAUSTED;
+										}
 
-											MergeServiceJobStatus (job_p, status);
-										}		/* if (IsCKANSearchEnabled (facet_s, data_p)) */
+									/* Skip any sources that the cursor has ruled out */
+									sources_flags &= ~ (cursor_p -> sc_exhausted_flags);
+
+									status = RunSearchExport (lucene_p, keyword_s, facets_p, sources_flags, GetSearchResultFromLuceneDocument, &sd, projection_p, job_p, config_p);
+								}		/* if (export_flag) */
+							else if (IsKnownEmptySearch (keyword_s, facet_s, index_generation, data_p, config_p))
+								{
+									SetTraceSpanString (trace_p, span, "negative_cache", "hit");
+									status = AddEmptySearchMetadata (job_p);
+								}
+							else if (RunLuceneSearch (lucene_p, keyword_s, facet_s, facets_p, cursor_p, results_generation, data_p, &cached_results_p, trace_p))
+								{
+									SearchData sd;
+									LucenePageSource source;
+									uint32 sources_flags = SC_LUCENE_EXHAUSTED;
+									uint32 skipped_flags = 0;
+									FacetAccumulator *facet_counts_p = AllocateFacetAccumulator (config_p -> sc_facet_keys_p);
 
+									/* Without the counts, CKAN and Zenodo are still searched but their hits aren't added to the facets */
+									if (!facet_counts_p)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate facet counts for \"%s\", external hits won't be counted in the facets", keyword_s);
+										}
 
-									if (IsZenodoSearchEnabled (facet_s, data_p))
+									sd.sd_service_data_p = data_p;
+									sd.sd_config_p = config_p;
+									sd.sd_job_p = job_p;
+									sd.sd_projection_p = projection_p;
+									sd.sd_dictionary_p = NULL;
+									sd.sd_cursor_p = cursor_p;
+									sd.sd_lucene_p = lucene_p;
+									sd.sd_lucene_hits_p = NULL;
+									sd.sd_trace_p = trace_p;
+
+									if (compact_flag)
 										{
-											OperationStatus search_status = CallSearchEndpoint (keyword_s, lucene_p, SearchZenodo, job_p, lucene_p, data_p);
+											sd.sd_dictionary_p = AllocateResultDictionary ();
+
+											if (!sd.sd_dictionary_p)
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate result dictionary for \"%s\", sending full results", keyword_s);
+												}
+										}
 
-											MergeServiceJobStatus (job_p, status);
-										}		/* if (IsZenodoSearchEnabled (facet_s, data_p)) */
+									source.lps_add_cached_hits_fn = AddCachedLuceneHits;
+									source.lps_add_searched_hits_fn = AddSearchedLuceneHits;
+									source.lps_get_num_total_hits_fn = GetNumTotalLuceneHits;
+									source.lps_data_p = &sd;
 
+									/* A cached page has had its total hits restored by RunLuceneSearch () */
+									status = ServeLucenePage (data_p -> ssd_lucene_cache_p, keyword_s, facet_s, cursor_p, results_generation, cached_results_p, &source);
 
-									if ((status == OS_SUCCEEDED) || (status == OS_PARTIALLY_SUCCEEDED))
+									if ((!cached_results_p) && (lucene_p -> lt_num_total_hits == 0) && (status == OS_SUCCEEDED) && (index_generation > 0) && (data_p -> ssd_negative_cache_p))
 										{
-											bool added_metadata_flag = false;
-											json_error_t error;
-											json_t *metadata_p = json_pack_ex (&error, 0, "{s:i,s:i,s:i}",
-																												 LT_NUM_TOTAL_HITS_S, lucene_p -> lt_num_total_hits,
-																												 LT_HITS_START_INDEX_S, lucene_p -> lt_hits_from_index,
-																												 LT_HITS_END_INDEX_S, lucene_p -> lt_hits_to_index);
+											AddEmptyQuery (data_p -> ssd_negative_cache_p, SC_LUCENE_EXHAUSTED, keyword_s, facet_s, index_generation);
+										}
 
-											if (metadata_p)
+									if (IsCKANSearchEnabled (facet_s, config_p))
+										{
+											sources_flags |= SC_CKAN_EXHAUSTED;
+
+											if (! ((cursor_p -> sc_exhausted_flags) & SC_CKAN_EXHAUSTED))
 												{
-													if (AddLuceneFacetResultsToJSON (lucene_p, metadata_p))
+													/* A skipped source keeps its place in the cursor for the next page */
+													if (HasLatencyBudgetForSource (data_p, SC_CKAN_EXHAUSTED, deadline))
 														{
-															added_metadata_flag = true;
+															const OperationStatus search_status = CallSearchEndpoint (keyword_s, facet_counts_p, SearchCKAN, SC_CKAN_EXHAUSTED, &sd, lucene_p);
+
+															status = MergeSourceStatus (status, search_status);
+														}
+													else
+														{
+															skipped_flags |= SC_CKAN_EXHAUSTED;
+														}
+												}
+										}		/* if (IsCKANSearchEnabled (facet_s, config_p)) */
+
+
+									if (IsZenodoSearchEnabled (facet_s, config_p))
+										{
+											sources_flags |= SC_ZENODO_EXHAUSTED;
+
+											if (! ((cursor_p -> sc_exhausted_flags) & SC_ZENODO_EXHAUSTED))
+												{
+													if (HasLatencyBudgetForSource (data_p, SC_ZENODO_EXHAUSTED, deadline))
+														{
+															const OperationStatus search_status = CallSearchEndpoint (keyword_s, facet_counts_p, SearchZenodo, SC_ZENODO_EXHAUSTED, &sd, lucene_p);
+
+															status = MergeSourceStatus (status, search_status);
+														}
+													else
+														{
+															skipped_flags |= SC_ZENODO_EXHAUSTED;
+														}
+												}
+										}		/* if (IsZenodoSearchEnabled (facet_s, config_p)) */
+
+									/* Add the external facet counts to the lucene ones in one go */
+									if (facet_counts_p)
+										{
+											FlushFacetAccumulatorToLucene (facet_counts_p, lucene_p);
+											FreeFacetAccumulator (facet_counts_p);
+										}
+
+
+									if ((status == OS_SUCCEEDED) || (status == OS_PARTIALLY_SUCCEEDED))
+										{
+											bool added_metadata_flag = false;
+											json_error_t error;
+											json_t *metadata_p = json_pack_ex (&error, 0, "{s:i,s:i,s:i}",
+																												 LT_NUM_TOTAL_HITS_S, lucene_p -> lt_num_total_hits,
+																												 LT_HITS_START_INDEX_S, lucene_p -> lt_hits_from_index,
+																												 LT_HITS_END_INDEX_S, lucene_p -> lt_hits_to_index);
+
+											if (metadata_p)
+												{
+													if (AddLuceneFacetResultsToJSON (lucene_p, metadata_p))
+														{
+															added_metadata_flag = true;
+														}
+
+													if (sd.sd_dictionary_p)
+														{
+															if (!AddResultDictionaryToJSON (sd.sd_dictionary_p, metadata_p))
+																{
+																	added_metadata_flag = false;
+																}
+														}
+
+													if (skipped_flags)
+														{
+															if (!AddSkippedSourcesToJSON (metadata_p, skipped_flags))
+																{
+																	added_metadata_flag = false;
+																}
+														}
+
+													if (HasMoreSearchCursorResults (cursor_p, sources_flags))
+														{
+															char *next_cursor_s = GetSearchCursorAsString (cursor_p);
+
+															if (next_cursor_s)
+																{
+																	if (!SetJSONString (metadata_p, SC_NEXT_CURSOR_S, next_cursor_s))
+																		{
+																			added_metadata_flag = false;
+																		}
+
+																	FreeCopiedString (next_cursor_s);
+																}
+															else
+																{
+																	added_metadata_flag = false;
+																}
 														}
 
 													job_p -> sj_metadata_p = metadata_p;
@@ -715,9 +1312,14 @@ static void SearchKeyword (const char *keyword_s, const char *facet_s, const uin
 											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "ParseLuceneResults failed for \"%s\"", keyword_s);
 										}
 
+									if (sd.sd_dictionary_p)
+										{
+											FreeResultDictionary (sd.sd_dictionary_p);
+										}
+
 
 
-								}		/* if (SearchLucene (lucene_p, keyword_s, facets_p, "drill-down", page_number, page_size)) */
+								}		/* if (RunLuceneSearch (lucene_p, keyword_s, facet_s, facets_p, cursor_p, results_generation, data_p, &cached_results_p)) */
 							else
 								{
 									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "SearchLucene for \"%s\" failed", keyword_s);
@@ -735,6 +1337,11 @@ static void SearchKeyword (const char *keyword_s, const char *facet_s, const uin
 							FreeLinkedList (facets_p);
 						}
 
+					if (cached_results_p)
+						{
+							json_decref (cached_results_p);
+						}
+
 				}		/* if (success_flag) */
 			else
 				{
@@ -750,6 +1357,9 @@ static void SearchKeyword (const char *keyword_s, const char *facet_s, const uin
 
 
 	SetServiceJobStatus (job_p, status);
+
+	SetTraceSpanString (trace_p, span, "status", GetOperationStatusAsString (status));
+	EndTraceSpan (trace_p, span);
 }
 
 
@@ -757,6 +1367,63 @@ static void SearchKeyword (const char *keyword_s, const char *facet_s, const uin
 static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const uint32 index, void *data_p)
 {
 	bool success_flag = false;
+	SearchData *search_data_p = (SearchData *) data_p;
+	json_t *result_p = NULL;
+
+	/* Copy the document before it is converted as the result can share parts of it */
+	if (search_data_p -> sd_lucene_hits_p)
+		{
+			if (json_array_append_new (search_data_p -> sd_lucene_hits_p, json_deep_copy (document_p)) != 0)
+				{
+					/* An incomplete page mustn't be cached */
+					json_decref (search_data_p -> sd_lucene_hits_p);
+					search_data_p -> sd_lucene_hits_p = NULL;
+				}
+		}
+
+	result_p = GetSearchResultFromLuceneDocument (document_p, search_data_p);
+
+	if (result_p)
+		{
+			const char *name_s = GetJSONString (result_p, "so:name");
+			json_t *dest_record_p = NULL;
+
+			if (search_data_p -> sd_dictionary_p)
+				{
+					if (!CompactResult (search_data_p -> sd_dictionary_p, result_p))
+						{
+							PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, result_p, "Failed to fully compact result");
+						}
+				}
+
+			dest_record_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, name_s, result_p);
+
+			if (dest_record_p)
+				{
+					if (AddResultToServiceJob (search_data_p -> sd_job_p, dest_record_p))
+						{
+							success_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AddResultToServiceJob () failed for \"%s\"", name_s);
+							json_decref (dest_record_p);
+						}
+				}		/* if (dest_record_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetResourceAsJSONByParts () failed for \"%s\"", name_s);
+				}
+
+			json_decref (result_p);
+		}		/* if (result_p) */
+
+	return success_flag;
+}
+
+
+static json_t *GetSearchResultFromLuceneDocument (const json_t *document_p, void *data_p)
+{
 	SearchData *search_data_p = (SearchData *) data_p;
 	const char *id_s = GetJSONString (document_p, LUCENE_ID_S);
 
@@ -766,17 +1433,28 @@ static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const u
 
 			if (type_s)
 				{
-					const char *name_s = GetJSONString (document_p, "so:name");
-					json_t *result_p = json_deep_copy (document_p);
+					const ResultProjection *projection_p = search_data_p -> sd_projection_p;
+					json_t *result_p = NULL;
+
+					/*
+					 * The document is only read from here on, so a shallow copy is
+					 * enough for the full result and the projection shares its values
+					 * with the document too.
+					 */
+					if (projection_p -> rp_full_flag)
+						{
+							result_p = json_copy ((json_t *) document_p);
+						}
+					else
+						{
+							result_p = GetProjectedResult (document_p, projection_p);
+						}
 
 					if (result_p)
 						{
-							json_t *dest_record_p = NULL;
-
-							if (strcmp (type_s, "Grassroots:Service") == 0)
+							if ((strcmp (type_s, "Grassroots:Service") == 0) && (IsFieldInResultProjection (projection_p, S_PAYLOAD_KEY_S)))
 								{
-									const char * const PAYLOAD_KEY_S = "payload";
-									const char *payload_s = GetJSONString (result_p, PAYLOAD_KEY_S);
+									const char *payload_s = GetJSONString (result_p, S_PAYLOAD_KEY_S);
 
 									if (payload_s)
 										{
@@ -785,7 +1463,7 @@ static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const u
 
 											if (payload_p)
 												{
-													if (json_object_set_new (result_p, PAYLOAD_KEY_S, payload_p) != 0)
+													if (json_object_set_new (result_p, S_PAYLOAD_KEY_S, payload_p) != 0)
 														{
 															PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, result_p, "Failed to add unpacked payload");
 															json_decref (payload_p);
@@ -807,7 +1485,7 @@ static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const u
 							 * If the provider has not been set, add it from the
 							 * default configuration
 							 */
-							if (! (json_object_get  (result_p, SERVER_PROVIDER_S)))
+							if ((IsFieldInResultProjection (projection_p, SERVER_PROVIDER_S)) && (! (json_object_get  (result_p, SERVER_PROVIDER_S))))
 								{
 									SearchServiceData *ssd_p = search_data_p -> sd_service_data_p;
 									GrassrootsServer *grassroots_p = ssd_p -> ssd_base_data.sd_service_p -> se_grassroots_p;
@@ -815,44 +1493,15 @@ static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const u
 
 									if (provider_p)
 										{
-											json_t *copied_provider_p = json_deep_copy (provider_p);
-
-											if (copied_provider_p)
-												{
-													if (json_object_set (result_p, SERVER_PROVIDER_S, copied_provider_p) != 0)
-														{
-															PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, result_p, "Failed to add provider");
-															json_decref (copied_provider_p);
-														}
-												}
-											else
+											/* The provider doesn't change so share it rather than copying it for each result */
+											if (json_object_set (result_p, SERVER_PROVIDER_S, (json_t *) provider_p) != 0)
 												{
-													PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, provider_p, "Failed to copy provider");
+													PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, result_p, "Failed to add provider");
 												}
 										}
 								}		/* if (! (json_object_get  (result_p, SERVER_PROVIDER_S))) */
 
-
-							dest_record_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, name_s, result_p);
-
-							if (dest_record_p)
-								{
-									if (AddResultToServiceJob (search_data_p -> sd_job_p, dest_record_p))
-										{
-											success_flag = true;
-										}
-									else
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AddResultToServiceJob () failed for \"%s\"", name_s);
-											json_decref (dest_record_p);
-										}
-								}		/* if (dest_record_p) */
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetResourceAsJSONByParts () failed for \"%s\"", name_s);
-								}
-
-							json_decref (result_p);
+							return result_p;
 						}		/* if (result_p) */
 					else
 						{
@@ -870,15 +1519,15 @@ static bool AddSearchResultsFromLuceneResults (const json_t *document_p, const u
 			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get \"%s\" from document", LUCENE_ID_S);
 		}
 
-	return success_flag;
+	return NULL;
 }
 
 
-static bool IsCKANSearchEnabled (const char *facet_s, const SearchServiceData * const data_p)
+static bool IsCKANSearchEnabled (const char *facet_s, const SearchConfig * const config_p)
 {
 	bool ckan_flag = false;
 
-	if (data_p -> ssd_ckan_url_s)
+	if (config_p -> sc_ckan_url_s)
 		{
 			/* What facets are we searching? */
 			if (facet_s != NULL)
@@ -902,19 +1551,19 @@ static bool IsCKANSearchEnabled (const char *facet_s, const SearchServiceData *
 
 
 
-static bool IsZenodoSearchEnabled (const char *facet_s, const SearchServiceData * const data_p)
+static bool IsZenodoSearchEnabled (const char *facet_s, const SearchConfig * const config_p)
 {
-	if (data_p -> ssd_zenodo_url_s)
+	if (config_p -> sc_zenodo_url_s)
 		{
 			/* What facets are we searching? */
 			if (facet_s != NULL)
 				{
-					if (data_p -> ssd_zenodo_resource_mappings_p)
+					if (config_p -> sc_zenodo_resource_mappings_p)
 						{
 							const char *key_s;
 							json_t *value_p;
 
-							json_object_foreach (data_p -> ssd_zenodo_resource_mappings_p, key_s, value_p)
+							json_object_foreach (config_p -> sc_zenodo_resource_mappings_p, key_s, value_p)
 								{
 									const char *indexing_type_s = GetJSONString (value_p, INDEXING_TYPE_S);
 
@@ -941,14 +1590,44 @@ static bool IsZenodoSearchEnabled (const char *facet_s, const SearchServiceData
 
 
 
-static OperationStatus CallSearchEndpoint (const char *keyword_s, json_t *facet_counts_p, json_t *(*search_fn) (const char *query_s, LuceneTool *lucene_p, const SearchServiceData *data_p),
-																ServiceJob *job_p, LuceneTool *lucene_p, const SearchServiceData *data_p)
+static OperationStatus CallSearchEndpoint (const char *keyword_s, FacetAccumulator *facets_p, json_t *(*search_fn) (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p),
+																const uint32 source_flag, SearchData *search_data_p, LuceneTool *lucene_p)
 {
 	OperationStatus status = OS_FAILED;
-	json_t *results_p = search_fn (keyword_s, facet_counts_p, data_p);
+	SourcePage page;
+	json_t *results_p = NULL;
+	NegativeQueryCache *negative_cache_p = search_data_p -> sd_service_data_p -> ssd_negative_cache_p;
+	const uint64 generation = GetSourceGeneration (search_data_p -> sd_config_p, source_flag);
+	SearchTrace *trace_p = search_data_p -> sd_trace_p;
+	const int32 span = BeginTraceSpan (trace_p, (source_flag == SC_CKAN_EXHAUSTED) ? "SearchCKAN" : "SearchZenodo");
+	uint64 call_start;
+
+	GetSearchCursorSourcePage (search_data_p -> sd_cursor_p, source_flag, &page);
+
+	if ((negative_cache_p) && (IsKnownEmptyQuery (negative_cache_p, source_flag, keyword_s, NULL, generation)))
+		{
+			/* Skip the remote call and mark the source as exhausted */
+			AdvanceSearchCursorSource (search_data_p -> sd_cursor_p, source_flag, &page);
+
+			SetTraceSpanString (trace_p, span, "negative_cache", "hit");
+			EndTraceSpan (trace_p, span);
+
+			return OS_SUCCEEDED;
+		}
+
+	call_start = GetAdmissionTime ();
+	results_p = search_fn (keyword_s, &page, facets_p, search_data_p -> sd_projection_p, search_data_p -> sd_config_p, trace_p);
+	UpdateSourceLatency (search_data_p -> sd_service_data_p, source_flag, GetAdmissionTime () - call_start);
 
 	if (results_p)
 		{
+			/* If the search failed, leave the cursor where it is so the next page can retry it */
+			AdvanceSearchCursorSource (search_data_p -> sd_cursor_p, source_flag, &page);
+
+			if ((negative_cache_p) && (page.sp_from == 0) && (page.sp_num_hits == 0))
+				{
+					AddEmptyQuery (negative_cache_p, source_flag, keyword_s, NULL, generation);
+				}
 
 			if (json_is_array (results_p))
 				{
@@ -961,11 +1640,21 @@ static OperationStatus CallSearchEndpoint (const char *keyword_s, json_t *facet_
 						{
 							json_t *result_p = json_array_get (results_p, i);
 							const char *name_s = GetJSONString (result_p, "so:name");
-							json_t *dest_record_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, name_s, result_p);
+							json_t *dest_record_p = NULL;
+
+							if (search_data_p -> sd_dictionary_p)
+								{
+									if (!CompactResult (search_data_p -> sd_dictionary_p, result_p))
+										{
+											PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, result_p, "Failed to fully compact result");
+										}
+								}
+
+							dest_record_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, name_s, result_p);
 
 							if (dest_record_p)
 								{
-									if (AddResultToServiceJob (job_p, dest_record_p))
+									if (AddResultToServiceJob (search_data_p -> sd_job_p, dest_record_p))
 										{
 											++ num_successes;
 										}
@@ -996,7 +1685,772 @@ static OperationStatus CallSearchEndpoint (const char *keyword_s, json_t *facet_
 			json_decref (results_p);
 		}
 
+	SetTraceSpanInteger (trace_p, span, "hits", page.sp_num_hits);
+	EndTraceSpan (trace_p, span);
+
 	return status;
 }
 
 
+/*
+ * A search can only be skipped if the query is known to be empty in
+ * Lucene and in every external source that would be searched.
+ */
+static bool IsKnownEmptySearch (const char *keyword_s, const char *facet_s, const uint64 index_generation, SearchServiceData *data_p, const SearchConfig *config_p)
+{
+	NegativeQueryCache *cache_p = data_p -> ssd_negative_cache_p;
+
+	if ((cache_p) && (index_generation > 0))
+		{
+			if (IsKnownEmptyQuery (cache_p, SC_LUCENE_EXHAUSTED, keyword_s, facet_s, index_generation))
+				{
+					if (IsCKANSearchEnabled (facet_s, config_p))
+						{
+							if (!IsKnownEmptyQuery (cache_p, SC_CKAN_EXHAUSTED, keyword_s, NULL, config_p -> sc_ckan_generation))
+								{
+									return false;
+								}
+						}
+
+					if (IsZenodoSearchEnabled (facet_s, config_p))
+						{
+							if (!IsKnownEmptyQuery (cache_p, SC_ZENODO_EXHAUSTED, keyword_s, NULL, config_p -> sc_zenodo_generation))
+								{
+									return false;
+								}
+						}
+
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * Get the page of Lucene hits from the cache if it is there, putting
+ * its totals and facet counts back into the LuceneTool as if Lucene had
+ * been searched, or search Lucene if it isn't.
+ */
+static bool RunLuceneSearch (LuceneTool *lucene_p, const char *keyword_s, const char *facet_s, LinkedList *facets_p, const SearchCursor *cursor_p, const uint64 results_generation, SearchServiceData *data_p, json_t **cached_results_pp, SearchTrace *trace_p)
+{
+	LuceneResultCache *cache_p = data_p -> ssd_lucene_cache_p;
+	const int32 span = BeginTraceSpan (trace_p, "SearchLucene");
+	bool success_flag;
+
+	if ((cache_p) && (results_generation > 0) && (! ((cursor_p -> sc_exhausted_flags) & SC_LUCENE_EXHAUSTED)))
+		{
+			json_t *cached_results_p = GetCachedLucenePage (cache_p, keyword_s, facet_s, cursor_p, results_generation);
+
+			if (cached_results_p)
+				{
+					json_int_t total_hits = 0;
+					json_int_t from = 0;
+					json_int_t to = 0;
+
+					if (GetJSONInteger (cached_results_p, LT_NUM_TOTAL_HITS_S, &total_hits) && GetJSONInteger (cached_results_p, LT_HITS_START_INDEX_S, &from) && GetJSONInteger (cached_results_p, LT_HITS_END_INDEX_S, &to))
+						{
+							lucene_p -> lt_num_total_hits = total_hits;
+							lucene_p -> lt_hits_from_index = from;
+							lucene_p -> lt_hits_to_index = to;
+
+							if (!RestoreLuceneFacets (lucene_p, json_object_get (cached_results_p, S_CACHED_FACETS_S)))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to restore all of the cached facet counts for \"%s\"", keyword_s);
+								}
+
+							*cached_results_pp = cached_results_p;
+
+							SetTraceSpanString (trace_p, span, "cache", "hit");
+							SetTraceSpanInteger (trace_p, span, "total_hits", lucene_p -> lt_num_total_hits);
+							EndTraceSpan (trace_p, span);
+
+							return true;
+						}
+					else
+						{
+							PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, cached_results_p, "Cached Lucene results for \"%s\" are incomplete", keyword_s);
+						}
+
+					json_decref (cached_results_p);
+				}		/* if (cached_results_p) */
+
+			SetTraceSpanString (trace_p, span, "cache", "miss");
+		}
+
+	success_flag = SearchLucene (lucene_p, keyword_s, facets_p, "drill-down", cursor_p -> sc_lucene_page, cursor_p -> sc_page_size, QM_PARSER);
+
+	SetTraceSpanInteger (trace_p, span, "total_hits", lucene_p -> lt_num_total_hits);
+	EndTraceSpan (trace_p, span);
+
+	return success_flag;
+}
+
+
+/*
+ * The facets are stored as AddLuceneFacetResultsToJSON () wrote them,
+ * where each facet is an object with its name and its count, so add
+ * the first string and first integer of each one back.
+ */
+static bool RestoreLuceneFacets (LuceneTool *lucene_p, const json_t *facets_p)
+{
+	bool success_flag = true;
+
+	if (json_is_object (facets_p))
+		{
+			const char *key_s;
+			json_t *value_p;
+
+			json_object_foreach ((json_t *) facets_p, key_s, value_p)
+				{
+					if (json_is_array (value_p))
+						{
+							size_t i;
+							json_t *facet_p;
+
+							json_array_foreach (value_p, i, facet_p)
+								{
+									if (json_is_object (facet_p))
+										{
+											const char *name_s = NULL;
+											json_int_t count = -1;
+											const char *facet_key_s;
+											json_t *facet_value_p;
+
+											json_object_foreach (facet_p, facet_key_s, facet_value_p)
+												{
+													if ((!name_s) && (json_is_string (facet_value_p)))
+														{
+															name_s = json_string_value (facet_value_p);
+														}
+													else if ((count < 0) && (json_is_integer (facet_value_p)))
+														{
+															count = json_integer_value (facet_value_p);
+														}
+												}
+
+											if ((name_s) && (count >= 0))
+												{
+													if (!AddFacetResultToLucene (lucene_p, name_s, (uint32) count))
+														{
+															success_flag = false;
+														}
+												}
+										}
+								}
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+static OperationStatus AddCachedLuceneHits (const json_t *cached_results_p, const uint32 from, void *data_p)
+{
+	SearchData *sd_p = (SearchData *) data_p;
+	OperationStatus status = OS_FAILED;
+	const json_t *hits_p = json_object_get (cached_results_p, S_CACHED_HITS_S);
+
+	if (json_is_array (hits_p))
+		{
+			const size_t num_hits = json_array_size (hits_p);
+			size_t num_added = 0;
+			size_t i;
+
+			for (i = 0; i < num_hits; ++ i)
+				{
+					if (AddSearchResultsFromLuceneResults (json_array_get (hits_p, i), from + (uint32) i, sd_p))
+						{
+							++ num_added;
+						}
+				}
+
+			if (num_added == num_hits)
+				{
+					status = OS_SUCCEEDED;
+				}
+			else if (num_added > 0)
+				{
+					status = OS_PARTIALLY_SUCCEEDED;
+				}
+		}
+
+	return status;
+}
+
+
+static OperationStatus AddSearchedLuceneHits (const uint32 from, const uint32 to, json_t **page_pp, void *data_p)
+{
+	SearchData *sd_p = (SearchData *) data_p;
+	OperationStatus status;
+	int32 parse_span;
+
+	if (page_pp)
+		{
+			/* If this fails, the page just isn't cached */
+			sd_p -> sd_lucene_hits_p = json_array ();
+		}
+
+	parse_span = BeginTraceSpan (sd_p -> sd_trace_p, "ParseLuceneResults");
+
+	status = ParseLuceneResults (sd_p -> sd_lucene_p, from, to, AddSearchResultsFromLuceneResults, sd_p);
+	EndTraceSpan (sd_p -> sd_trace_p, parse_span);
+
+	if (sd_p -> sd_lucene_hits_p)
+		{
+			if (status == OS_SUCCEEDED)
+				{
+					*page_pp = GetLucenePageToCache (sd_p -> sd_lucene_p, sd_p -> sd_lucene_hits_p);
+				}
+
+			json_decref (sd_p -> sd_lucene_hits_p);
+			sd_p -> sd_lucene_hits_p = NULL;
+		}
+
+	return status;
+}
+
+
+static uint32 GetNumTotalLuceneHits (void *data_p)
+{
+	const LuceneTool *lucene_p = ((SearchData *) data_p) -> sd_lucene_p;
+
+	return (lucene_p -> lt_num_total_hits <= 0) ? 0 : ((lucene_p -> lt_num_total_hits < UINT32_MAX) ? (uint32) (lucene_p -> lt_num_total_hits) : UINT32_MAX);
+}
+
+
+/*
+ * The totals and facet counts are taken before the external facet
+ * counts are added to the LuceneTool so that only Lucene's are cached.
+ */
+static json_t *GetLucenePageToCache (LuceneTool *lucene_p, json_t *hits_p)
+{
+	json_t *page_p = NULL;
+	json_error_t error;
+	json_t *results_p = json_pack_ex (&error, 0, "{s:i,s:i,s:i,s:O}",
+																		LT_NUM_TOTAL_HITS_S, lucene_p -> lt_num_total_hits,
+																		LT_HITS_START_INDEX_S, lucene_p -> lt_hits_from_index,
+																		LT_HITS_END_INDEX_S, lucene_p -> lt_hits_to_index,
+																		S_CACHED_HITS_S, hits_p);
+
+	if (results_p)
+		{
+			json_t *facets_p = json_object ();
+
+			if (facets_p)
+				{
+					if (AddLuceneFacetResultsToJSON (lucene_p, facets_p))
+						{
+							if (json_object_set_new (results_p, S_CACHED_FACETS_S, facets_p) == 0)
+								{
+									page_p = results_p;
+								}
+						}
+					else
+						{
+							json_decref (facets_p);
+						}
+				}
+
+			if (!page_p)
+				{
+					json_decref (results_p);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create cached Lucene results: %s", error.text);
+		}
+
+	return page_p;
+}
+
+
+/*
+ * If the index's generation can't be found, we can't tell if an empty
+ * query is still empty or if a cached page is still current, so both
+ * are 0. When the indexing pipeline sends its changes, the generations
+ * come from those rather than from the index directory, until the
+ * socket that they arrive on is lost.
+ */
+static void GetLuceneGenerations (const LuceneTool *lucene_p, SearchServiceData *data_p, uint64 *index_generation_p, uint64 *results_generation_p)
+{
+	if (data_p -> ssd_invalidator_p)
+		{
+			if (IsCacheInvalidatorListening (data_p -> ssd_invalidator_p))
+				{
+					*index_generation_p = GetNotifiedEmptyQueriesGeneration (data_p -> ssd_invalidator_p);
+					*results_generation_p = GetNotifiedResultsGeneration (data_p -> ssd_invalidator_p);
+				}
+			else
+				{
+					*index_generation_p = GetFallbackIndexGeneration (data_p -> ssd_invalidator_p, GetLuceneIndexGeneration (lucene_p -> lt_index_s));
+					*results_generation_p = *index_generation_p;
+				}
+		}
+	else if ((data_p -> ssd_negative_cache_p) || (data_p -> ssd_lucene_cache_p))
+		{
+			*index_generation_p = GetLuceneIndexGeneration (lucene_p -> lt_index_s);
+			*results_generation_p = *index_generation_p;
+		}
+	else
+		{
+			*index_generation_p = 0;
+			*results_generation_p = 0;
+		}
+}
+
+
+static OperationStatus AddEmptySearchMetadata (ServiceJob *job_p)
+{
+	OperationStatus status = OS_FAILED;
+	json_error_t error;
+	json_t *metadata_p = json_pack_ex (&error, 0, "{s:i,s:i,s:i}", LT_NUM_TOTAL_HITS_S, 0, LT_HITS_START_INDEX_S, 0, LT_HITS_END_INDEX_S, 0);
+
+	if (metadata_p)
+		{
+			job_p -> sj_metadata_p = metadata_p;
+			status = OS_SUCCEEDED;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create metadata for empty search: %s", error.text);
+		}
+
+	return status;
+}
+
+
+static uint64 GetSourceGeneration (const SearchConfig *config_p, const uint32 source_flag)
+{
+	return (source_flag == SC_ZENODO_EXHAUSTED) ? config_p -> sc_zenodo_generation : config_p -> sc_ckan_generation;
+}
+
+
+static LinkedList *GetLuceneFacets (const char *facet_key_s, const char *facet_s)
+{
+	LinkedList *facets_p = AllocateLinkedList (FreeKeyValuePairNode);
+
+	if (facets_p)
+		{
+			KeyValuePairNode *facet_p = AllocateKeyValuePairNodeByParts (facet_key_s, facet_s);
+
+			if (facet_p)
+				{
+					LinkedListAddTail (facets_p, & (facet_p -> kvpn_node));
+					return facets_p;
+				}		/* if (facet_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AllocateKeyValuePairNode for facet \"type\": \"%s\" failed", facet_s);
+				}
+
+			FreeLinkedList (facets_p);
+		}		/* if (facets_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "AllocateLinkedList for facet \"%s\" failed", facet_s);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Run the first page of a logged query against each source without a
+ * job to add the hits to. This fills the external result cache and
+ * records any queries with no hits in the negative cache, and the
+ * Lucene search brings the index into the page cache.
+ */
+static void WarmUpQuery (const char *keyword_s, const char *facet_s, void *data_p)
+{
+	SearchServiceData *service_data_p = (SearchServiceData *) data_p;
+	SearchConfig *config_p = AcquireSearchConfig (service_data_p);
+
+	if (config_p)
+		{
+			ResultProjection projection;
+
+			WarmUpLucene (keyword_s, facet_s, service_data_p);
+
+			/* The full projection as the portals are asked for the same fields whichever is used */
+			if (InitResultProjection (&projection, NULL))
+				{
+					FacetAccumulator *facet_counts_p = AllocateFacetAccumulator (config_p -> sc_facet_keys_p);
+
+					if (facet_counts_p)
+						{
+							SearchCursor cursor;
+
+							InitSearchCursor (&cursor, S_DEFAULT_PAGE_NUMBER, S_DEFAULT_PAGE_SIZE, config_p -> sc_external_page_size);
+
+							if (IsCKANSearchEnabled (facet_s, config_p))
+								{
+									WarmUpSearchEndpoint (keyword_s, facet_counts_p, SearchCKAN, SC_CKAN_EXHAUSTED, &cursor, &projection, service_data_p, config_p);
+								}
+
+							if (IsZenodoSearchEnabled (facet_s, config_p))
+								{
+									WarmUpSearchEndpoint (keyword_s, facet_counts_p, SearchZenodo, SC_ZENODO_EXHAUSTED, &cursor, &projection, service_data_p, config_p);
+								}
+
+							FreeFacetAccumulator (facet_counts_p);
+						}
+
+					ClearResultProjection (&projection);
+				}
+
+			ReleaseSearchConfig (config_p);
+		}
+}
+
+
+static void WarmUpLucene (const char *keyword_s, const char *facet_s, SearchServiceData *data_p)
+{
+	GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (data_p -> ssd_base_data.sd_service_p);
+	uuid_t id;
+	LuceneTool *lucene_p = NULL;
+
+	uuid_generate (id);
+	lucene_p = AllocateLuceneTool (grassroots_p, id);
+
+	if (lucene_p)
+		{
+			uint64 index_generation = 0;
+			uint64 results_generation = 0;
+			LinkedList *facets_p = NULL;
+
+			GetLuceneGenerations (lucene_p, data_p, &index_generation, &results_generation);
+
+			if ((facet_s == NULL) || ((facets_p = GetLuceneFacets (lucene_p -> lt_facet_key_s, facet_s)) != NULL))
+				{
+					if (SetLuceneToolName (lucene_p, "search_keywords"))
+						{
+							if (SearchLucene (lucene_p, keyword_s, facets_p, "drill-down", S_DEFAULT_PAGE_NUMBER, S_DEFAULT_PAGE_SIZE, QM_PARSER))
+								{
+									/* Only the total number of hits is needed */
+									if (ParseLuceneResults (lucene_p, 0, 0, CountLuceneResult, NULL) == OS_SUCCEEDED)
+										{
+											if ((lucene_p -> lt_num_total_hits == 0) && (index_generation > 0) && (data_p -> ssd_negative_cache_p))
+												{
+													AddEmptyQuery (data_p -> ssd_negative_cache_p, SC_LUCENE_EXHAUSTED, keyword_s, facet_s, index_generation);
+												}
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "SearchLucene for warming up \"%s\" failed", keyword_s);
+								}
+						}
+
+					if (facets_p)
+						{
+							FreeLinkedList (facets_p);
+						}
+				}
+
+			FreeLuceneTool (lucene_p);
+		}
+}
+
+
+static bool CountLuceneResult (const json_t * UNUSED_PARAM (document_p), const uint32 UNUSED_PARAM (index), void * UNUSED_PARAM (data_p))
+{
+	return true;
+}
+
+
+static void WarmUpSearchEndpoint (const char *keyword_s, FacetAccumulator *facets_p, json_t *(*search_fn) (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p),
+																	const uint32 source_flag, const SearchCursor *cursor_p, const ResultProjection *projection_p, SearchServiceData *data_p, const SearchConfig *config_p)
+{
+	NegativeQueryCache *negative_cache_p = data_p -> ssd_negative_cache_p;
+	const uint64 generation = GetSourceGeneration (config_p, source_flag);
+	SourcePage page;
+
+	GetSearchCursorSourcePage (cursor_p, source_flag, &page);
+
+	if (! ((negative_cache_p) && (IsKnownEmptyQuery (negative_cache_p, source_flag, keyword_s, NULL, generation))))
+		{
+			json_t *results_p = search_fn (keyword_s, &page, facets_p, projection_p, config_p, NULL);
+
+			if (results_p)
+				{
+					if ((negative_cache_p) && (page.sp_num_hits == 0))
+						{
+							AddEmptyQuery (negative_cache_p, source_flag, keyword_s, NULL, generation);
+						}
+
+					json_decref (results_p);
+				}
+		}
+}
+
+
+static bool AddAdmissionMetadata (ServiceJob *job_p, const char *admission_s)
+{
+	bool success_flag = false;
+
+	if (! (job_p -> sj_metadata_p))
+		{
+			job_p -> sj_metadata_p = json_object ();
+		}
+
+	if (job_p -> sj_metadata_p)
+		{
+			success_flag = SetJSONString (job_p -> sj_metadata_p, AC_ADMISSION_S, admission_s);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add admission \"%s\" to job metadata", admission_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Only the parameters that shape the search are kept. The API key
+ * identifies a client so it isn't written out and the trace id is
+ * particular to the original search.
+ */
+static bool CaptureSearchParameters (SearchCapture *capture_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+	json_t *params_p = json_object ();
+
+	if (params_p)
+		{
+			const char *value_s = NULL;
+			const uint32 *value_p = NULL;
+			const bool *flag_p = NULL;
+
+			success_flag = true;
+
+			if ((GetCurrentStringParameterValueFromParameterSet (param_set_p, S_KEYWORD.npt_name_s, &value_s)) && (value_s))
+				{
+					success_flag = SetJSONString (params_p, S_KEYWORD.npt_name_s, value_s) && success_flag;
+				}
+
+			if ((GetCurrentStringParameterValueFromParameterSet (param_set_p, S_FACET.npt_name_s, &value_s)) && (value_s))
+				{
+					success_flag = SetJSONString (params_p, S_FACET.npt_name_s, value_s) && success_flag;
+				}
+
+			if ((GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_PAGE_NUMBER.npt_name_s, &value_p)) && (value_p))
+				{
+					success_flag = SetJSONInteger (params_p, S_PAGE_NUMBER.npt_name_s, *value_p) && success_flag;
+				}
+
+			if ((GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_PAGE_SIZE.npt_name_s, &value_p)) && (value_p))
+				{
+					success_flag = SetJSONInteger (params_p, S_PAGE_SIZE.npt_name_s, *value_p) && success_flag;
+				}
+
+			if ((GetCurrentStringParameterValueFromParameterSet (param_set_p, S_RESULT_FIELDS.npt_name_s, &value_s)) && (value_s))
+				{
+					success_flag = SetJSONString (params_p, S_RESULT_FIELDS.npt_name_s, value_s) && success_flag;
+				}
+
+			if ((GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_COMPACT_RESULTS.npt_name_s, &flag_p)) && (flag_p))
+				{
+					success_flag = SetJSONBoolean (params_p, S_COMPACT_RESULTS.npt_name_s, *flag_p) && success_flag;
+				}
+
+			if ((GetCurrentStringParameterValueFromParameterSet (param_set_p, S_CURSOR.npt_name_s, &value_s)) && (value_s))
+				{
+					success_flag = SetJSONString (params_p, S_CURSOR.npt_name_s, value_s) && success_flag;
+				}
+
+			if ((GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_EXPORT.npt_name_s, &flag_p)) && (flag_p))
+				{
+					success_flag = SetJSONBoolean (params_p, S_EXPORT.npt_name_s, *flag_p) && success_flag;
+				}
+
+			if ((GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_LATENCY_BUDGET.npt_name_s, &value_p)) && (value_p))
+				{
+					success_flag = SetJSONInteger (params_p, S_LATENCY_BUDGET.npt_name_s, *value_p) && success_flag;
+				}
+
+			if (success_flag)
+				{
+					success_flag = CaptureSearch (capture_p, params_p);
+				}
+			else
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, params_p, "Failed to get all of the search parameters to capture");
+				}
+
+			json_decref (params_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Searches that don't come with a trace id of their own are traced
+ * under their job's id so that the trace can be found from the job.
+ */
+static SearchTrace *StartTrace (const char *trace_id_s, ServiceJob *job_p, SearchServiceData *data_p)
+{
+	char uuid_s [UUID_STRING_BUFFER_SIZE];
+
+	ConvertUUIDToString (job_p -> sj_id, uuid_s);
+
+	return StartSearchTrace (data_p -> ssd_tracer_p, trace_id_s, uuid_s, data_p -> ssd_slow_query_log_p != NULL);
+}
+
+
+static bool AddTraceMetadata (ServiceJob *job_p, const SearchTrace *trace_p)
+{
+	bool success_flag = false;
+
+	if (! (job_p -> sj_metadata_p))
+		{
+			job_p -> sj_metadata_p = json_object ();
+		}
+
+	if (job_p -> sj_metadata_p)
+		{
+			success_flag = SetJSONString (job_p -> sj_metadata_p, ST_TRACE_ID_S, GetSearchTraceId (trace_p));
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add trace id \"%s\" to job metadata", GetSearchTraceId (trace_p));
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Logged in users are scheduled by their email address. Anonymous
+ * clients can send an API key to get their own share rather than
+ * sharing one with every other anonymous client. The keys are prefixed
+ * so that they can't be used to pass as a logged in user.
+ */
+static char *GetSchedulingUser (const User *user_p, const char *api_key_s)
+{
+	char *user_s = NULL;
+
+	if ((user_p) && (!IsStringEmpty (user_p -> us_email_s)))
+		{
+			user_s = EasyCopyToNewString (user_p -> us_email_s);
+		}
+	else if (!IsStringEmpty (api_key_s))
+		{
+			user_s = ConcatenateVarargsStrings (S_API_KEY_PREFIX_S, api_key_s, NULL);
+		}
+
+	return user_s;
+}
+
+
+/*
+ * A source whose latency isn't known yet is always tried so that
+ * we can find out. The estimate for a source that hasn't been called
+ * lately decays, so one that was skipped for being slow is tried again
+ * and, if it has recovered, its estimate comes back down.
+ */
+static bool HasLatencyBudgetForSource (SearchServiceData *data_p, const uint32 source_flag, const uint64 deadline)
+{
+	if (deadline > 0)
+		{
+			const uint32 *latency_p = (source_flag == SC_ZENODO_EXHAUSTED) ? & (data_p -> ssd_zenodo_latency) : & (data_p -> ssd_ckan_latency);
+			const uint64 *latency_time_p = (source_flag == SC_ZENODO_EXHAUSTED) ? & (data_p -> ssd_zenodo_latency_time) : & (data_p -> ssd_ckan_latency_time);
+			const uint64 now = GetAdmissionTime ();
+			const uint64 latency_time = __atomic_load_n (latency_time_p, __ATOMIC_RELAXED);
+			uint64 latency = __atomic_load_n (latency_p, __ATOMIC_RELAXED);
+
+			if (now > latency_time)
+				{
+					const uint64 num_half_lives = (now - latency_time) / S_LATENCY_HALF_LIFE;
+
+					latency = (num_half_lives < 32) ? (latency >> num_half_lives) : 0;
+				}
+
+			return (now + latency <= deadline);
+		}
+
+	return true;
+}
+
+
+/*
+ * Keep a moving average weighted 1/8 towards the newest request, which
+ * includes any that were answered from the cache. Concurrent updates
+ * can lose one another's samples, which is fine for an estimate.
+ */
+static void UpdateSourceLatency (SearchServiceData *data_p, const uint32 source_flag, const uint64 latency)
+{
+	uint32 *latency_p = (source_flag == SC_ZENODO_EXHAUSTED) ? & (data_p -> ssd_zenodo_latency) : & (data_p -> ssd_ckan_latency);
+	const uint32 sample = (latency > 0) ? ((latency < S_MAX_LATENCY_SAMPLE) ? (uint32) latency : S_MAX_LATENCY_SAMPLE) : 1;
+	const uint32 average = __atomic_load_n (latency_p, __ATOMIC_RELAXED);
+
+	__atomic_store_n (latency_p, (average == 0) ? sample : (uint32) ((((uint64) average) * 7 + sample) >> 3), __ATOMIC_RELAXED);
+	__atomic_store_n ((source_flag == SC_ZENODO_EXHAUSTED) ? & (data_p -> ssd_zenodo_latency_time) : & (data_p -> ssd_ckan_latency_time), GetAdmissionTime (), __ATOMIC_RELAXED);
+}
+
+
+/*
+ * The job's status is set from the Lucene search's once the page is
+ * done, so a CKAN or Zenodo search that fails has to be folded into
+ * that rather than into the job directly. Its hits are just missing
+ * from the page, so the search has only partly succeeded.
+ */
+static OperationStatus MergeSourceStatus (const OperationStatus status, const OperationStatus source_status)
+{
+	if ((source_status != OS_SUCCEEDED) && ((status == OS_SUCCEEDED) || (status == OS_PARTIALLY_SUCCEEDED)))
+		{
+			return OS_PARTIALLY_SUCCEEDED;
+		}
+
+	return status;
+}
+
+
+static bool AddSkippedSourcesToJSON (json_t *metadata_p, const uint32 skipped_flags)
+{
+	json_t *sources_p = json_array ();
+
+	if (sources_p)
+		{
+			bool success_flag = true;
+
+			if (skipped_flags & SC_CKAN_EXHAUSTED)
+				{
+					if (json_array_append_new (sources_p, json_string ("ckan")) != 0)
+						{
+							success_flag = false;
+						}
+				}
+
+			if (skipped_flags & SC_ZENODO_EXHAUSTED)
+				{
+					if (json_array_append_new (sources_p, json_string ("zenodo")) != 0)
+						{
+							success_flag = false;
+						}
+				}
+
+			if (success_flag)
+				{
+					if (json_object_set_new (metadata_p, S_SKIPPED_SOURCES_S, sources_p) == 0)
+						{
+							return true;
+						}
+				}
+			else
+				{
+					json_decref (sources_p);
+				}
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add skipped sources to metadata");
+
+	return false;
+}
@@ -1,7 +1,118 @@
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
 #include "search_service_data.h"
 
 #include "memory_allocations.h"
+#include "streams.h"
+
+
+/* How often to check the configuration file if no interval is given */
+static const uint32 S_DEFAULT_RELOAD_INTERVAL = 10;
+
+static const uint32 S_DEFAULT_EXTERNAL_CACHE_MAX_ENTRIES = 1000;
+
+static const uint32 S_DEFAULT_EXTERNAL_CACHE_TTL = 300;
+
+static const uint32 S_DEFAULT_EXTERNAL_CACHE_GRACE = 3600;
+
+static const uint32 S_DEFAULT_EXTERNAL_CACHE_STALE_IF_ERROR = 86400;
+
+/* In MiB */
+static const uint32 S_DEFAULT_DISK_CACHE_MAX_SIZE = 1024;
+
+/* 1 MiB for each source which keeps false positives below 1 in 10000 for up to 200000 empty queries */
+static const uint32 S_DEFAULT_NEGATIVE_CACHE_BITS = 1 << 23;
+
+static const uint32 S_DEFAULT_NEGATIVE_CACHE_TTL = 3600;
+
+static const uint32 S_DEFAULT_LUCENE_CACHE_MAX_ENTRIES = 1000;
+
+/* In MiB */
+static const uint32 S_DEFAULT_LUCENE_CACHE_MAX_SIZE = 64;
+
+static const uint32 S_DEFAULT_WARM_UP_NUM_QUERIES = 100;
+
+/* In MiB */
+static const uint32 S_DEFAULT_QUERY_LOG_MAX_SIZE = 64;
+
+/* In MiB */
+static const uint32 S_DEFAULT_TRACE_MAX_SIZE = 64;
+
+static const uint32 S_DEFAULT_TRACE_MAX_FILES = 5;
+
+static const uint32 S_DEFAULT_TRACE_SAMPLE_PERCENT = 100;
+
+/* In milliseconds */
+static const uint32 S_DEFAULT_SLOW_QUERY_THRESHOLD = 1000;
+
+static const uint32 S_DEFAULT_ADMISSION_MIN_CONCURRENT = 2;
+
+static const uint32 S_DEFAULT_ADMISSION_MAX_CONCURRENT = 32;
+
+static const uint32 S_DEFAULT_ADMISSION_QUEUE = 64;
+
+/* In milliseconds */
+static const uint32 S_DEFAULT_ADMISSION_QUEUE_TIMEOUT = 2000;
+
+/* In milliseconds */
+static const uint32 S_DEFAULT_ADMISSION_TARGET_LATENCY = 3000;
+
+static const uint32 S_DEFAULT_ADMISSION_USER_WEIGHT = 1;
+
+/* No limit */
+static const uint32 S_DEFAULT_ADMISSION_MAX_CONCURRENT_PER_USER = 0;
+
+static const uint32 S_DEFAULT_ADMISSION_QUEUE_PER_USER = 0;
+
+static const uint32 S_DEFAULT_HEDGE_PERCENTILE = 95;
+
+static const uint32 S_DEFAULT_HEDGE_MAX_PERCENT = 5;
+
+/* In milliseconds */
+static const uint32 S_DEFAULT_HEDGE_MIN_DELAY = 50;
+
+
+/*
+ * Set once a warm up has started in this process. It is cleared again if
+ * the warm up is stopped before it finishes, so the next instance of the
+ * service can have another go.
+ */
+static bool s_warm_up_started_flag = false;
+
+
+static ExternalResultCache *GetExternalResultCache (const json_t *cache_config_p);
+
+static DiskResultCache *GetDiskResultCache (const json_t *disk_config_p, const uint32 max_age);
+
+static NegativeQueryCache *GetNegativeQueryCache (const json_t *cache_config_p);
+
+static LuceneResultCache *GetLuceneResultCache (const json_t *cache_config_p, const bool notified_flag);
+
+static QueryLog *GetQueryLog (const json_t *log_config_p, uint32 *num_queries_p);
+
+static SearchTracer *GetSearchTracer (const json_t *trace_config_p);
+
+static SlowQueryLog *GetSlowQueryLog (const json_t *log_config_p);
+
+static SearchCapture *GetSearchCapture (const json_t *capture_config_p);
+
+static AdmissionController *GetAdmissionController (const json_t *admission_config_p);
+
+static HedgePolicy *GetHedgePolicy (const json_t *hedge_config_p);
+
+static bool StartConfigWatcher (SearchServiceData *data_p, const json_t *reload_p);
+
+static void StopConfigWatcher (SearchServiceData *data_p);
+
+static void *RunConfigWatcher (void *data_p);
+
+static bool GetConfigFileModificationTime (const char *filename_s, time_t *mtime_p);
+
+static void ReloadSearchConfig (SearchServiceData *data_p);
+
+static void SetSearchConfig (SearchServiceData *data_p, SearchConfig *config_p);
 
 
 SearchServiceData *AllocateSearchServiceData (void)
@@ -11,14 +122,121 @@ SearchServiceData *AllocateSearchServiceData (void)
 	if (data_p)
 		{
 			memset (data_p, 0, sizeof (SearchServiceData));
+
+			if (pthread_mutex_init (& (data_p -> ssd_config_lock), NULL) == 0)
+				{
+					data_p -> ssd_job_sets_p = AllocateSearchJobSets ();
+
+					if (data_p -> ssd_job_sets_p)
+						{
+							/* If this fails, searches just won't be shared */
+							data_p -> ssd_flights_p = AllocateSearchFlightTable ();
+
+							return data_p;
+						}
+
+					pthread_mutex_destroy (& (data_p -> ssd_config_lock));
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise the configuration lock");
+				}
+
+			FreeMemory (data_p);
 		}
 
-	return data_p;
+	return NULL;
 }
 
 
 void FreeSearchServiceData (SearchServiceData *data_p)
 {
+	StopConfigWatcher (data_p);
+
+	/* Stop this before the caches that it fills are freed */
+	if (data_p -> ssd_warm_up_p)
+		{
+			if (!StopSearchWarmUp (data_p -> ssd_warm_up_p))
+				{
+					__atomic_store_n (&s_warm_up_started_flag, false, __ATOMIC_RELEASE);
+				}
+		}
+
+	if (data_p -> ssd_query_log_p)
+		{
+			FreeQueryLog (data_p -> ssd_query_log_p);
+		}
+
+	/* The service is only freed once it has no searches running */
+	if (data_p -> ssd_admission_p)
+		{
+			FreeAdmissionController (data_p -> ssd_admission_p);
+		}
+
+	if (data_p -> ssd_config_p)
+		{
+			ReleaseSearchConfig (data_p -> ssd_config_p);
+		}
+
+	/*
+	 * Any searches still using a snapshot will have finished by now,
+	 * so the pool can go.
+	 */
+	if (data_p -> ssd_conversion_pool_p)
+		{
+			FreeConversionPool (data_p -> ssd_conversion_pool_p);
+		}
+
+	if (data_p -> ssd_external_cache_p)
+		{
+			FreeExternalResultCache (data_p -> ssd_external_cache_p);
+		}
+
+	if (data_p -> ssd_hedge_p)
+		{
+			FreeHedgePolicy (data_p -> ssd_hedge_p);
+		}
+
+	/* Stop this before the caches that it removes entries from are freed */
+	if (data_p -> ssd_invalidator_p)
+		{
+			FreeCacheInvalidator (data_p -> ssd_invalidator_p);
+		}
+
+	if (data_p -> ssd_negative_cache_p)
+		{
+			FreeNegativeQueryCache (data_p -> ssd_negative_cache_p);
+		}
+
+	if (data_p -> ssd_lucene_cache_p)
+		{
+			FreeLuceneResultCache (data_p -> ssd_lucene_cache_p);
+		}
+
+	if (data_p -> ssd_flights_p)
+		{
+			FreeSearchFlightTable (data_p -> ssd_flights_p);
+		}
+
+	if (data_p -> ssd_tracer_p)
+		{
+			FreeSearchTracer (data_p -> ssd_tracer_p);
+		}
+
+	if (data_p -> ssd_slow_query_log_p)
+		{
+			FreeSlowQueryLog (data_p -> ssd_slow_query_log_p);
+		}
+
+	if (data_p -> ssd_capture_p)
+		{
+			FreeSearchCapture (data_p -> ssd_capture_p);
+		}
+
+	FreeSearchJobSets (data_p -> ssd_job_sets_p);
+
+	pthread_mutex_destroy (& (data_p -> ssd_config_lock));
+
 	FreeMemory (data_p);
 }
 
@@ -27,45 +245,660 @@ bool ConfigureSearchServiceData (SearchServiceData *data_p)
 {
 	bool success_flag = false;
 
-	const json_t *search_service_config_p = data_p -> ssd_base_data.sd_config_p;
+	json_t *search_service_config_p = data_p -> ssd_base_data.sd_config_p;
 
 	if (search_service_config_p)
 		{
-			const json_t *ckan_p = json_object_get (search_service_config_p, "ckan");
-			const json_t *zenodo_p = json_object_get (search_service_config_p, "zenodo");
+			const json_t *conversion_p = json_object_get (search_service_config_p, "parallel_conversion");
+			const json_t *reload_p = json_object_get (search_service_config_p, "hot_reload");
+			const json_t *cache_p = json_object_get (search_service_config_p, "external_cache");
+			const json_t *negative_cache_p = json_object_get (search_service_config_p, "negative_cache");
+			const json_t *lucene_cache_p = json_object_get (search_service_config_p, "lucene_cache");
+			const json_t *invalidation_p = json_object_get (search_service_config_p, "invalidation");
+			const char *invalidation_socket_s = invalidation_p ? GetJSONString (invalidation_p, "socket") : NULL;
+			const json_t *query_log_p = json_object_get (search_service_config_p, "query_log");
+			const json_t *admission_p = json_object_get (search_service_config_p, "admission");
+			const json_t *hedging_p = json_object_get (search_service_config_p, "hedging");
+			const json_t *tracing_p = json_object_get (search_service_config_p, "tracing");
+			const json_t *slow_query_log_p = json_object_get (search_service_config_p, "slow_query_log");
+			const json_t *capture_p = json_object_get (search_service_config_p, "capture");
 
-			success_flag = true;
-
-			if (ckan_p)
+			/*
+			 * The threads are started once, so changing their number
+			 * still needs a restart.
+			 */
+			if (conversion_p)
 				{
-					data_p -> ssd_ckan_url_s = GetJSONString (ckan_p, CONTEXT_PREFIX_SCHEMA_ORG_S "url");
+					json_int_t num_threads = 0;
 
-					if (data_p -> ssd_ckan_url_s)
+					if (GetJSONInteger (conversion_p, "threads", &num_threads) && (num_threads > 0))
 						{
-							data_p -> ssd_ckan_resource_mappings_p = json_object_get (ckan_p, "mappings");
-
-							data_p -> ssd_ckan_provider_p = json_object_get (ckan_p, SERVER_PROVIDER_S);
-							data_p -> ssd_ckan_filters_p = json_object_get (ckan_p, "filters");
+							/*
+							 * If we can't get the pool, the hits will just be
+							 * converted sequentially.
+							 */
+							data_p -> ssd_conversion_pool_p = AllocateConversionPool ((uint32) num_threads);
 						}
 				}
 
-			if (zenodo_p)
+			/* Like the pool, the cache settings need a restart to change */
+			if (cache_p)
+				{
+					data_p -> ssd_external_cache_p = GetExternalResultCache (cache_p);
+				}
+
+			if (negative_cache_p)
 				{
-					data_p -> ssd_zenodo_url_s = GetJSONString (zenodo_p, CONTEXT_PREFIX_SCHEMA_ORG_S "url");
+					data_p -> ssd_negative_cache_p = GetNegativeQueryCache (negative_cache_p);
+				}
 
-					if (data_p -> ssd_zenodo_url_s)
+			if (lucene_cache_p)
+				{
+					data_p -> ssd_lucene_cache_p = GetLuceneResultCache (lucene_cache_p, invalidation_socket_s != NULL);
+				}
+
+			if (invalidation_socket_s)
+				{
+					data_p -> ssd_invalidator_p = AllocateCacheInvalidator (invalidation_socket_s, data_p -> ssd_lucene_cache_p, data_p -> ssd_negative_cache_p);
+
+					if (! (data_p -> ssd_invalidator_p))
 						{
-							data_p -> ssd_zenodo_provider_p = json_object_get (zenodo_p, SERVER_PROVIDER_S);
-							data_p -> ssd_zenodo_community_s = GetJSONString (zenodo_p, "community");
-							data_p -> ssd_zenodo_api_token_s = GetJSONString (zenodo_p, "api_token");
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to listen for index changes on \"%s\", using the index generation instead", invalidation_socket_s);
 
-							data_p -> ssd_zenodo_resource_mappings_p = json_object_get (zenodo_p, "mappings");
+							/* Without the notifications, the Lucene pages must be cleared whenever the index changes */
+							if (data_p -> ssd_lucene_cache_p)
+								{
+									FreeLuceneResultCache (data_p -> ssd_lucene_cache_p);
+									data_p -> ssd_lucene_cache_p = GetLuceneResultCache (lucene_cache_p, false);
+								}
 						}
 				}
 
+			if (query_log_p)
+				{
+					data_p -> ssd_query_log_p = GetQueryLog (query_log_p, & (data_p -> ssd_warm_up_num_queries));
+				}
+
+			if (admission_p)
+				{
+					data_p -> ssd_admission_p = GetAdmissionController (admission_p);
+				}
+
+			if (hedging_p)
+				{
+					data_p -> ssd_hedge_p = GetHedgePolicy (hedging_p);
+				}
+
+			if (tracing_p)
+				{
+					data_p -> ssd_tracer_p = GetSearchTracer (tracing_p);
+				}
+
+			if (slow_query_log_p)
+				{
+					data_p -> ssd_slow_query_log_p = GetSlowQueryLog (slow_query_log_p);
+				}
+
+			if (capture_p)
+				{
+					data_p -> ssd_capture_p = GetSearchCapture (capture_p);
+				}
+
+			data_p -> ssd_config_p = AllocateSearchConfig (search_service_config_p, NULL, data_p -> ssd_conversion_pool_p, data_p -> ssd_external_cache_p, data_p -> ssd_hedge_p);
+
+			if (data_p -> ssd_config_p)
+				{
+					success_flag = true;
+
+					if (reload_p)
+						{
+							if (!StartConfigWatcher (data_p, reload_p))
+								{
+									PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, reload_p, "Failed to start watching the configuration, hot reloading is disabled");
+								}
+						}
+				}
 
 		}		/* if (search_service_config_p) */
 
 
 	return success_flag;
 }
+
+
+SearchConfig *AcquireSearchConfig (SearchServiceData *data_p)
+{
+	SearchConfig *config_p = NULL;
+
+	pthread_mutex_lock (& (data_p -> ssd_config_lock));
+
+	if (data_p -> ssd_config_p)
+		{
+			config_p = RetainSearchConfig (data_p -> ssd_config_p);
+		}
+
+	pthread_mutex_unlock (& (data_p -> ssd_config_lock));
+
+	return config_p;
+}
+
+
+bool WarmUpSearchServiceData (SearchServiceData *data_p, WarmUpQueryFn warm_up_fn)
+{
+	if ((data_p -> ssd_query_log_p) && (data_p -> ssd_warm_up_num_queries > 0))
+		{
+			if (!__atomic_exchange_n (&s_warm_up_started_flag, true, __ATOMIC_ACQ_REL))
+				{
+					data_p -> ssd_warm_up_p = StartSearchWarmUp (data_p -> ssd_query_log_p, data_p -> ssd_warm_up_num_queries, warm_up_fn, data_p);
+
+					if (data_p -> ssd_warm_up_p)
+						{
+							return true;
+						}
+
+					__atomic_store_n (&s_warm_up_started_flag, false, __ATOMIC_RELEASE);
+				}
+		}
+
+	return false;
+}
+
+
+static ExternalResultCache *GetExternalResultCache (const json_t *cache_config_p)
+{
+	ExternalResultCache *cache_p = NULL;
+	uint32 max_entries = S_DEFAULT_EXTERNAL_CACHE_MAX_ENTRIES;
+	uint32 ttl = S_DEFAULT_EXTERNAL_CACHE_TTL;
+	uint32 grace = S_DEFAULT_EXTERNAL_CACHE_GRACE;
+	uint32 stale_if_error = S_DEFAULT_EXTERNAL_CACHE_STALE_IF_ERROR;
+
+	GetJSONUnsignedInteger (cache_config_p, "max_entries", &max_entries);
+	GetJSONUnsignedInteger (cache_config_p, "ttl", &ttl);
+	GetJSONUnsignedInteger (cache_config_p, "grace", &grace);
+	GetJSONUnsignedInteger (cache_config_p, "stale_if_error", &stale_if_error);
+
+	if (max_entries > 0)
+		{
+			const json_t *disk_config_p = json_object_get (cache_config_p, "disk");
+			DiskResultCache *disk_p = NULL;
+
+			if (disk_config_p)
+				{
+					/* Keep the responses for as long as any of them could be returned */
+					disk_p = GetDiskResultCache (disk_config_p, ttl + ((grace > stale_if_error) ? grace : stale_if_error));
+				}
+
+			/*
+			 * If we can't get the cache, every request will just
+			 * go to the portals.
+			 */
+			cache_p = AllocateExternalResultCache (max_entries, ttl, grace, stale_if_error, disk_p);
+
+			if (!cache_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, cache_config_p, "Failed to create the external result cache");
+
+					if (disk_p)
+						{
+							FreeDiskResultCache (disk_p);
+						}
+				}
+		}
+
+	return cache_p;
+}
+
+
+static DiskResultCache *GetDiskResultCache (const json_t *disk_config_p, const uint32 max_age)
+{
+	DiskResultCache *disk_p = NULL;
+	const char *filename_s = GetJSONString (disk_config_p, "file");
+
+	if (filename_s)
+		{
+			uint32 max_size = S_DEFAULT_DISK_CACHE_MAX_SIZE;
+
+			GetJSONUnsignedInteger (disk_config_p, "max_size", &max_size);
+
+			/* Without it, only the memory cache is used */
+			disk_p = AllocateDiskResultCache (filename_s, ((uint64) max_size) << 20, max_age);
+
+			if (!disk_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, disk_config_p, "Failed to open the disk result cache");
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, disk_config_p, "No disk result cache \"file\"");
+		}
+
+	return disk_p;
+}
+
+
+static NegativeQueryCache *GetNegativeQueryCache (const json_t *cache_config_p)
+{
+	NegativeQueryCache *cache_p = NULL;
+	uint32 num_bits = S_DEFAULT_NEGATIVE_CACHE_BITS;
+	uint32 ttl = S_DEFAULT_NEGATIVE_CACHE_TTL;
+
+	GetJSONUnsignedInteger (cache_config_p, "bits", &num_bits);
+	GetJSONUnsignedInteger (cache_config_p, "ttl", &ttl);
+
+	if (num_bits > 0)
+		{
+			/* Without it, every query is just run as normal */
+			cache_p = AllocateNegativeQueryCache (num_bits, ttl);
+
+			if (!cache_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, cache_config_p, "Failed to create the negative query cache");
+				}
+		}
+
+	return cache_p;
+}
+
+
+static LuceneResultCache *GetLuceneResultCache (const json_t *cache_config_p, const bool notified_flag)
+{
+	LuceneResultCache *cache_p = NULL;
+	uint32 max_entries = S_DEFAULT_LUCENE_CACHE_MAX_ENTRIES;
+	uint32 max_size = S_DEFAULT_LUCENE_CACHE_MAX_SIZE;
+
+	GetJSONUnsignedInteger (cache_config_p, "max_entries", &max_entries);
+	GetJSONUnsignedInteger (cache_config_p, "max_size", &max_size);
+
+	if ((max_entries > 0) && (max_size > 0))
+		{
+			/* Without it, every page is just read from Lucene */
+			cache_p = AllocateLuceneResultCache (max_entries, ((uint64) max_size) << 20, notified_flag);
+
+			if (!cache_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, cache_config_p, "Failed to create the Lucene result cache");
+				}
+		}
+
+	return cache_p;
+}
+
+
+static QueryLog *GetQueryLog (const json_t *log_config_p, uint32 *num_queries_p)
+{
+	QueryLog *log_p = NULL;
+	const char *filename_s = GetJSONString (log_config_p, "file");
+
+	if (filename_s)
+		{
+			uint32 max_size = S_DEFAULT_QUERY_LOG_MAX_SIZE;
+
+			*num_queries_p = S_DEFAULT_WARM_UP_NUM_QUERIES;
+			GetJSONUnsignedInteger (log_config_p, "warm_up", num_queries_p);
+			GetJSONUnsignedInteger (log_config_p, "max_size", &max_size);
+
+			/* Without it, searches just aren't recorded */
+			log_p = AllocateQueryLog (filename_s, ((uint64) max_size) << 20);
+
+			if (!log_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, log_config_p, "Failed to open the query log");
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, log_config_p, "No query log \"file\"");
+		}
+
+	return log_p;
+}
+
+
+static SearchTracer *GetSearchTracer (const json_t *trace_config_p)
+{
+	SearchTracer *tracer_p = NULL;
+	const char *filename_s = GetJSONString (trace_config_p, "file");
+
+	if (filename_s)
+		{
+			uint32 max_size = S_DEFAULT_TRACE_MAX_SIZE;
+			uint32 max_files = S_DEFAULT_TRACE_MAX_FILES;
+			uint32 sample_percent = S_DEFAULT_TRACE_SAMPLE_PERCENT;
+
+			GetJSONUnsignedInteger (trace_config_p, "max_size", &max_size);
+			GetJSONUnsignedInteger (trace_config_p, "max_files", &max_files);
+			GetJSONUnsignedInteger (trace_config_p, "sample_percent", &sample_percent);
+
+			/* Without it, searches just aren't traced */
+			tracer_p = AllocateSearchTracer (filename_s, ((uint64) max_size) << 20, max_files, sample_percent);
+
+			if (!tracer_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, trace_config_p, "Failed to open the trace file");
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, trace_config_p, "No trace \"file\"");
+		}
+
+	return tracer_p;
+}
+
+
+static SlowQueryLog *GetSlowQueryLog (const json_t *log_config_p)
+{
+	SlowQueryLog *log_p = NULL;
+	const char *filename_s = GetJSONString (log_config_p, "file");
+
+	if (filename_s)
+		{
+			uint32 threshold = S_DEFAULT_SLOW_QUERY_THRESHOLD;
+
+			GetJSONUnsignedInteger (log_config_p, "threshold", &threshold);
+
+			/* Without it, slow searches just aren't recorded */
+			log_p = AllocateSlowQueryLog (filename_s, threshold);
+
+			if (!log_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, log_config_p, "Failed to open the slow query log");
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, log_config_p, "No slow query log \"file\"");
+		}
+
+	return log_p;
+}
+
+
+static SearchCapture *GetSearchCapture (const json_t *capture_config_p)
+{
+	SearchCapture *capture_p = NULL;
+	const char *filename_s = GetJSONString (capture_config_p, "file");
+
+	if (filename_s)
+		{
+			/* Without it, searches just aren't captured */
+			capture_p = AllocateSearchCapture (filename_s);
+
+			if (!capture_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, capture_config_p, "Failed to open the search capture");
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, capture_config_p, "No search capture \"file\"");
+		}
+
+	return capture_p;
+}
+
+
+static AdmissionController *GetAdmissionController (const json_t *admission_config_p)
+{
+	AdmissionController *controller_p = NULL;
+	uint32 min_concurrent = S_DEFAULT_ADMISSION_MIN_CONCURRENT;
+	uint32 max_concurrent = S_DEFAULT_ADMISSION_MAX_CONCURRENT;
+	uint32 max_queue = S_DEFAULT_ADMISSION_QUEUE;
+	uint32 queue_timeout = S_DEFAULT_ADMISSION_QUEUE_TIMEOUT;
+	uint32 target_latency = S_DEFAULT_ADMISSION_TARGET_LATENCY;
+	uint32 default_weight = S_DEFAULT_ADMISSION_USER_WEIGHT;
+	uint32 max_concurrent_per_user = S_DEFAULT_ADMISSION_MAX_CONCURRENT_PER_USER;
+	uint32 max_queue_per_user = S_DEFAULT_ADMISSION_QUEUE_PER_USER;
+	bool local_only_flag = true;
+	const char *when_saturated_s = GetJSONString (admission_config_p, "when_saturated");
+	const json_t *users_p = json_object_get (admission_config_p, "users");
+
+	GetJSONUnsignedInteger (admission_config_p, "min_concurrent", &min_concurrent);
+	GetJSONUnsignedInteger (admission_config_p, "max_concurrent", &max_concurrent);
+	GetJSONUnsignedInteger (admission_config_p, "queue", &max_queue);
+	GetJSONUnsignedInteger (admission_config_p, "queue_timeout", &queue_timeout);
+	GetJSONUnsignedInteger (admission_config_p, "target_latency", &target_latency);
+	GetJSONUnsignedInteger (admission_config_p, "default_weight", &default_weight);
+	GetJSONUnsignedInteger (admission_config_p, "max_concurrent_per_user", &max_concurrent_per_user);
+	GetJSONUnsignedInteger (admission_config_p, "queue_per_user", &max_queue_per_user);
+
+	if ((users_p) && (!json_is_object (users_p)))
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, users_p, "\"users\" should be an object keyed by user, ignoring it");
+			users_p = NULL;
+		}
+
+	if (when_saturated_s)
+		{
+			if (strcmp (when_saturated_s, "reject") == 0)
+				{
+					local_only_flag = false;
+				}
+			else if (strcmp (when_saturated_s, "local_only") != 0)
+				{
+					PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, admission_config_p, "Unknown \"when_saturated\" value \"%s\", using \"local_only\"", when_saturated_s);
+				}
+		}
+
+	/* Without it, every search is run straight away */
+	controller_p = AllocateAdmissionController (min_concurrent, max_concurrent, max_queue, queue_timeout, target_latency, local_only_flag, default_weight, max_concurrent_per_user, max_queue_per_user, users_p);
+
+	if (!controller_p)
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, admission_config_p, "Failed to create the admission controller");
+		}
+
+	return controller_p;
+}
+
+
+static HedgePolicy *GetHedgePolicy (const json_t *hedge_config_p)
+{
+	HedgePolicy *policy_p = NULL;
+	uint32 percentile = S_DEFAULT_HEDGE_PERCENTILE;
+	uint32 max_percent = S_DEFAULT_HEDGE_MAX_PERCENT;
+	uint32 min_delay = S_DEFAULT_HEDGE_MIN_DELAY;
+
+	GetJSONUnsignedInteger (hedge_config_p, "percentile", &percentile);
+	GetJSONUnsignedInteger (hedge_config_p, "max_percent", &max_percent);
+	GetJSONUnsignedInteger (hedge_config_p, "min_delay", &min_delay);
+
+	/* Without it, a single request is sent each time */
+	policy_p = AllocateHedgePolicy (percentile, max_percent, min_delay);
+
+	if (!policy_p)
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, hedge_config_p, "Failed to create the hedging policy");
+		}
+
+	return policy_p;
+}
+
+
+static bool StartConfigWatcher (SearchServiceData *data_p, const json_t *reload_p)
+{
+	const char *filename_s = GetJSONString (reload_p, "file");
+
+	if (filename_s)
+		{
+			data_p -> ssd_reload_filename_s = filename_s;
+
+			if (! ((GetJSONUnsignedInteger (reload_p, "interval", & (data_p -> ssd_reload_interval))) && (data_p -> ssd_reload_interval > 0)))
+				{
+					data_p -> ssd_reload_interval = S_DEFAULT_RELOAD_INTERVAL;
+				}
+
+			/*
+			 * The initial configuration came from this file, so only
+			 * changes made after now need reloading.
+			 */
+			if (!GetConfigFileModificationTime (filename_s, & (data_p -> ssd_reload_mtime)))
+				{
+					data_p -> ssd_reload_mtime = 0;
+				}
+
+			if (pthread_mutex_init (& (data_p -> ssd_reload_lock), NULL) == 0)
+				{
+					if (pthread_cond_init (& (data_p -> ssd_reload_cond), NULL) == 0)
+						{
+							data_p -> ssd_reload_stop_flag = false;
+
+							if (pthread_create (& (data_p -> ssd_reload_thread), NULL, RunConfigWatcher, data_p) == 0)
+								{
+									data_p -> ssd_reload_thread_flag = true;
+									return true;
+								}
+
+							pthread_cond_destroy (& (data_p -> ssd_reload_cond));
+						}
+
+					pthread_mutex_destroy (& (data_p -> ssd_reload_lock));
+				}
+		}
+	else
+		{
+			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, reload_p, "No \"file\" to watch");
+		}
+
+	data_p -> ssd_reload_filename_s = NULL;
+
+	return false;
+}
+
+
+static void StopConfigWatcher (SearchServiceData *data_p)
+{
+	if (data_p -> ssd_reload_thread_flag)
+		{
+			pthread_mutex_lock (& (data_p -> ssd_reload_lock));
+			data_p -> ssd_reload_stop_flag = true;
+			pthread_cond_signal (& (data_p -> ssd_reload_cond));
+			pthread_mutex_unlock (& (data_p -> ssd_reload_lock));
+
+			pthread_join (data_p -> ssd_reload_thread, NULL);
+
+			pthread_cond_destroy (& (data_p -> ssd_reload_cond));
+			pthread_mutex_destroy (& (data_p -> ssd_reload_lock));
+
+			data_p -> ssd_reload_thread_flag = false;
+		}
+}
+
+
+/*
+ * Wait on the condition rather than sleeping so that stopping
+ * the service doesn't have to wait for the interval to finish.
+ */
+static void *RunConfigWatcher (void *data_p)
+{
+	SearchServiceData *service_data_p = (SearchServiceData *) data_p;
+
+	pthread_mutex_lock (& (service_data_p -> ssd_reload_lock));
+
+	while (!service_data_p -> ssd_reload_stop_flag)
+		{
+			struct timespec wake_time;
+
+			clock_gettime (CLOCK_REALTIME, &wake_time);
+			wake_time.tv_sec += service_data_p -> ssd_reload_interval;
+
+			if (pthread_cond_timedwait (& (service_data_p -> ssd_reload_cond), & (service_data_p -> ssd_reload_lock), &wake_time) == ETIMEDOUT)
+				{
+					if (!service_data_p -> ssd_reload_stop_flag)
+						{
+							pthread_mutex_unlock (& (service_data_p -> ssd_reload_lock));
+							ReloadSearchConfig (service_data_p);
+							pthread_mutex_lock (& (service_data_p -> ssd_reload_lock));
+						}
+				}
+		}
+
+	pthread_mutex_unlock (& (service_data_p -> ssd_reload_lock));
+
+	return NULL;
+}
+
+
+static bool GetConfigFileModificationTime (const char *filename_s, time_t *mtime_p)
+{
+	struct stat info;
+
+	if (stat (filename_s, &info) == 0)
+		{
+			*mtime_p = info.st_mtime;
+			return true;
+		}
+
+	return false;
+}
+
+
+static void ReloadSearchConfig (SearchServiceData *data_p)
+{
+	time_t mtime;
+
+	if (GetConfigFileModificationTime (data_p -> ssd_reload_filename_s, &mtime))
+		{
+			if (mtime != data_p -> ssd_reload_mtime)
+				{
+					json_error_t err;
+					json_t *config_p = json_load_file (data_p -> ssd_reload_filename_s, 0, &err);
+
+					/*
+					 * Whatever happens, don't keep trying to load the
+					 * same version of the file.
+					 */
+					data_p -> ssd_reload_mtime = mtime;
+
+					if (config_p)
+						{
+							/* Only this thread changes the snapshot, so it can be read without the lock */
+							SearchConfig *search_config_p = AllocateSearchConfig (config_p, data_p -> ssd_config_p, data_p -> ssd_conversion_pool_p, data_p -> ssd_external_cache_p, data_p -> ssd_hedge_p);
+
+							if (search_config_p)
+								{
+									PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Reloaded search configuration from \"%s\", ckan generation " UINT32_FMT " zenodo generation " UINT32_FMT,
+														data_p -> ssd_reload_filename_s, search_config_p -> sc_ckan_generation, search_config_p -> sc_zenodo_generation);
+
+									SetSearchConfig (data_p, search_config_p);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create search configuration from \"%s\", keeping the current one", data_p -> ssd_reload_filename_s);
+								}
+
+							json_decref (config_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to load \"%s\", keeping the current configuration: %s at line %d, column %d",
+													 data_p -> ssd_reload_filename_s, err.text, err.line, err.column);
+						}
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to check configuration file \"%s\"", data_p -> ssd_reload_filename_s);
+		}
+}
+
+
+/*
+ * Searches that already hold the old snapshot carry on using it and
+ * it is freed when the last of them releases it.
+ */
+static void SetSearchConfig (SearchServiceData *data_p, SearchConfig *config_p)
+{
+	SearchConfig *old_config_p = NULL;
+
+	pthread_mutex_lock (& (data_p -> ssd_config_lock));
+	old_config_p = data_p -> ssd_config_p;
+	data_p -> ssd_config_p = config_p;
+	pthread_mutex_unlock (& (data_p -> ssd_config_lock));
+
+	if (old_config_p)
+		{
+			ReleaseSearchConfig (old_config_p);
+		}
+}
@@ -0,0 +1,675 @@
+/*
+ * search_trace.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "search_trace.h"
+
+#include "byte_buffer.h"
+#include "json_util.h"
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+#define S_TRACE_ID_LENGTH (32)
+
+/* Enough for a search's stages and the HTTP phases of each of its requests */
+#define S_MAX_SPANS (64)
+
+/* How many spans deep GetSearchTraceStages () keeps track of */
+#define S_MAX_DEPTH (16)
+
+
+typedef struct TraceSpan
+{
+	const char *ts_name_s;
+
+	uint64 ts_start;
+
+	/** This is 0 while the span is open. */
+	uint64 ts_end;
+
+	json_t *ts_args_p;
+} TraceSpan;
+
+
+struct SearchTrace
+{
+	/** This is <code>NULL</code> if the trace isn't written out. */
+	SearchTracer *st_tracer_p;
+
+	char st_id_s [S_TRACE_ID_LENGTH + 1];
+
+	/** Each search gets its own row in the trace viewer. */
+	uint32 st_row;
+
+	TraceSpan st_spans [S_MAX_SPANS];
+
+	uint32 st_num_spans;
+};
+
+
+/*
+ * The lock is only held while a finished trace is written out, so
+ * searches don't wait on each other while they are running.
+ */
+struct SearchTracer
+{
+	char *str_filename_s;
+
+	FILE *str_file_f;
+
+	uint64 str_size;
+	uint64 str_max_size;
+
+	uint32 str_max_files;
+
+	uint32 str_sample_percent;
+
+	uint32 str_next_row;
+
+	pid_t str_pid;
+
+	pthread_mutex_t str_lock;
+};
+
+
+static bool OpenTraceFile (SearchTracer *tracer_p);
+
+static void RotateTraceFiles (SearchTracer *tracer_p);
+
+static bool GetTraceIdFromRequest (const char *trace_id_s, char *id_s);
+
+static bool IsSampledTrace (const SearchTracer *tracer_p, const char *id_s);
+
+static bool AppendTraceSpan (ByteBuffer *buffer_p, const SearchTrace *trace_p, const TraceSpan *span_p, const pid_t pid);
+
+static TraceSpan *GetTraceSpan (SearchTrace *trace_p, const int32 span);
+
+static json_t *GetTraceSpanAsJSON (const TraceSpan *span_p, const uint64 trace_start, const uint32 depth);
+
+static uint64 GetTraceSpanEnd (const TraceSpan *span_p);
+
+
+
+SearchTracer *AllocateSearchTracer (const char *filename_s, const uint64 max_size, const uint32 max_files, const uint32 sample_percent)
+{
+	SearchTracer *tracer_p = (SearchTracer *) AllocMemory (sizeof (SearchTracer));
+
+	if (tracer_p)
+		{
+			memset (tracer_p, 0, sizeof (SearchTracer));
+
+			tracer_p -> str_max_size = max_size;
+			tracer_p -> str_max_files = max_files;
+			tracer_p -> str_sample_percent = sample_percent;
+			tracer_p -> str_pid = getpid ();
+			tracer_p -> str_filename_s = EasyCopyToNewString (filename_s);
+
+			if (tracer_p -> str_filename_s)
+				{
+					if (pthread_mutex_init (& (tracer_p -> str_lock), NULL) == 0)
+						{
+							if (OpenTraceFile (tracer_p))
+								{
+									return tracer_p;
+								}
+
+							pthread_mutex_destroy (& (tracer_p -> str_lock));
+						}
+
+					FreeCopiedString (tracer_p -> str_filename_s);
+				}
+
+			FreeMemory (tracer_p);
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up tracing to \"%s\"", filename_s);
+
+	return NULL;
+}
+
+
+void FreeSearchTracer (SearchTracer *tracer_p)
+{
+	if (tracer_p -> str_file_f)
+		{
+			fclose (tracer_p -> str_file_f);
+		}
+
+	pthread_mutex_destroy (& (tracer_p -> str_lock));
+	FreeCopiedString (tracer_p -> str_filename_s);
+	FreeMemory (tracer_p);
+}
+
+
+SearchTrace *StartSearchTrace (SearchTracer *tracer_p, const char *trace_id_s, const char *default_id_s, const bool always_flag)
+{
+	char id_s [S_TRACE_ID_LENGTH + 1];
+	bool sampled_flag = (tracer_p != NULL);
+
+	if (!GetTraceIdFromRequest (trace_id_s, id_s))
+		{
+			if (GetTraceIdFromRequest (default_id_s, id_s))
+				{
+					sampled_flag = (tracer_p != NULL) && (IsSampledTrace (tracer_p, id_s));
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid default trace id \"%s\"", default_id_s ? default_id_s : "");
+					sampled_flag = false;
+					id_s [0] = '\0';
+				}
+		}
+
+	if (sampled_flag || always_flag)
+		{
+			SearchTrace *trace_p = (SearchTrace *) AllocMemory (sizeof (SearchTrace));
+
+			if (trace_p)
+				{
+					memset (trace_p, 0, sizeof (SearchTrace));
+
+					strcpy (trace_p -> st_id_s, id_s);
+
+					if (sampled_flag)
+						{
+							trace_p -> st_tracer_p = tracer_p;
+							trace_p -> st_row = __atomic_add_fetch (& (tracer_p -> str_next_row), 1, __ATOMIC_RELAXED);
+						}
+
+					return trace_p;
+				}
+		}
+
+	return NULL;
+}
+
+
+void FinishSearchTrace (SearchTrace *trace_p)
+{
+	if (trace_p)
+		{
+			SearchTracer *tracer_p = trace_p -> st_tracer_p;
+			ByteBuffer *buffer_p = tracer_p ? AllocateByteBuffer (4096) : NULL;
+			const uint64 now = GetTraceTime ();
+			uint32 i;
+
+			if (buffer_p)
+				{
+					bool success_flag = true;
+
+					for (i = 0; (i < trace_p -> st_num_spans) && success_flag; ++ i)
+						{
+							TraceSpan *span_p = & (trace_p -> st_spans [i]);
+
+							if (span_p -> ts_end == 0)
+								{
+									span_p -> ts_end = now;
+								}
+
+							success_flag = AppendTraceSpan (buffer_p, trace_p, span_p, tracer_p -> str_pid);
+						}
+
+					if (success_flag)
+						{
+							const size_t size = GetByteBufferSize (buffer_p);
+
+							pthread_mutex_lock (& (tracer_p -> str_lock));
+
+							if ((tracer_p -> str_size + size > tracer_p -> str_max_size) && (tracer_p -> str_size > 0))
+								{
+									RotateTraceFiles (tracer_p);
+								}
+
+							if (tracer_p -> str_file_f)
+								{
+									if (fwrite (GetByteBufferData (buffer_p), 1, size, tracer_p -> str_file_f) == size)
+										{
+											fflush (tracer_p -> str_file_f);
+											tracer_p -> str_size += size;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to write trace %s to \"%s\"", trace_p -> st_id_s, tracer_p -> str_filename_s);
+										}
+								}
+
+							pthread_mutex_unlock (& (tracer_p -> str_lock));
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to serialise trace %s", trace_p -> st_id_s);
+						}
+
+					FreeByteBuffer (buffer_p);
+				}
+
+			for (i = 0; i < trace_p -> st_num_spans; ++ i)
+				{
+					if (trace_p -> st_spans [i].ts_args_p)
+						{
+							json_decref (trace_p -> st_spans [i].ts_args_p);
+						}
+				}
+
+			FreeMemory (trace_p);
+		}
+}
+
+
+const char *GetSearchTraceId (const SearchTrace *trace_p)
+{
+	return trace_p ? trace_p -> st_id_s : NULL;
+}
+
+
+uint64 GetSearchTraceDuration (const SearchTrace *trace_p)
+{
+	if ((trace_p) && (trace_p -> st_num_spans > 0))
+		{
+			const TraceSpan *span_p = trace_p -> st_spans;
+
+			return GetTraceSpanEnd (span_p) - (span_p -> ts_start);
+		}
+
+	return 0;
+}
+
+
+/*
+ * The spans of a search all run on its thread, so each one is nested
+ * inside the most recent span that was still running when it started.
+ */
+json_t *GetSearchTraceStages (const SearchTrace *trace_p)
+{
+	json_t *stages_p = json_array ();
+
+	if ((stages_p) && (trace_p) && (trace_p -> st_num_spans > 0))
+		{
+			const uint64 trace_start = trace_p -> st_spans [0].ts_start;
+			uint64 open_ends [S_MAX_DEPTH];
+			uint32 depth = 0;
+			uint32 i;
+
+			for (i = 0; i < trace_p -> st_num_spans; ++ i)
+				{
+					const TraceSpan *span_p = & (trace_p -> st_spans [i]);
+					json_t *stage_p;
+
+					while ((depth > 0) && (span_p -> ts_start >= open_ends [depth - 1]))
+						{
+							-- depth;
+						}
+
+					stage_p = GetTraceSpanAsJSON (span_p, trace_start, depth);
+
+					if ((!stage_p) || (json_array_append_new (stages_p, stage_p) != 0))
+						{
+							json_decref (stages_p);
+							return NULL;
+						}
+
+					if (depth < S_MAX_DEPTH)
+						{
+							open_ends [depth] = GetTraceSpanEnd (span_p);
+							++ depth;
+						}
+				}
+		}
+
+	return stages_p;
+}
+
+
+int32 BeginTraceSpan (SearchTrace *trace_p, const char *name_s)
+{
+	return AddTraceSpan (trace_p, name_s, GetTraceTime (), 0);
+}
+
+
+void EndTraceSpan (SearchTrace *trace_p, const int32 span)
+{
+	TraceSpan *span_p = GetTraceSpan (trace_p, span);
+
+	if (span_p)
+		{
+			span_p -> ts_end = GetTraceTime ();
+
+			/* 0 means that the span is still open */
+			if (span_p -> ts_end == 0)
+				{
+					span_p -> ts_end = 1;
+				}
+		}
+}
+
+
+int32 AddTraceSpan (SearchTrace *trace_p, const char *name_s, const uint64 start, const uint64 end)
+{
+	if (trace_p)
+		{
+			/* Any later spans are dropped rather than growing the trace without limit */
+			if (trace_p -> st_num_spans < S_MAX_SPANS)
+				{
+					TraceSpan *span_p = & (trace_p -> st_spans [trace_p -> st_num_spans]);
+
+					span_p -> ts_name_s = name_s;
+					span_p -> ts_start = start;
+					span_p -> ts_end = end;
+					span_p -> ts_args_p = NULL;
+
+					return (int32) ((trace_p -> st_num_spans) ++);
+				}
+		}
+
+	return ST_NO_SPAN;
+}
+
+
+void SetTraceSpanString (SearchTrace *trace_p, const int32 span, const char *key_s, const char *value_s)
+{
+	TraceSpan *span_p = GetTraceSpan (trace_p, span);
+
+	if ((span_p) && (value_s))
+		{
+			if (! (span_p -> ts_args_p))
+				{
+					span_p -> ts_args_p = json_object ();
+				}
+
+			if (span_p -> ts_args_p)
+				{
+					SetJSONString (span_p -> ts_args_p, key_s, value_s);
+				}
+		}
+}
+
+
+void SetTraceSpanInteger (SearchTrace *trace_p, const int32 span, const char *key_s, const int64 value)
+{
+	TraceSpan *span_p = GetTraceSpan (trace_p, span);
+
+	if (span_p)
+		{
+			if (! (span_p -> ts_args_p))
+				{
+					span_p -> ts_args_p = json_object ();
+				}
+
+			if (span_p -> ts_args_p)
+				{
+					json_object_set_new (span_p -> ts_args_p, key_s, json_integer (value));
+				}
+		}
+}
+
+
+uint64 GetTraceTime (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (((uint64) now.tv_sec) * 1000000) + (now.tv_nsec / 1000);
+}
+
+
+/*
+ * The file is in the JSON array format, which the trace viewers can
+ * read without the closing bracket, so each trace can just be appended.
+ */
+static bool OpenTraceFile (SearchTracer *tracer_p)
+{
+	tracer_p -> str_file_f = fopen (tracer_p -> str_filename_s, "a");
+
+	if (tracer_p -> str_file_f)
+		{
+			long size;
+
+			fseek (tracer_p -> str_file_f, 0, SEEK_END);
+			size = ftell (tracer_p -> str_file_f);
+
+			tracer_p -> str_size = (size > 0) ? (uint64) size : 0;
+
+			if (tracer_p -> str_size == 0)
+				{
+					if (fputs ("[\n", tracer_p -> str_file_f) >= 0)
+						{
+							tracer_p -> str_size = 2;
+						}
+				}
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open trace file \"%s\"", tracer_p -> str_filename_s);
+
+	return false;
+}
+
+
+/*
+ * This must be called with the tracer's lock held. The files are
+ * shifted along so that file.1 is always the most recent of them.
+ */
+static void RotateTraceFiles (SearchTracer *tracer_p)
+{
+	uint32 i;
+
+	fclose (tracer_p -> str_file_f);
+	tracer_p -> str_file_f = NULL;
+
+	for (i = tracer_p -> str_max_files; i > 0; -- i)
+		{
+			char old_suffix_s [16];
+			char new_suffix_s [16];
+			char *old_filename_s;
+			char *new_filename_s;
+
+			snprintf (old_suffix_s, sizeof (old_suffix_s), "." UINT32_FMT, i - 1);
+			snprintf (new_suffix_s, sizeof (new_suffix_s), "." UINT32_FMT, i);
+
+			old_filename_s = (i > 1) ? ConcatenateVarargsStrings (tracer_p -> str_filename_s, old_suffix_s, NULL) : EasyCopyToNewString (tracer_p -> str_filename_s);
+			new_filename_s = ConcatenateVarargsStrings (tracer_p -> str_filename_s, new_suffix_s, NULL);
+
+			if ((old_filename_s) && (new_filename_s))
+				{
+					/* The oldest file is just replaced */
+					rename (old_filename_s, new_filename_s);
+				}
+
+			if (old_filename_s)
+				{
+					FreeCopiedString (old_filename_s);
+				}
+
+			if (new_filename_s)
+				{
+					FreeCopiedString (new_filename_s);
+				}
+		}
+
+	if (tracer_p -> str_max_files == 0)
+		{
+			remove (tracer_p -> str_filename_s);
+		}
+
+	OpenTraceFile (tracer_p);
+}
+
+
+/*
+ * Accept either the bare trace id or a W3C traceparent such as
+ * 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01. A job's
+ * uuid is also accepted since it is 32 digits once the dashes go.
+ */
+static bool GetTraceIdFromRequest (const char *trace_id_s, char *id_s)
+{
+	if (trace_id_s)
+		{
+			const char *c_p = trace_id_s;
+			uint32 length = 0;
+			bool all_zeroes_flag = true;
+
+			/* Skip the version of a traceparent */
+			if ((strlen (trace_id_s) == 55) && (trace_id_s [2] == '-'))
+				{
+					c_p += 3;
+				}
+
+			while ((*c_p) && (length < S_TRACE_ID_LENGTH))
+				{
+					if (isxdigit ((unsigned char) *c_p))
+						{
+							id_s [length] = (char) tolower ((unsigned char) *c_p);
+
+							if (*c_p != '0')
+								{
+									all_zeroes_flag = false;
+								}
+
+							++ length;
+						}
+					else if (*c_p != '-')
+						{
+							return false;
+						}
+
+					++ c_p;
+				}
+
+			id_s [length] = '\0';
+
+			return ((length == S_TRACE_ID_LENGTH) && (!all_zeroes_flag));
+		}
+
+	return false;
+}
+
+
+/*
+ * Sample on the id rather than at random so that a trace id is either
+ * always traced or never.
+ */
+static bool IsSampledTrace (const SearchTracer *tracer_p, const char *id_s)
+{
+	if (tracer_p -> str_sample_percent < 100)
+		{
+			uint32 hash = 2166136261u;
+			const unsigned char *c_p = (const unsigned char *) id_s;
+
+			while (*c_p)
+				{
+					hash ^= *c_p;
+					hash *= 16777619u;
+					++ c_p;
+				}
+
+			return ((hash % 100) < tracer_p -> str_sample_percent);
+		}
+
+	return true;
+}
+
+
+static bool AppendTraceSpan (ByteBuffer *buffer_p, const SearchTrace *trace_p, const TraceSpan *span_p, const pid_t pid)
+{
+	bool success_flag = false;
+	json_t *event_p = json_pack ("{s:s,s:s,s:s,s:I,s:I,s:i,s:i}",
+															 "name", span_p -> ts_name_s,
+															 "cat", "search",
+															 "ph", "X",
+															 "ts", (json_int_t) (span_p -> ts_start),
+															 "dur", (json_int_t) ((span_p -> ts_end > span_p -> ts_start) ? (span_p -> ts_end - span_p -> ts_start) : 0),
+															 "pid", (int) pid,
+															 "tid", (int) (trace_p -> st_row));
+
+	if (event_p)
+		{
+			char *event_s = NULL;
+
+			/* The first span is the root, so it is the one to find the trace by */
+			if (span_p == trace_p -> st_spans)
+				{
+					json_t *args_p = span_p -> ts_args_p ? json_copy (span_p -> ts_args_p) : json_object ();
+
+					if (args_p)
+						{
+							SetJSONString (args_p, ST_TRACE_ID_S, trace_p -> st_id_s);
+							json_object_set_new (event_p, "args", args_p);
+						}
+				}
+			else if (span_p -> ts_args_p)
+				{
+					json_object_set (event_p, "args", span_p -> ts_args_p);
+				}
+
+			event_s = json_dumps (event_p, JSON_COMPACT);
+
+			if (event_s)
+				{
+					success_flag = AppendStringsToByteBuffer (buffer_p, event_s, ",\n", NULL);
+					free (event_s);
+				}
+
+			json_decref (event_p);
+		}
+
+	return success_flag;
+}
+
+
+static json_t *GetTraceSpanAsJSON (const TraceSpan *span_p, const uint64 trace_start, const uint32 depth)
+{
+	json_t *stage_p = span_p -> ts_args_p ? json_copy (span_p -> ts_args_p) : json_object ();
+
+	if (stage_p)
+		{
+			if ((SetJSONString (stage_p, "name", span_p -> ts_name_s))
+					&& (json_object_set_new (stage_p, "depth", json_integer (depth)) == 0)
+					&& (json_object_set_new (stage_p, "start", json_real (((double) (span_p -> ts_start - trace_start)) / 1000.0)) == 0)
+					&& (json_object_set_new (stage_p, "ms", json_real (((double) (GetTraceSpanEnd (span_p) - span_p -> ts_start)) / 1000.0)) == 0))
+				{
+					return stage_p;
+				}
+
+			json_decref (stage_p);
+		}
+
+	return NULL;
+}
+
+
+/* A span that is still open is treated as running until now */
+static uint64 GetTraceSpanEnd (const TraceSpan *span_p)
+{
+	if (span_p -> ts_end == 0)
+		{
+			return GetTraceTime ();
+		}
+
+	return (span_p -> ts_end > span_p -> ts_start) ? span_p -> ts_end : span_p -> ts_start;
+}
+
+
+static TraceSpan *GetTraceSpan (SearchTrace *trace_p, const int32 span)
+{
+	if ((trace_p) && (span >= 0) && (((uint32) span) < trace_p -> st_num_spans))
+		{
+			return & (trace_p -> st_spans [span]);
+		}
+
+	return NULL;
+}
@@ -0,0 +1,123 @@
+/*
+ * search_warm_up.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+
+#include "search_warm_up.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "json_util.h"
+
+
+struct SearchWarmUp
+{
+	QueryLog *swu_log_p;
+
+	uint32 swu_num_queries;
+
+	WarmUpQueryFn swu_warm_up_fn;
+
+	void *swu_data_p;
+
+	pthread_t swu_thread;
+
+	/** Set to <code>true</code> to stop before the next query. */
+	bool swu_stop_flag;
+
+	/** Set to <code>true</code> once every query has been run. */
+	bool swu_done_flag;
+};
+
+
+static void *RunSearchWarmUp (void *data_p);
+
+
+
+SearchWarmUp *StartSearchWarmUp (QueryLog *log_p, const uint32 num_queries, WarmUpQueryFn warm_up_fn, void *data_p)
+{
+	SearchWarmUp *warm_up_p = (SearchWarmUp *) AllocMemory (sizeof (SearchWarmUp));
+
+	if (warm_up_p)
+		{
+			warm_up_p -> swu_log_p = log_p;
+			warm_up_p -> swu_num_queries = num_queries;
+			warm_up_p -> swu_warm_up_fn = warm_up_fn;
+			warm_up_p -> swu_data_p = data_p;
+			warm_up_p -> swu_stop_flag = false;
+			warm_up_p -> swu_done_flag = false;
+
+			if (pthread_create (& (warm_up_p -> swu_thread), NULL, RunSearchWarmUp, warm_up_p) == 0)
+				{
+					return warm_up_p;
+				}
+
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start the search warm up thread");
+			FreeMemory (warm_up_p);
+		}
+
+	return NULL;
+}
+
+
+bool StopSearchWarmUp (SearchWarmUp *warm_up_p)
+{
+	bool done_flag;
+
+	__atomic_store_n (& (warm_up_p -> swu_stop_flag), true, __ATOMIC_RELEASE);
+
+	pthread_join (warm_up_p -> swu_thread, NULL);
+
+	done_flag = warm_up_p -> swu_done_flag;
+	FreeMemory (warm_up_p);
+
+	return done_flag;
+}
+
+
+/*
+ * The queries are run one at a time so that warming up doesn't
+ * compete too much with the real searches that arrive meanwhile.
+ */
+static void *RunSearchWarmUp (void *data_p)
+{
+	SearchWarmUp *warm_up_p = (SearchWarmUp *) data_p;
+	json_t *queries_p = GetTopQueries (warm_up_p -> swu_log_p, warm_up_p -> swu_num_queries);
+
+	if (queries_p)
+		{
+			const size_t num_queries = json_array_size (queries_p);
+			size_t i;
+
+			PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Warming up the search caches with " SIZET_FMT " queries", num_queries);
+
+			for (i = 0; (i < num_queries) && (!__atomic_load_n (& (warm_up_p -> swu_stop_flag), __ATOMIC_ACQUIRE)); ++ i)
+				{
+					const json_t *entry_p = json_array_get (queries_p, i);
+					const char *query_s = GetJSONString (entry_p, QL_QUERY_S);
+
+					if (query_s)
+						{
+							warm_up_p -> swu_warm_up_fn (query_s, GetJSONString (entry_p, QL_FACET_S), warm_up_p -> swu_data_p);
+						}
+				}
+
+			if (i == num_queries)
+				{
+					warm_up_p -> swu_done_flag = true;
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Finished warming up the search caches");
+				}
+
+			json_decref (queries_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get the queries to warm up the search caches with");
+		}
+
+	return NULL;
+}
@@ -0,0 +1,363 @@
+/*
+ * slow_query_log.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "slow_query_log.h"
+
+#include "lucene_tool.h"
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+struct SlowQueryLog
+{
+	char *sql_filename_s;
+
+	FILE *sql_out_f;
+
+	/** In microseconds to match the trace. */
+	uint64 sql_threshold;
+
+	pthread_mutex_t sql_lock;
+};
+
+
+static json_t *GetSlowQueryEntry (const SearchTrace *trace_p, const uint64 duration, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const bool cursor_flag, const ServiceJob *job_p);
+
+static json_t *GetSourceSummaries (const json_t *stages_p, json_int_t *total_bytes_p);
+
+static const char *GetSourceForStage (const char *name_s);
+
+static char *GetNormalisedQuery (const char *query_s);
+
+
+
+SlowQueryLog *AllocateSlowQueryLog (const char *filename_s, const uint32 threshold)
+{
+	SlowQueryLog *log_p = (SlowQueryLog *) AllocMemory (sizeof (SlowQueryLog));
+
+	if (log_p)
+		{
+			log_p -> sql_threshold = ((uint64) threshold) * 1000;
+			log_p -> sql_filename_s = EasyCopyToNewString (filename_s);
+
+			if (log_p -> sql_filename_s)
+				{
+					log_p -> sql_out_f = fopen (filename_s, "a");
+
+					if (log_p -> sql_out_f)
+						{
+							if (pthread_mutex_init (& (log_p -> sql_lock), NULL) == 0)
+								{
+									return log_p;
+								}
+
+							fclose (log_p -> sql_out_f);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open slow query log \"%s\"", filename_s);
+						}
+
+					FreeCopiedString (log_p -> sql_filename_s);
+				}
+
+			FreeMemory (log_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeSlowQueryLog (SlowQueryLog *log_p)
+{
+	fclose (log_p -> sql_out_f);
+	pthread_mutex_destroy (& (log_p -> sql_lock));
+	FreeCopiedString (log_p -> sql_filename_s);
+	FreeMemory (log_p);
+}
+
+
+bool LogSlowQuery (SlowQueryLog *log_p, const SearchTrace *trace_p, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const bool cursor_flag, const ServiceJob *job_p)
+{
+	const uint64 duration = GetSearchTraceDuration (trace_p);
+	bool success_flag = false;
+	json_t *entry_p = NULL;
+
+	if ((!trace_p) || (duration < log_p -> sql_threshold))
+		{
+			return true;
+		}
+
+	entry_p = GetSlowQueryEntry (trace_p, duration, query_s, facet_s, page, page_size, cursor_flag, job_p);
+
+	if (entry_p)
+		{
+			char *entry_s = json_dumps (entry_p, JSON_COMPACT);
+
+			if (entry_s)
+				{
+					/* Write each line in one go so that the lines of concurrent searches can't interleave */
+					pthread_mutex_lock (& (log_p -> sql_lock));
+
+					if ((fprintf (log_p -> sql_out_f, "%s\n", entry_s) > 0) && (fflush (log_p -> sql_out_f) == 0))
+						{
+							success_flag = true;
+						}
+
+					pthread_mutex_unlock (& (log_p -> sql_lock));
+
+					free (entry_s);
+				}
+
+			json_decref (entry_p);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add slow query \"%s\" to \"%s\"", query_s ? query_s : "", log_p -> sql_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+static json_t *GetSlowQueryEntry (const SearchTrace *trace_p, const uint64 duration, const char *query_s, const char *facet_s, const uint32 page, const uint32 page_size, const bool cursor_flag, const ServiceJob *job_p)
+{
+	json_t *entry_p = NULL;
+	char *normalised_query_s = GetNormalisedQuery (query_s);
+
+	if (normalised_query_s)
+		{
+			char time_s [32];
+			struct tm now;
+			const time_t t = time (NULL);
+
+			gmtime_r (&t, &now);
+			strftime (time_s, sizeof (time_s), "%Y-%m-%dT%H:%M:%SZ", &now);
+
+			entry_p = json_pack ("{s:s,s:s,s:f,s:s,s:i,s:i,s:b,s:s,s:i}",
+													 "time", time_s,
+													 ST_TRACE_ID_S, GetSearchTraceId (trace_p),
+													 "ms", ((double) duration) / 1000.0,
+													 "query", normalised_query_s,
+													 "page", (json_int_t) page,
+													 "page_size", (json_int_t) page_size,
+													 "cursor", cursor_flag,
+													 "status", GetOperationStatusAsString (job_p -> sj_status),
+													 "results", (json_int_t) (json_is_array (job_p -> sj_result_p) ? json_array_size (job_p -> sj_result_p) : 0));
+
+			if (entry_p)
+				{
+					json_t *stages_p = GetSearchTraceStages (trace_p);
+					bool success_flag = false;
+
+					if (stages_p)
+						{
+							json_int_t total_bytes = 0;
+							json_t *sources_p = GetSourceSummaries (stages_p, &total_bytes);
+
+							if (sources_p)
+								{
+									json_int_t total_hits = 0;
+
+									if ((facet_s == NULL) || (SetJSONString (entry_p, "facet", facet_s)))
+										{
+											/* Searches that failed or were known to be empty don't have a total */
+											if ((! (job_p -> sj_metadata_p)) || (!GetJSONInteger (job_p -> sj_metadata_p, LT_NUM_TOTAL_HITS_S, &total_hits)) || (SetJSONInteger (entry_p, "total_hits", total_hits)))
+												{
+													if ((SetJSONInteger (entry_p, "bytes", total_bytes)) && (json_object_set_new (entry_p, "sources", sources_p) == 0))
+														{
+															sources_p = NULL;
+
+															if (json_object_set_new (entry_p, "stages", stages_p) == 0)
+																{
+																	stages_p = NULL;
+																	success_flag = true;
+																}
+														}
+												}
+										}
+
+									if (sources_p)
+										{
+											json_decref (sources_p);
+										}
+								}
+
+							if (stages_p)
+								{
+									json_decref (stages_p);
+								}
+						}
+
+					if (!success_flag)
+						{
+							json_decref (entry_p);
+							entry_p = NULL;
+						}
+				}
+
+			FreeMemory (normalised_query_s);
+		}
+
+	return entry_p;
+}
+
+
+/*
+ * Each source's summary is its own stage's arguments and time. The
+ * stages nested inside it add the external cache status and the bytes
+ * that were downloaded.
+ */
+static json_t *GetSourceSummaries (const json_t *stages_p, json_int_t *total_bytes_p)
+{
+	json_t *sources_p = json_object ();
+
+	if (sources_p)
+		{
+			json_t *source_p = NULL;
+			json_int_t source_depth = 0;
+			size_t i;
+			json_t *stage_p;
+
+			json_array_foreach (stages_p, i, stage_p)
+				{
+					const char *source_s = GetSourceForStage (GetJSONString (stage_p, "name"));
+					json_int_t depth = 0;
+					json_int_t bytes = 0;
+
+					GetJSONInteger (stage_p, "depth", &depth);
+
+					if ((source_p) && (depth <= source_depth))
+						{
+							source_p = NULL;
+						}
+
+					if (source_s)
+						{
+							source_p = json_copy (stage_p);
+
+							if (source_p)
+								{
+									json_object_del (source_p, "name");
+									json_object_del (source_p, "depth");
+									json_object_del (source_p, "start");
+
+									if (json_object_set_new (sources_p, source_s, source_p) == 0)
+										{
+											source_depth = depth;
+										}
+									else
+										{
+											source_p = NULL;
+										}
+								}
+						}
+					else if (source_p)
+						{
+							const char *cache_s = GetJSONString (stage_p, "cache");
+
+							if ((cache_s) && (!json_object_get (source_p, "cache")))
+								{
+									SetJSONString (source_p, "cache", cache_s);
+								}
+						}
+
+					/* Only the HTTP stages have the bytes that were downloaded */
+					if (GetJSONInteger (stage_p, "bytes", &bytes))
+						{
+							*total_bytes_p += bytes;
+
+							if (source_p)
+								{
+									json_int_t source_bytes = 0;
+
+									GetJSONInteger (source_p, "bytes", &source_bytes);
+									SetJSONInteger (source_p, "bytes", source_bytes + bytes);
+								}
+						}
+				}
+		}
+
+	return sources_p;
+}
+
+
+static const char *GetSourceForStage (const char *name_s)
+{
+	if (name_s)
+		{
+			if (strcmp (name_s, "SearchLucene") == 0)
+				{
+					return "lucene";
+				}
+			else if (strcmp (name_s, "SearchCKAN") == 0)
+				{
+					return "ckan";
+				}
+			else if (strcmp (name_s, "SearchZenodo") == 0)
+				{
+					return "zenodo";
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Collapse the white space in the query so that the same search always
+ * looks the same in the log. Case is kept since the query parser treats
+ * AND, OR and NOT differently to and, or and not.
+ */
+static char *GetNormalisedQuery (const char *query_s)
+{
+	const char *safe_query_s = query_s ? query_s : "";
+	char *normalised_s = (char *) AllocMemory (strlen (safe_query_s) + 1);
+
+	if (normalised_s)
+		{
+			const unsigned char *c_p = (const unsigned char *) safe_query_s;
+			char *dest_p = normalised_s;
+			bool space_flag = false;
+
+			while (*c_p)
+				{
+					if (isspace (*c_p))
+						{
+							space_flag = (dest_p != normalised_s);
+						}
+					else
+						{
+							if (space_flag)
+								{
+									*dest_p = ' ';
+									++ dest_p;
+									space_flag = false;
+								}
+
+							*dest_p = (char) *c_p;
+							++ dest_p;
+						}
+
+					++ c_p;
+				}
+
+			*dest_p = '\0';
+		}
+
+	return normalised_s;
+}
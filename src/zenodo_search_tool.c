@@ -6,19 +6,25 @@
  */
 
 
+#include <stdio.h>
+
 #include "zenodo_search_tool.h"
+#include "author_parser.h"
+#include "hit_converter.h"
+#include "external_result_cache.h"
 
 #include "curl_tools.h"
 #include "streams.h"
 #include "byte_buffer.h"
 #include "string_utils.h"
 #include "key_value_pair.h"
-#include "lucene_tool.h"
 
 
-static json_t *GetResult (const json_t *zenodo_result_p, LuceneTool *lucene_p, const SearchServiceData *data_p);
+static json_t *GetResult (const json_t *zenodo_result_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
+
+static json_t *ParseZenodoResults (const json_t *zenodo_results_p, const uint32 num_skipped, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p);
 
-static json_t *ParseZenodoResults (const json_t *zenodo_results_p, LuceneTool *lucene_p, const SearchServiceData *data_p);
+static json_t *DropLeadingHits (const json_t *hits_p, const uint32 num_skipped);
 
 
 /*
@@ -26,7 +32,7 @@ static json_t *ParseZenodoResults (const json_t *zenodo_results_p, LuceneTool *l
  */
 
 
-json_t *SearchZenodo (const char *query_s, LuceneTool *lucene_p, const SearchServiceData *data_p)
+json_t *SearchZenodo (const char *query_s, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p, SearchTrace *trace_p)
 {
 	json_t *grassroots_results_p = NULL;
 	CurlTool *curl_p = AllocateMemoryCurlTool (0);
@@ -41,13 +47,29 @@ json_t *SearchZenodo (const char *query_s, LuceneTool *lucene_p, const SearchSer
 
 					if (escaped_query_s)
 						{
-							if (AppendStringsToByteBuffer (buffer_p, data_p -> ssd_zenodo_url_s, "/api/records?access_token=", data_p -> ssd_zenodo_api_token_s, "&q=", escaped_query_s, NULL))
+							if (AppendStringsToByteBuffer (buffer_p, config_p -> sc_zenodo_url_s, "/api/records?access_token=", config_p -> sc_zenodo_api_token_s, "&q=", escaped_query_s, NULL))
 								{
 									bool success_flag = true;
+									char range_s [64];
+
+									/*
+									 * Zenodo pages start at 1. A cursor from before the external
+									 * page size was changed can start partway through a page, in
+									 * which case the hits before it are dropped.
+									 */
+									const uint32 num_skipped = page_p -> sp_from % page_p -> sp_size;
+
+									snprintf (range_s, sizeof (range_s), "&page=" UINT32_FMT "&size=" UINT32_FMT, (page_p -> sp_from / page_p -> sp_size) + 1, page_p -> sp_size);
+
+									if (!AppendStringsToByteBuffer (buffer_p, range_s, NULL))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\" to byte buffer", range_s);
+											success_flag = false;
+										}
 
-									if (data_p -> ssd_zenodo_community_s)
+									if (config_p -> sc_zenodo_community_s)
 										{
-											if (! (AppendStringsToByteBuffer (buffer_p, "&communities=", data_p -> ssd_zenodo_community_s, NULL)))
+											if (! (AppendStringsToByteBuffer (buffer_p, "&communities=", config_p -> sc_zenodo_community_s, NULL)))
 												{
 													success_flag = false;
 												}
@@ -60,46 +82,17 @@ json_t *SearchZenodo (const char *query_s, LuceneTool *lucene_p, const SearchSer
 									if (success_flag)
 										{
 											const char *url_s = GetByteBufferData (buffer_p);
+											json_t *zenodo_results_p = GetExternalResults (config_p -> sc_external_cache_p, config_p -> sc_hedge_p, url_s, trace_p);
 
-											if (SetUriForCurlTool (curl_p, url_s))
+											if (zenodo_results_p)
 												{
-													CURLcode res = RunCurlTool (curl_p);
+													const int32 span = BeginTraceSpan (trace_p, "ParseZenodoResults");
 
-													if (res == CURLE_OK)
-														{
-															const char *result_s = GetCurlToolData (curl_p);
-
-															if (result_s)
-																{
-																	json_error_t err;
-																	json_t *zenodo_results_p = json_loads (result_s, 0, &err);
+													grassroots_results_p = ParseZenodoResults (zenodo_results_p, num_skipped, page_p, facets_p, projection_p, config_p);
 
-																	if (zenodo_results_p)
-																		{
-																			grassroots_results_p = ParseZenodoResults (zenodo_results_p, lucene_p, data_p);
-																			json_decref (zenodo_results_p);
-																		}
-																	else
-																		{
-																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "json_loads () failed for url \"%s\" with error at %d,%d\n\"%s\"\n", url_s, err.line, err.column, err.text, result_s);
-																		}
-
-																}		/* if (result_s) */
-															else
-																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetCurlToolData () failed for \"%s\"", url_s);
-																}
-
-														}		/* if (res == CURLE_OK) */
-													else
-														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "RunCurlTool () Failed for \"%s\" with error code %d", url_s, res);
-														}
-
-												}		/* if (SetUriForCurlTool (curl_p, url_s)) */
-											else
-												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\", \"/api/3/action/package_search?q=\" and \"%s\"", data_p -> ssd_zenodo_url_s, query_s);
+													SetTraceSpanInteger (trace_p, span, "hits", page_p -> sp_num_hits);
+													EndTraceSpan (trace_p, span);
+													json_decref (zenodo_results_p);
 												}
 
 										}		/* if (success_flag) */
@@ -108,7 +101,7 @@ json_t *SearchZenodo (const char *query_s, LuceneTool *lucene_p, const SearchSer
 								}		/* if (AppendStringsToByteBuffer (buffer_p, zenodo_search_url_s, "?q=", query_s, NULL)) */
 							else
 								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\", \"/api/3/action/package_search?q=\" and \"%s\"", data_p -> ssd_zenodo_url_s, query_s);
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to append \"%s\", \"/api/3/action/package_search?q=\" and \"%s\"", config_p -> sc_zenodo_url_s, query_s);
 								}
 
 						}		/* if (escaped_query_s) */
@@ -136,7 +129,12 @@ json_t *SearchZenodo (const char *query_s, LuceneTool *lucene_p, const SearchSer
 }
 
 
-static json_t *ParseZenodoResults (const json_t *zenodo_results_p, LuceneTool *lucene_p, const SearchServiceData *data_p)
+/*
+ * If the first hits on the page are skipped, the page is made smaller by
+ * the same amount so that it only counts as the last one if Zenodo's page
+ * was short, and the next page starts at the start of one of Zenodo's.
+ */
+static json_t *ParseZenodoResults (const json_t *zenodo_results_p, const uint32 num_skipped, SourcePage *page_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
 {
 	const json_t *zenodo_first_hits_data_p = json_object_get (zenodo_results_p, "hits");
 
@@ -152,40 +150,29 @@ static json_t *ParseZenodoResults (const json_t *zenodo_results_p, LuceneTool *l
 
 					if (json_is_array (hits_p))
 						{
-							json_t *grassroots_results_p = json_array ();
+							if (num_skipped == 0)
+								{
+									page_p -> sp_num_hits = (uint32) json_array_size (hits_p);
 
-							if (grassroots_results_p)
+									return ConvertHits (hits_p, GetResult, facets_p, projection_p, config_p);
+								}
+							else
 								{
-									size_t i;
-									const json_t *zenodo_hit_p;
+									json_t *page_hits_p = DropLeadingHits (hits_p, num_skipped);
 
-									json_array_foreach (hits_p, i, zenodo_hit_p)
+									if (page_hits_p)
 										{
-											json_t *grassroots_result_p = GetResult (zenodo_hit_p, lucene_p, data_p);
+											json_t *results_p = NULL;
 
-											if (grassroots_result_p)
-												{
-													if (json_array_append_new (grassroots_results_p, grassroots_result_p) != 0)
-														{
-															PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, grassroots_result_p, "Failed to add grassroots result");
-															json_decref (grassroots_result_p);
-														}
-												}
-											else
-												{
-													PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, zenodo_hit_p, "Failed to create grassroots result");
-												}
-										}
+											page_p -> sp_size -= num_skipped;
+											page_p -> sp_num_hits = (uint32) json_array_size (page_hits_p);
 
-									return grassroots_results_p;
+											results_p = ConvertHits (page_hits_p, GetResult, facets_p, projection_p, config_p);
+											json_decref (page_hits_p);
 
+											return results_p;
+										}
 								}
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create grassroots results array");
-								}
-
-
 						}
 					else
 						{
@@ -210,16 +197,45 @@ static json_t *ParseZenodoResults (const json_t *zenodo_results_p, LuceneTool *l
 }
 
 
+static json_t *DropLeadingHits (const json_t *hits_p, const uint32 num_skipped)
+{
+	json_t *page_hits_p = json_array ();
+
+	if (page_hits_p)
+		{
+			const size_t num_hits = json_array_size (hits_p);
+			size_t i;
+
+			for (i = num_skipped; i < num_hits; ++ i)
+				{
+					if (json_array_append (page_hits_p, json_array_get (hits_p, i)) != 0)
+						{
+							json_decref (page_hits_p);
+							page_hits_p = NULL;
+							break;
+						}
+				}
+		}
+
+	if (!page_hits_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get the Zenodo hits after the first " UINT32_FMT, num_skipped);
+		}
+
+	return page_hits_p;
+}
+
+
 
 
-static json_t *GetResult (const json_t *zenodo_result_p, LuceneTool *lucene_p, const SearchServiceData *data_p)
+static json_t *GetResult (const json_t *zenodo_result_p, FacetAccumulator *facets_p, const ResultProjection *projection_p, const SearchConfig *config_p)
 {
 	json_t *grassroots_result_p = NULL;
 	const char *doi_url_s = GetJSONString (zenodo_result_p, "doi");
 
 	if (doi_url_s)
 		{
-			char *url_s = ConcatenateVarargsStrings (data_p -> ssd_zenodo_url_s, doi_url_s, NULL);
+			char *url_s = ConcatenateVarargsStrings (config_p -> sc_zenodo_url_s, doi_url_s, NULL);
 
 			if (url_s)
 				{
@@ -242,7 +258,7 @@ static json_t *GetResult (const json_t *zenodo_result_p, LuceneTool *lucene_p, c
 											const char *datatype_description_s = NULL;
 											const char *image_s = NULL;
 
-											if (description_s)
+											if ((description_s) && (IsFieldInResultProjection (projection_p, INDEXING_DESCRIPTION_S)))
 												{
 													if (!SetJSONString (grassroots_result_p, INDEXING_DESCRIPTION_S, description_s))
 														{
@@ -277,9 +293,9 @@ static json_t *GetResult (const json_t *zenodo_result_p, LuceneTool *lucene_p, c
 														}
 
 
-													if (data_p -> ssd_zenodo_resource_mappings_p)
+													if (config_p -> sc_zenodo_resource_mappings_p)
 														{
-															const json_t *resource_p = json_object_get (data_p -> ssd_zenodo_resource_mappings_p, type_s);
+															const json_t *resource_p = json_object_get (config_p -> sc_zenodo_resource_mappings_p, type_s);
 
 															if (resource_p)
 																{
@@ -293,9 +309,9 @@ static json_t *GetResult (const json_t *zenodo_result_p, LuceneTool *lucene_p, c
 
 													if (datatype_description_s)
 														{
-															if (!AddFacetResultToLucene (lucene_p, datatype_description_s, 1))
+															if (!IncrementFacetAccumulator (facets_p, datatype_description_s, count))
 																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\": " UINT32_FMT " as lucene facet", type_s, count);
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\": " UINT32_FMT " facet count", type_s, count);
 																}
 														}
 													else
@@ -317,105 +333,39 @@ static json_t *GetResult (const json_t *zenodo_result_p, LuceneTool *lucene_p, c
 																		{
 																			if (SetJSONString (grassroots_result_p, INDEXING_NAME_S, title_s))
 																				{
-																					json_t *authors_p = json_object_get (metadata_p, "creators");
+																					const bool author_list_flag = IsAuthorsListInResultProjection (projection_p, config_p -> sc_author_list_flag);
 
-																					if (authors_p)
+																					if ((author_list_flag) || (IsFieldInResultProjection (projection_p, AP_AUTHOR_S)))
 																						{
-																							if (json_is_array (authors_p))
-																								{
-																									ByteBuffer *buffer_p = AllocateByteBuffer (1024);
+																							const json_t *authors_p = json_object_get (metadata_p, "creators");
 
-																									if (buffer_p)
+																							if (authors_p)
+																								{
+																									if (!AddAuthorsFromJSON (grassroots_result_p, authors_p, author_list_flag))
 																										{
-																											size_t num_authors = json_array_size (authors_p);
-																											size_t i = 0;
-																											bool loop_flag = true;
-																											bool authors_success_flag = true;
-																											bool first_entry_flag = true;
-																											const char * const AUTHORS_KEY_S = "author";
-
-																											while (loop_flag && authors_success_flag)
-																												{
-																													json_t *entry_p = json_array_get (authors_p, i);
-
-																													if (json_is_object (entry_p))
-																														{
-																															const char *name_s = GetJSONString (entry_p, "name");
-
-																															if (name_s)
-																																{
-																																	if (first_entry_flag)
-																																		{
-																																			authors_success_flag = AppendStringToByteBuffer (buffer_p, name_s);
-																																			first_entry_flag = false;
-																																		}
-																																	else
-																																		{
-																																			authors_success_flag = AppendStringsToByteBuffer (buffer_p, "; ", name_s, NULL);
-																																		}
-
-																																	if (!authors_success_flag)
-																																		{
-																																			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to append \"%s\" to authors", name_s);
-																																		}
-																																}
-																														}
-
-																													if (authors_success_flag)
-																														{
-																															++ i;
-
-																															if (i == num_authors)
-																																{
-																																	loop_flag = false;
-																																}
-																														}
-																												}		/* while (loop_flag && success_flag */
-
-																											if (authors_success_flag)
-																												{
-																													const char *authors_s = GetByteBufferData (buffer_p);
-
-																													if (SetJSONString (grassroots_result_p, AUTHORS_KEY_S, authors_s))
-																														{
-																															if (data_p -> ssd_zenodo_provider_p)
-																																{
-																																	if (json_object_set (grassroots_result_p, SERVER_PROVIDER_S, data_p -> ssd_zenodo_provider_p) != 0)
-																																		{
-																																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\" object", SERVER_PROVIDER_S);
-																																		}
-																																}
-
-																															if (image_s)
-																																{
-																																	if (!SetJSONString (grassroots_result_p, INDEXING_ICON_URI_S, image_s))
-																																		{
-																																			PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\": \"%s\"", INDEXING_ICON_URI_S, image_s);
-																																		}
-																																}
-
-																														}
-
-
-																													else
-																														{
-																															PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set authors to \"%s\"", authors_s);
-																														}
-																												}
-
-																											FreeByteBuffer (buffer_p);
+																											PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, authors_p, "Failed to set authors");
 																										}
-
-																								}		/* if (json_is_array (authors_p)) */
+																								}
 																							else
 																								{
-																									PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, authors_p, "Authors is not a JSON array");
+																									PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "No authors specified");
 																								}
+																						}
 
-																						}		/* if (authors_p) */
-																					else
+																					if ((config_p -> sc_zenodo_provider_p) && (IsFieldInResultProjection (projection_p, SERVER_PROVIDER_S)))
 																						{
-																							PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "No authors specified");
+																							if (json_object_set (grassroots_result_p, SERVER_PROVIDER_S, config_p -> sc_zenodo_provider_p) != 0)
+																								{
+																									PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\" object", SERVER_PROVIDER_S);
+																								}
+																						}
+
+																					if ((image_s) && (IsFieldInResultProjection (projection_p, INDEXING_ICON_URI_S)))
+																						{
+																							if (!SetJSONString (grassroots_result_p, INDEXING_ICON_URI_S, image_s))
+																								{
+																									PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, grassroots_result_p, "Failed to set \"%s\": \"%s\"", INDEXING_ICON_URI_S, image_s);
+																								}
 																						}
 
 
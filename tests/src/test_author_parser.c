@@ -0,0 +1,100 @@
+/*
+ * test_author_parser.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "author_parser.h"
+
+#include "test_util.h"
+
+
+static void TestPlainStringWithList (void);
+
+static void TestPlainStringWithoutList (void);
+
+static void TestEmptyStringWithList (void);
+
+static void TestArrayStringWithList (void);
+
+static bool IsStringValue (const json_t *value_p, const char *expected_s);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestPlainStringWithList);
+	RUN_TEST (TestPlainStringWithoutList);
+	RUN_TEST (TestEmptyStringWithList);
+	RUN_TEST (TestArrayStringWithList);
+
+	return TEST_RESULT ();
+}
+
+
+/*
+ * Portals that store the authors as a plain string must give the same
+ * shape of result as those that store a serialised array.
+ */
+static void TestPlainStringWithList (void)
+{
+	json_t *result_p = json_object ();
+
+	TEST_CHECK (AddAuthorsFromString (result_p, "Jane Doe and John Smith", true));
+	TEST_CHECK (IsStringValue (json_object_get (result_p, AP_AUTHOR_S), "Jane Doe and John Smith"));
+	TEST_CHECK (json_is_array (json_object_get (result_p, AP_AUTHORS_LIST_S)));
+	TEST_CHECK (json_array_size (json_object_get (result_p, AP_AUTHORS_LIST_S)) == 1);
+	TEST_CHECK (IsStringValue (json_array_get (json_object_get (result_p, AP_AUTHORS_LIST_S), 0), "Jane Doe and John Smith"));
+
+	json_decref (result_p);
+}
+
+
+static void TestPlainStringWithoutList (void)
+{
+	json_t *result_p = json_object ();
+
+	TEST_CHECK (AddAuthorsFromString (result_p, "Jane Doe", false));
+	TEST_CHECK (IsStringValue (json_object_get (result_p, AP_AUTHOR_S), "Jane Doe"));
+	TEST_CHECK (json_object_get (result_p, AP_AUTHORS_LIST_S) == NULL);
+
+	json_decref (result_p);
+}
+
+
+static void TestEmptyStringWithList (void)
+{
+	json_t *result_p = json_object ();
+
+	TEST_CHECK (AddAuthorsFromString (result_p, "", true));
+	TEST_CHECK (json_is_array (json_object_get (result_p, AP_AUTHORS_LIST_S)));
+	TEST_CHECK (json_array_size (json_object_get (result_p, AP_AUTHORS_LIST_S)) == 0);
+
+	json_decref (result_p);
+}
+
+
+static void TestArrayStringWithList (void)
+{
+	json_t *result_p = json_object ();
+	const json_t *names_p;
+
+	TEST_CHECK (AddAuthorsFromString (result_p, "[{\"name\": \"Jane Doe\"}, {\"name\": \"John \\u0053mith\"}]", true));
+	TEST_CHECK (IsStringValue (json_object_get (result_p, AP_AUTHOR_S), "Jane Doe; John Smith"));
+
+	names_p = json_object_get (result_p, AP_AUTHORS_LIST_S);
+	TEST_CHECK (json_array_size (names_p) == 2);
+	TEST_CHECK (IsStringValue (json_array_get (names_p, 0), "Jane Doe"));
+	TEST_CHECK (IsStringValue (json_array_get (names_p, 1), "John Smith"));
+
+	json_decref (result_p);
+}
+
+
+static bool IsStringValue (const json_t *value_p, const char *expected_s)
+{
+	return ((json_is_string (value_p)) && (strcmp (json_string_value (value_p), expected_s) == 0));
+}
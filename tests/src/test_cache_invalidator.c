@@ -0,0 +1,371 @@
+/*
+ * test_cache_invalidator.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache_invalidator.h"
+#include "search_cursor.h"
+
+#include "test_util.h"
+
+
+/* The listener checks its socket once a second so give it a few goes */
+#define S_MAX_WAIT_MILLIS (5000)
+
+#define S_WAIT_STEP_MILLIS (50)
+
+
+static const char * const S_QUERY_S = "wheat";
+
+static const char * const S_EMPTY_QUERY_S = "triticum nonexistens";
+
+
+static void TestInvalidatorsShareListener (void);
+
+static void TestLostSocketUsesIndexGeneration (void);
+
+static void TestSocketInUseIsKept (void);
+
+static void GetSocketPath (char *path_s, const size_t path_size, const char *test_s);
+
+static bool SendNotification (const char *path_s, const char *message_s);
+
+static int BindSocket (const char *path_s);
+
+static bool WaitForResultsGeneration (const CacheInvalidator *invalidator_p, const uint64 generation);
+
+static bool WaitUntilNotListening (const CacheInvalidator *invalidator_p);
+
+static bool DoesPathExist (const char *path_s);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestInvalidatorsShareListener);
+	RUN_TEST (TestLostSocketUsesIndexGeneration);
+	RUN_TEST (TestSocketInUseIsKept);
+
+	return TEST_RESULT ();
+}
+
+
+/*
+ * Two instances of the service on the same path should both get every
+ * change and freeing the first mustn't take the socket from the second.
+ */
+static void TestInvalidatorsShareListener (void)
+{
+	char path_s [108];
+	CacheInvalidator *first_p;
+	CacheInvalidator *second_p;
+
+	GetSocketPath (path_s, sizeof (path_s), "shared");
+
+	first_p = AllocateCacheInvalidator (path_s, NULL, NULL);
+	second_p = AllocateCacheInvalidator (path_s, NULL, NULL);
+
+	TEST_CHECK (first_p != NULL);
+	TEST_CHECK (second_p != NULL);
+
+	if (first_p && second_p)
+		{
+			TEST_CHECK (SendNotification (path_s, "{ \"change\": \"index\", \"types\": [ \"Study\" ] }"));
+
+			TEST_CHECK (WaitForResultsGeneration (first_p, 2));
+			TEST_CHECK (WaitForResultsGeneration (second_p, 2));
+			TEST_CHECK (GetNotifiedEmptyQueriesGeneration (first_p) == 2);
+			TEST_CHECK (GetNotifiedEmptyQueriesGeneration (second_p) == 2);
+
+			FreeCacheInvalidator (first_p);
+			first_p = NULL;
+
+			TEST_CHECK (DoesPathExist (path_s));
+
+			/* Deletions don't change the empty queries */
+			TEST_CHECK (SendNotification (path_s, "{ \"change\": \"delete\" }"));
+			TEST_CHECK (WaitForResultsGeneration (second_p, 3));
+			TEST_CHECK (GetNotifiedEmptyQueriesGeneration (second_p) == 2);
+			TEST_CHECK (IsCacheInvalidatorListening (second_p));
+
+			FreeCacheInvalidator (second_p);
+			second_p = NULL;
+
+			TEST_CHECK (!DoesPathExist (path_s));
+		}
+
+	if (first_p)
+		{
+			FreeCacheInvalidator (first_p);
+		}
+
+	if (second_p)
+		{
+			FreeCacheInvalidator (second_p);
+		}
+
+	unlink (path_s);
+}
+
+
+/*
+ * Once the socket is replaced, the caches must be emptied and go back to
+ * the index generation, and the new socket must be left alone. The index
+ * generations mustn't match any of the notified ones that the caches have
+ * already seen.
+ */
+static void TestLostSocketUsesIndexGeneration (void)
+{
+	char path_s [108];
+	LuceneResultCache *cache_p = AllocateLuceneResultCache (16, 1 << 20, true);
+	NegativeQueryCache *negative_cache_p = AllocateNegativeQueryCache (1 << 12, 60);
+
+	TEST_CHECK (cache_p != NULL);
+	TEST_CHECK (negative_cache_p != NULL);
+
+	GetSocketPath (path_s, sizeof (path_s), "lost");
+
+	if (cache_p && negative_cache_p)
+		{
+			CacheInvalidator *invalidator_p = AllocateCacheInvalidator (path_s, cache_p, negative_cache_p);
+
+			TEST_CHECK (invalidator_p != NULL);
+
+			if (invalidator_p)
+				{
+					json_t *results_p = json_object ();
+					json_t *cached_p;
+					uint64 notified_generation;
+					uint64 empty_generation;
+					uint64 index_generation;
+					int other_fd;
+
+					TEST_CHECK (SendNotification (path_s, "{ \"change\": \"index\" }"));
+					TEST_CHECK (SendNotification (path_s, "{ \"change\": \"update\" }"));
+					TEST_CHECK (WaitForResultsGeneration (invalidator_p, 3));
+
+					notified_generation = GetNotifiedResultsGeneration (invalidator_p);
+					empty_generation = GetNotifiedEmptyQueriesGeneration (invalidator_p);
+
+					TEST_CHECK (AddCachedLuceneResults (cache_p, S_QUERY_S, NULL, 0, 10, notified_generation, results_p));
+					AddEmptyQuery (negative_cache_p, SC_LUCENE_EXHAUSTED, S_EMPTY_QUERY_S, NULL, empty_generation);
+
+					cached_p = GetCachedLuceneResults (cache_p, S_QUERY_S, NULL, 0, 10, notified_generation);
+					TEST_CHECK (cached_p != NULL);
+
+					if (cached_p)
+						{
+							json_decref (cached_p);
+						}
+
+					TEST_CHECK (IsKnownEmptyQuery (negative_cache_p, SC_LUCENE_EXHAUSTED, S_EMPTY_QUERY_S, NULL, empty_generation));
+
+					/* Something else takes the path */
+					unlink (path_s);
+					other_fd = BindSocket (path_s);
+					TEST_CHECK (other_fd >= 0);
+
+					TEST_CHECK (WaitUntilNotListening (invalidator_p));
+
+					cached_p = GetCachedLuceneResults (cache_p, S_QUERY_S, NULL, 0, 10, notified_generation);
+					TEST_CHECK (cached_p == NULL);
+
+					if (cached_p)
+						{
+							json_decref (cached_p);
+						}
+
+					TEST_CHECK (!IsKnownEmptyQuery (negative_cache_p, SC_LUCENE_EXHAUSTED, S_EMPTY_QUERY_S, NULL, empty_generation));
+
+					/* An index generation equal to an old notified one still comes after it */
+					index_generation = GetFallbackIndexGeneration (invalidator_p, empty_generation);
+					TEST_CHECK (index_generation > notified_generation);
+					TEST_CHECK (GetFallbackIndexGeneration (invalidator_p, 0) == 0);
+					TEST_CHECK (!IsKnownEmptyQuery (negative_cache_p, SC_LUCENE_EXHAUSTED, S_EMPTY_QUERY_S, NULL, index_generation));
+
+					/* The empty queries can be cached again for the index generation */
+					AddEmptyQuery (negative_cache_p, SC_LUCENE_EXHAUSTED, S_EMPTY_QUERY_S, NULL, index_generation);
+					TEST_CHECK (IsKnownEmptyQuery (negative_cache_p, SC_LUCENE_EXHAUSTED, S_EMPTY_QUERY_S, NULL, index_generation));
+
+					/* A newer index generation now empties the cache */
+					TEST_CHECK (AddCachedLuceneResults (cache_p, S_QUERY_S, NULL, 0, 10, index_generation, results_p));
+					TEST_CHECK (AddCachedLuceneResults (cache_p, "barley", NULL, 0, 10, index_generation + 1, results_p));
+
+					cached_p = GetCachedLuceneResults (cache_p, S_QUERY_S, NULL, 0, 10, index_generation + 1);
+					TEST_CHECK (cached_p == NULL);
+
+					if (cached_p)
+						{
+							json_decref (cached_p);
+						}
+
+					FreeCacheInvalidator (invalidator_p);
+
+					TEST_CHECK (DoesPathExist (path_s));
+
+					if (other_fd >= 0)
+						{
+							close (other_fd);
+						}
+
+					json_decref (results_p);
+				}
+		}
+
+	if (cache_p)
+		{
+			FreeLuceneResultCache (cache_p);
+		}
+
+	if (negative_cache_p)
+		{
+			FreeNegativeQueryCache (negative_cache_p);
+		}
+
+	unlink (path_s);
+}
+
+
+/*
+ * A socket that another process is listening on mustn't be taken.
+ */
+static void TestSocketInUseIsKept (void)
+{
+	char path_s [108];
+	int other_fd;
+
+	GetSocketPath (path_s, sizeof (path_s), "in_use");
+
+	other_fd = BindSocket (path_s);
+	TEST_CHECK (other_fd >= 0);
+
+	if (other_fd >= 0)
+		{
+			CacheInvalidator *invalidator_p = AllocateCacheInvalidator (path_s, NULL, NULL);
+
+			TEST_CHECK (invalidator_p == NULL);
+
+			if (invalidator_p)
+				{
+					FreeCacheInvalidator (invalidator_p);
+				}
+
+			TEST_CHECK (DoesPathExist (path_s));
+			TEST_CHECK (SendNotification (path_s, "{ \"change\": \"index\" }"));
+
+			close (other_fd);
+		}
+
+	unlink (path_s);
+}
+
+
+static void GetSocketPath (char *path_s, const size_t path_size, const char *test_s)
+{
+	snprintf (path_s, path_size, "/tmp/test_cache_invalidator_%ld_%s.sock", (long) getpid (), test_s);
+	unlink (path_s);
+}
+
+
+static bool SendNotification (const char *path_s, const char *message_s)
+{
+	bool success_flag = false;
+	int fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+
+	if (fd >= 0)
+		{
+			struct sockaddr_un address;
+			const size_t length = strlen (message_s);
+
+			memset (&address, 0, sizeof (address));
+			address.sun_family = AF_UNIX;
+			strcpy (address.sun_path, path_s);
+
+			if (sendto (fd, message_s, length, 0, (struct sockaddr *) &address, sizeof (address)) == (ssize_t) length)
+				{
+					success_flag = true;
+				}
+
+			close (fd);
+		}
+
+	return success_flag;
+}
+
+
+static int BindSocket (const char *path_s)
+{
+	int fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+
+	if (fd >= 0)
+		{
+			struct sockaddr_un address;
+
+			memset (&address, 0, sizeof (address));
+			address.sun_family = AF_UNIX;
+			strcpy (address.sun_path, path_s);
+
+			if (bind (fd, (struct sockaddr *) &address, sizeof (address)) != 0)
+				{
+					close (fd);
+					fd = -1;
+				}
+		}
+
+	return fd;
+}
+
+
+static bool WaitForResultsGeneration (const CacheInvalidator *invalidator_p, const uint64 generation)
+{
+	uint32 waited = 0;
+
+	while (GetNotifiedResultsGeneration (invalidator_p) < generation)
+		{
+			if (waited >= S_MAX_WAIT_MILLIS)
+				{
+					return false;
+				}
+
+			usleep (S_WAIT_STEP_MILLIS * 1000);
+			waited += S_WAIT_STEP_MILLIS;
+		}
+
+	return (GetNotifiedResultsGeneration (invalidator_p) == generation);
+}
+
+
+static bool WaitUntilNotListening (const CacheInvalidator *invalidator_p)
+{
+	uint32 waited = 0;
+
+	while (IsCacheInvalidatorListening (invalidator_p))
+		{
+			if (waited >= S_MAX_WAIT_MILLIS)
+				{
+					return false;
+				}
+
+			usleep (S_WAIT_STEP_MILLIS * 1000);
+			waited += S_WAIT_STEP_MILLIS;
+		}
+
+	return true;
+}
+
+
+static bool DoesPathExist (const char *path_s)
+{
+	struct stat path_stat;
+
+	return (stat (path_s, &path_stat) == 0);
+}
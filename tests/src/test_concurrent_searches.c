@@ -0,0 +1,279 @@
+/*
+ * test_concurrent_searches.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lucene_result_cache.h"
+#include "negative_query_cache.h"
+#include "search_cursor.h"
+
+#include "memory_allocations.h"
+
+#include "test_util.h"
+
+
+#define S_NUM_SEARCHERS (8)
+
+#define S_NUM_PASSES (50)
+
+#define S_NUM_HITS (23)
+
+#define S_PAGE_SIZE (5)
+
+#define S_NUM_PAGES ((S_NUM_HITS + S_PAGE_SIZE - 1) / S_PAGE_SIZE)
+
+
+static const char * const S_QUERY_S = "wheat";
+
+static const char * const S_TOTAL_HITS_S = "total_hits";
+
+static const char * const S_HITS_S = "hits";
+
+static const char * const S_ID_S = "id";
+
+
+/*
+ * What RunSearchService shares between the searches on one instance
+ * of the service, along with the generation that the index changes move on.
+ */
+typedef struct SharedSearchState
+{
+	LuceneResultCache *sss_lucene_cache_p;
+
+	NegativeQueryCache *sss_negative_cache_p;
+
+	uint64 sss_generation;
+
+	bool sss_stop_flag;
+} SharedSearchState;
+
+
+typedef struct Searcher
+{
+	SharedSearchState *se_state_p;
+
+	uint32 se_index;
+
+	uint32 se_num_failures;
+} Searcher;
+
+
+static void TestConcurrentSearches (void);
+
+static void *RunSearcher (void *data_p);
+
+static void *RunIndexChanges (void *data_p);
+
+static bool PageThroughQuery (SharedSearchState *state_p);
+
+static bool CheckPage (const json_t *results_p, const uint32 page);
+
+static json_t *SearchFakeIndex (const uint32 page, const uint32 page_size);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestConcurrentSearches);
+
+	return TEST_RESULT ();
+}
+
+
+/*
+ * Run the same query from several threads at once, as the server does with
+ * a single instance of the service, while the index keeps changing. Every
+ * search should still get each of its pages, in order, whether they come
+ * from the cache or the index. Running this with "make SANITIZE=thread"
+ * also checks the shared state for data races.
+ */
+static void TestConcurrentSearches (void)
+{
+	SharedSearchState state;
+
+	memset (&state, 0, sizeof (state));
+
+	state.sss_lucene_cache_p = AllocateLuceneResultCache (64, 1 << 20, true);
+	state.sss_negative_cache_p = AllocateNegativeQueryCache (1 << 16, 60);
+	state.sss_generation = 1;
+
+	TEST_CHECK (state.sss_lucene_cache_p != NULL);
+	TEST_CHECK (state.sss_negative_cache_p != NULL);
+
+	if ((state.sss_lucene_cache_p) && (state.sss_negative_cache_p))
+		{
+			pthread_t threads [S_NUM_SEARCHERS];
+			Searcher searchers [S_NUM_SEARCHERS];
+			pthread_t changes_thread;
+			uint32 num_started = 0;
+			uint32 i;
+			bool changes_flag = (pthread_create (&changes_thread, NULL, RunIndexChanges, &state) == 0);
+
+			TEST_CHECK (changes_flag);
+
+			for (i = 0; i < S_NUM_SEARCHERS; ++ i)
+				{
+					searchers [i].se_state_p = &state;
+					searchers [i].se_index = i;
+					searchers [i].se_num_failures = 0;
+
+					if (pthread_create (& (threads [i]), NULL, RunSearcher, & (searchers [i])) == 0)
+						{
+							++ num_started;
+						}
+					else
+						{
+							break;
+						}
+				}
+
+			TEST_CHECK (num_started == S_NUM_SEARCHERS);
+
+			for (i = 0; i < num_started; ++ i)
+				{
+					pthread_join (threads [i], NULL);
+					TEST_CHECK (searchers [i].se_num_failures == 0);
+				}
+
+			__atomic_store_n (& (state.sss_stop_flag), true, __ATOMIC_RELEASE);
+
+			if (changes_flag)
+				{
+					pthread_join (changes_thread, NULL);
+				}
+		}
+
+	if (state.sss_lucene_cache_p)
+		{
+			FreeLuceneResultCache (state.sss_lucene_cache_p);
+		}
+
+	if (state.sss_negative_cache_p)
+		{
+			FreeNegativeQueryCache (state.sss_negative_cache_p);
+		}
+}
+
+
+static void *RunSearcher (void *data_p)
+{
+	Searcher *searcher_p = (Searcher *) data_p;
+	SharedSearchState *state_p = searcher_p -> se_state_p;
+	char empty_query_s [32];
+	uint32 i;
+
+	sprintf (empty_query_s, "nothing %u", searcher_p -> se_index);
+
+	for (i = 0; i < S_NUM_PASSES; ++ i)
+		{
+			if (!PageThroughQuery (state_p))
+				{
+					++ (searcher_p -> se_num_failures);
+				}
+
+			/* A query that has just been found to be empty must stay known as empty */
+			AddEmptyQuery (state_p -> sss_negative_cache_p, SC_LUCENE_EXHAUSTED, empty_query_s, NULL, 1);
+
+			if (!IsKnownEmptyQuery (state_p -> sss_negative_cache_p, SC_LUCENE_EXHAUSTED, empty_query_s, NULL, 1))
+				{
+					++ (searcher_p -> se_num_failures);
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Move the generation on and remove the cached pages in the same way
+ * that NotifyIndexChange () does.
+ */
+static void *RunIndexChanges (void *data_p)
+{
+	SharedSearchState *state_p = (SharedSearchState *) data_p;
+
+	while (!__atomic_load_n (& (state_p -> sss_stop_flag), __ATOMIC_ACQUIRE))
+		{
+			const uint64 generation = __atomic_add_fetch (& (state_p -> sss_generation), 1, __ATOMIC_ACQ_REL);
+
+			InvalidateLuceneResults (state_p -> sss_lucene_cache_p, NULL, generation);
+			sched_yield ();
+		}
+
+	return NULL;
+}
+
+
+/*
+ * This follows the Lucene part of SearchKeyword () for each page of the
+ * query, reading the generation at the start of the search.
+ */
+static bool PageThroughQuery (SharedSearchState *state_p)
+{
+	const uint64 generation = __atomic_load_n (& (state_p -> sss_generation), __ATOMIC_ACQUIRE);
+	SearchCursor cursor;
+	uint32 num_pages = 0;
+	bool success_flag = InitSearchCursor (&cursor, 0, S_PAGE_SIZE, S_PAGE_SIZE);
+
+	while ((success_flag) && (! (cursor.sc_exhausted_flags & SC_LUCENE_EXHAUSTED)) && (num_pages <= S_NUM_PAGES))
+		{
+			json_t *results_p = GetCachedLuceneResults (state_p -> sss_lucene_cache_p, S_QUERY_S, NULL, cursor.sc_lucene_page, cursor.sc_page_size, generation);
+
+			if (!results_p)
+				{
+					results_p = SearchFakeIndex (cursor.sc_lucene_page, cursor.sc_page_size);
+
+					/* This fails once the generation has moved on, which is fine */
+					AddCachedLuceneResults (state_p -> sss_lucene_cache_p, S_QUERY_S, NULL, cursor.sc_lucene_page, cursor.sc_page_size, generation, results_p);
+				}
+
+			if (CheckPage (results_p, cursor.sc_lucene_page))
+				{
+					AdvanceSearchCursorLucene (&cursor, (uint32) json_integer_value (json_object_get (results_p, S_TOTAL_HITS_S)));
+					++ num_pages;
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			json_decref (results_p);
+		}
+
+	return (success_flag && (num_pages == S_NUM_PAGES));
+}
+
+
+static bool CheckPage (const json_t *results_p, const uint32 page)
+{
+	const json_t *hits_p = json_object_get (results_p, S_HITS_S);
+	const json_t *first_hit_p = json_array_get (hits_p, 0);
+
+	if (first_hit_p)
+		{
+			return (json_integer_value (json_object_get (first_hit_p, S_ID_S)) == (json_int_t) (page * S_PAGE_SIZE));
+		}
+
+	return false;
+}
+
+
+static json_t *SearchFakeIndex (const uint32 page, const uint32 page_size)
+{
+	json_t *hits_p = json_array ();
+	uint32 i;
+
+	for (i = page * page_size; (i < (page + 1) * page_size) && (i < S_NUM_HITS); ++ i)
+		{
+			json_array_append_new (hits_p, json_pack ("{s:i}", S_ID_S, (json_int_t) i));
+		}
+
+	return json_pack ("{s:i,s:o}", S_TOTAL_HITS_S, (json_int_t) S_NUM_HITS, S_HITS_S, hits_p);
+}
@@ -0,0 +1,203 @@
+/*
+ * test_lucene_paging.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "lucene_page.h"
+
+#include "memory_allocations.h"
+
+#include "test_util.h"
+
+
+#define S_NUM_HITS (23)
+
+#define S_PAGE_SIZE (5)
+
+/* One more than the number of pages so that a cursor that never ends is caught */
+#define S_MAX_PAGES (((S_NUM_HITS + S_PAGE_SIZE - 1) / S_PAGE_SIZE) + 1)
+
+#define S_GENERATION (7)
+
+
+static const char * const S_QUERY_S = "wheat";
+
+static const char * const S_TOTAL_HITS_S = "total_hits";
+
+static const char * const S_HITS_S = "hits";
+
+
+/*
+ * This stands in for the LuceneTool, keeping the total number of hits
+ * from the last search or cached page as SearchKeyword () does.
+ */
+typedef struct FakeIndex
+{
+	uint32 fi_num_total_hits;
+	uint32 fi_num_hits_added;
+	uint32 fi_num_cached_pages;
+} FakeIndex;
+
+
+static void TestCachedPagesAdvanceCursor (void);
+
+static uint32 PageThroughQuery (LuceneResultCache *cache_p, char *cursors_ss [S_MAX_PAGES], uint32 *num_cached_p);
+
+static OperationStatus AddCachedHits (const json_t *page_p, const uint32 from, void *data_p);
+
+static OperationStatus AddSearchedHits (const uint32 from, const uint32 to, json_t **page_pp, void *data_p);
+
+static uint32 GetNumTotalHits (void *data_p);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestCachedPagesAdvanceCursor);
+
+	return TEST_RESULT ();
+}
+
+
+/*
+ * Page through the same query twice, the first time from the "index" and
+ * the second time from the cache, and check that the cursor moves on and
+ * ends in the same way both times.
+ */
+static void TestCachedPagesAdvanceCursor (void)
+{
+	LuceneResultCache *cache_p = AllocateLuceneResultCache (100, 1 << 20, false);
+
+	TEST_CHECK (cache_p != NULL);
+
+	if (cache_p)
+		{
+			char *first_cursors_ss [S_MAX_PAGES];
+			char *second_cursors_ss [S_MAX_PAGES];
+			uint32 num_first_cached = 0;
+			uint32 num_second_cached = 0;
+			const uint32 num_first_pages = PageThroughQuery (cache_p, first_cursors_ss, &num_first_cached);
+			const uint32 num_second_pages = PageThroughQuery (cache_p, second_cursors_ss, &num_second_cached);
+			const uint32 expected_num_pages = (S_NUM_HITS + S_PAGE_SIZE - 1) / S_PAGE_SIZE;
+			uint32 i;
+
+			TEST_CHECK (num_first_pages == expected_num_pages);
+			TEST_CHECK (num_first_cached == 0);
+
+			TEST_CHECK (num_second_pages == expected_num_pages);
+			TEST_CHECK (num_second_cached == expected_num_pages);
+
+			for (i = 0; (i < num_first_pages) && (i < num_second_pages); ++ i)
+				{
+					TEST_CHECK (strcmp (first_cursors_ss [i], second_cursors_ss [i]) == 0);
+				}
+
+			for (i = 0; i < num_first_pages; ++ i)
+				{
+					FreeCopiedString (first_cursors_ss [i]);
+				}
+
+			for (i = 0; i < num_second_pages; ++ i)
+				{
+					FreeCopiedString (second_cursors_ss [i]);
+				}
+
+			FreeLuceneResultCache (cache_p);
+		}
+}
+
+/*
+ * Each page is served in the same way as in SearchKeyword (), so the
+ * cursor has to move on whether the page came from the cache or not.
+ */
+static uint32 PageThroughQuery (LuceneResultCache *cache_p, char *cursors_ss [S_MAX_PAGES], uint32 *num_cached_p)
+{
+	SearchCursor cursor;
+	FakeIndex index;
+	LucenePageSource source;
+	uint32 num_pages = 0;
+
+	memset (&index, 0, sizeof (index));
+
+	source.lps_add_cached_hits_fn = AddCachedHits;
+	source.lps_add_searched_hits_fn = AddSearchedHits;
+	source.lps_get_num_total_hits_fn = GetNumTotalHits;
+	source.lps_data_p = &index;
+
+	TEST_CHECK (InitSearchCursor (&cursor, 0, S_PAGE_SIZE, S_PAGE_SIZE));
+
+	while ((! (cursor.sc_exhausted_flags & SC_LUCENE_EXHAUSTED)) && (num_pages < S_MAX_PAGES))
+		{
+			json_t *cached_page_p = GetCachedLucenePage (cache_p, S_QUERY_S, NULL, &cursor, S_GENERATION);
+
+			TEST_CHECK (ServeLucenePage (cache_p, S_QUERY_S, NULL, &cursor, S_GENERATION, cached_page_p, &source) == OS_SUCCEEDED);
+
+			cursors_ss [num_pages] = GetSearchCursorAsString (&cursor);
+			++ num_pages;
+
+			if (cached_page_p)
+				{
+					json_decref (cached_page_p);
+				}
+		}
+
+	TEST_CHECK (cursor.sc_exhausted_flags & SC_LUCENE_EXHAUSTED);
+	TEST_CHECK (index.fi_num_hits_added == S_NUM_HITS);
+
+	/* Once Lucene has run out, there is nothing more to serve */
+	TEST_CHECK (GetCachedLucenePage (cache_p, S_QUERY_S, NULL, &cursor, S_GENERATION) == NULL);
+	TEST_CHECK (ServeLucenePage (cache_p, S_QUERY_S, NULL, &cursor, S_GENERATION, NULL, &source) == OS_SUCCEEDED);
+	TEST_CHECK (index.fi_num_hits_added == S_NUM_HITS);
+
+	*num_cached_p = index.fi_num_cached_pages;
+
+	return num_pages;
+}
+
+
+static OperationStatus AddCachedHits (const json_t *page_p, const uint32 from, void *data_p)
+{
+	FakeIndex *index_p = (FakeIndex *) data_p;
+	const json_t *hits_p = json_object_get (page_p, S_HITS_S);
+
+	TEST_CHECK (json_integer_value (json_object_get (json_array_get (hits_p, 0), "id")) == (json_int_t) from);
+
+	index_p -> fi_num_total_hits = (uint32) json_integer_value (json_object_get (page_p, S_TOTAL_HITS_S));
+	index_p -> fi_num_hits_added += (uint32) json_array_size (hits_p);
+	++ (index_p -> fi_num_cached_pages);
+
+	return OS_SUCCEEDED;
+}
+
+
+static OperationStatus AddSearchedHits (const uint32 from, const uint32 to, json_t **page_pp, void *data_p)
+{
+	FakeIndex *index_p = (FakeIndex *) data_p;
+	json_t *hits_p = json_array ();
+	uint32 i;
+
+	TEST_CHECK (page_pp != NULL);
+	TEST_CHECK (to == from + S_PAGE_SIZE - 1);
+
+	for (i = from; (i <= to) && (i < S_NUM_HITS); ++ i)
+		{
+			json_array_append_new (hits_p, json_pack ("{s:i}", "id", (json_int_t) i));
+		}
+
+	index_p -> fi_num_total_hits = S_NUM_HITS;
+	index_p -> fi_num_hits_added += (uint32) json_array_size (hits_p);
+
+	*page_pp = json_pack ("{s:i,s:o}", S_TOTAL_HITS_S, (json_int_t) S_NUM_HITS, S_HITS_S, hits_p);
+
+	return OS_SUCCEEDED;
+}
+
+
+static uint32 GetNumTotalHits (void *data_p)
+{
+	return ((FakeIndex *) data_p) -> fi_num_total_hits;
+}
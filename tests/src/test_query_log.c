@@ -0,0 +1,189 @@
+/*
+ * test_query_log.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "query_log.h"
+
+#include "test_util.h"
+
+
+#define S_MAX_SIZE (4096)
+
+#define S_NUM_QUERIES (1000)
+
+
+static void TestCompactsWhenTooLarge (void);
+
+static void TestSharedLogFollowsCompaction (void);
+
+static void GetLogPath (char *path_s, const size_t path_size, const char *test_s);
+
+static json_int_t GetQueryCount (const json_t *top_queries_p, const char *query_s);
+
+static uint64 GetFileSize (const char *path_s);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestCompactsWhenTooLarge);
+	RUN_TEST (TestSharedLogFollowsCompaction);
+
+	return TEST_RESULT ();
+}
+
+
+/*
+ * Recording the queries should keep the file below its limit without
+ * losing any of their counts.
+ */
+static void TestCompactsWhenTooLarge (void)
+{
+	char path_s [256];
+	QueryLog *log_p;
+
+	GetLogPath (path_s, sizeof (path_s), "large");
+
+	log_p = AllocateQueryLog (path_s, S_MAX_SIZE);
+	TEST_CHECK (log_p != NULL);
+
+	if (log_p)
+		{
+			json_t *top_queries_p;
+			uint32 i;
+
+			for (i = 0; i < S_NUM_QUERIES; ++ i)
+				{
+					TEST_CHECK (RecordQuery (log_p, "wheat", "Study"));
+				}
+
+			TEST_CHECK (GetFileSize (path_s) < S_MAX_SIZE);
+
+			top_queries_p = GetTopQueries (log_p, 10);
+			TEST_CHECK (top_queries_p != NULL);
+
+			if (top_queries_p)
+				{
+					TEST_CHECK (json_array_size (top_queries_p) == 1);
+					TEST_CHECK (GetQueryCount (top_queries_p, "wheat") == S_NUM_QUERIES);
+
+					json_decref (top_queries_p);
+				}
+
+			FreeQueryLog (log_p);
+		}
+
+	unlink (path_s);
+}
+
+
+/*
+ * Two QueryLogs on the same file stand in for two processes sharing it.
+ * Once one of them compacts the file, the other must add its queries to
+ * the new file rather than the one that has been replaced.
+ */
+static void TestSharedLogFollowsCompaction (void)
+{
+	char path_s [256];
+	QueryLog *compacting_log_p;
+	QueryLog *other_log_p;
+
+	GetLogPath (path_s, sizeof (path_s), "shared");
+
+	compacting_log_p = AllocateQueryLog (path_s, S_MAX_SIZE);
+	other_log_p = AllocateQueryLog (path_s, 0);
+
+	TEST_CHECK (compacting_log_p != NULL);
+	TEST_CHECK (other_log_p != NULL);
+
+	if (compacting_log_p && other_log_p)
+		{
+			json_t *top_queries_p;
+			uint32 i;
+
+			TEST_CHECK (RecordQuery (other_log_p, "barley", NULL));
+
+			for (i = 0; i < S_NUM_QUERIES; ++ i)
+				{
+					TEST_CHECK (RecordQuery (compacting_log_p, "wheat", NULL));
+				}
+
+			/* The file must have been replaced for this to test anything */
+			TEST_CHECK (GetFileSize (path_s) < S_MAX_SIZE);
+
+			for (i = 0; i < 10; ++ i)
+				{
+					TEST_CHECK (RecordQuery (other_log_p, "barley", NULL));
+				}
+
+			top_queries_p = GetTopQueries (other_log_p, 10);
+			TEST_CHECK (top_queries_p != NULL);
+
+			if (top_queries_p)
+				{
+					TEST_CHECK (GetQueryCount (top_queries_p, "wheat") == S_NUM_QUERIES);
+					TEST_CHECK (GetQueryCount (top_queries_p, "barley") == 11);
+
+					json_decref (top_queries_p);
+				}
+		}
+
+	if (compacting_log_p)
+		{
+			FreeQueryLog (compacting_log_p);
+		}
+
+	if (other_log_p)
+		{
+			FreeQueryLog (other_log_p);
+		}
+
+	unlink (path_s);
+}
+
+
+static void GetLogPath (char *path_s, const size_t path_size, const char *test_s)
+{
+	snprintf (path_s, path_size, "/tmp/test_query_log_%ld_%s.log", (long) getpid (), test_s);
+	unlink (path_s);
+}
+
+
+static json_int_t GetQueryCount (const json_t *top_queries_p, const char *query_s)
+{
+	size_t i;
+	json_t *entry_p;
+
+	json_array_foreach (top_queries_p, i, entry_p)
+		{
+			const char *entry_query_s = json_string_value (json_object_get (entry_p, QL_QUERY_S));
+
+			if (entry_query_s && (strcmp (entry_query_s, query_s) == 0))
+				{
+					return json_integer_value (json_object_get (entry_p, QL_COUNT_S));
+				}
+		}
+
+	return 0;
+}
+
+
+static uint64 GetFileSize (const char *path_s)
+{
+	struct stat info;
+
+	if (stat (path_s, &info) == 0)
+		{
+			return (uint64) info.st_size;
+		}
+
+	return 0;
+}
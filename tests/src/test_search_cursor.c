@@ -0,0 +1,106 @@
+/*
+ * test_search_cursor.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "search_cursor.h"
+
+#include "memory_allocations.h"
+
+#include "test_util.h"
+
+
+#define S_EXTERNAL_PAGE_SIZE (20)
+
+
+static void TestRoundTrip (void);
+
+static void TestExternalPageSizeFromConfig (void);
+
+static void TestPageSizeLimits (void);
+
+static void TestOverflowingPositions (void);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestRoundTrip);
+	RUN_TEST (TestExternalPageSizeFromConfig);
+	RUN_TEST (TestPageSizeLimits);
+	RUN_TEST (TestOverflowingPositions);
+
+	return TEST_RESULT ();
+}
+
+
+static void TestRoundTrip (void)
+{
+	SearchCursor cursor;
+	SearchCursor parsed;
+	char *cursor_s;
+
+	TEST_CHECK (InitSearchCursor (&cursor, 3, 50, S_EXTERNAL_PAGE_SIZE));
+	TEST_CHECK (cursor.sc_ckan_from == 3 * S_EXTERNAL_PAGE_SIZE);
+
+	cursor.sc_exhausted_flags = SC_ZENODO_EXHAUSTED;
+	cursor_s = GetSearchCursorAsString (&cursor);
+	TEST_CHECK (cursor_s != NULL);
+
+	if (cursor_s)
+		{
+			TEST_CHECK (ParseSearchCursor (&parsed, cursor_s, S_EXTERNAL_PAGE_SIZE));
+			TEST_CHECK (memcmp (&cursor, &parsed, sizeof (SearchCursor)) == 0);
+
+			FreeCopiedString (cursor_s);
+		}
+}
+
+
+/*
+ * A client that edits the external page size in its cursor mustn't be
+ * able to make the portals return more hits than configured.
+ */
+static void TestExternalPageSizeFromConfig (void)
+{
+	SearchCursor cursor;
+
+	TEST_CHECK (ParseSearchCursor (&cursor, "c1.1.32.14.14.ffffff.0", S_EXTERNAL_PAGE_SIZE));
+	TEST_CHECK (cursor.sc_external_page_size == S_EXTERNAL_PAGE_SIZE);
+}
+
+
+static void TestPageSizeLimits (void)
+{
+	SearchCursor cursor;
+	char cursor_s [64];
+
+	TEST_CHECK (!InitSearchCursor (&cursor, 0, 0, S_EXTERNAL_PAGE_SIZE));
+	TEST_CHECK (!InitSearchCursor (&cursor, 0, SC_MAX_PAGE_SIZE + 1, S_EXTERNAL_PAGE_SIZE));
+	TEST_CHECK (InitSearchCursor (&cursor, 0, SC_MAX_PAGE_SIZE, S_EXTERNAL_PAGE_SIZE));
+
+	TEST_CHECK (!ParseSearchCursor (&cursor, "c1.0.0.0.0.14.0", S_EXTERNAL_PAGE_SIZE));
+
+	snprintf (cursor_s, sizeof (cursor_s), "c1.0.%x.0.0.14.0", SC_MAX_PAGE_SIZE + 1);
+	TEST_CHECK (!ParseSearchCursor (&cursor, cursor_s, S_EXTERNAL_PAGE_SIZE));
+}
+
+
+static void TestOverflowingPositions (void)
+{
+	SearchCursor cursor;
+
+	/* The end of the Lucene page doesn't fit */
+	TEST_CHECK (!InitSearchCursor (&cursor, 0x7fffffff, 100, S_EXTERNAL_PAGE_SIZE));
+	TEST_CHECK (!ParseSearchCursor (&cursor, "c1.ffffffff.64.0.0.14.0", S_EXTERNAL_PAGE_SIZE));
+
+	/* Nor does the end of the next CKAN or Zenodo page */
+	TEST_CHECK (!ParseSearchCursor (&cursor, "c1.0.64.fffffff0.0.14.0", S_EXTERNAL_PAGE_SIZE));
+	TEST_CHECK (!ParseSearchCursor (&cursor, "c1.0.64.0.fffffff0.14.0", S_EXTERNAL_PAGE_SIZE));
+
+	TEST_CHECK (ParseSearchCursor (&cursor, "c1.0.64.ffffffe0.0.14.0", S_EXTERNAL_PAGE_SIZE));
+}
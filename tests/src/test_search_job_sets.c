@@ -0,0 +1,189 @@
+/*
+ * test_search_job_sets.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "search_job_sets.h"
+
+#include "test_util.h"
+
+
+#define S_NUM_SEARCHERS (8)
+
+#define S_NUM_SEARCHES (500)
+
+
+/*
+ * This stands in for the ServiceJobSet that RunSearchService () returns
+ * so that the tests don't need the Grassroots server library.
+ */
+typedef struct FakeJobSet
+{
+	bool fjs_freed_flag;
+} FakeJobSet;
+
+
+typedef struct Searcher
+{
+	SearchJobSets *se_sets_p;
+
+	uint32 se_num_failures;
+} Searcher;
+
+
+/* The number of FakeJobSets that have been allocated but not freed */
+static uint32 s_num_live_sets = 0;
+
+/* The most that there have been at once */
+static uint32 s_max_live_sets = 0;
+
+
+static void TestJobSetsDontBuildUp (void);
+
+static void *RunSearcher (void *data_p);
+
+static ServiceJobSet *AllocateFakeJobSet (void);
+
+
+
+int main (void)
+{
+	RUN_TEST (TestJobSetsDontBuildUp);
+
+	return TEST_RESULT ();
+}
+
+
+/*
+ * The freed sets are only marked as freed, rather than having their memory
+ * released, so that a set which is freed too early can be spotted.
+ */
+void FreeServiceJobSet (ServiceJobSet *jobs_p)
+{
+	FakeJobSet *set_p = (FakeJobSet *) jobs_p;
+
+	__atomic_store_n (& (set_p -> fjs_freed_flag), true, __ATOMIC_RELEASE);
+	__atomic_sub_fetch (&s_num_live_sets, 1, __ATOMIC_ACQ_REL);
+}
+
+
+/*
+ * Run lots of searches on one instance of the service from several threads
+ * at once, handing each ServiceJobSet over in the same way that
+ * RunSearchService () does. Each thread's latest set must stay valid until
+ * its next search, but the sets mustn't build up.
+ */
+static void TestJobSetsDontBuildUp (void)
+{
+	SearchJobSets *sets_p = AllocateSearchJobSets ();
+
+	TEST_CHECK (sets_p != NULL);
+
+	if (sets_p)
+		{
+			pthread_t threads [S_NUM_SEARCHERS];
+			Searcher searchers [S_NUM_SEARCHERS];
+			uint32 num_started = 0;
+			uint32 i;
+
+			for (i = 0; i < S_NUM_SEARCHERS; ++ i)
+				{
+					searchers [i].se_sets_p = sets_p;
+					searchers [i].se_num_failures = 0;
+
+					if (pthread_create (& (threads [i]), NULL, RunSearcher, & (searchers [i])) == 0)
+						{
+							++ num_started;
+						}
+					else
+						{
+							break;
+						}
+				}
+
+			TEST_CHECK (num_started == S_NUM_SEARCHERS);
+
+			for (i = 0; i < num_started; ++ i)
+				{
+					pthread_join (threads [i], NULL);
+					TEST_CHECK (searchers [i].se_num_failures == 0);
+				}
+
+			/* Just the latest set from each thread is left */
+			TEST_CHECK (__atomic_load_n (&s_num_live_sets, __ATOMIC_ACQUIRE) == num_started);
+
+			/* Each thread has at most its latest set and the one that it is running */
+			TEST_CHECK (__atomic_load_n (&s_max_live_sets, __ATOMIC_ACQUIRE) <= 2 * num_started);
+
+			FreeSearchJobSets (sets_p);
+
+			TEST_CHECK (__atomic_load_n (&s_num_live_sets, __ATOMIC_ACQUIRE) == 0);
+		}
+}
+
+
+static void *RunSearcher (void *data_p)
+{
+	Searcher *searcher_p = (Searcher *) data_p;
+	FakeJobSet *previous_p = NULL;
+	uint32 i;
+
+	for (i = 0; i < S_NUM_SEARCHES; ++ i)
+		{
+			FakeJobSet *set_p = (FakeJobSet *) AllocateFakeJobSet ();
+
+			if (set_p)
+				{
+					/* The server could still be sending the previous search's results */
+					if (previous_p && __atomic_load_n (& (previous_p -> fjs_freed_flag), __ATOMIC_ACQUIRE))
+						{
+							++ (searcher_p -> se_num_failures);
+						}
+
+					KeepSearchJobSet (searcher_p -> se_sets_p, (ServiceJobSet *) set_p);
+
+					if (previous_p)
+						{
+							if (__atomic_load_n (& (previous_p -> fjs_freed_flag), __ATOMIC_ACQUIRE))
+								{
+									free (previous_p);
+								}
+							else
+								{
+									++ (searcher_p -> se_num_failures);
+								}
+						}
+
+					previous_p = set_p;
+				}
+			else
+				{
+					++ (searcher_p -> se_num_failures);
+				}
+		}
+
+	return NULL;
+}
+
+
+static ServiceJobSet *AllocateFakeJobSet (void)
+{
+	FakeJobSet *set_p = (FakeJobSet *) calloc (1, sizeof (FakeJobSet));
+
+	if (set_p)
+		{
+			const uint32 num_live_sets = __atomic_add_fetch (&s_num_live_sets, 1, __ATOMIC_ACQ_REL);
+			uint32 max_live_sets = __atomic_load_n (&s_max_live_sets, __ATOMIC_ACQUIRE);
+
+			while ((num_live_sets > max_live_sets) && (!__atomic_compare_exchange_n (&s_max_live_sets, &max_live_sets, num_live_sets, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)))
+				{
+				}
+		}
+
+	return (ServiceJobSet *) set_p;
+}
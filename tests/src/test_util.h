@@ -0,0 +1,57 @@
+/*
+ * test_util.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_TESTS_TEST_UTIL_H_
+#define SERVICES_SEARCH_SERVICE_TESTS_TEST_UTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/*
+ * Each test program is a single file, so the failures can be counted
+ * in a static rather than being passed around.
+ */
+static unsigned int s_num_failures = 0;
+
+
+/**
+ * Report a failure, with where it happened, if a condition isn't true
+ * and carry on with the rest of the test.
+ */
+#define TEST_CHECK(cond) \
+	do \
+		{ \
+			if (! (cond)) \
+				{ \
+					fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+					++ s_num_failures; \
+				} \
+		} \
+	while (0)
+
+
+/**
+ * Run a test function and print its name and outcome.
+ */
+#define RUN_TEST(test_fn) \
+	do \
+		{ \
+			const unsigned int num_failures = s_num_failures; \
+			test_fn (); \
+			printf ("%s %s\n", (s_num_failures == num_failures) ? "PASS" : "FAIL", #test_fn); \
+		} \
+	while (0)
+
+
+/**
+ * The exit code for a test program.
+ */
+#define TEST_RESULT() ((s_num_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE)
+
+
+#endif /* SERVICES_SEARCH_SERVICE_TESTS_TEST_UTIL_H_ */
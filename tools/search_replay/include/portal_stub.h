@@ -0,0 +1,66 @@
+/*
+ * portal_stub.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SERVICES_SEARCH_SERVICE_TOOLS_SEARCH_REPLAY_INCLUDE_PORTAL_STUB_H_
+#define SERVICES_SEARCH_SERVICE_TOOLS_SEARCH_REPLAY_INCLUDE_PORTAL_STUB_H_
+
+#include "typedefs.h"
+
+
+/**
+ * A local HTTP server that stands in for CKAN and Zenodo during a replay
+ * so that the load only measures the search service itself.
+ *
+ * Every CKAN package search gets the same CKAN response and every Zenodo
+ * records search gets the same Zenodo response, after an optional delay
+ * to stand in for the portals' own response times.
+ */
+typedef struct PortalStub PortalStub;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start a PortalStub listening on the loopback interface.
+ *
+ * @param port The port to listen on.
+ * @param ckan_response_s The body to send for CKAN package searches.
+ * @param zenodo_response_s The body to send for Zenodo records searches.
+ * @param delay The number of milliseconds to wait before each response.
+ * @param num_threads The number of requests that can be answered at once.
+ * @return The new PortalStub or <code>NULL</code> upon error.
+ */
+PortalStub *StartPortalStub (const uint32 port, const char *ckan_response_s, const char *zenodo_response_s, const uint32 delay, const uint32 num_threads);
+
+
+/**
+ * Stop a PortalStub and free it.
+ *
+ * @param stub_p The PortalStub.
+ */
+void StopPortalStub (PortalStub *stub_p);
+
+
+/**
+ * Get the number of requests that a PortalStub has answered.
+ *
+ * @param stub_p The PortalStub.
+ * @return The number of requests.
+ */
+uint64 GetPortalStubNumRequests (const PortalStub *stub_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_SEARCH_SERVICE_TOOLS_SEARCH_REPLAY_INCLUDE_PORTAL_STUB_H_ */
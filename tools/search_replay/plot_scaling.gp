@@ -0,0 +1,35 @@
+# Plot the CSV from "search_replay --scaling" against the number of threads.
+#
+#   gnuplot -e "data='scaling.csv'" plot_scaling.gp
+#
+# This writes scaling.png with the throughput, along with perfect linear
+# scaling from the single thread throughput, on the left and the
+# latencies on the right.
+
+if (!exists ("data")) data = 'scaling.csv'
+
+set datafile separator ","
+set terminal pngcairo size 1400,560
+set output 'scaling.png'
+
+stats data using 4 every ::0::0 nooutput
+single = STATS_min
+
+set multiplot layout 1,2
+set grid
+set key top left
+set xlabel "threads"
+
+set title "Throughput"
+set ylabel "searches/s"
+set yrange [0:*]
+plot data using 1:4 with linespoints title "measured", \
+	data using 1:($1 * single) with lines dashtype 2 title "linear"
+
+set title "Latency"
+set ylabel "ms"
+plot data using 1:8 with linespoints title "p50", \
+	data using 1:10 with linespoints title "p99", \
+	data using 1:12 with linespoints title "max"
+
+unset multiplot
@@ -0,0 +1,348 @@
+/*
+ * portal_stub.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "portal_stub.h"
+
+
+/* Requests from curl are a single short GET so this is plenty */
+#define S_MAX_REQUEST_SIZE (16384)
+
+/* How often, in milliseconds, each thread checks whether it should stop */
+#define S_POLL_INTERVAL (200)
+
+
+struct PortalStub
+{
+	char *ps_ckan_response_s;
+
+	char *ps_zenodo_response_s;
+
+	uint32 ps_delay;
+
+	int ps_socket_fd;
+
+	pthread_t *ps_threads_p;
+
+	uint32 ps_num_threads;
+
+	uint64 ps_num_requests;
+
+	bool ps_stop_flag;
+};
+
+
+static int OpenStubSocket (const uint32 port);
+
+static void *RunStubThread (void *data_p);
+
+static void AnswerRequest (PortalStub *stub_p, const int fd, char *request_s);
+
+static bool ReadRequestHeaders (const int fd, char *request_s);
+
+static bool WriteAll (const int fd, const char *data_s, size_t size);
+
+static void WaitForMilliseconds (const uint32 delay);
+
+
+
+PortalStub *StartPortalStub (const uint32 port, const char *ckan_response_s, const char *zenodo_response_s, const uint32 delay, const uint32 num_threads)
+{
+	PortalStub *stub_p = (PortalStub *) calloc (1, sizeof (PortalStub));
+
+	if (stub_p)
+		{
+			stub_p -> ps_delay = delay;
+			stub_p -> ps_ckan_response_s = strdup (ckan_response_s);
+			stub_p -> ps_zenodo_response_s = strdup (zenodo_response_s);
+			stub_p -> ps_threads_p = (pthread_t *) calloc (num_threads, sizeof (pthread_t));
+
+			if ((stub_p -> ps_ckan_response_s) && (stub_p -> ps_zenodo_response_s) && (stub_p -> ps_threads_p))
+				{
+					stub_p -> ps_socket_fd = OpenStubSocket (port);
+
+					if (stub_p -> ps_socket_fd >= 0)
+						{
+							/* Every thread accepts on the same socket so whichever is free takes the next request */
+							while ((stub_p -> ps_num_threads < num_threads) && (pthread_create (stub_p -> ps_threads_p + stub_p -> ps_num_threads, NULL, RunStubThread, stub_p) == 0))
+								{
+									++ (stub_p -> ps_num_threads);
+								}
+
+							if (stub_p -> ps_num_threads == num_threads)
+								{
+									return stub_p;
+								}
+
+							fprintf (stderr, "Failed to start the portal stub threads\n");
+
+							StopPortalStub (stub_p);
+							return NULL;
+						}
+				}
+
+			free (stub_p -> ps_threads_p);
+			free (stub_p -> ps_zenodo_response_s);
+			free (stub_p -> ps_ckan_response_s);
+			free (stub_p);
+		}
+
+	return NULL;
+}
+
+
+void StopPortalStub (PortalStub *stub_p)
+{
+	uint32 i;
+
+	__atomic_store_n (& (stub_p -> ps_stop_flag), true, __ATOMIC_RELEASE);
+
+	for (i = 0; i < stub_p -> ps_num_threads; ++ i)
+		{
+			pthread_join (stub_p -> ps_threads_p [i], NULL);
+		}
+
+	close (stub_p -> ps_socket_fd);
+
+	free (stub_p -> ps_threads_p);
+	free (stub_p -> ps_zenodo_response_s);
+	free (stub_p -> ps_ckan_response_s);
+	free (stub_p);
+}
+
+
+uint64 GetPortalStubNumRequests (const PortalStub *stub_p)
+{
+	return __atomic_load_n (& (stub_p -> ps_num_requests), __ATOMIC_RELAXED);
+}
+
+
+static int OpenStubSocket (const uint32 port)
+{
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+	if (fd >= 0)
+		{
+			struct sockaddr_in address;
+			int reuse = 1;
+
+			setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+
+			/* Another thread may take a connection between poll () and accept (), so accept () mustn't block */
+			fcntl (fd, F_SETFL, fcntl (fd, F_GETFL, 0) | O_NONBLOCK);
+
+			memset (&address, 0, sizeof (address));
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+			address.sin_port = htons ((uint16_t) port);
+
+			if (bind (fd, (struct sockaddr *) &address, sizeof (address)) == 0)
+				{
+					if (listen (fd, 1024) == 0)
+						{
+							return fd;
+						}
+				}
+
+			fprintf (stderr, "Failed to listen on port %u: %s\n", port, strerror (errno));
+			close (fd);
+		}
+	else
+		{
+			fprintf (stderr, "Failed to create the portal stub socket: %s\n", strerror (errno));
+		}
+
+	return -1;
+}
+
+
+static void *RunStubThread (void *data_p)
+{
+	PortalStub *stub_p = (PortalStub *) data_p;
+	char *request_s = (char *) malloc (S_MAX_REQUEST_SIZE + 1);
+
+	if (request_s)
+		{
+			struct pollfd poll_fd;
+
+			poll_fd.fd = stub_p -> ps_socket_fd;
+			poll_fd.events = POLLIN;
+
+			while (!__atomic_load_n (& (stub_p -> ps_stop_flag), __ATOMIC_ACQUIRE))
+				{
+					if (poll (&poll_fd, 1, S_POLL_INTERVAL) > 0)
+						{
+							const int fd = accept (stub_p -> ps_socket_fd, NULL, NULL);
+
+							if (fd >= 0)
+								{
+									/* Accepted sockets don't inherit O_NONBLOCK */
+									fcntl (fd, F_SETFL, fcntl (fd, F_GETFL, 0) | O_NONBLOCK);
+									AnswerRequest (stub_p, fd, request_s);
+									close (fd);
+								}
+						}
+				}
+
+			free (request_s);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * The service builds its CKAN URLs from /api/3/action/package_search
+ * and its Zenodo ones from /api/records, so those are all that need
+ * telling apart. Each connection is closed after its response.
+ */
+static void AnswerRequest (PortalStub *stub_p, const int fd, char *request_s)
+{
+	if (ReadRequestHeaders (fd, request_s))
+		{
+			const char *body_s = NULL;
+			const char *end_of_line_s = strstr (request_s, "\r\n");
+			char header_s [256];
+
+			if (end_of_line_s)
+				{
+					/* Only look at the request line */
+					* ((char *) end_of_line_s) = '\0';
+
+					if (strstr (request_s, "/api/3/action/package_search"))
+						{
+							body_s = stub_p -> ps_ckan_response_s;
+						}
+					else if (strstr (request_s, "/api/records"))
+						{
+							body_s = stub_p -> ps_zenodo_response_s;
+						}
+				}
+
+			if (stub_p -> ps_delay > 0)
+				{
+					WaitForMilliseconds (stub_p -> ps_delay);
+				}
+
+			if (body_s)
+				{
+					const size_t body_length = strlen (body_s);
+
+					snprintf (header_s, sizeof (header_s), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_length);
+
+					if (WriteAll (fd, header_s, strlen (header_s)))
+						{
+							WriteAll (fd, body_s, body_length);
+						}
+				}
+			else
+				{
+					const char * const NOT_FOUND_S = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+					WriteAll (fd, NOT_FOUND_S, strlen (NOT_FOUND_S));
+				}
+
+			__atomic_add_fetch (& (stub_p -> ps_num_requests), 1, __ATOMIC_RELAXED);
+		}
+}
+
+
+static bool ReadRequestHeaders (const int fd, char *request_s)
+{
+	size_t size = 0;
+	struct pollfd poll_fd;
+
+	poll_fd.fd = fd;
+	poll_fd.events = POLLIN;
+
+	while (size < S_MAX_REQUEST_SIZE)
+		{
+			ssize_t num_read = read (fd, request_s + size, S_MAX_REQUEST_SIZE - size);
+
+			if (num_read > 0)
+				{
+					size += (size_t) num_read;
+					request_s [size] = '\0';
+
+					if (strstr (request_s, "\r\n\r\n"))
+						{
+							return true;
+						}
+				}
+			else if ((num_read < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+				{
+					/* Give up on clients that stop sending part of the way through */
+					if (poll (&poll_fd, 1, S_POLL_INTERVAL * 10) <= 0)
+						{
+							return false;
+						}
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	return false;
+}
+
+
+static bool WriteAll (const int fd, const char *data_s, size_t size)
+{
+	struct pollfd poll_fd;
+
+	poll_fd.fd = fd;
+	poll_fd.events = POLLOUT;
+
+	while (size > 0)
+		{
+			ssize_t num_written = send (fd, data_s, size, MSG_NOSIGNAL);
+
+			if (num_written > 0)
+				{
+					data_s += num_written;
+					size -= (size_t) num_written;
+				}
+			else if ((num_written < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+				{
+					if (poll (&poll_fd, 1, S_POLL_INTERVAL * 10) <= 0)
+						{
+							return false;
+						}
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static void WaitForMilliseconds (const uint32 delay)
+{
+	struct timespec wait;
+
+	wait.tv_sec = delay / 1000;
+	wait.tv_nsec = (long) (delay % 1000) * 1000000L;
+
+	while ((nanosleep (&wait, &wait) != 0) && (errno == EINTR))
+		{
+		}
+}
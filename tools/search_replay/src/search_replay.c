@@ -0,0 +1,1107 @@
+/*
+ * search_replay.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: billy
+ *
+ * Replay the searches from a search service capture file against a
+ * Grassroots server, keeping the gaps between them, and report the
+ * throughput and latency percentiles. CKAN and Zenodo can be served by
+ * a local stub so that only the search service is being measured.
+ *
+ * With --scaling, the searches are instead sent back to back from 1,
+ * 2, ... up to one thread per core, each for a fixed time, and a CSV
+ * line of the throughput and latencies is printed for each number of
+ * threads.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "jansson.h"
+
+#include "portal_stub.h"
+
+
+static const char * const S_DEFAULT_URL_S = "http://localhost:2000/grassroots/controller";
+
+static const char * const S_DEFAULT_SERVICE_S = "Search Grassroots";
+
+static const char * const S_DEFAULT_CKAN_RESPONSE_S = "{\"success\":true,\"result\":{\"count\":0,\"results\":[]}}";
+
+static const char * const S_DEFAULT_ZENODO_RESPONSE_S = "{\"hits\":{\"total\":0,\"hits\":[]}}";
+
+static const uint32 S_DEFAULT_NUM_WORKERS = 16;
+
+static const uint32 S_DEFAULT_STUB_THREADS = 32;
+
+static const double S_PERCENTILES [] = { 50.0, 90.0, 99.0, 99.9 };
+
+#define S_NUM_PERCENTILES (sizeof (S_PERCENTILES) / sizeof (S_PERCENTILES [0]))
+
+
+typedef struct CapturedSearch
+{
+	/** In milliseconds since the epoch. */
+	json_int_t cs_time;
+
+	/** The Grassroots request to send. */
+	char *cs_request_s;
+
+	/** The monotonic time in microseconds that it should be sent at. */
+	uint64 cs_due;
+
+	/** The microseconds from cs_due until the response arrived. */
+	uint64 cs_latency;
+
+	bool cs_success_flag;
+} CapturedSearch;
+
+
+typedef struct Replay
+{
+	const char *re_url_s;
+
+	CapturedSearch *re_searches_p;
+
+	size_t re_num_searches;
+
+	/** The number of searches that have been scheduled. */
+	size_t re_num_due;
+
+	/** The next search for a worker to send. */
+	size_t re_next;
+
+	/** When the speed is 0, latency is measured from when a worker is free rather than from the schedule. */
+	bool re_unpaced_flag;
+
+	pthread_mutex_t re_lock;
+
+	pthread_cond_t re_cond;
+} Replay;
+
+
+/** One number of threads in a --scaling run. */
+typedef struct ScalingStep
+{
+	Replay *ss_replay_p;
+
+	/** The monotonic time in microseconds after which no more searches are sent. */
+	uint64 ss_end;
+
+	/** The next search to send, wrapping around to the first one after the last. */
+	size_t ss_next;
+} ScalingStep;
+
+
+typedef struct ScalingWorker
+{
+	ScalingStep *sw_step_p;
+
+	pthread_t sw_thread;
+
+	/** In microseconds. */
+	uint64 *sw_latencies_p;
+
+	size_t sw_num_latencies;
+
+	size_t sw_num_allocated;
+
+	size_t sw_num_failed;
+} ScalingWorker;
+
+
+/** In milliseconds. */
+typedef struct LatencySummary
+{
+	double ls_mean;
+
+	double ls_percentiles [S_NUM_PERCENTILES];
+
+	double ls_max;
+} LatencySummary;
+
+
+static bool LoadCapture (const char *filename_s, const char *service_s, Replay *replay_p);
+
+static char *GetRequestForSearch (const char *service_s, json_t *params_p);
+
+static int CompareCapturedSearches (const void *v0_p, const void *v1_p);
+
+static bool RunReplay (Replay *replay_p, const uint32 num_workers, const double speed, const PortalStub *stub_p);
+
+static void *RunReplayWorker (void *data_p);
+
+static bool RunScaling (Replay *replay_p, const uint32 max_threads, const uint32 duration, const PortalStub *stub_p);
+
+static bool RunScalingStep (Replay *replay_p, const uint32 num_threads, const uint32 duration, double *first_throughput_p);
+
+static void *RunScalingWorker (void *data_p);
+
+static bool AddLatency (ScalingWorker *worker_p, const uint64 latency);
+
+static void WarmUp (const Replay *replay_p);
+
+static bool SendSearch (CURL *curl_p, const char *url_s, const char *request_s);
+
+static size_t DiscardResponse (char *data_p, size_t size, size_t num_members, void *user_p);
+
+static void ScheduleSearches (Replay *replay_p, const double speed);
+
+static void PrintReport (const Replay *replay_p, const uint64 duration, const PortalStub *stub_p);
+
+static void GetLatencySummary (uint64 *latencies_p, const size_t num_latencies, LatencySummary *summary_p);
+
+static int CompareLatencies (const void *v0_p, const void *v1_p);
+
+static char *LoadFile (const char *filename_s);
+
+static uint64 GetTime (void);
+
+static void WaitUntil (const uint64 due);
+
+static void PrintUsage (const char *program_s);
+
+
+
+int main (int argc, char *argv [])
+{
+	const char *url_s = S_DEFAULT_URL_S;
+	const char *service_s = S_DEFAULT_SERVICE_S;
+	const char *ckan_file_s = NULL;
+	const char *zenodo_file_s = NULL;
+	double speed = 1.0;
+	uint32 num_workers = S_DEFAULT_NUM_WORKERS;
+	uint32 stub_port = 0;
+	uint32 stub_delay = 0;
+	uint32 scaling_duration = 0;
+	uint32 max_threads = 0;
+	size_t max_searches = 0;
+	int result = EXIT_FAILURE;
+	int c;
+
+	static struct option long_options [] =
+		{
+			{ "url", required_argument, NULL, 'u' },
+			{ "service", required_argument, NULL, 'S' },
+			{ "speed", required_argument, NULL, 's' },
+			{ "workers", required_argument, NULL, 'w' },
+			{ "max", required_argument, NULL, 'n' },
+			{ "stub-port", required_argument, NULL, 'p' },
+			{ "stub-delay", required_argument, NULL, 'd' },
+			{ "ckan-response", required_argument, NULL, 'c' },
+			{ "zenodo-response", required_argument, NULL, 'z' },
+			{ "scaling", required_argument, NULL, 't' },
+			{ "max-threads", required_argument, NULL, 'T' },
+			{ "help", no_argument, NULL, 'h' },
+			{ NULL, 0, NULL, 0 }
+		};
+
+	while ((c = getopt_long (argc, argv, "u:S:s:w:n:p:d:c:z:t:T:h", long_options, NULL)) != -1)
+		{
+			switch (c)
+				{
+					case 'u':
+						url_s = optarg;
+						break;
+
+					case 'S':
+						service_s = optarg;
+						break;
+
+					case 's':
+						speed = atof (optarg);
+						break;
+
+					case 'w':
+						num_workers = (uint32) atoi (optarg);
+						break;
+
+					case 'n':
+						max_searches = (size_t) atol (optarg);
+						break;
+
+					case 'p':
+						stub_port = (uint32) atoi (optarg);
+						break;
+
+					case 'd':
+						stub_delay = (uint32) atoi (optarg);
+						break;
+
+					case 'c':
+						ckan_file_s = optarg;
+						break;
+
+					case 'z':
+						zenodo_file_s = optarg;
+						break;
+
+					case 't':
+						scaling_duration = (uint32) atoi (optarg);
+						break;
+
+					case 'T':
+						max_threads = (uint32) atoi (optarg);
+						break;
+
+					default:
+						PrintUsage (argv [0]);
+						return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+				}
+		}
+
+	if ((optind != argc - 1) || (speed < 0.0) || (num_workers == 0))
+		{
+			PrintUsage (argv [0]);
+			return EXIT_FAILURE;
+		}
+
+	if (max_threads == 0)
+		{
+			const long num_cores = sysconf (_SC_NPROCESSORS_ONLN);
+
+			max_threads = (num_cores > 0) ? (uint32) num_cores : 1;
+		}
+
+	if (curl_global_init (CURL_GLOBAL_ALL) == CURLE_OK)
+		{
+			Replay replay;
+
+			memset (&replay, 0, sizeof (Replay));
+			replay.re_url_s = url_s;
+			replay.re_unpaced_flag = (speed == 0.0);
+
+			if (LoadCapture (argv [optind], service_s, &replay))
+				{
+					char *ckan_response_s = ckan_file_s ? LoadFile (ckan_file_s) : NULL;
+					char *zenodo_response_s = zenodo_file_s ? LoadFile (zenodo_file_s) : NULL;
+					PortalStub *stub_p = NULL;
+
+					if ((max_searches > 0) && (max_searches < replay.re_num_searches))
+						{
+							replay.re_num_searches = max_searches;
+						}
+
+					if (stub_port > 0)
+						{
+							stub_p = StartPortalStub (stub_port, ckan_response_s ? ckan_response_s : S_DEFAULT_CKAN_RESPONSE_S, zenodo_response_s ? zenodo_response_s : S_DEFAULT_ZENODO_RESPONSE_S, stub_delay, S_DEFAULT_STUB_THREADS);
+						}
+
+					if ((stub_port == 0) || (stub_p))
+						{
+							bool success_flag;
+
+							if (scaling_duration > 0)
+								{
+									success_flag = RunScaling (&replay, max_threads, scaling_duration, stub_p);
+								}
+							else
+								{
+									success_flag = RunReplay (&replay, num_workers, speed, stub_p);
+								}
+
+							if (success_flag)
+								{
+									result = EXIT_SUCCESS;
+								}
+
+							if (stub_p)
+								{
+									StopPortalStub (stub_p);
+								}
+						}
+
+					free (zenodo_response_s);
+					free (ckan_response_s);
+				}
+
+			if (replay.re_searches_p)
+				{
+					size_t i;
+
+					/* re_num_searches may have been cut down by --max */
+					for (i = 0; (replay.re_searches_p [i].cs_request_s); ++ i)
+						{
+							free (replay.re_searches_p [i].cs_request_s);
+						}
+
+					free (replay.re_searches_p);
+				}
+
+			curl_global_cleanup ();
+		}
+
+	return result;
+}
+
+
+/*
+ * The searches are sorted by time since the lines from different
+ * service instances sharing a file can be slightly out of order.
+ */
+static bool LoadCapture (const char *filename_s, const char *service_s, Replay *replay_p)
+{
+	FILE *in_f = fopen (filename_s, "r");
+
+	if (in_f)
+		{
+			size_t num_allocated = 1024;
+			char *line_s = NULL;
+			size_t line_size = 0;
+			size_t line_number = 0;
+
+			/* Keep an empty search at the end to mark where they stop */
+			replay_p -> re_searches_p = (CapturedSearch *) calloc (num_allocated + 1, sizeof (CapturedSearch));
+
+			while ((replay_p -> re_searches_p) && (getline (&line_s, &line_size, in_f) > 0))
+				{
+					json_error_t error;
+					json_t *entry_p = json_loads (line_s, 0, &error);
+
+					++ line_number;
+
+					if (entry_p)
+						{
+							json_t *time_p = json_object_get (entry_p, "time");
+							json_t *params_p = json_object_get (entry_p, "params");
+
+							if ((json_is_integer (time_p)) && (json_is_object (params_p)))
+								{
+									CapturedSearch *search_p;
+
+									if (replay_p -> re_num_searches == num_allocated)
+										{
+											CapturedSearch *searches_p = (CapturedSearch *) realloc (replay_p -> re_searches_p, ((num_allocated * 2) + 1) * sizeof (CapturedSearch));
+
+											if (searches_p)
+												{
+													memset (searches_p + num_allocated, 0, (num_allocated + 1) * sizeof (CapturedSearch));
+													num_allocated *= 2;
+												}
+											else
+												{
+													free (replay_p -> re_searches_p);
+												}
+
+											replay_p -> re_searches_p = searches_p;
+										}
+
+									if (replay_p -> re_searches_p)
+										{
+											search_p = replay_p -> re_searches_p + replay_p -> re_num_searches;
+											search_p -> cs_time = json_integer_value (time_p);
+											search_p -> cs_request_s = GetRequestForSearch (service_s, params_p);
+
+											if (search_p -> cs_request_s)
+												{
+													++ (replay_p -> re_num_searches);
+												}
+										}
+								}
+							else
+								{
+									fprintf (stderr, "Skipping line %zu of \"%s\" without a time and params\n", line_number, filename_s);
+								}
+
+							json_decref (entry_p);
+						}
+					else
+						{
+							fprintf (stderr, "Skipping line %zu of \"%s\": %s\n", line_number, filename_s, error.text);
+						}
+				}
+
+			free (line_s);
+			fclose (in_f);
+
+			if (replay_p -> re_searches_p)
+				{
+					if (replay_p -> re_num_searches > 0)
+						{
+							qsort (replay_p -> re_searches_p, replay_p -> re_num_searches, sizeof (CapturedSearch), CompareCapturedSearches);
+							return true;
+						}
+
+					fprintf (stderr, "\"%s\" has no searches\n", filename_s);
+				}
+			else
+				{
+					fprintf (stderr, "Failed to allocate the searches from \"%s\"\n", filename_s);
+				}
+		}
+	else
+		{
+			fprintf (stderr, "Failed to open \"%s\": %s\n", filename_s, strerror (errno));
+		}
+
+	return false;
+}
+
+
+/*
+ * Build the same request that a Grassroots client would send to run
+ * the service with the captured parameter values.
+ */
+static char *GetRequestForSearch (const char *service_s, json_t *params_p)
+{
+	char *request_s = NULL;
+	json_t *parameters_p = json_array ();
+
+	if (parameters_p)
+		{
+			const char *key_s;
+			json_t *value_p;
+			json_t *request_p;
+
+			json_object_foreach (params_p, key_s, value_p)
+				{
+					json_array_append_new (parameters_p, json_pack ("{s:s,s:O}", "param", key_s, "current_value", value_p));
+				}
+
+			request_p = json_pack ("{s:[{s:s,s:b,s:{s:o}}]}",
+														 "services",
+														 "so:name", service_s,
+														 "start_service", 1,
+														 "parameter_set",
+														 "parameters", parameters_p);
+
+			if (request_p)
+				{
+					request_s = json_dumps (request_p, JSON_COMPACT);
+					json_decref (request_p);
+				}
+		}
+
+	return request_s;
+}
+
+
+static int CompareCapturedSearches (const void *v0_p, const void *v1_p)
+{
+	const CapturedSearch *search0_p = (const CapturedSearch *) v0_p;
+	const CapturedSearch *search1_p = (const CapturedSearch *) v1_p;
+
+	if (search0_p -> cs_time < search1_p -> cs_time)
+		{
+			return -1;
+		}
+	else if (search0_p -> cs_time > search1_p -> cs_time)
+		{
+			return 1;
+		}
+
+	return 0;
+}
+
+
+static bool RunReplay (Replay *replay_p, const uint32 num_workers, const double speed, const PortalStub *stub_p)
+{
+	bool success_flag = false;
+	pthread_t *workers_p = (pthread_t *) calloc (num_workers, sizeof (pthread_t));
+
+	if (workers_p)
+		{
+			uint32 num_started = 0;
+			uint64 start;
+			uint32 i;
+
+			pthread_mutex_init (& (replay_p -> re_lock), NULL);
+			pthread_cond_init (& (replay_p -> re_cond), NULL);
+
+			while ((num_started < num_workers) && (pthread_create (workers_p + num_started, NULL, RunReplayWorker, replay_p) == 0))
+				{
+					++ num_started;
+				}
+
+			start = GetTime ();
+
+			if (num_started > 0)
+				{
+					ScheduleSearches (replay_p, speed);
+				}
+
+			for (i = 0; i < num_started; ++ i)
+				{
+					pthread_join (workers_p [i], NULL);
+				}
+
+			if (num_started == num_workers)
+				{
+					PrintReport (replay_p, GetTime () - start, stub_p);
+					success_flag = true;
+				}
+			else
+				{
+					fprintf (stderr, "Only started %u of %u workers\n", num_started, num_workers);
+				}
+
+			pthread_cond_destroy (& (replay_p -> re_cond));
+			pthread_mutex_destroy (& (replay_p -> re_lock));
+
+			free (workers_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Each worker keeps its own curl handle so that its connection to
+ * the server is reused from one search to the next.
+ */
+static void *RunReplayWorker (void *data_p)
+{
+	Replay *replay_p = (Replay *) data_p;
+	CURL *curl_p = curl_easy_init ();
+
+	if (curl_p)
+		{
+			bool running_flag = true;
+
+			while (running_flag)
+				{
+					CapturedSearch *search_p = NULL;
+
+					pthread_mutex_lock (& (replay_p -> re_lock));
+
+					while ((replay_p -> re_next == replay_p -> re_num_due) && (replay_p -> re_num_due < replay_p -> re_num_searches))
+						{
+							pthread_cond_wait (& (replay_p -> re_cond), & (replay_p -> re_lock));
+						}
+
+					if (replay_p -> re_next < replay_p -> re_num_due)
+						{
+							search_p = replay_p -> re_searches_p + replay_p -> re_next;
+							++ (replay_p -> re_next);
+						}
+					else
+						{
+							running_flag = false;
+						}
+
+					pthread_mutex_unlock (& (replay_p -> re_lock));
+
+					if (search_p)
+						{
+							if (replay_p -> re_unpaced_flag)
+								{
+									search_p -> cs_due = GetTime ();
+								}
+
+							search_p -> cs_success_flag = SendSearch (curl_p, replay_p -> re_url_s, search_p -> cs_request_s);
+
+							/* Measuring from when it was due counts any time spent waiting for a free worker */
+							search_p -> cs_latency = GetTime () - search_p -> cs_due;
+						}
+				}
+
+			curl_easy_cleanup (curl_p);
+		}
+	else
+		{
+			fprintf (stderr, "Failed to create a curl handle\n");
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Every step sends the same searches, so a warm up first means that the
+ * first step doesn't pay for filling the service's caches on its own.
+ * The CSV goes to stdout and the progress to stderr so that the output
+ * can be plotted directly.
+ */
+static bool RunScaling (Replay *replay_p, const uint32 max_threads, const uint32 duration, const PortalStub *stub_p)
+{
+	double first_throughput = 0.0;
+	uint32 num_threads;
+	size_t i;
+
+	fprintf (stderr, "Warming up with %zu searches\n", replay_p -> re_num_searches);
+	WarmUp (replay_p);
+
+	printf ("threads,searches,failed,throughput,speedup,efficiency,mean_ms");
+
+	for (i = 0; i < S_NUM_PERCENTILES; ++ i)
+		{
+			printf (",p%g_ms", S_PERCENTILES [i]);
+		}
+
+	printf (",max_ms\n");
+
+	for (num_threads = 1; num_threads <= max_threads; ++ num_threads)
+		{
+			fprintf (stderr, "Running %u thread%s for %u s\n", num_threads, (num_threads == 1) ? "" : "s", duration);
+
+			if (!RunScalingStep (replay_p, num_threads, duration, &first_throughput))
+				{
+					return false;
+				}
+		}
+
+	if (stub_p)
+		{
+			fprintf (stderr, "portal requests: %llu\n", (unsigned long long) GetPortalStubNumRequests (stub_p));
+		}
+
+	return true;
+}
+
+
+static bool RunScalingStep (Replay *replay_p, const uint32 num_threads, const uint32 duration, double *first_throughput_p)
+{
+	bool success_flag = false;
+	ScalingWorker *workers_p = (ScalingWorker *) calloc (num_threads, sizeof (ScalingWorker));
+
+	if (workers_p)
+		{
+			ScalingStep step;
+			uint32 num_started = 0;
+			uint64 start;
+			uint32 i;
+
+			start = GetTime ();
+
+			step.ss_replay_p = replay_p;
+			step.ss_end = start + ((uint64) duration) * 1000000;
+			step.ss_next = 0;
+
+			while (num_started < num_threads)
+				{
+					ScalingWorker *worker_p = workers_p + num_started;
+
+					worker_p -> sw_step_p = &step;
+
+					if (pthread_create (& (worker_p -> sw_thread), NULL, RunScalingWorker, worker_p) == 0)
+						{
+							++ num_started;
+						}
+					else
+						{
+							/* Stop the ones that did start as soon as they finish their current search */
+							__atomic_store_n (& (step.ss_end), 0, __ATOMIC_RELAXED);
+							break;
+						}
+				}
+
+			for (i = 0; i < num_started; ++ i)
+				{
+					pthread_join (workers_p [i].sw_thread, NULL);
+				}
+
+			if (num_started == num_threads)
+				{
+					const double seconds = ((double) (GetTime () - start)) / 1000000.0;
+					size_t num_latencies = 0;
+					size_t num_failed = 0;
+					uint64 *latencies_p;
+
+					for (i = 0; i < num_threads; ++ i)
+						{
+							num_latencies += workers_p [i].sw_num_latencies;
+							num_failed += workers_p [i].sw_num_failed;
+						}
+
+					latencies_p = (uint64 *) malloc ((num_latencies > 0 ? num_latencies : 1) * sizeof (uint64));
+
+					if (latencies_p)
+						{
+							const double throughput = ((double) num_latencies) / seconds;
+							double speedup = 0.0;
+							LatencySummary summary;
+							size_t j = 0;
+
+							for (i = 0; i < num_threads; ++ i)
+								{
+									memcpy (latencies_p + j, workers_p [i].sw_latencies_p, workers_p [i].sw_num_latencies * sizeof (uint64));
+									j += workers_p [i].sw_num_latencies;
+								}
+
+							GetLatencySummary (latencies_p, num_latencies, &summary);
+
+							if (num_threads == 1)
+								{
+									*first_throughput_p = throughput;
+								}
+
+							if (*first_throughput_p > 0.0)
+								{
+									speedup = throughput / *first_throughput_p;
+								}
+
+							printf ("%u,%zu,%zu,%.2f,%.3f,%.3f,%.2f", num_threads, num_latencies, num_failed, throughput, speedup, speedup / (double) num_threads, summary.ls_mean);
+
+							for (i = 0; i < S_NUM_PERCENTILES; ++ i)
+								{
+									printf (",%.2f", summary.ls_percentiles [i]);
+								}
+
+							printf (",%.2f\n", summary.ls_max);
+							fflush (stdout);
+
+							free (latencies_p);
+							success_flag = true;
+						}
+				}
+			else
+				{
+					fprintf (stderr, "Only started %u of %u threads\n", num_started, num_threads);
+				}
+
+			for (i = 0; i < num_threads; ++ i)
+				{
+					free (workers_p [i].sw_latencies_p);
+				}
+
+			free (workers_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Each thread sends its next search as soon as the last one has
+ * finished, so that every thread is always running a search in the
+ * service and the throughput shows how well the service's own work
+ * spreads across cores.
+ */
+static void *RunScalingWorker (void *data_p)
+{
+	ScalingWorker *worker_p = (ScalingWorker *) data_p;
+	ScalingStep *step_p = worker_p -> sw_step_p;
+	const Replay *replay_p = step_p -> ss_replay_p;
+	CURL *curl_p = curl_easy_init ();
+
+	if (curl_p)
+		{
+			uint64 start = GetTime ();
+
+			while (start < __atomic_load_n (& (step_p -> ss_end), __ATOMIC_RELAXED))
+				{
+					const size_t i = __atomic_fetch_add (& (step_p -> ss_next), 1, __ATOMIC_RELAXED) % (replay_p -> re_num_searches);
+					const bool success_flag = SendSearch (curl_p, replay_p -> re_url_s, replay_p -> re_searches_p [i].cs_request_s);
+					const uint64 end = GetTime ();
+
+					if (!AddLatency (worker_p, end - start))
+						{
+							fprintf (stderr, "Failed to store a latency\n");
+							break;
+						}
+
+					if (!success_flag)
+						{
+							++ (worker_p -> sw_num_failed);
+						}
+
+					start = end;
+				}
+
+			curl_easy_cleanup (curl_p);
+		}
+	else
+		{
+			fprintf (stderr, "Failed to create a curl handle\n");
+		}
+
+	return NULL;
+}
+
+
+static bool AddLatency (ScalingWorker *worker_p, const uint64 latency)
+{
+	if (worker_p -> sw_num_latencies == worker_p -> sw_num_allocated)
+		{
+			const size_t num_allocated = (worker_p -> sw_num_allocated > 0) ? (worker_p -> sw_num_allocated * 2) : 1024;
+			uint64 *latencies_p = (uint64 *) realloc (worker_p -> sw_latencies_p, num_allocated * sizeof (uint64));
+
+			if (!latencies_p)
+				{
+					return false;
+				}
+
+			worker_p -> sw_latencies_p = latencies_p;
+			worker_p -> sw_num_allocated = num_allocated;
+		}
+
+	worker_p -> sw_latencies_p [worker_p -> sw_num_latencies] = latency;
+	++ (worker_p -> sw_num_latencies);
+
+	return true;
+}
+
+
+static void WarmUp (const Replay *replay_p)
+{
+	CURL *curl_p = curl_easy_init ();
+
+	if (curl_p)
+		{
+			size_t i;
+
+			for (i = 0; i < replay_p -> re_num_searches; ++ i)
+				{
+					SendSearch (curl_p, replay_p -> re_url_s, replay_p -> re_searches_p [i].cs_request_s);
+				}
+
+			curl_easy_cleanup (curl_p);
+		}
+}
+
+
+static bool SendSearch (CURL *curl_p, const char *url_s, const char *request_s)
+{
+	bool success_flag = false;
+	struct curl_slist *headers_p = curl_slist_append (NULL, "Content-Type: application/json");
+
+	curl_easy_setopt (curl_p, CURLOPT_URL, url_s);
+	curl_easy_setopt (curl_p, CURLOPT_POSTFIELDS, request_s);
+	curl_easy_setopt (curl_p, CURLOPT_HTTPHEADER, headers_p);
+	curl_easy_setopt (curl_p, CURLOPT_WRITEFUNCTION, DiscardResponse);
+	curl_easy_setopt (curl_p, CURLOPT_NOSIGNAL, 1L);
+
+	if (curl_easy_perform (curl_p) == CURLE_OK)
+		{
+			long response_code = 0;
+
+			curl_easy_getinfo (curl_p, CURLINFO_RESPONSE_CODE, &response_code);
+			success_flag = (response_code == 200);
+		}
+
+	curl_slist_free_all (headers_p);
+
+	return success_flag;
+}
+
+
+static size_t DiscardResponse (char * UNUSED_PARAM (data_p), size_t size, size_t num_members, void * UNUSED_PARAM (user_p))
+{
+	return size * num_members;
+}
+
+
+/*
+ * Release each search to the workers at its original offset from the
+ * first one, divided by the speed. With a speed of 0 they are all
+ * released at once and the workers send them as fast as they can.
+ */
+static void ScheduleSearches (Replay *replay_p, const double speed)
+{
+	const uint64 start = GetTime ();
+	const json_int_t first_time = replay_p -> re_searches_p [0].cs_time;
+	size_t i;
+
+	for (i = 0; i < replay_p -> re_num_searches; ++ i)
+		{
+			CapturedSearch *search_p = replay_p -> re_searches_p + i;
+
+			if (speed > 0.0)
+				{
+					search_p -> cs_due = start + (uint64) (((double) (search_p -> cs_time - first_time)) * 1000.0 / speed);
+					WaitUntil (search_p -> cs_due);
+				}
+
+			pthread_mutex_lock (& (replay_p -> re_lock));
+			replay_p -> re_num_due = i + 1;
+			pthread_cond_signal (& (replay_p -> re_cond));
+			pthread_mutex_unlock (& (replay_p -> re_lock));
+		}
+
+	/* Let the idle workers see that there is nothing left */
+	pthread_mutex_lock (& (replay_p -> re_lock));
+	pthread_cond_broadcast (& (replay_p -> re_cond));
+	pthread_mutex_unlock (& (replay_p -> re_lock));
+}
+
+
+static void PrintReport (const Replay *replay_p, const uint64 duration, const PortalStub *stub_p)
+{
+	uint64 *latencies_p = (uint64 *) malloc (replay_p -> re_num_searches * sizeof (uint64));
+
+	if (latencies_p)
+		{
+			const double seconds = ((double) duration) / 1000000.0;
+			LatencySummary summary;
+			size_t num_failed = 0;
+			size_t i;
+
+			for (i = 0; i < replay_p -> re_num_searches; ++ i)
+				{
+					latencies_p [i] = replay_p -> re_searches_p [i].cs_latency;
+
+					if (! (replay_p -> re_searches_p [i].cs_success_flag))
+						{
+							++ num_failed;
+						}
+				}
+
+			GetLatencySummary (latencies_p, replay_p -> re_num_searches, &summary);
+
+			printf ("searches:   %zu\n", replay_p -> re_num_searches);
+			printf ("failed:     %zu\n", num_failed);
+			printf ("duration:   %.3f s\n", seconds);
+			printf ("throughput: %.2f searches/s\n", (seconds > 0.0) ? ((double) (replay_p -> re_num_searches)) / seconds : 0.0);
+			printf ("mean:       %.2f ms\n", summary.ls_mean);
+
+			for (i = 0; i < S_NUM_PERCENTILES; ++ i)
+				{
+					printf ("p%-9g %.2f ms\n", S_PERCENTILES [i], summary.ls_percentiles [i]);
+				}
+
+			printf ("max:        %.2f ms\n", summary.ls_max);
+
+			if (stub_p)
+				{
+					printf ("portal requests: %llu\n", (unsigned long long) GetPortalStubNumRequests (stub_p));
+				}
+
+			free (latencies_p);
+		}
+}
+
+
+/* This sorts the latencies in place */
+static void GetLatencySummary (uint64 *latencies_p, const size_t num_latencies, LatencySummary *summary_p)
+{
+	memset (summary_p, 0, sizeof (LatencySummary));
+
+	if (num_latencies > 0)
+		{
+			double total = 0.0;
+			size_t i;
+
+			qsort (latencies_p, num_latencies, sizeof (uint64), CompareLatencies);
+
+			for (i = 0; i < num_latencies; ++ i)
+				{
+					total += (double) latencies_p [i];
+				}
+
+			summary_p -> ls_mean = total / ((double) num_latencies) / 1000.0;
+
+			for (i = 0; i < S_NUM_PERCENTILES; ++ i)
+				{
+					/* Nearest rank */
+					size_t rank = (size_t) ((S_PERCENTILES [i] / 100.0) * (double) num_latencies + 0.999999);
+
+					if (rank > 0)
+						{
+							-- rank;
+						}
+
+					summary_p -> ls_percentiles [i] = ((double) latencies_p [rank]) / 1000.0;
+				}
+
+			summary_p -> ls_max = ((double) latencies_p [num_latencies - 1]) / 1000.0;
+		}
+}
+
+
+static int CompareLatencies (const void *v0_p, const void *v1_p)
+{
+	const uint64 latency0 = * ((const uint64 *) v0_p);
+	const uint64 latency1 = * ((const uint64 *) v1_p);
+
+	return (latency0 < latency1) ? -1 : ((latency0 > latency1) ? 1 : 0);
+}
+
+
+static char *LoadFile (const char *filename_s)
+{
+	char *data_s = NULL;
+	FILE *in_f = fopen (filename_s, "rb");
+
+	if (in_f)
+		{
+			if (fseek (in_f, 0, SEEK_END) == 0)
+				{
+					const long size = ftell (in_f);
+
+					if ((size >= 0) && (fseek (in_f, 0, SEEK_SET) == 0))
+						{
+							data_s = (char *) malloc ((size_t) size + 1);
+
+							if (data_s)
+								{
+									if (fread (data_s, 1, (size_t) size, in_f) == (size_t) size)
+										{
+											data_s [size] = '\0';
+										}
+									else
+										{
+											free (data_s);
+											data_s = NULL;
+										}
+								}
+						}
+				}
+
+			fclose (in_f);
+		}
+
+	if (!data_s)
+		{
+			fprintf (stderr, "Failed to load \"%s\", using an empty response instead\n", filename_s);
+		}
+
+	return data_s;
+}
+
+
+/* In microseconds */
+static uint64 GetTime (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (((uint64) now.tv_sec) * 1000000) + (now.tv_nsec / 1000);
+}
+
+
+static void WaitUntil (const uint64 due)
+{
+	struct timespec wait;
+
+	wait.tv_sec = (time_t) (due / 1000000);
+	wait.tv_nsec = (long) ((due % 1000000) * 1000);
+
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &wait, NULL) == EINTR)
+		{
+		}
+}
+
+
+static void PrintUsage (const char *program_s)
+{
+	fprintf (stderr,
+					 "Usage: %s [options] <capture file>\n"
+					 "\n"
+					 "Replay the searches from a search service capture file and report the\n"
+					 "throughput and latency percentiles.\n"
+					 "\n"
+					 "  -u, --url <url>                The Grassroots server to send the searches to (default %s)\n"
+					 "  -S, --service <name>           The name of the search service (default \"%s\")\n"
+					 "  -s, --speed <factor>           How much faster than they were captured to send the searches.\n"
+					 "                                 0 sends them as fast as the workers can (default 1)\n"
+					 "  -w, --workers <number>         The number of searches that can be waiting for a response (default %u)\n"
+					 "  -n, --max <number>             Only replay this many searches\n"
+					 "  -p, --stub-port <port>         Serve CKAN and Zenodo from a local stub on this port\n"
+					 "  -d, --stub-delay <ms>          Wait this long before each stub response (default 0)\n"
+					 "  -c, --ckan-response <file>     The body of each CKAN response from the stub\n"
+					 "  -z, --zenodo-response <file>   The body of each Zenodo response from the stub\n"
+					 "  -t, --scaling <seconds>        Instead of replaying, send the searches back to back from 1 up to\n"
+					 "                                 --max-threads threads for this long each and print a CSV line for each\n"
+					 "  -T, --max-threads <number>     The most threads for --scaling (default the number of cores)\n",
+					 program_s, S_DEFAULT_URL_S, S_DEFAULT_SERVICE_S, S_DEFAULT_NUM_WORKERS);
+}